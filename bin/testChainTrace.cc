@@ -0,0 +1,145 @@
+/**
+   \class testChainTrace testChainTrace.cc "TauAnalysis/ClassicSVfit/bin/testChainTrace.cc"
+   \brief Check that the samples written by ChainTraceWriter are read back unchanged by ChainTraceReader,
+          for several Markov Chains filled concurrently, for several events and for files opened in append mode
+*/
+
+#include "TauAnalysis/ClassicSVfit/interface/svFitChainTrace.h"
+
+#include <cstdio>
+#include <iostream>
+#include <thread>
+
+using namespace classic_svFit;
+
+namespace
+{
+  const unsigned numChains = 3;
+  // CV: small block size, so that each chain writes several complete blocks and one partially filled block per event
+  const unsigned blockSize = 7;
+
+  /// number of samples stored for each chain in given event
+  unsigned getNumSamples(unsigned iEvent, unsigned iChain)
+  {
+    return 20 + 5*iEvent + 3*iChain;
+  }
+
+  /// value stored for given event, chain, sample and column (all exactly representable as 32-bit floating point numbers)
+  float getValue(unsigned iEvent, unsigned iChain, unsigned iSample, unsigned iColumn)
+  {
+    return 0.25f*iSample - 1.5f*iColumn + 100.f*iChain + 1000.f*iEvent;
+  }
+
+  std::vector<std::string> getColumnNames()
+  {
+    std::vector<std::string> columnNames;
+    columnNames.push_back("event");
+    columnNames.push_back("chain");
+    columnNames.push_back("sample");
+    columnNames.push_back("x0");
+    columnNames.push_back("x1");
+    return columnNames;
+  }
+
+  /// write samples of one event, filling the Markov Chains concurrently from different threads
+  void writeEvent(ChainTraceWriter& writer, unsigned iEvent)
+  {
+    std::vector<std::string> columnNames = getColumnNames();
+    writer.beginEvent(columnNames, numChains);
+    std::vector<std::thread> threads;
+    for ( unsigned iChain = 0; iChain < numChains; ++iChain ) {
+      threads.push_back(std::thread([&writer, iEvent, iChain]() {
+        float values[5];
+        for ( unsigned iSample = 0; iSample < getNumSamples(iEvent, iChain); ++iSample ) {
+          values[0] = iEvent;
+          values[1] = iChain;
+          values[2] = iSample;
+          values[3] = getValue(iEvent, iChain, iSample, 3);
+          values[4] = getValue(iEvent, iChain, iSample, 4);
+          writer.fill(iChain, values);
+        }
+      }));
+    }
+    for ( std::vector<std::thread>::iterator thread = threads.begin();
+          thread != threads.end(); ++thread ) {
+      thread->join();
+    }
+    writer.endEvent();
+  }
+
+  /// compare samples read for given event with the values written, returns the number of mismatches;
+  /// CV: the blocks of different chains are stored in the order in which they are written,
+  ///     so the samples get identified by the event, chain and sample columns
+  unsigned checkEvent(const ChainTraceReader& reader, unsigned iEvent)
+  {
+    unsigned numMismatches = 0;
+    std::vector<std::string> columnNames = getColumnNames();
+    if ( reader.getColumnNames(iEvent) != columnNames ) {
+      std::cout << "event #" << iEvent << ": column names do not match !!" << std::endl;
+      return 1;
+    }
+    std::vector<std::vector<float> > columns(columnNames.size());
+    for ( unsigned iColumn = 0; iColumn < columnNames.size(); ++iColumn ) {
+      reader.readColumn(iEvent, columnNames[iColumn], columns[iColumn]);
+    }
+    std::vector<std::vector<unsigned> > numTimesRead(numChains);
+    for ( unsigned iChain = 0; iChain < numChains; ++iChain ) {
+      numTimesRead[iChain].assign(getNumSamples(iEvent, iChain), 0);
+    }
+    unsigned numSamples = columns[0].size();
+    for ( unsigned iSample = 0; iSample < numSamples; ++iSample ) {
+      unsigned iChain_read = columns[1][iSample];
+      unsigned iSample_read = columns[2][iSample];
+      if ( !(columns[0][iSample] == iEvent && iChain_read < numChains && iSample_read < getNumSamples(iEvent, iChain_read)) ) {
+        ++numMismatches;
+        continue;
+      }
+      ++numTimesRead[iChain_read][iSample_read];
+      for ( unsigned iColumn = 3; iColumn < columnNames.size(); ++iColumn ) {
+        if ( columns[iColumn][iSample] != getValue(iEvent, iChain_read, iSample_read, iColumn) ) ++numMismatches;
+      }
+    }
+    for ( unsigned iChain = 0; iChain < numChains; ++iChain ) {
+      for ( unsigned iSample = 0; iSample < getNumSamples(iEvent, iChain); ++iSample ) {
+        if ( numTimesRead[iChain][iSample] != 1 ) ++numMismatches;
+      }
+    }
+    std::cout << "event #" << iEvent << ": samples read = " << numSamples << ", mismatches = " << numMismatches << std::endl;
+    return numMismatches;
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  std::string fileName = "testChainTrace.dat";
+  std::remove(fileName.data());
+  std::remove((fileName + ".idx").data());
+
+  // CV: write two events, then reopen the files in append mode and write a third event
+  {
+    ChainTraceWriter writer(fileName, 1, blockSize);
+    writeEvent(writer, 0);
+    writeEvent(writer, 1);
+  }
+  {
+    ChainTraceWriter writer(fileName, 1, blockSize);
+    writeEvent(writer, 2);
+  }
+
+  int status = 0;
+  const unsigned numEvents = 3;
+  ChainTraceReader reader(fileName);
+  if ( reader.getNumEvents() != numEvents ) {
+    std::cout << "number of events = " << reader.getNumEvents() << " (expected = " << numEvents << ")" << std::endl;
+    status = 1;
+  } else {
+    for ( unsigned iEvent = 0; iEvent < numEvents; ++iEvent ) {
+      if ( checkEvent(reader, iEvent) != 0 ) status = 1;
+    }
+  }
+
+  std::remove(fileName.data());
+  std::remove((fileName + ".idx").data());
+
+  return status;
+}
@@ -0,0 +1,100 @@
+/**
+   \class testClassicSVfitAllocations testClassicSVfitAllocations.cc "TauAnalysis/ClassicSVfit/bin/testClassicSVfitAllocations.cc"
+   \brief Check that repeated calls to ClassicSVfit::integrate do not allocate memory on the heap once the first event has been processed
+*/
+
+#include "TauAnalysis/ClassicSVfit/interface/ClassicSVfit.h"
+#include "TauAnalysis/ClassicSVfit/interface/MeasuredTauLepton.h"
+#include "TauAnalysis/ClassicSVfit/interface/svFitHistogramAdapter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+using namespace classic_svFit;
+
+namespace
+{
+  std::atomic<long> numAllocations(0);
+}
+
+// CV: replace global operator new, so that all heap allocations made by the program get counted
+void* operator new(std::size_t size)
+{
+  ++numAllocations;
+  void* ptr = std::malloc(size > 0 ? size : 1);
+  if ( !ptr ) throw std::bad_alloc();
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+  std::free(ptr);
+}
+
+namespace
+{
+  /// process the same event several times and return the number of heap allocations made by the last call to integrate
+  long countAllocations(ClassicSVfit& svFitAlgo, const std::vector<MeasuredTauLepton>& measuredTauLeptons, double measuredMETx, double measuredMETy, const TMatrixD& covMET,
+                        double& mass_1stRun, double& mass_lastRun)
+  {
+    const unsigned numRuns = 3;
+    long numAllocations_lastRun = 0;
+    for ( unsigned iRun = 0; iRun < numRuns; ++iRun ) {
+      long numAllocations_before = numAllocations;
+      svFitAlgo.integrate(measuredTauLeptons, measuredMETx, measuredMETy, covMET);
+      numAllocations_lastRun = numAllocations - numAllocations_before;
+      double mass = static_cast<HistogramAdapterDiTau*>(svFitAlgo.getHistogramAdapter())->getMass();
+      if ( iRun == 0 ) mass_1stRun = mass;
+      mass_lastRun = mass;
+    }
+    return numAllocations_lastRun;
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  // define MET
+  double measuredMETx =  11.7491;
+  double measuredMETy = -51.9172;
+
+  // define MET covariance
+  TMatrixD covMET(2, 2);
+  covMET[0][0] =  787.352;
+  covMET[1][0] = -178.63;
+  covMET[0][1] = -178.63;
+  covMET[1][1] =  179.545;
+
+  // define lepton four vectors
+  std::vector<MeasuredTauLepton> measuredTauLeptons;
+  measuredTauLeptons.push_back(MeasuredTauLepton(MeasuredTauLepton::kTauToElecDecay, 33.7393, 0.9409,  -0.541458, 0.51100e-3)); // tau -> electron decay (Pt, eta, phi, mass)
+  measuredTauLeptons.push_back(MeasuredTauLepton(MeasuredTauLepton::kTauToHadDecay,  25.7322, 0.618228, 2.79362,  0.13957, 0)); // tau -> 1prong0pi0 hadronic decay (Pt, eta, phi, mass)
+
+  int verbosity = 0;
+  int status = 0;
+
+  // CV: check single Markov Chain (default) and several Markov Chains run in parallel threads
+  const unsigned numChains[] = { 1, 2 };
+  for ( unsigned idx = 0; idx < sizeof(numChains)/sizeof(unsigned); ++idx ) {
+    ClassicSVfit svFitAlgo(verbosity);
+    svFitAlgo.addLogM_fixed(true, 6.);
+    svFitAlgo.setMaxObjFunctionCalls(20000);
+    svFitAlgo.setNumChains(numChains[idx]);
+    svFitAlgo.setNumThreads(numChains[idx]);
+    double mass_1stRun = 0.;
+    double mass_lastRun = 0.;
+    long numAllocations_lastRun = countAllocations(svFitAlgo, measuredTauLeptons, measuredMETx, measuredMETy, covMET, mass_1stRun, mass_lastRun);
+    std::cout << "numChains = " << numChains[idx] << ": heap allocations in last call to integrate = " << numAllocations_lastRun << " (expected = 0),"
+              << " mass = " << mass_lastRun << " (1st run = " << mass_1stRun << ")" << std::endl;
+    if ( numAllocations_lastRun != 0 ) status = 1;
+    if ( mass_lastRun != mass_1stRun ) status = 1;
+  }
+
+  return status;
+}
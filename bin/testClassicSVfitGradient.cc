@@ -0,0 +1,155 @@
+/**
+   \class testClassicSVfitGradient testClassicSVfitGradient.cc "TauAnalysis/ClassicSVfit/bin/testClassicSVfitGradient.cc"
+   \brief Check that the integrand computed with dual numbers by ClassicSVfitIntegrand::EvalLogProb agrees with ClassicSVfitIntegrand::Eval,
+          and that the gradient computed by ClassicSVfitIntegrand::EvalWithGradient agrees with the gradient obtained by finite differences
+*/
+
+#include "TauAnalysis/ClassicSVfit/interface/ClassicSVfit.h"
+#include "TauAnalysis/ClassicSVfit/interface/ClassicSVfitIntegrand.h"
+#include "TauAnalysis/ClassicSVfit/interface/MeasuredTauLepton.h"
+#include "TauAnalysis/ClassicSVfit/interface/svFitDual.h"
+
+#include <TRandom3.h>
+#include <TMath.h>
+
+#include <iostream>
+
+using namespace classic_svFit;
+
+namespace
+{
+  const unsigned numPoints = 1000;
+
+  /// provide access to the integrand, as it has been set up for the last event processed by ClassicSVfit::integrate
+  class ClassicSVfitIntegrandProbe : public ClassicSVfit
+  {
+   public:
+    ClassicSVfitIntegrandProbe()
+      : ClassicSVfit(0)
+    {}
+
+    const ClassicSVfitIntegrand* getIntegrand() const { return static_cast<const ClassicSVfitIntegrand*>(integrand_); }
+    unsigned getNumDimensions() const { return numDimensions_; }
+    double getXl(unsigned iDimension) const { return xl_[iDimension]; }
+    double getXh(unsigned iDimension) const { return xh_[iDimension]; }
+  };
+
+  /// compare EvalLogProb with Eval and the gradient computed by EvalWithGradient with central finite differences
+  /// for random points at which the integrand is non-zero, returns the largest relative deviations
+  void compMaxDeviations(const ClassicSVfitIntegrandProbe& svFitAlgo, TRandom3& rnd, double& maxDeviation_logProb, double& maxDeviation_grad, unsigned& numNonZeroPoints)
+  {
+    const ClassicSVfitIntegrand* integrand = svFitAlgo.getIntegrand();
+    unsigned numDimensions = svFitAlgo.getNumDimensions();
+    // CV: step size used for finite differences, in coordinates rescaled to the interval [0..1]
+    const double h = 1.e-6;
+
+    double q[Dual::maxNumDerivatives];
+    double q_shifted[Dual::maxNumDerivatives];
+    double gradLogProb[Dual::maxNumDerivatives];
+    Dual x[Dual::maxNumDerivatives];
+    maxDeviation_logProb = 0.;
+    maxDeviation_grad = 0.;
+    numNonZeroPoints = 0;
+    for ( unsigned iPoint = 0; iPoint < numPoints; ++iPoint ) {
+      // CV: keep points away from the boundaries of the integration region, so that the finite differences can be computed
+      for ( unsigned iDimension = 0; iDimension < numDimensions; ++iDimension ) {
+        q[iDimension] = rnd.Uniform(0.01, 0.99);
+      }
+      double prob = integrand->EvalWithGradient(q, gradLogProb);
+      if ( !(prob > 0.) ) continue;
+      ++numNonZeroPoints;
+
+      for ( unsigned iDimension = 0; iDimension < numDimensions; ++iDimension ) {
+        double xl = svFitAlgo.getXl(iDimension);
+        double xh = svFitAlgo.getXh(iDimension);
+        x[iDimension] = Dual((1. - q[iDimension])*xl + q[iDimension]*xh, iDimension, xh - xl);
+      }
+      double logProb = integrand->EvalLogProb(x).value();
+      double deviation_logProb = TMath::Abs(TMath::Exp(logProb - TMath::Log(prob)) - 1.);
+      // CV: also catches NaN values
+      if ( !(deviation_logProb <= maxDeviation_logProb) ) maxDeviation_logProb = deviation_logProb;
+
+      for ( unsigned iDimension = 0; iDimension < numDimensions; ++iDimension ) {
+        for ( unsigned jDimension = 0; jDimension < numDimensions; ++jDimension ) {
+          q_shifted[jDimension] = q[jDimension];
+        }
+        q_shifted[iDimension] = q[iDimension] + h;
+        double prob_up = integrand->Eval(q_shifted);
+        q_shifted[iDimension] = q[iDimension] - h;
+        double prob_down = integrand->Eval(q_shifted);
+        // CV: skip points close to the boundary of the physical region, where the integrand drops to zero
+        if ( !(prob_up > 0. && prob_down > 0.) ) continue;
+        double gradLogProb_numerical = (TMath::Log(prob_up) - TMath::Log(prob_down))/(2.*h);
+        double deviation_grad = TMath::Abs(gradLogProb[iDimension] - gradLogProb_numerical)/(TMath::Abs(gradLogProb_numerical) + 1.);
+        if ( !(deviation_grad <= maxDeviation_grad) ) maxDeviation_grad = deviation_grad;
+      }
+    }
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  TMatrixD covMET(2, 2);
+  covMET[0][0] =  787.352;
+  covMET[1][0] = -178.63;
+  covMET[0][1] = -178.63;
+  covMET[1][1] =  179.545;
+  double measuredMETx =  11.7491;
+  double measuredMETy = -51.9172;
+
+  MeasuredTauLepton elec(MeasuredTauLepton::kTauToElecDecay, 33.7393, 0.9409,  -0.541458, 0.51100e-3); // tau -> electron decay (Pt, eta, phi, mass)
+  MeasuredTauLepton mu(MeasuredTauLepton::kTauToMuDecay,     52.1,   -2.1,      1.2,      0.10566);    // tau -> muon decay (Pt, eta, phi, mass)
+  MeasuredTauLepton had1(MeasuredTauLepton::kTauToHadDecay,  25.7322, 0.618228, 2.79362,  0.13957, 0); // tau -> 1prong0pi0 hadronic decay (Pt, eta, phi, mass)
+  MeasuredTauLepton had3(MeasuredTauLepton::kTauToHadDecay,  87.3,    0.05,    -3.0,      1.2,     10); // tau -> 3prong0pi0 hadronic decay (Pt, eta, phi, mass)
+  MeasuredTauLepton prompt(MeasuredTauLepton::kPrompt,       45.2,   -0.7,      0.3,      0.10566);    // prompt muon (Pt, eta, phi, mass)
+
+  struct Channel
+  {
+    const char* label_;
+    MeasuredTauLepton leg1_;
+    MeasuredTauLepton leg2_;
+    int logM_; // 0 = no log(M) term, 1 = fixed power, 2 = dynamic power
+    double diTauMassConstraint_;
+  };
+  Channel channels[] = {
+    { "e+had, log(M) fixed",                elec, had1,   1, -1.     },
+    { "mu+e, log(M) dynamic",               mu,   elec,   2, -1.     },
+    { "had+had",                            had1, had3,   0, -1.     },
+    { "had+prompt, log(M) fixed",           had3, prompt, 1, -1.     },
+    { "e+had, di-tau mass constraint",      elec, had1,   0, 125.06  }
+  };
+
+  // CV: relative accuracy expected for the integrand and for gradients computed by finite differences
+  //    (the tau lepton momenta are computed with plain and with dual numbers, which round differently at the level of 1e-9)
+  const double maxDeviation_logProb_expected = 1.e-8;
+  const double maxDeviation_grad_expected = 1.e-3;
+
+  TRandom3 rnd(12345);
+  int status = 0;
+  for ( unsigned iChannel = 0; iChannel < sizeof(channels)/sizeof(Channel); ++iChannel ) {
+    const Channel& channel = channels[iChannel];
+    ClassicSVfitIntegrandProbe svFitAlgo;
+    if      ( channel.logM_ == 1 ) svFitAlgo.addLogM_fixed(true, 6.);
+    else                           svFitAlgo.addLogM_fixed(false);
+    if ( channel.logM_ == 2 ) svFitAlgo.addLogM_dynamic(true, "(m/1000.)*15.");
+    if ( channel.diTauMassConstraint_ > 0. ) svFitAlgo.setDiTauMassConstraint(channel.diTauMassConstraint_);
+    // CV: the integration is run only to set up the integrand for the event
+    svFitAlgo.setMaxObjFunctionCalls(1000);
+    std::vector<MeasuredTauLepton> measuredTauLeptons;
+    measuredTauLeptons.push_back(channel.leg1_);
+    measuredTauLeptons.push_back(channel.leg2_);
+    svFitAlgo.integrate(measuredTauLeptons, measuredMETx, measuredMETy, covMET);
+
+    double maxDeviation_logProb, maxDeviation_grad;
+    unsigned numNonZeroPoints;
+    compMaxDeviations(svFitAlgo, rnd, maxDeviation_logProb, maxDeviation_grad, numNonZeroPoints);
+    std::cout << channel.label_ << ": max. relative deviation of exp(EvalLogProb) from Eval = " << maxDeviation_logProb << " (expected < " << maxDeviation_logProb_expected << "),"
+              << " of gradient from finite differences = " << maxDeviation_grad << " (expected < " << maxDeviation_grad_expected << "),"
+              << " non-zero points = " << numNonZeroPoints << "/" << numPoints << std::endl;
+    if ( numNonZeroPoints == 0 ) status = 1;
+    if ( !(maxDeviation_logProb < maxDeviation_logProb_expected) ) status = 1;
+    if ( !(maxDeviation_grad < maxDeviation_grad_expected) ) status = 1;
+  }
+
+  return status;
+}
@@ -0,0 +1,121 @@
+/**
+   \class testClassicSVfitVisMomentumVariations testClassicSVfitVisMomentumVariations.cc "TauAnalysis/ClassicSVfit/bin/testClassicSVfitVisMomentumVariations.cc"
+   \brief Check the results obtained for variations of the momenta of the visible tau decay products by reweighting the samples of the nominal Markov Chain integration:
+          the variation without any shift needs to reproduce the nominal result with unit weights,
+          while shifting the momenta up (down) needs to increase (decrease) the mass
+*/
+
+#include "TauAnalysis/ClassicSVfit/interface/ClassicSVfit.h"
+#include "TauAnalysis/ClassicSVfit/interface/MeasuredTauLepton.h"
+#include "TauAnalysis/ClassicSVfit/interface/svFitHistogramAdapter.h"
+
+#include <iostream>
+
+using namespace classic_svFit;
+
+namespace
+{
+  /// process two events twice with variations of the visible momenta by 0%, +3% and -3%, returns 0 if the checks pass and 1 otherwise.
+  /// The result of the unshifted variation is required to be the same as the nominal result in all quantities
+  /// in case isExactNominal is set, and in the mass only otherwise
+  int checkVisMomentumVariations(ClassicSVfit& svFitAlgo, const std::vector<std::vector<MeasuredTauLepton> >& events,
+                                 double measuredMETx, double measuredMETy, const TMatrixD& covMET, bool isExactNominal)
+  {
+    // CV: variation #0 leaves the momenta unchanged, variations #1 and #2 shift the momenta of both legs up and down by 3%
+    svFitAlgo.clearVisMomentumVariations();
+    svFitAlgo.addVisMomentumVariation(1.,   1.);
+    svFitAlgo.addVisMomentumVariation(1.03, 1.03);
+    svFitAlgo.addVisMomentumVariation(0.97, 0.97);
+
+    int status = 0;
+    // CV: the events are processed twice, to check that the integrands kept for the variations get updated for each event
+    const unsigned numRuns = 2;
+    for ( unsigned iRun = 0; iRun < numRuns; ++iRun ) {
+      for ( unsigned iEvent = 0; iEvent < events.size(); ++iEvent ) {
+        svFitAlgo.integrate(events[iEvent], measuredMETx, measuredMETy, covMET);
+        const HistogramAdapterDiTau* histogramAdapter = static_cast<HistogramAdapterDiTau*>(svFitAlgo.getHistogramAdapter());
+        if ( svFitAlgo.getNumVisMomentumVariations() != 3 ) {
+          std::cout << "run #" << iRun << ", event #" << iEvent << ": number of variations = " << svFitAlgo.getNumVisMomentumVariations() << " (expected = 3)" << std::endl;
+          status = 1;
+          continue;
+        }
+        double mass = histogramAdapter->getMass();
+        const ClassicSVfit::VariationResult& result_unshifted = svFitAlgo.getVisMomentumVariationResult(0);
+        const ClassicSVfit::VariationResult& result_up = svFitAlgo.getVisMomentumVariationResult(1);
+        const ClassicSVfit::VariationResult& result_down = svFitAlgo.getVisMomentumVariationResult(2);
+        std::cout << "run #" << iRun << ", event #" << iEvent << ": mass = " << mass << " +/- " << histogramAdapter->getMassErr() << ","
+                  << " unshifted = " << result_unshifted.mass_ << " +/- " << result_unshifted.massErr_
+                  << " (effective sample fraction = " << result_unshifted.effectiveSampleFraction_ << "),"
+                  << " up = " << result_up.mass_ << " (effective sample fraction = " << result_up.effectiveSampleFraction_ << "),"
+                  << " down = " << result_down.mass_ << " (effective sample fraction = " << result_down.effectiveSampleFraction_ << ")" << std::endl;
+
+        // CV: all samples get a weight of exactly one for the variation without any shift
+        if ( result_unshifted.effectiveSampleFraction_ != 1. ) {
+          std::cout << "--> effective sample fraction of unshifted variation differs from one !!" << std::endl;
+          status = 1;
+        }
+        bool isSameAsNominal = result_unshifted.isValidSolution_ && result_unshifted.mass_ == mass;
+        if ( isExactNominal ) {
+          isSameAsNominal &= ( result_unshifted.massErr_ == histogramAdapter->getMassErr() &&
+                               result_unshifted.pt_ == histogramAdapter->getPt() && result_unshifted.ptErr_ == histogramAdapter->getPtErr() &&
+                               result_unshifted.transverseMass_ == histogramAdapter->getTransverseMass() &&
+                               result_unshifted.transverseMassErr_ == histogramAdapter->getTransverseMassErr() );
+        }
+        if ( !isSameAsNominal ) {
+          std::cout << "--> unshifted variation does not reproduce the nominal result !!" << std::endl;
+          status = 1;
+        }
+        if ( !(result_up.isValidSolution_ && result_down.isValidSolution_ && result_up.mass_ > mass && result_down.mass_ < mass) ) {
+          std::cout << "--> mass does not move in the direction of the shifted momenta !!" << std::endl;
+          status = 1;
+        }
+      }
+    }
+    return status;
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  // define MET
+  double measuredMETx =  11.7491;
+  double measuredMETy = -51.9172;
+
+  // define MET covariance
+  TMatrixD covMET(2, 2);
+  covMET[0][0] =  787.352;
+  covMET[1][0] = -178.63;
+  covMET[0][1] = -178.63;
+  covMET[1][1] =  179.545;
+
+  // define lepton four vectors for two events
+  std::vector<std::vector<MeasuredTauLepton> > events(2);
+  events[0].push_back(MeasuredTauLepton(MeasuredTauLepton::kTauToElecDecay, 33.7393, 0.9409,  -0.541458, 0.51100e-3)); // tau -> electron decay (Pt, eta, phi, mass)
+  events[0].push_back(MeasuredTauLepton(MeasuredTauLepton::kTauToHadDecay,  25.7322, 0.618228, 2.79362,  0.13957, 0)); // tau -> 1prong0pi0 hadronic decay (Pt, eta, phi, mass)
+  events[1].push_back(MeasuredTauLepton(MeasuredTauLepton::kTauToMuDecay,   52.1,   -0.3,      1.2,      0.10566));    // tau -> muon decay (Pt, eta, phi, mass)
+  events[1].push_back(MeasuredTauLepton(MeasuredTauLepton::kTauToHadDecay,  41.4,    0.2,     -2.0,      1.2,     10)); // tau -> 3prong0pi0 hadronic decay (Pt, eta, phi, mass)
+
+  int verbosity = 0;
+  int status = 0;
+
+  // CV: with the default Metropolis moves, the nominal histograms are filled with the kinematics of the last integrand evaluation,
+  //     which is the rejected proposal in case a move is rejected, while the histograms of the variations are filled
+  //     with the kinematics at the current position of the Markov Chain. The unshifted variation hence reproduces the nominal mass,
+  //     but the quantiles of the mass distribution differ slightly
+  std::cout << "Metropolis moves:" << std::endl;
+  ClassicSVfit svFitAlgo(verbosity);
+  svFitAlgo.addLogM_fixed(true, 6.);
+  svFitAlgo.setMaxObjFunctionCalls(20000);
+  if ( checkVisMomentumVariations(svFitAlgo, events, measuredMETx, measuredMETy, covMET, false) != 0 ) status = 1;
+
+  // CV: Hamiltonian Monte Carlo moves re-evaluate the integrand at the current position in case a move is rejected,
+  //     so that the unshifted variation needs to reproduce the nominal histograms exactly
+  std::cout << "Hamiltonian Monte Carlo moves:" << std::endl;
+  ClassicSVfit svFitAlgo_hmc(verbosity);
+  svFitAlgo_hmc.addLogM_fixed(true, 6.);
+  svFitAlgo_hmc.setMaxObjFunctionCalls(20000);
+  svFitAlgo_hmc.enableHamiltonianMonteCarlo();
+  if ( checkVisMomentumVariations(svFitAlgo_hmc, events, measuredMETx, measuredMETy, covMET, true) != 0 ) status = 1;
+
+  return status;
+}
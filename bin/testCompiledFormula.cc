@@ -0,0 +1,103 @@
+/**
+   \class testCompiledFormula testCompiledFormula.cc "TauAnalysis/ClassicSVfit/bin/testCompiledFormula.cc"
+   \brief Check that CompiledFormula::eval agrees with TFormula::Eval, including operator precedence and associativity,
+          and that replaceVariableName replaces whole identifiers only
+*/
+
+#include "TauAnalysis/ClassicSVfit/interface/svFitFormula.h"
+
+#include <TFormula.h>
+#include <TMath.h>
+
+#include <iostream>
+#include <string>
+
+using namespace classic_svFit;
+
+namespace
+{
+  /// compare CompiledFormula with TFormula for given expression at several values of x,
+  /// returns the number of values for which they differ
+  unsigned compareWithTFormula(const std::string& expression)
+  {
+    CompiledFormula compiledFormula;
+    if ( !compiledFormula.compile(expression) ) {
+      std::cout << "expression = '" << expression << "': failed to compile !!" << std::endl;
+      return 1;
+    }
+    // CV: do not add formula to global list of functions
+    TFormula formula("testCompiledFormula", expression.data(), false);
+    const double xValues[] = { 0.5, 1.5, 15., 91.2, 125.06, 350. };
+    const unsigned numValues = sizeof(xValues)/sizeof(double);
+    unsigned numMismatches = 0;
+    for ( unsigned iValue = 0; iValue < numValues; ++iValue ) {
+      double x = xValues[iValue];
+      double value_compiled = compiledFormula.eval(x);
+      double value_ref = formula.Eval(x);
+      if ( !(TMath::Abs(value_compiled - value_ref) <= 1.e-12*TMath::Max(1., TMath::Abs(value_ref))) ) {
+        std::cout << "expression = '" << expression << "', x = " << x << ": CompiledFormula = " << value_compiled << ", TFormula = " << value_ref << " !!" << std::endl;
+        ++numMismatches;
+      }
+    }
+    return numMismatches;
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  int status = 0;
+
+  // CV: expressions are chosen to check the precedence of unary minus and power operators,
+  //     the right-associativity of the power operator and the supported functions
+  const char* expressions[] = {
+    "(x/1000.)*15.",
+    "-x^2",
+    "2^-1",
+    "x**2",
+    "x^2^0.5",
+    "2^x^0.1",
+    "-2^2 + x",
+    "1. - x/2./3.",
+    "x - 1. - 2.",
+    "3.*x^2/4.",
+    "sqrt(x) + exp(-x/100.) + log(x) + log10(x) + abs(1. - x)",
+    "sin(x) + cos(x) + tan(x/1000.)",
+    "pow(x, 1.5) + min(x, 100.) + max(x, 100.)",
+    "TMath::Sqrt(x) + TMath::Power(x, 0.5) + TMath::Min(x, 50.) + TMath::Max(x, 50.)",
+    "TMath::Exp(-x/100.) + TMath::Log(x) + TMath::Log10(x) + TMath::Abs(-x)",
+    "pi*x",
+    "TMath::Pi()*x",
+    "2.e-3*x + 1.5e+1"
+  };
+  const unsigned numExpressions = sizeof(expressions)/sizeof(const char*);
+  for ( unsigned iExpression = 0; iExpression < numExpressions; ++iExpression ) {
+    if ( compareWithTFormula(expressions[iExpression]) != 0 ) status = 1;
+  }
+  std::cout << "compared " << numExpressions << " expressions with TFormula" << std::endl;
+
+  // CV: the dynamic log(M) term is given in terms of m or mass, which must not be replaced within function names
+  struct Replacement
+  {
+    const char* expression_;
+    const char* expected_;
+  };
+  const Replacement replacements[] = {
+    { "(m/1000.)*15.",                        "(x/1000.)*15."                        },
+    { "min(m, 150.)/mass",                    "min(x, 150.)/x"                       },
+    { "max(mass, 2.e-3*m)",                   "max(x, 2.e-3*x)"                      },
+    { "TMath::Min(m,mass) + TMath::Exp(-m)",  "TMath::Min(x,x) + TMath::Exp(-x)"     },
+    { "mm + m_1 + m",                         "mm + m_1 + x"                         }
+  };
+  const unsigned numReplacements = sizeof(replacements)/sizeof(Replacement);
+  for ( unsigned iReplacement = 0; iReplacement < numReplacements; ++iReplacement ) {
+    const Replacement& replacement = replacements[iReplacement];
+    std::string result = replaceVariableName(replaceVariableName(replacement.expression_, "m"), "mass");
+    if ( result != replacement.expected_ ) {
+      std::cout << "replaceVariableName('" << replacement.expression_ << "') = '" << result << "' (expected = '" << replacement.expected_ << "') !!" << std::endl;
+      status = 1;
+    }
+  }
+  std::cout << "checked " << numReplacements << " replacements of variable names" << std::endl;
+
+  return status;
+}
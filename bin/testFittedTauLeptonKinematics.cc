@@ -0,0 +1,119 @@
+/**
+   \class testFittedTauLeptonKinematics testFittedTauLeptonKinematics.cc "TauAnalysis/ClassicSVfit/bin/testFittedTauLeptonKinematics.cc"
+   \brief Check that the neutrino and tau lepton momenta computed by FittedTauLepton::updateTauMomenta for a batch of points
+          agree with the momenta computed by FittedTauLepton::updateTauMomentum for each point in turn
+*/
+
+#include "TauAnalysis/ClassicSVfit/interface/FittedTauLepton.h"
+#include "TauAnalysis/ClassicSVfit/interface/MeasuredTauLepton.h"
+#include "TauAnalysis/ClassicSVfit/interface/svFitAuxFunctions.h"
+
+#include <TRandom3.h>
+#include <TMath.h>
+
+#include <iostream>
+
+using namespace classic_svFit;
+
+namespace
+{
+  const unsigned numPoints = 1000;
+
+  /// compare momenta computed for a batch of random points with the momenta computed point by point,
+  /// returns the largest difference of any momentum component, relative to the tau lepton energy
+  double compMaxDeviation(const MeasuredTauLepton& measuredTauLepton, TRandom3& rnd, unsigned& numInvalidPoints, bool& isValidMismatch)
+  {
+    FittedTauLepton fittedTauLepton_batch(0, 0);
+    fittedTauLepton_batch.setMeasuredTauLepton(measuredTauLepton);
+    fittedTauLepton_batch.updateVisMomentum(1.);
+    FittedTauLepton fittedTauLepton_scalar(1, 0);
+    fittedTauLepton_scalar.setMeasuredTauLepton(measuredTauLepton);
+    fittedTauLepton_scalar.updateVisMomentum(1.);
+
+    double x[numPoints];
+    double phiNu[numPoints];
+    double nuMass[numPoints];
+    double minX = square(measuredTauLepton.mass())/tauLeptonMass2;
+    for ( unsigned iPoint = 0; iPoint < numPoints; ++iPoint ) {
+      x[iPoint] = rnd.Uniform(minX, 1.);
+      phiNu[iPoint] = rnd.Uniform(-TMath::Pi(), +TMath::Pi());
+      // CV: choose neutrino masses up to and beyond the kinematic limit, in order to check unphysical points as well
+      nuMass[iPoint] = ( measuredTauLepton.isLeptonicTauDecay() ) ? rnd.Uniform(0., 1.2*tauLeptonMass*TMath::Sqrt(1. - x[iPoint])) : 0.;
+    }
+
+    double nuEn[numPoints], nuP[numPoints], nuPx[numPoints], nuPy[numPoints], nuPz[numPoints];
+    double tauEn[numPoints], tauPx[numPoints], tauPy[numPoints], tauPz[numPoints];
+    bool isValid[numPoints];
+    FittedTauLepton::MomentaBatch momenta;
+    momenta.nuEn_ = nuEn;
+    momenta.nuP_ = nuP;
+    momenta.nuPx_ = nuPx;
+    momenta.nuPy_ = nuPy;
+    momenta.nuPz_ = nuPz;
+    momenta.tauEn_ = tauEn;
+    momenta.tauPx_ = tauPx;
+    momenta.tauPy_ = tauPy;
+    momenta.tauPz_ = tauPz;
+    momenta.isValid_ = isValid;
+    fittedTauLepton_batch.updateTauMomenta(numPoints, x, phiNu, nuMass, momenta);
+
+    double maxDeviation = 0.;
+    numInvalidPoints = 0;
+    for ( unsigned iPoint = 0; iPoint < numPoints; ++iPoint ) {
+      fittedTauLepton_scalar.updateTauMomentum(x[iPoint], phiNu[iPoint], nuMass[iPoint]);
+      bool isValid_ref = !(fittedTauLepton_scalar.errorCode() & FittedTauLepton::TauDecayParameters);
+      const LorentzVector& nuP4_ref = fittedTauLepton_scalar.nuP4();
+      const LorentzVector& tauP4_ref = fittedTauLepton_scalar.tauP4();
+      if ( isValid[iPoint] != isValid_ref ) {
+        isValidMismatch = true;
+        continue;
+      }
+      if ( !isValid_ref ) {
+        ++numInvalidPoints;
+        continue;
+      }
+      double scale = tauP4_ref.E();
+      double deviations[] = {
+        nuEn[iPoint] - nuP4_ref.E(), nuP[iPoint] - nuP4_ref.P(), nuPx[iPoint] - nuP4_ref.px(), nuPy[iPoint] - nuP4_ref.py(), nuPz[iPoint] - nuP4_ref.pz(),
+        tauEn[iPoint] - tauP4_ref.E(), tauPx[iPoint] - tauP4_ref.px(), tauPy[iPoint] - tauP4_ref.py(), tauPz[iPoint] - tauP4_ref.pz()
+      };
+      for ( unsigned idx = 0; idx < sizeof(deviations)/sizeof(double); ++idx ) {
+        double deviation = TMath::Abs(deviations[idx])/scale;
+        // CV: also catches NaN values
+        if ( !(deviation <= maxDeviation) ) maxDeviation = deviation;
+      }
+    }
+    return maxDeviation;
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  std::vector<MeasuredTauLepton> measuredTauLeptons;
+  measuredTauLeptons.push_back(MeasuredTauLepton(MeasuredTauLepton::kTauToElecDecay, 33.7393, 0.9409,  -0.541458, 0.51100e-3)); // tau -> electron decay (Pt, eta, phi, mass)
+  measuredTauLeptons.push_back(MeasuredTauLepton(MeasuredTauLepton::kTauToMuDecay,   52.1,   -2.1,      1.2,      0.10566));    // tau -> muon decay (Pt, eta, phi, mass)
+  measuredTauLeptons.push_back(MeasuredTauLepton(MeasuredTauLepton::kTauToHadDecay,  25.7322, 0.618228, 2.79362,  0.13957, 0)); // tau -> 1prong0pi0 hadronic decay (Pt, eta, phi, mass)
+  measuredTauLeptons.push_back(MeasuredTauLepton(MeasuredTauLepton::kTauToHadDecay,  87.3,    0.05,    -3.0,      1.2,     10)); // tau -> 3prong0pi0 hadronic decay (Pt, eta, phi, mass)
+  measuredTauLeptons.push_back(MeasuredTauLepton(MeasuredTauLepton::kPrompt,         45.2,   -0.7,      0.3,      0.10566));    // prompt muon (Pt, eta, phi, mass)
+
+  // CV: relative accuracy expected for momenta computed with sin(thetaNu) = sqrt(1 - cos(thetaNu)^2) instead of sin(acos(cos(thetaNu)))
+  const double maxDeviation_expected = 1.e-9;
+
+  TRandom3 rnd(12345);
+  int status = 0;
+  for ( std::vector<MeasuredTauLepton>::const_iterator measuredTauLepton = measuredTauLeptons.begin();
+        measuredTauLepton != measuredTauLeptons.end(); ++measuredTauLepton ) {
+    unsigned numInvalidPoints = 0;
+    bool isValidMismatch = false;
+    double maxDeviation = compMaxDeviation(*measuredTauLepton, rnd, numInvalidPoints, isValidMismatch);
+    std::cout << "decay type = " << measuredTauLepton->type() << ": max. relative deviation = " << maxDeviation << " (expected < " << maxDeviation_expected << "),"
+              << " unphysical points = " << numInvalidPoints << "/" << numPoints << std::endl;
+    if ( isValidMismatch ) {
+      std::cout << " points flagged as unphysical differ between batch and scalar computation !!" << std::endl;
+      status = 1;
+    }
+    if ( !(maxDeviation < maxDeviation_expected) ) status = 1;
+  }
+
+  return status;
+}
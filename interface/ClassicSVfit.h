@@ -4,6 +4,7 @@
 #include "TauAnalysis/ClassicSVfit/interface/ClassicSVfitBase.h"
 #include "TauAnalysis/ClassicSVfit/interface/MeasuredTauLepton.h"
 #include "TauAnalysis/ClassicSVfit/interface/svFitHistogramAdapter.h"
+#include "TauAnalysis/ClassicSVfit/interface/svFitThreadPool.h"
 
 class ClassicSVfit : public ClassicSVfitBase
 {
@@ -11,6 +12,128 @@ class ClassicSVfit : public ClassicSVfitBase
   ClassicSVfit(int = 0);
   ~ClassicSVfit();
 
+  /// input measurements of one event, for integrating a batch of events
+  struct Event
+  {
+    Event()
+      : measuredMETx_(0.)
+      , measuredMETy_(0.)
+      , covMET_(2, 2)
+    {}
+    Event(const std::vector<classic_svFit::MeasuredTauLepton>& measuredTauLeptons, double measuredMETx, double measuredMETy, const TMatrixD& covMET)
+      : measuredTauLeptons_(measuredTauLeptons)
+      , measuredMETx_(measuredMETx)
+      , measuredMETy_(measuredMETy)
+      , covMET_(covMET)
+    {}
+    std::vector<classic_svFit::MeasuredTauLepton> measuredTauLeptons_;
+    double measuredMETx_;
+    double measuredMETy_;
+    TMatrixD covMET_;
+  };
+
+  /// result of integrating one event of a batch
+  struct Result
+  {
+    bool isValidSolution_;
+    double pt_;
+    double ptErr_;
+    double eta_;
+    double etaErr_;
+    double phi_;
+    double phiErr_;
+    double mass_;
+    double massErr_;
+    double transverseMass_;
+    double transverseMassErr_;
+    double probMax_;
+    long numObjFunctionCalls_;
+    double numSeconds_cpu_;
+    double numSeconds_real_;
+    classic_svFit::IntegratorStatistics integratorStatistics_;
+  };
+
+  /// result for one systematic variation, obtained by reweighting the samples of the nominal Markov Chain integration
+  struct VariationResult
+  {
+    bool isValidSolution_;
+    double pt_;
+    double ptErr_;
+    double mass_;
+    double massErr_;
+    double transverseMass_;
+    double transverseMassErr_;
+    /// effective sample size, (sum of weights)^2/(sum of squared weights), and its ratio to the number of samples;
+    /// a small fraction indicates that the nominal samples do not cover the region of the integrand relevant for the variation
+    double effectiveSampleSize_;
+    double effectiveSampleFraction_;
+    /// flag indicating that the effective sample fraction is below the threshold set by setMinEffectiveSampleFraction,
+    /// i.e. that the variation needs to be integrated separately
+    bool isReweightingPoor_;
+  };
+
+  /// histograms filled for systematic variations by each Markov Chain (index = chain*numVariations + variation),
+  /// sums of weights and of squared weights (same index) and number of samples (index = chain),
+  /// used to compute the results and the effective sample size of each variation
+  struct VariationHistograms
+  {
+    VariationHistograms() {}
+    ~VariationHistograms();
+
+    /// create copies of given histogram adapter, unless they exist already for the same number of chains and variations,
+    /// and reset the sums of weights
+    void initialize(const classic_svFit::HistogramAdapterDiTau* histogramAdapter, unsigned numChains, unsigned numVariations);
+
+    /// delete histograms
+    void clear();
+
+    /// fill histograms for given chain and variation
+    void fill(unsigned iChain, unsigned iVariation, const classic_svFit::LorentzVector& tau1P4, const classic_svFit::LorentzVector& tau2P4, double weight);
+
+    std::vector<classic_svFit::HistogramAdapterDiTau*> histogramAdapters_;
+    std::vector<double> sumWeights_;
+    std::vector<double> sumWeights2_;
+    std::vector<long> numSamples_;
+
+   private:
+    VariationHistograms(const VariationHistograms&) = delete;
+    VariationHistograms& operator=(const VariationHistograms&) = delete;
+  };
+
+  /// set threshold on the effective sample fraction of systematic variations below which the reweighting is flagged as poor
+  /// (default = 0.1)
+  void setMinEffectiveSampleFraction(double minEffectiveSampleFraction);
+
+  /// add/clear MET variations (e.g. for jet energy scale or unclustered energy uncertainties).
+  /// The samples of the Markov Chain integration for the nominal MET are reweighted by the ratio of the MET transfer function
+  /// for each variation to the MET transfer function for the nominal MET, and filled into one set of histograms per variation,
+  /// so that the results for all variations are obtained from a single integration.
+  /// The variations are kept for subsequent events, until clearMETVariations is called.
+  /// CV: MET variations are supported by the Markov Chain integration of single events only
+  void addMETVariation(double measuredMETx, double measuredMETy, const TMatrixD& covMET);
+  void clearMETVariations();
+
+  /// get number of MET variations and the results and histograms obtained for the variation with given index
+  unsigned getNumMETVariations() const;
+  const VariationResult& getMETVariationResult(unsigned iVariation) const;
+  classic_svFit::HistogramAdapterDiTau* getMETVariationHistogramAdapter(unsigned iVariation) const;
+
+  /// add/clear variations of the momenta of the visible tau decay products (e.g. for tau or lepton energy scale uncertainties),
+  /// given as scale factors for the first and second lepton, in the order in which the leptons are passed to integrate.
+  /// The samples of the Markov Chain integration for the nominal momenta are reweighted by the ratio of the integrand
+  /// computed for the scaled momenta to the integrand computed for the nominal momenta, at the same values of the integration variables
+  /// (x, phiNu, mNuNu), and filled into one set of histograms per variation.
+  /// The MET is not changed by the variations.
+  /// The variations are kept for subsequent events, until clearVisMomentumVariations is called.
+  /// CV: variations are supported by the Markov Chain integration of single events only
+  void addVisMomentumVariation(double visPtShift1, double visPtShift2);
+  void clearVisMomentumVariations();
+
+  /// get number of variations of the visible momenta and the results and histograms obtained for the variation with given index
+  unsigned getNumVisMomentumVariations() const;
+  const VariationResult& getVisMomentumVariationResult(unsigned iVariation) const;
+  classic_svFit::HistogramAdapterDiTau* getVisMomentumVariationHistogramAdapter(unsigned iVariation) const;
+
   void setDiTauMassConstraint(double diTauMass);
 
   /// set and get histogram adapter
@@ -26,19 +149,98 @@ class ClassicSVfit : public ClassicSVfitBase
   /// run integration with Markov Chain
   void integrate(const std::vector<classic_svFit::MeasuredTauLepton>&, double, double, const TMatrixD&);
 
+  /// run integration with Markov Chain for a batch of events,
+  /// processing the events in parallel threads (number of threads set by setNumThreads).
+  /// Each thread uses its own copy of integrand, integrator and histogram adapter,
+  /// configured the same way as this instance; threads that run out of events take over events of other threads.
+  /// Returns one result per event, in the order of the input events.
+  /// CV: the histogram adapter of this instance is not modified; likelihood and tree files are not written in batch mode.
+  ///     ROOT::EnableThreadSafety() needs to be called before when using more than one thread.
+  std::vector<Result> integrate(const std::vector<Event>& events);
+
  protected:
   /// initialize Markov Chain integrator class
   void initializeMCIntegrator();
 
+  /// delete the copies of the integrand used for the variations of the visible momenta,
+  /// so that they get created again with the current configuration of the integrand
+  void integrandConfigurationChanged();
+
   /// set integration indices and ranges for both legs
   /// when useMassConstraint is true reduce number of
   /// dimension by using the mass contraint
   void setIntegrationParams(bool useDiTauMassConstraint=false);
 
+  /// compute candidates for start-position of Markov Chain from visible kinematics and MET
+  void computeStartPositionCandidates(std::vector<std::vector<double> >& candidates) const;
+
+  /// candidates for start-position of Markov Chain, kept to reuse the allocated memory for subsequent events
+  std::vector<std::vector<double> > startPositionCandidates_;
+
+  /// pass leptons, integration ranges and histogram adapter to given integrand
+  void prepareIntegrand(classic_svFit::ClassicSVfitIntegrandBase* integrand, classic_svFit::HistogramAdapterDiTau* histogramAdapter,
+                        const std::vector<classic_svFit::MeasuredTauLepton>& measuredTauLeptons);
+
   double diTauMassConstraint_;
 
   /// histograms for evaluation of pT, eta, phi, mass and transverse mass of di-tau system
   mutable classic_svFit::HistogramAdapterDiTau* histogramAdapter_;
+
+  /// copies of histogram adapter filled by Markov Chains run in parallel threads
+  /// (index = chain - 1, chain 0 fills histogramAdapter_);
+  /// the histograms get added to those of histogramAdapter_ at the end of the integration
+  std::vector<classic_svFit::HistogramAdapterDiTau*> chainHistogramAdapters_;
+
+  /// MET variations
+  struct METVariation
+  {
+    double measuredMETx_;
+    double measuredMETy_;
+    TMatrixD covMET_;
+  };
+  std::vector<METVariation> metVariations_;
+  VariationHistograms metVariationHistograms_;
+  std::vector<VariationResult> metVariationResults_;
+
+  /// variations of the momenta of the visible tau decay products
+  struct VisMomentumVariation
+  {
+    double visPtShift_[2];
+  };
+  std::vector<VisMomentumVariation> visMomentumVariations_;
+  VariationHistograms visMomentumVariationHistograms_;
+  std::vector<VariationResult> visMomentumVariationResults_;
+
+  /// scaled momenta of the visible tau decay products, in the same order as measuredTauLeptons_ (index = variation)
+  std::vector<std::vector<classic_svFit::MeasuredTauLepton> > visMomentumVariationTauLeptons_;
+
+  /// copies of the integrand, evaluated for the scaled momenta of the visible tau decay products
+  /// (index = chain*numVariations + variation);
+  /// kept for subsequent events, unless the integrator is re-initialized, the configuration of the integrand or the number of variations changes
+  std::vector<classic_svFit::ClassicSVfitIntegrandBase*> visMomentumVariationIntegrands_;
+
+  double minEffectiveSampleFraction_;
+
+  /// compute scaled momenta of the visible tau decay products, create the integrands for the variations in case needed
+  /// and set their MET to the nominal MET estimate
+  void prepareVisMomentumVariations(const std::vector<classic_svFit::MeasuredTauLepton>& measuredTauLeptons, double measuredMETx, double measuredMETy);
+
+  /// book histograms for MET variations and variations of the visible momenta and reset sums of weights
+  void bookVariationHistograms();
+
+  /// add histograms filled by different Markov Chains and compute results for the variations
+  void compVariationResults(const VariationHistograms& variationHistograms, std::vector<VariationResult>& variationResults, const char* label) const;
+
+ private:
+  void deleteChainHistogramAdapters();
+  void deleteVisMomentumVariationIntegrands();
+
+  /// create instance with the same configuration as this one,
+  /// used to process events of a batch in one thread
+  ClassicSVfit* createBatchWorker() const;
+
+  /// thread pool for processing batches of events
+  classic_svFit::ThreadPool* batchThreadPool_;
 };
 
 #endif
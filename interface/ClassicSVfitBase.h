@@ -3,7 +3,7 @@
 
 #include "TauAnalysis/ClassicSVfit/interface/ClassicSVfitIntegrand.h"
 #include "TauAnalysis/ClassicSVfit/interface/MeasuredTauLepton.h"
-#include "TauAnalysis/ClassicSVfit/interface/SVfitIntegratorMarkovChain.h"
+#include "TauAnalysis/ClassicSVfit/interface/SVfitIntegratorBase.h"
 #ifdef USE_SVFITTF
 #include "TauAnalysis/SVfitTF/interface/HadTauTFBase.h"
 #endif
@@ -18,6 +18,39 @@
 class ClassicSVfitBase
 {
  public:
+  /// schedule of the "simulated annealing" at the beginning of the "burnin" stage of the Markov Chain integration:
+  /// in phase 1, the momenta are scaled by sqrt(T0), i.e. the chain moves at "temperature" T0;
+  /// in phase 2, the momenta are only partially refreshed (persistence alpha), so that the chain gradually "cools down".
+  /// In automatic mode, the annealing is skipped for chains that start close to the highest integrand value found by a short "pilot"
+  /// of Metropolis moves at temperature 1 and by the evaluation of the start-position candidates,
+  /// and phase 2 ends as soon as the "potential energy" of the chain has stabilized
+  /// (see SVfitIntegratorMarkovChain::setAutoAnnealing)
+  struct AnnealingSchedule
+  {
+    AnnealingSchedule()
+      : fractionPhase1_(0.20)
+      , fractionPhase2_(0.60)
+      , T0_(15.)
+      , alpha_(-1.)
+      , isAuto_(false)
+      , minProbRatio_(1.e-2)
+      , energyTolerance_(0.5)
+      , fractionEnergyWindow_(0.05)
+    {}
+    /// fractions of "burnin" iterations spent in phase 1 and 2
+    double fractionPhase1_;
+    double fractionPhase2_;
+    double T0_;
+    /// persistence of momenta in phase 2; values <= 0 select alpha = 1 - 10/(number of "burnin" iterations)
+    double alpha_;
+    /// parameters of automatic mode;
+    /// the length of the "pilot" and of the windows over which the "potential energy" is averaged is given as fraction of "burnin" iterations
+    bool isAuto_;
+    double minProbRatio_;
+    double energyTolerance_;
+    double fractionEnergyWindow_;
+  };
+
   ClassicSVfitBase(int = 0);
   virtual ~ClassicSVfitBase();
 
@@ -40,15 +73,100 @@ class ClassicSVfitBase
   ///Level 0 - mute, level 1 - print inputs, level 2 - print integration details
   void setVerbosity(int aVerbosity);
 
-  /// number of function calls for Markov Chain integration (default is 100000)
+  /// number of function calls for Markov Chain integration (default is 100000);
+  /// the number of "sampling" moves per chain, nominally 90% of the function calls divided by the number of chains,
+  /// is rounded to the nearest multiple of the number of batches (100), from which the uncertainty of the integral is estimated
   void setMaxObjFunctionCalls(unsigned maxObjFunctionCalls);
 
+  /// set integration algorithm:
+  ///  - "MarkovChain" (default)
+  ///  - "VEGAS" (adaptive importance sampling, which typically needs fewer function calls for the same precision;
+  ///    the function calls are split among 5 "training" and 5 "sampling" iterations)
+  ///  - "QuasiMonteCarlo" (scrambled Sobol sequence; the function calls are split among 8 independent scramblings,
+  ///    from which the uncertainty of the integral is estimated; the number of points per scrambling
+  ///    is rounded down to a power of 2, so fewer function calls than set by setMaxObjFunctionCalls may be made).
+  /// The settings for number of chains, start-position seeding, adaptive step-sizes and early stopping
+  /// apply to the Markov Chain integration only
+  void setIntegrator(const std::string& integratorType);
+
+  /// number of independent Markov Chains, among which the function calls are split (default is 1)
+  void setNumChains(unsigned numChains);
+
+  /// number of threads used to run the Markov Chains in parallel (default is 1),
+  /// or to process the events in parallel when integrating a batch of events;
+  /// the result does not depend on the number of threads
+  void setNumThreads(unsigned numThreads);
+
+  /// set type of random number generator used by Markov Chain integration:
+  /// "TRandom3" (default) or "Philox" (counter-based generator, faster generation of Gaussian random numbers)
+  void setRandomGenerator(const std::string& randomGeneratorType);
+
+  /// policy for seeding the random number generators at the start of each integration:
+  ///  - kFixedSeed (default): the same seed is used for each event
+  ///  - kEventSeed: the seed is derived from a hash of the event inputs (measured tau leptons, MET and MET covariance, after rounding)
+  ///    and of the given salt, so that each event uses its own random numbers.
+  /// With either policy, the result of an event depends on its inputs only,
+  /// not on the order in which events are processed, on the composition of batches or on the number of threads
+  enum SeedingPolicy { kFixedSeed, kEventSeed };
+  void setSeedingPolicy(SeedingPolicy seedingPolicy, unsigned long salt = 0);
+
+  /// enable/disable computation of start-position candidates for the Markov Chain from the visible kinematics (disabled by default):
+  /// candidates are placed around the collinear approximation for the visible energy fractions x1 and x2,
+  /// with the neutrinos emitted in the direction of the MET;
+  /// the random search for a start-position is used only in case the integrand is zero for all candidates
+  void enableStartPositionSeeding();
+  void disableStartPositionSeeding();
+
+  /// enable/disable adaptation of Markov Chain step-sizes during "burnin" stage (disabled by default);
+  /// the step-sizes get tuned separately for each dimension, such that the fraction of accepted moves approaches targetAcceptanceRate.
+  /// The tuning is done in the last minFractionAdaptation of the "burnin" iterations (at least 100 iterations),
+  /// for which the "simulated annealing" gets shortened if necessary
+  void enableAdaptiveStepSize(double targetAcceptanceRate = 0.3, double minFractionAdaptation = 0.2);
+  void disableAdaptiveStepSize();
+
+  /// set schedule of "simulated annealing" used by Markov Chain integration
+  void setAnnealingSchedule(const AnnealingSchedule& schedule);
+
+  /// enable/disable multiple-try Metropolis moves in Markov Chain integration (disabled by default):
+  /// numTries proposals are drawn and evaluated in one batch per move.
+  /// As each move takes about 2*numTries integrand evaluations, the number of moves is reduced accordingly,
+  /// so that the number of function calls stays close to the value set by setMaxObjFunctionCalls
+  void enableMultipleTryMetropolis(unsigned numTries = 4);
+  void disableMultipleTryMetropolis();
+
+  /// enable/disable Hamiltonian Monte Carlo moves in Markov Chain integration (disabled by default):
+  /// each move follows a trajectory of numLeapfrogSteps steps along the gradient of the integrand,
+  /// which is computed analytically together with the integrand (see ClassicSVfitIntegrand::EvalWithGradient).
+  /// The number of moves is reduced such that the number of function calls stays close to the value set by setMaxObjFunctionCalls.
+  /// Hamiltonian Monte Carlo moves take precedence over multiple-try Metropolis moves
+  void enableHamiltonianMonteCarlo(unsigned numLeapfrogSteps = 10, double stepSize = 2.e-2);
+  void disableHamiltonianMonteCarlo();
+
+  /// enable/disable evaluation of Markov Chain moves in log domain (disabled by default):
+  /// the logarithm of the integrand is computed as sum of the logarithms of its factors (see ClassicSVfitIntegrand::EvalLog)
+  /// and moves are accepted based on the difference of logarithms, so that start-positions and proposals for which the integrand underflows are not rejected.
+  /// Not supported in combination with multiple-try Metropolis or Hamiltonian Monte Carlo moves, in which case the setting is ignored (with a warning)
+  void enableLogDomain();
+  void disableLogDomain();
+
+  /// enable/disable convergence-driven stopping of Markov Chain integration (disabled by default).
+  /// When enabled, the integration stops once the relative uncertainty on the integral
+  /// and the relative change of the di-tau mass quantiles between batches are below the given precision;
+  /// the number of function calls is at least minObjFunctionCalls and at most the value set by setMaxObjFunctionCalls
+  void enableEarlyStopping(double precision = 1.e-2, unsigned minObjFunctionCalls = 20000);
+  void disableEarlyStopping();
+
   /// set name of ROOT file to store histograms of di-tau pT, eta, phi, mass and transverse mass
   void setLikelihoodFileName(const std::string& likelihoodFileName);
 
-  /// set name of ROOT file to store Markov Chain steps
+  /// set name of file to store the Markov Chain steps of the "sampling" stage,
+  /// together with the tau lepton four-vectors (see ChainTraceWriter for the file format).
+  /// The samples of subsequent events are appended to the file and can be re-histogrammed with ChainTraceReader
   void setTreeFileName(const std::string& treeFileName);
 
+  /// store only every thinning-th Markov Chain step (default is 1)
+  void setTreeThinning(unsigned thinning);
+
   /// prepare the integrand
   virtual void prepareIntegrand() = 0;
 
@@ -70,17 +188,37 @@ class ClassicSVfitBase
   /// return flag indicating if algorithm succeeded to find valid solution
   bool isValidSolution() const;
 
+  /// return number of function calls used in last call to integrate method
+  long getNumObjFunctionCalls() const;
+
   /// return computing time (in seconds) spent on last call to integrate method
   double getComputingTime_cpu() const;
   double getComputingTime_real() const;
 
- protected:
-  ///flag for choosing the integrator class
-  bool useCuba_;
+  /// return statistics of integration algorithm for last call to integrate method:
+  /// integrand evaluations, accepted and rejected Markov Chain moves, CPU and real time per phase of the integration,
+  /// number of tries to find a start-position, integral and its uncertainty (total and per Markov Chain)
+  const classic_svFit::IntegratorStatistics& getIntegratorStatistics() const { return integratorStatistics_; }
 
-  /// initialize Markov Chain integrator class
+ protected:
+  /// initialize integrator class
   virtual void initializeMCIntegrator();
 
+  /// delete integrator class, so that it gets re-initialized with current settings
+  void resetMCIntegrator();
+
+  /// called after the configuration of the integrand (verbosity, log(M) term, transfer functions) has been changed,
+  /// so that derived classes can update further copies of the integrand they keep
+  virtual void integrandConfigurationChanged() {}
+
+  /// take over integrand and integration settings from other instance
+  /// (used to set up the per-thread instances processing a batch of events)
+  void copyConfiguration(const ClassicSVfitBase& other);
+
+  /// compute seed of random number generators from the inputs of the current event (used by seeding policy kEventSeed);
+  /// the measured tau leptons are taken from measuredTauLeptons_, which are expected to be rounded already
+  unsigned long compEventSeed(double measuredMETx, double measuredMETy, const TMatrixD& covMET) const;
+
   /// print MET and its covariance matrix
   void printMET(double measuredMETx, double measuredMETy, const TMatrixD& covMET) const;
 
@@ -98,13 +236,40 @@ class ClassicSVfitBase
 
   classic_svFit::ClassicSVfitIntegrandBase* integrand_;
 
+  /// copies of integrand used by Markov Chains run in parallel threads
+  /// (index = chain - 1, chain 0 uses integrand_)
+  std::vector<classic_svFit::ClassicSVfitIntegrandBase*> chainIntegrands_;
+
   std::vector<classic_svFit::MeasuredTauLepton> measuredTauLeptons_;
   classic_svFit::Vector met_;
+  /// MET covariance matrix rounded by addMETEstimate (member, to avoid allocating a temporary for each event)
+  TMatrixD covMET_rounded_;
 
-  /// interface to Markov Chain integration algorithm
-  classic_svFit::SVfitIntegratorMarkovChain* intAlgo_;
+  /// interface to integration algorithm
+  classic_svFit::SVfitIntegratorBase* intAlgo_;
+  std::string integratorType_;
   unsigned maxObjFunctionCalls_;
+  unsigned numChains_;
+  unsigned numThreads_;
+  std::string randomGeneratorType_;
+  SeedingPolicy seedingPolicy_;
+  unsigned long seedSalt_;
+  bool useStartPositionSeeding_;
+  bool useAdaptiveStepSize_;
+  double targetAcceptanceRate_;
+  double minFractionAdaptation_;
+  AnnealingSchedule annealingSchedule_;
+  unsigned numTries_;
+  unsigned numLeapfrogSteps_;
+  double leapfrogStepSize_;
+  bool useLogDomain_;
+  bool useEarlyStopping_;
+  double earlyStoppingPrecision_;
+  unsigned minObjFunctionCalls_;
+  long numObjFunctionCalls_;
+  classic_svFit::IntegratorStatistics integratorStatistics_;
   std::string treeFileName_;
+  unsigned treeThinning_;
   std::string likelihoodFileName_;
 
   /// variables indices and ranges for each leg
@@ -11,12 +11,17 @@
 
 namespace classic_svFit
 {
+  class Dual;
+
   class ClassicSVfitIntegrand : public ClassicSVfitIntegrandBase
   {
    public:
     ClassicSVfitIntegrand(int);
+    ClassicSVfitIntegrand(const ClassicSVfitIntegrand&);
     ~ClassicSVfitIntegrand();
 
+    ClassicSVfitIntegrand* clone() const;
+
     void setDiTauMassConstraint(double diTauMass);
 
     /// set pointer to histograms used to keep track of pT, eta, phi, mass and transverse mass of di-tau system
@@ -26,17 +31,111 @@ namespace classic_svFit
     /// set momenta of visible tau decay products
     void setLeptonInputs(const std::vector<classic_svFit::MeasuredTauLepton>&);
 
+    /// select the implementation of EvalPS that is specialised for the decay types of both legs and the di-tau mass constraint,
+    /// and compute the constants it needs. Needs to be called once per event,
+    /// after the lepton inputs, the integration parameters and the di-tau mass constraint have been set
+    void selectEvalPSKernel();
+
     /// evaluate Phase Space part of the integrand for given value of integration variables x
     double EvalPS(const double* x) const;
 
+    /// evaluate logarithm of Phase Space part of the integrand for given value of integration variables x,
+    /// returns -infinity in case the integrand is zero
+    double EvalLogPS(const double* x) const;
+
     /// evaluate the iComponent of the full integrand for given value of integration variables q.
     /// q is given in standarised range [0,1] for each dimension.
     double Eval(const double* q, unsigned int iComponent=0) const;
 
-    /// static pointer to this (needed for interfacing the likelihood function calls to Markov Chain integration)
-    static const ClassicSVfitIntegrand* gSVfitIntegrand;
+    /// evaluate logarithm of the iComponent of the full integrand for given value of integration variables q,
+    /// computed as sum of the logarithms of the phase-space factor, the tau decay factors, the log(M) term and the MET transfer function.
+    /// In contrast to Eval, small values of the integrand are not set to zero.
+    /// The histogram adapter is updated in case the integrand is non-zero
+    double EvalLog(const double* q, unsigned int iComponent=0) const;
+
+    /// evaluate the full integrand (iComponent = 0) for numPoints values of integration variables q at once.
+    /// q is given in "structure-of-arrays" layout, q[iDimension*numPoints + iPoint], in standarised range [0,1] for each dimension.
+    /// The momenta of the tau leptons (see FittedTauLepton::updateTauMomenta), the tau decay matrix elements
+    /// and the MET transfer function are computed in loops over the points without branches, which the compiler can vectorise
+    /// in case math functions are not required to set errno (-fno-math-errno, as in the Makefile).
+    /// The log(M) term and the exponential of the MET transfer function are computed point by point.
+    /// The results agree with calling Eval for each point up to rounding errors.
+    /// The histogram adapter is updated as if Eval had been called for each point in turn,
+    /// while the momenta of the fitted tau leptons are not updated
+    void EvalBatch(const double* q, unsigned numPoints, double* prob) const;
+
+    /// maximum number of points processed per block by EvalBatch
+    static const unsigned maxNumPointsPerBlock = 16;
+
+    /// evaluate logarithm of the full integrand (iComponent = 0) for given value of integration variables q, like EvalLog,
+    /// but without updating the histogram adapter, and compute the weights of the MET variations (see getMETVariationWeights)
+    /// in case more than one MET estimate has been added. Used to reweight the samples of the Markov Chain for systematic variations
+    double EvalLogForReweighting(const double* q) const;
+
+    /// momenta of the tau leptons reconstructed in the last evaluation of the integrand
+    const LorentzVector& getFittedTau1P4() const { return fittedTauLepton1_.tauP4(); }
+    const LorentzVector& getFittedTau2P4() const { return fittedTauLepton2_.tauP4(); }
+
+    /// evaluate the full integrand (iComponent = 0) for given value of integration variables q
+    /// and compute the gradient of its logarithm with respect to q by forward-mode automatic differentiation
+    /// (used by Hamiltonian Monte Carlo moves). The gradient is set to zero in case the integrand is zero
+    double EvalWithGradient(const double* q, double* gradLogProb) const;
+
+    /// evaluate logarithm of the full integrand (iComponent = 0) for integration variables x (not rescaled to the interval [0..1])
+    /// (same computation as EvalPS and EvalMET_TF, with derivatives propagated by dual numbers).
+    /// The checks for the physical region are omitted, so the result is meaningful only for points at which Eval is non-zero
+    Dual EvalLogProb(const Dual* x) const;
 
    protected:
+
+    /// generic implementation of EvalPS (isLog = false) and EvalLogPS (isLog = true),
+    /// used in case no specialised implementation is available
+    template <bool isLog>
+    double EvalPS_generic(const double* x) const;
+
+    /// implementation of EvalPS (isLog = false) and EvalLogPS (isLog = true)
+    /// for given decay types of both legs (see LegType) and with or without di-tau mass constraint
+    template <int leg1Type, int leg2Type, bool hasMassConstraint, bool isLog>
+    double EvalPS_kernel(const double* x) const;
+
+    /// combine tau decay matrix elements, transfer functions, log(M) term and Jacobi factor into the Phase Space part of the integrand
+    /// (isLog = false) or into its logarithm (isLog = true)
+    template <bool isLog>
+    double compProbPS(double prob_tauDecay, double prob_TF, double mTauTau, double jacobiFactor) const;
+
+    /// reconstruct momentum of tau lepton on given leg, returns false in case the tau decay parameters are unphysical
+    template <int legType>
+    bool updateTauMomentum_kernel(FittedTauLepton& fittedTauLepton, unsigned iLeg, double x) const;
+
+    /// compute tau decay matrix element for given leg
+    template <int legType>
+    double compPSfactor_kernel(const FittedTauLepton& fittedTauLepton, unsigned iLeg) const;
+
+    typedef double (ClassicSVfitIntegrand::*EvalPSKernel)(const double*) const;
+    template <int leg1Type, bool isLog>
+    static EvalPSKernel getEvalPSKernel(int leg2Type, bool hasMassConstraint);
+
+    enum LegType { kLeptonicLeg, kHadronicLeg, kPromptLeg };
+
+    /// implementations of EvalPS and EvalLogPS selected for current event
+    EvalPSKernel evalPSKernel_;
+    EvalPSKernel evalLogPSKernel_;
+
+    /// constants used by specialised implementations of EvalPS, computed once per event
+    struct LegConstants
+    {
+      double visMass_;
+      double visMass2_;
+      double minX_;   // minimum visible energy fraction visMass2/tauLeptonMass2
+      double psNorm_; // 1/(tauLeptonMass2 - visMass2), for hadronic tau decays
+      double visEn_;
+      double visP_;
+      int idx_X_;
+      int idx_phi_;
+      int idx_mNuNu_;
+    };
+    LegConstants legConstants_[2];
+
     /// momenta of visible tau decay products and of reconstructed tau leptons
     MeasuredTauLepton measuredTauLepton1_;    
     mutable FittedTauLepton fittedTauLepton1_;
@@ -8,6 +8,7 @@
 #endif
 #include "TauAnalysis/ClassicSVfit/interface/svFitHistogramAdapter.h"
 #include "TauAnalysis/ClassicSVfit/interface/svFitAuxFunctions.h"
+#include "TauAnalysis/ClassicSVfit/interface/svFitFormula.h"
 
 #include <Math/Functor.h>
 #include <TMatrixD.h>
@@ -28,8 +29,13 @@ namespace classic_svFit
     };
 
     ClassicSVfitIntegrandBase(int);
+    ClassicSVfitIntegrandBase(const ClassicSVfitIntegrandBase&);
     virtual ~ClassicSVfitIntegrandBase();
 
+    /// create independent copy of this integrand,
+    /// used to evaluate the integrand in parallel threads
+    virtual ClassicSVfitIntegrandBase* clone() const = 0;
+
     /// add an additional log(mTauTau) term to the nll to suppress high mass tail in mTauTau distribution (default is false)
     void addLogM_fixed(bool value, double power = 1.);
     void addLogM_dynamic(bool value, const std::string& power= "");
@@ -65,43 +71,81 @@ namespace classic_svFit
     /// evaluate Phase Space part of the integrand for given value of integration variables x
     virtual double EvalPS(const double* x) const = 0;
 
-    /// evaluate the MET TF part of the integral.
-    double EvalMET_TF(double aMETx, double aMETy, const TMatrixD&) const;
-
     /// evaluate the MET TF part of the integral using current values of the MET variables
     /// iComponent is ans index to MET estimate, i.e. systamtic effect variation
     double EvalMET_TF(unsigned int iComponent=0) const;
 
+    /// evaluate logarithm of the MET TF part of the integral using current values of the MET variables;
+    /// returns -infinity in case the MET covariance matrix cannot be inverted
+    double EvalMET_TF_log(unsigned int iComponent=0) const;
+
     /// evaluate the iComponent of the full integrand for given value of integration variables q.
     /// q is given in standarised range [0,1] for each dimension.
     virtual double Eval(const double* q, unsigned int iComponent=0) const = 0;
 
+    /// evaluate the logarithm of the iComponent of the full integrand for given value of integration variables q,
+    /// adding the logarithms of the individual factors instead of multiplying them,
+    /// so that small values of the integrand do not underflow to zero.
+    /// Returns -infinity in case the integrand is zero
+    virtual double EvalLog(const double* q, unsigned int iComponent=0) const = 0;
+
     ///Transform the values fo integration variables from [0,1] to
     ///desires [xMin,xMax] range;
     void rescaleX(const double* q) const;
 
     int getMETComponentsSize() const;
 
+    /// get ratios of the MET TF of MET estimates 1..N-1 to the MET TF of the nominal MET estimate (iComponent = 0),
+    /// computed for the point given to the last call of ClassicSVfitIntegrand::EvalLogForReweighting (index = iComponent - 1)
+    const std::vector<double>& getMETVariationWeights() const { return metVariationWeights_; }
+
    protected:
+    ClassicSVfitIntegrandBase& operator=(const ClassicSVfitIntegrandBase&) = delete;
+
+    /// MET estimate, together with the inverse of its covariance matrix and the normalization of the MET TF,
+    /// computed once when the MET estimate is added.
+    /// CV: the adjugate and the determinant are stored, rather than the inverse covariance matrix, and compMET_pull2 deliberately
+    ///     keeps dividing by covDet_ for each evaluation, as the original implementation did. Folding 1/covDet_ into the matrix
+    ///     elements would reduce the MET TF to a few multiply-adds and one exp, but would change the results by rounding;
+    ///     the division is kept so that the results stay bit-identical
+    struct METEstimate
+    {
+      double measuredMETx_;
+      double measuredMETy_;
+      /// adjugate of the covariance matrix, i.e. inverse covariance matrix multiplied by its determinant
+      double adjCovMETxx_;
+      double adjCovMETxy_;
+      double adjCovMETyx_;
+      double adjCovMETyy_;
+      double covDet_;
+      /// normalization of the MET TF and its logarithm
+      double const_MET_;
+      double logConst_MET_;
+      bool isInvertible_;
+    };
+
+    /// compute inverse covariance matrix and normalization of the MET TF for given MET estimate
+    static void initMETEstimate(METEstimate& metEstimate, double aMETx, double aMETy, const TMatrixD& covMET);
+
+    /// compute pull2 of the MET TF for given MET estimate, used by EvalMET_TF and EvalMET_TF_log;
+    /// the covariance matrix of the MET estimate must be invertible
+    double compMET_pull2(const METEstimate& metEstimate) const;
+
+    /// compute ratios of MET TF of all MET estimates to the MET TF of the nominal MET estimate,
+    /// for the current momenta of the reconstructed tau leptons
+    void compMETVariationWeights() const;
+
     /// number of tau leptons reconstructed per event
     unsigned numTaus_;
 
     /// momenta of reconstructed tau leptons
     std::vector<FittedTauLepton*> fittedTauLeptons_;
 
-    /// measured MET
-    std::vector<double> measuredMETx_;
-    std::vector<double> measuredMETy_;
-
-    ///MET covariance matrix
-    std::vector<TMatrixD> covMET_;
+    /// measured MET and its covariance matrix (index = iComponent)
+    std::vector<METEstimate> metEstimates_;
 
-    ///Inverse covariance matix elements
-    double invCovMETxx_;
-    double invCovMETxy_;
-    double invCovMETyx_;
-    double invCovMETyy_;
-    double const_MET_;
+    /// ratios of MET TF of MET estimates 1..N-1 to MET TF of nominal MET estimate
+    mutable std::vector<double> metVariationWeights_;
 
 #ifdef USE_SVFITTF
     /// account for resolution on pT of hadronic tau decays via appropriate transfer functions
@@ -122,12 +166,23 @@ namespace classic_svFit
     bool addLogM_fixed_;
     double addLogM_fixed_power_;
     bool addLogM_dynamic_;
+    std::string addLogM_dynamic_expression_;
+    /// expression for power of dynamic log(mTauTau) term, compiled once when the expression is set
+    /// (TFormula is only used in case the expression is not supported by CompiledFormula)
+    CompiledFormula addLogM_dynamic_compiledFormula_;
     TFormula* addLogM_dynamic_formula_;
 
+    /// evaluate power of dynamic log(mTauTau) term
+    double evalLogM_dynamic_power(double mTauTau) const
+    {
+      return ( addLogM_dynamic_formula_ ) ? addLogM_dynamic_formula_->Eval(mTauTau) : addLogM_dynamic_compiledFormula_.eval(mTauTau);
+    }
+
     /// error code that can be passed on
     mutable int errorCode_;
 
     mutable double phaseSpaceComponentCache_;
+    mutable double logPhaseSpaceComponentCache_;
 
     /// verbosity level
     int verbosity_;
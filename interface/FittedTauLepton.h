@@ -24,12 +24,40 @@ namespace classic_svFit
     /// scale momenta of visible tau decays products
     void updateVisMomentum(double visPtShift);
 
-    /// reconstruct tau lepton momentum, given momentum of visible tau decays products and the three parameters x, nuPhi, nuMass
+    /// reconstruct tau lepton momentum, given momentum of visible tau decays products and the three parameters x, nuPhi, nuMass;
+    /// for electrons and muons directly originating from LFV Higgs boson decay, the momenta set by updateVisMomentum are kept
     void updateTauMomentum(double x, double phiNu, double nuMass);
 
+    /// momenta of neutrinos and tau lepton for a batch of points, in "structure-of-arrays" layout (index = point);
+    /// the arrays are provided by the caller and need to hold at least numPoints entries
+    struct MomentaBatch
+    {
+      double* nuEn_;
+      double* nuP_;
+      double* nuPx_;
+      double* nuPy_;
+      double* nuPz_;
+      double* tauEn_;
+      double* tauPx_;
+      double* tauPy_;
+      double* tauPz_;
+      bool* isValid_;
+    };
+
+    /// reconstruct neutrino and tau lepton momenta for numPoints values of the parameters x, phiNu, nuMass at once,
+    /// given the momentum of visible tau decay products set by updateVisMomentum (same for all points).
+    /// Follows updateTauMomentum, but computes sin(thetaNu) as sqrt(1 - cos(thetaNu)^2) instead of sin(acos(cos(thetaNu)))
+    /// and does not construct LorentzVector objects, so that the loops over points can be vectorised.
+    /// isValid is set to false, and the momenta are set to zero, for points with unphysical tau decay parameters.
+    /// The parameters, momenta and error code held by this object are not changed
+    void updateTauMomenta(unsigned numPoints, const double* x, const double* phiNu, const double* nuMass, MomentaBatch& momenta) const;
+
     /// momentum of visible tau decay products (in labframe)  
     const LorentzVector& visP4() const;
 
+    /// magnitude of momentum of visible tau decay products (in labframe)
+    double visP() const;
+
     /// sum of momenta of all neutrinos produced in tau decay (in labframe)
     const LorentzVector& nuP4() const;
 
@@ -43,6 +71,9 @@ namespace classic_svFit
 
     int errorCode() const;
 
+    /// local coordinate system in which momentum of visible tau decay products defines z-axis
+    void getLocalCoordinateSystem(Vector& eX, Vector& eY, Vector& eZ) const;
+
    private:
     /// instance counter (only used for debug output)
     int iTau_;
@@ -64,6 +95,7 @@ namespace classic_svFit
 
     /// momentum of visible tau decay products (in labframe)  
     mutable LorentzVector visP4_;
+    double visP_;
 
     /// sum of momenta of all neutrinos produced in tau decay (in labframe)
     mutable LorentzVector nuP4_;
@@ -0,0 +1,167 @@
+#ifndef TauAnalysis_ClassicSVfit_SVfitIntegratorBase_h
+#define TauAnalysis_ClassicSVfit_SVfitIntegratorBase_h
+
+/** \class SVfitIntegratorBase
+ *
+ * Abstract base-class for algorithms computing the integral of a function
+ * in N-dimensional space and the distributions of observables computed from the integration variables.
+ *
+ * Implementations:
+ *  - SVfitIntegratorMarkovChain:     Markov Chain integration (Metropolis algorithm)
+ *  - SVfitIntegratorVEGAS:           adaptive importance sampling (VEGAS algorithm)
+ *  - SVfitIntegratorQuasiMonteCarlo: randomized quasi-Monte Carlo integration (scrambled Sobol sequences)
+ *
+ */
+
+#include "TauAnalysis/ClassicSVfit/interface/svFitRandomGenerator.h"
+
+#include <Math/Functor.h>
+
+#include <iostream>
+#include <vector>
+
+namespace classic_svFit
+{
+  /// interface for "call-back" functions that are evaluated with a weight,
+  /// used to fill histograms of observables by integration algorithms based on importance sampling
+  class WeightedCallBackFunction
+  {
+   public:
+    virtual ~WeightedCallBackFunction() {}
+
+    /// evaluate "call-back" function at point x of the integration region, with weight given by ratio of integrand value to sampling density
+    virtual void evalWeighted(const double* x, double weight) const = 0;
+  };
+
+  /// statistics of the last call to the integrate method of an integration algorithm,
+  /// e.g. to monitor the computing time spent per event in production
+  struct IntegratorStatistics
+  {
+    /// phases of the integration:
+    ///  kStartPosition: search for start-position of Markov Chains
+    ///  kAdaptation:    "burnin" stage of Markov Chain integration, training iterations of VEGAS
+    ///  kSampling:      evaluations entering the computation of the integral
+    enum { kStartPosition, kAdaptation, kSampling, kNumPhases };
+
+    /// result of single Markov Chain
+    struct Chain
+    {
+      bool isValid_;
+      double integral_;
+      double integralErr_;
+      double probMax_;
+      long numCalls_;
+      long numMoves_accepted_;
+      long numMoves_rejected_;
+    };
+
+    IntegratorStatistics()
+    {
+      reset();
+    }
+    void reset()
+    {
+      for ( unsigned idxPhase = 0; idxPhase < kNumPhases; ++idxPhase ) {
+        numCalls_[idxPhase] = 0;
+        numMoves_accepted_[idxPhase] = 0;
+        numMoves_rejected_[idxPhase] = 0;
+        cpuTime_[idxPhase] = 0.;
+        realTime_[idxPhase] = 0.;
+      }
+      numStartPositionTries_ = 0;
+      integral_ = 0.;
+      integralErr_ = 0.;
+      probMax_ = -1.;
+      chains_.clear();
+    }
+
+    /// number of integrand evaluations and of accepted and rejected Markov Chain moves per phase
+    long numCalls_[kNumPhases];
+    long numMoves_accepted_[kNumPhases];
+    long numMoves_rejected_[kNumPhases];
+
+    /// CPU time and elapsed real time per phase, in seconds;
+    /// both are summed over Markov Chains, so the real time exceeds the wall-clock time in case chains run in parallel threads
+    double cpuTime_[kNumPhases];
+    double realTime_[kNumPhases];
+
+    /// number of random points tried before a start-position with non-zero integrand value was found (summed over Markov Chains)
+    long numStartPositionTries_;
+
+    double integral_;
+    double integralErr_;
+    double probMax_;
+
+    /// results of individual Markov Chains (index = chain)
+    std::vector<Chain> chains_;
+  };
+
+  class SVfitIntegratorBase
+  {
+   public:
+    SVfitIntegratorBase()
+      : useFixedSeed_(true)
+      , seed_(0)
+    {}
+    virtual ~SVfitIntegratorBase() {}
+
+    /// set seed from which the random number generator(s) get initialized at the start of each integration.
+    /// The seeds of the random number streams (e.g. one per Markov Chain) are derived from this seed by hashing,
+    /// so that the streams used for different seeds do not overlap.
+    /// By default (or after calling resetSeed), a fixed seed is used, with stream iStream using the seed 12345 + iStream
+    void setSeed(unsigned long seed)
+    {
+      useFixedSeed_ = false;
+      seed_ = seed;
+    }
+    void resetSeed()
+    {
+      useFixedSeed_ = true;
+      seed_ = 0;
+    }
+
+    /// register "call-back" functions,
+    /// evaluated for each point sampled by the integration algorithm
+    /// (algorithms that sample points with weights evaluate the weighted "call-back" functions)
+    virtual void registerCallBackFunction(const ROOT::Math::Functor&) = 0;
+    virtual void registerWeightedCallBackFunction(const WeightedCallBackFunction&) = 0;
+
+    /// compute integral of function g
+    /// the points xl and xh represent the lower left and upper right corner of a Hypercube in d-dimensional integration space.
+    /// The function g is evaluated in coordinates rescaled to the interval [0..1] in each dimension, q = (x - xl)/(xh - xl),
+    /// and the integral is computed with respect to q; the "call-back" functions are evaluated at the corresponding points x
+    /// the pointer param is passed on to every call of g, so that g can access the context (e.g. the integrand object)
+    /// of the calling instance without resorting to global variables
+    typedef double (*gPtr_C)(const double*, size_t, void*);
+    virtual void integrate(gPtr_C g, const double* xl, const double* xu, unsigned d, double& integral, double& integralErr, void* param = nullptr) = 0;
+
+    /// return maximum of integrand within integration domain, found in last call to integrate method
+    virtual double getProbMax() const = 0;
+
+    /// return number of integrand evaluations in last call to integrate method
+    virtual long getNumCalls() const = 0;
+
+    /// return statistics of last call to integrate method
+    const IntegratorStatistics& getStatistics() const { return statistics_; }
+
+    virtual void print(std::ostream&) const = 0;
+
+   protected:
+    /// return seed of random number stream iStream
+    unsigned long getSeed(unsigned iStream) const
+    {
+      if ( useFixedSeed_ ) return 12345 + iStream;
+      unsigned long seed = hashSeed(seed_, static_cast<uint64_t>(iStream));
+      // CV: TRandom3 uses the lower 32 bits of the seed only and chooses a random seed in case they are zero
+      if ( (seed & 0xffffffffUL) == 0 ) seed |= 1;
+      return seed;
+    }
+
+    bool useFixedSeed_;
+    unsigned long seed_;
+
+    IntegratorStatistics statistics_;
+  };
+}
+
+#endif
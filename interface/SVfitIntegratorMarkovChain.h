@@ -16,18 +16,24 @@
  *
  */
 
+#include "TauAnalysis/ClassicSVfit/interface/SVfitIntegratorBase.h"
+#include "TauAnalysis/ClassicSVfit/interface/svFitRandomGenerator.h"
+#include "TauAnalysis/ClassicSVfit/interface/svFitThreadPool.h"
+#include "TauAnalysis/ClassicSVfit/interface/svFitChainTrace.h"
+
 #include <Math/Functor.h>
-#include <TRandom3.h>
-#include <TFile.h>
-#include <TTree.h>
+#include <TMath.h>
 
 #include <vector>
 #include <string>
 #include <iostream>
+#include <functional>
+#include <utility>
+#include <limits>
 
 namespace classic_svFit
 {
-  class SVfitIntegratorMarkovChain
+  class SVfitIntegratorMarkovChain : public SVfitIntegratorBase
   {
    public:
     SVfitIntegratorMarkovChain(const std::string&, unsigned, unsigned, unsigned, unsigned, double, double, unsigned, unsigned, double, double, const std::string&, int = 0);
@@ -37,6 +43,24 @@ namespace classic_svFit
     /// in order to start path of chain transitions from non-random point
     void initializeStartPosition_and_Momentum(const double*);
 
+    /// enable/disable automatic shortening of the "simulated annealing" at the beginning of the "burnin" stage (disabled by default).
+    /// In automatic mode, each chain first makes numIterEnergyWindow Metropolis moves at temperature 1 from its start-position ("pilot"),
+    /// which are taken from the beginning of the "burnin" stage.
+    /// Annealing is skipped in case the integrand value at the start-position is at least minProbRatio times
+    /// the highest integrand value found by the pilot and, in case start-position candidates are used (see setStartPositionCandidates),
+    /// by the evaluation of the candidates. Without candidates, the decision is thus based on the pilot only.
+    /// Otherwise, phase 2 of the annealing is stopped as soon as the mean "potential energy" E = -log(integrand) of the chain
+    /// changes by less than energyTolerance between subsequent windows of numIterEnergyWindow moves
+    void setAutoAnnealing(bool value, double minProbRatio = 1.e-2, double energyTolerance = 0.5, unsigned numIterEnergyWindow = 100);
+
+    /// set candidates for initial position of Markov Chain (in coordinates of the integration region, not rescaled to ]0..1[),
+    /// e.g. computed from the visible kinematics of the event.
+    /// All candidates are evaluated before the chain is started;
+    /// chain iChain starts from the candidate with the (iChain % N)-th highest integrand value, N being the number of candidates with non-zero integrand value.
+    /// The random search for a valid start-position is used only in case the integrand is zero for all candidates.
+    /// Pass an empty vector to disable.
+    void setStartPositionCandidates(const std::vector<std::vector<double> >& candidates);
+
     /// register "call-back" functions:
     /// A user may register any number of "call-back" functions,
     /// which are evaluated in every iteration of the Markov Chain.
@@ -49,29 +73,381 @@ namespace classic_svFit
     /// N-dimensional space in which the integration is performed.
     void registerCallBackFunction(const ROOT::Math::Functor&);
 
+    /// register "call-back" functions evaluated with weight 1 in every iteration of the Markov Chain
+    void registerWeightedCallBackFunction(const WeightedCallBackFunction&);
+
+    /// set number of threads used to run the Markov Chains in parallel (default is 1)
+    void setNumThreads(unsigned numThreads);
+
+    /// set type of random number generator ("TRandom3" or "Philox"; default is "TRandom3").
+    /// Each Markov Chain uses its own generator, seeded by a chain-dependent value
+    void setRandomGenerator(const std::string& type);
+
+    /// enable/disable adaptation of step-sizes during "burnin" stage (disabled by default).
+    /// When enabled, the step-sizes are tuned separately for each dimension in the iterations
+    /// between the end of "simulated annealing" and the end of the "burnin" stage:
+    /// the step-size in each dimension is taken proportional to the spread of the Markov Chain positions in this dimension,
+    /// and the overall scale is tuned such that the fraction of accepted moves approaches targetAcceptanceRate.
+    /// The adaptation window comprises at least the last minFractionAdaptation of the "burnin" iterations,
+    /// and at least minNumAdaptiveMoves iterations (or all "burnin" iterations, if fewer):
+    /// "simulated annealing" is ended earlier in case it would otherwise leave fewer iterations for the adaptation.
+    /// The step-sizes are kept fixed during the "sampling" stage.
+    void setAdaptiveStepSize(bool value, double targetAcceptanceRate = 0.3, double minFractionAdaptation = 0.2);
+
+    /// enable/disable stopping rule for "sampling" stage (disabled by default).
+    /// When enabled, convergence is checked at the end of each batch, once at least minIterSampling moves have been made;
+    /// sampling stops once the relative uncertainty on the integral, estimated from the batch means (eq. (6.40) in [1]),
+    /// as well as the relative change of all observables returned by the convergence monitor
+    /// between the middle and the end of the "sampling" stage done so far are below the given precision. The maximum number of moves is given by numIterSampling.
+    void setEarlyStopping(bool value, double precision = 1.e-2, unsigned minIterSampling = 0);
+
+    /// set number of proposals drawn per move (default is 1).
+    /// For numTries > 1, moves are made according to the multiple-try Metropolis algorithm described in
+    ///  [3] "The Multiple-Try Method and Local Optimization in Metropolis Sampling",
+    ///      J. Liu, F. Liang, W. Wong, J. Amer. Statist. Assoc. 95 (2000) 121:
+    /// numTries proposals are drawn and evaluated in one batch, one of them is selected with probability proportional to its integrand value,
+    /// and the move to the selected point is accepted based on a reference set of numTries - 1 points drawn around the selected point.
+    /// Each move thus takes 2*numTries - 1 integrand evaluations, plus one evaluation at the current position in the "sampling" stage,
+    /// to set the kinematics used by the "call-back" functions
+    void setMultipleTry(unsigned numTries);
+
+    /// enable Hamiltonian Monte Carlo moves for numLeapfrogSteps > 0 (disabled by default).
+    /// Each move then follows a trajectory of numLeapfrogSteps steps of the "leapfrog" discretization of Hamilton's equations described in [2],
+    /// using the gradient of the logarithm of the integrand, and is accepted or rejected depending on the change of the total energy along the trajectory.
+    /// The step-size in each dimension is given by stepSize, scaled by the ratio of the step-size of Metropolis moves in this dimension to epsilon0
+    /// (so that step-sizes tuned during the "burnin" stage are taken into account), and is varied randomly by +/- 20% between trajectories.
+    /// Each move takes numLeapfrogSteps evaluations of the integrand and its gradient, plus one evaluation at the current position
+    /// after rejected moves in the "sampling" stage, to set the kinematics used by the "call-back" functions.
+    /// The "simulated annealing" phases of the "burnin" stage use the usual Metropolis moves,
+    /// as the gradient is large far away from the maxima of the integrand and leapfrog trajectories starting there are rarely accepted.
+    /// Hamiltonian Monte Carlo moves take precedence over multiple-try Metropolis moves
+    void setHamiltonianMonteCarlo(unsigned numLeapfrogSteps, double stepSize = 2.e-2);
+
+    /// enable/disable evaluation of Metropolis moves in log domain (disabled by default):
+    /// the logarithm of the integrand is computed directly by the integrand (see LogDomain),
+    /// and the move is accepted based on the difference between the logarithms at the proposed and at the current position.
+    /// This avoids the computation of the logarithm of the ratio of integrand values in every move,
+    /// as well as the rejection of start-positions and proposals for which the integrand underflows to zero.
+    /// The log domain is not supported for multiple-try Metropolis and Hamiltonian Monte Carlo moves:
+    /// in case either of them is enabled, the setting is ignored (with a warning) and all moves are evaluated as usual
+    void setLogDomain(bool value);
+
+    /// tag used to request the logarithm of the integrand (see integrate method)
+    struct LogDomain {};
+
+    /// set function returning observables (e.g. quantiles of the di-tau mass distribution)
+    /// used to monitor the convergence of Markov Chain iChain;
+    /// the function is called from the thread running the chain
+    typedef std::function<void(unsigned iChain, std::vector<double>& observables)> ConvergenceMonitor;
+    void setConvergenceMonitor(const ConvergenceMonitor& monitor);
+
+    /// set integrand context and "call-back" functions used by Markov Chain iChain.
+    /// Markov Chains can only be run in parallel if each chain has its own integrand and "call-back" functions;
+    /// chains for which no context has been set use the param passed to integrate
+    /// and the "call-back" functions registered via registerCallBackFunction
+    void setChainContext(unsigned iChain, void* param, const std::vector<const ROOT::Math::Functor*>& callBackFunctions);
+
+    /// set thinning of the samples stored in the chain-trace file in case a tree file name is given
+    /// (default is 1, i.e. every move of the "sampling" stage is stored)
+    void setTraceThinning(unsigned thinning);
+
+    /// set names and function computing quantities stored in the chain-trace file for each sample of Markov Chain iChain,
+    /// in addition to the position ("x0".."xN-1"), the index of the move ("move") and the integrand value ("integrand").
+    /// The function is called after the observer, from the thread running the chain
+    typedef std::function<void(unsigned iChain, float* values)> TraceColumnFunction;
+    void setTraceColumns(const std::vector<std::string>& columnNames, const TraceColumnFunction& function);
+
     /// compute integral of function g
     /// the points xl and xh represent the lower left and upper right corner of a Hypercube in d-dimensional integration space
-    typedef double (*gPtr_C)(const double*, size_t, void*);
-    void integrate(gPtr_C g, const double* xl, const double* xu, unsigned d, double& integral, double& integralErr);
+    /// the pointer param is passed on to every call of g, so that g can access the context (e.g. the integrand object)
+    /// of the calling instance without resorting to global variables
+    void integrate(gPtr_C g, const double* xl, const double* xu, unsigned d, double& integral, double& integralErr, void* param = nullptr);
+
+    /// compute integral of function integrand, evaluating observer in every iteration of the Markov Chains.
+    /// The integrand and observer are called as
+    ///   double integrand(unsigned iChain, const double* q)
+    ///   void observer(unsigned iChain, const double* x)
+    /// where q is the position of the Markov Chain rescaled to the interval ]0..1[
+    /// and x the position in coordinates of the integration region.
+    /// As the types are known at compile time, the calls can be inlined into the loop over Markov Chain moves,
+    /// avoiding the function pointer and the virtual calls of the "call-back" functions.
+    /// In case more than one proposal is drawn per move (see setMultipleTry), the integrand is evaluated for batches of points, calling
+    ///   void integrand(unsigned iChain, const double* q, unsigned numPoints, double* prob)
+    /// where q holds the positions of all points in "structure-of-arrays" layout (q[iDimension*numPoints + iPoint]).
+    /// In case Hamiltonian Monte Carlo moves are enabled (see setHamiltonianMonteCarlo), the integrand is evaluated together with its gradient, calling
+    ///   double integrand(unsigned iChain, const double* q, double* gradLogProb)
+    /// which returns the integrand value and sets gradLogProb to the gradient of the logarithm of the integrand with respect to q.
+    /// (the integrate method taking a function pointer computes the gradient by finite differences, at the cost of 2*d additional evaluations).
+    /// In case Metropolis moves are evaluated in log domain (see setLogDomain), the logarithm of the integrand is computed by calling
+    ///   double integrand(unsigned iChain, const double* q, SVfitIntegratorMarkovChain::LogDomain)
+    /// which returns -infinity in case the integrand is zero.
+    /// The "call-back" functions and integrand contexts set via registerCallBackFunction and setChainContext are not used.
+    /// In case more than one thread is used, integrand and observer must be safe to call concurrently for different chains
+    template <typename Integrand, typename Observer>
+    void integrate(Integrand& integrand, Observer& observer, const double* xl, const double* xu, unsigned d, double& integral, double& integralErr);
 
     double getProbMax() const { return probMax_; }
 
+    /// return number of integrand evaluations in last call to integrate method
+    long getNumCalls() const { return numCalls_; }
+
     void print(std::ostream&) const;
 
   protected:
-    void setIntegrand(gPtr_C, const double*, const double*, unsigned);
+    typedef std::vector<double> vdouble;
+
+    enum { kUniform, kGaus, kNone };
+
+    /// state of one Markov Chain;
+    /// each chain has its own random number generator and temporary variables,
+    /// so that different chains can be run in parallel threads
+    struct MarkovChain
+    {
+      /// random number generator
+      RandomGenerator* rnd_;
+
+      /// integrand context and "call-back" functions
+      void* integrandParam_;
+      const std::vector<const ROOT::Math::Functor*>* callBackFunctions_;
+      const std::vector<const WeightedCallBackFunction*>* weightedCallBackFunctions_;
+
+      /// internal variables storing current state of Markov Chain
+      vdouble p_;
+      vdouble q_;
+      vdouble gradE_;
+      bool isGradEValid_;
+      double prob_;
+      double logProb_; // only used for Metropolis moves in log domain
+
+      /// temporary variables used for computations
+      vdouble x_;
+      vdouble u_;
+      vdouble gaus_;
+      vdouble epsilon_;
+      vdouble pProposal_;
+      vdouble qProposal_;
+      vdouble gradEProposal_;
+
+      /// temporary variables used for multiple-try Metropolis moves
+      vdouble pPrevious_;
+      vdouble pTries_;    // index = try*2*numDimensions + dimension
+      vdouble qTries_;    // index = dimension*numTries + try
+      vdouble probTries_; // index = try
+      vdouble qSelected_;
+      vdouble qPoint_;
+
+      /// random step-size factors exp(nu*C) of Metropolis moves, C being distributed according to a Cauchy distribution,
+      /// generated in blocks of numStepSizeFactorsPerBlock values, and index of next value to be used
+      vdouble stepSizeFactors_;
+      unsigned idxStepSizeFactor_;
+
+      /// quantities stored in chain-trace file (index = column)
+      std::vector<float> traceValues_;
+
+      /// step-sizes of Metropolis moves (index = dimension),
+      /// tuned during "burnin" stage in case adaptive step-sizes are enabled
+      vdouble epsilon0s_;
+
+      /// running mean and sum of squared deviations of positions (index = dimension)
+      /// and logarithm of overall step-size scale used for step-size adaptation
+      vdouble qMean_;
+      vdouble qM2_;
+      unsigned numAdaptiveMoves_;
+      double logStepScale_;
+
+      long numMoves_accepted_;
+      long numMoves_rejected_;
+      long numMovesBurnin_accepted_;
+      long numMovesBurnin_rejected_;
+
+      /// number of random points tried to find start-position
+      long numStartPositionTries_;
+
+      /// number of integrand evaluations, CPU and real time per phase of the integration (index = IntegratorStatistics::kStartPosition, ...),
+      /// and values at beginning of current phase
+      long numCallsPhase_[IntegratorStatistics::kNumPhases];
+      double cpuTimePhase_[IntegratorStatistics::kNumPhases];
+      double realTimePhase_[IntegratorStatistics::kNumPhases];
+      long phaseBeginNumCalls_;
+      double phaseBeginCpuTime_;
+      double phaseBeginRealTime_;
+
+      /// number of integrand evaluations and of batches used for computation of integral
+      long numCalls_;
+      unsigned numBatchesRun_;
+
+      /// observables returned by convergence monitor at the end of each batch (index = batch)
+      std::vector<vdouble> observables_;
+
+      double probMax_;
+
+      /// integrand values of start-position candidates with non-zero integrand value (index = candidate);
+      /// logarithms of the integrand values in case moves are evaluated in log domain
+      std::vector<std::pair<double, unsigned> > candidateProbs_;
+
+      /// logarithm of highest integrand value of start-position candidates
+      double logProbMaxCandidates_;
+
+      /// number of "simulated annealing" iterations of this chain (may be reduced in automatic mode)
+      /// and mean "potential energy" in current and previous window of moves
+      unsigned numIterSimAnnealingPhase1_;
+      unsigned numIterSimAnnealingPhase1plus2_;
+      double energySum_;
+      unsigned numEnergyEntries_;
+      unsigned numEnergyWindows_;
+      double energyMeanPrevious_;
+
+      bool isValid_;
+    };
+
+    void setIntegrand(gPtr_C, const double*, const double*, unsigned, void*);
+
+    void beginIntegration();
+    void endIntegration(double&, double&);
+
+    /// fill statistics of last call to integrate method
+    void fillStatistics(double, double);
+
+    template <typename Integrand, typename Observer>
+    void runChains(Integrand&, Observer&, bool);
+
+    template <typename Integrand, typename Observer>
+    void runChain(Integrand&, Observer&, unsigned);
+
+    void beginChain(MarkovChain&);
+
+    /// record integrand evaluations and computing time of phase idxPhase of the integration and begin next phase
+    void beginPhase(MarkovChain&);
+    void endPhase(MarkovChain&, unsigned);
+
+    /// set number of "simulated annealing" iterations of chain, once start-position has been found;
+    /// in case adaptive step-sizes are enabled, the number is reduced such that the adaptation window is kept
+    void beginAnnealing(MarkovChain&);
+
+    /// make the "pilot" moves of the automatic "simulated annealing" schedule and decide whether annealing is skipped,
+    /// returns the number of "burnin" iterations used by the pilot
+    template <typename Integrand>
+    unsigned runAnnealingPilot(Integrand&, MarkovChain&, unsigned);
+
+    /// skip "simulated annealing" in case the logarithm of the integrand at the start-position is close to the highest value found by the pilot
+    void selectAnnealing(MarkovChain&, double, double);
+
+    /// logarithm of integrand at current position of chain
+    double getLogProb(const MarkovChain&) const;
+
+    /// check if Metropolis moves are evaluated in log domain
+    /// (requested by setLogDomain and neither multiple-try Metropolis nor Hamiltonian Monte Carlo moves enabled)
+    bool isLogDomain() const { return useLogDomain_ && numTries_ == 1 && numLeapfrogSteps_ == 0; }
+
+    /// print warning in case the log domain is requested together with moves that do not support it
+    void checkLogDomain() const;
+
+    /// end phase 2 of "simulated annealing" once "potential energy" of chain has stabilized (automatic mode)
+    void updateAnnealing(MarkovChain&, unsigned);
+
+    bool isValidStartPosition(const MarkovChain&) const;
+
+    /// check if integrand is non-zero at current position of chain
+    bool hasNonZeroProb(const MarkovChain&) const;
+
+    /// evaluate integrand (or its logarithm, in case moves are evaluated in log domain) at start-position of chain
+    template <typename Integrand>
+    void evalStartPosition(Integrand&, MarkovChain&, unsigned);
+
+    /// update statistics of accepted moves, batch sums and chain-trace after each move of the "sampling" stage;
+    /// returns true in case the stopping rule ends the "sampling" stage
+    bool endSamplingMove(MarkovChain&, unsigned, unsigned, bool);
+
+    void initializeStartPosition_and_Momentum(MarkovChain&);
+
+    template <typename Integrand>
+    bool initializeStartPosition_fromCandidates(Integrand&, MarkovChain&, unsigned);
+
+    void convertStartPositionCandidate(unsigned, vdouble&) const;
+
+    bool selectStartPosition_fromCandidates(MarkovChain&, unsigned, std::vector<std::pair<double, unsigned> >&) const;
+
+    template <typename Integrand>
+    void makeStochasticMove(Integrand&, MarkovChain&, unsigned, unsigned, bool&, bool&);
+
+    /// update momentum and step-size and compute proposed new position qProposal starting from position q (eqs. 24 and 27 in [2])
+    void proposeMove(MarkovChain&, unsigned, const vdouble&);
+
+    /// return next random step-size factor, generating a new block of factors in case all factors of the current block have been used
+    double getStepSizeFactor(MarkovChain&);
+
+    /// generate block of random step-size factors
+    void fillStepSizeFactors(MarkovChain&);
+
+    static const unsigned numStepSizeFactorsPerBlock = 64;
+
+    /// accept or reject move to proposed new position (eq. 13 in [2])
+    bool acceptMove(MarkovChain&, double);
+
+    /// accept or reject move to proposed new position, given the logarithm of the integrand at the proposed position
+    bool acceptMove_log(MarkovChain&, double);
 
-    void initializeStartPosition_and_Momentum();
+    template <typename Integrand>
+    void makeMultipleTryMove(Integrand&, MarkovChain&, unsigned, unsigned, bool&);
 
-    void makeStochasticMove(unsigned, bool&, bool&);
+    /// draw numPoints proposals starting from position q and store them in qTries;
+    /// the momentum corresponding to each proposal is stored in pTries, if storeMomenta is set
+    void proposeMultipleTries(MarkovChain&, unsigned, const vdouble&, unsigned, bool);
 
-    void sampleSphericallyRandom();
+    /// select one of the proposals with probability proportional to its integrand value,
+    /// returns -1 in case the integrand is zero for all proposals
+    int selectTry(MarkovChain&, double&);
 
-    void updateX(const std::vector<double>&);
+    /// accept or reject move to selected proposal, given the sum of integrand values of proposals and reference points ([3])
+    bool acceptMultipleTry(MarkovChain&, unsigned, double, double, double);
 
-    double evalProb(const std::vector<double>&);
+    template <typename Integrand>
+    void makeHamiltonianMove(Integrand&, MarkovChain&, unsigned, bool&);
+
+    /// draw momentum and step-sizes of trajectory starting at current position, returns total energy at start of trajectory
+    double beginTrajectory(MarkovChain&);
+
+    /// first part of leapfrog step: half step of momentum and full step of position
+    void moveLeapfrog_position(MarkovChain&);
+
+    /// second part of leapfrog step: half step of momentum, using gradient at new position
+    void moveLeapfrog_momentum(MarkovChain&);
+
+    /// accept or reject move to end-point of trajectory, given total energy at start of trajectory
+    bool acceptTrajectory(MarkovChain&, double, double);
+
+    double compKineticEnergy(const MarkovChain&) const;
+
+    void adaptStepSize(MarkovChain&, bool);
+
+    /// minimum number of moves in adaptation window, also used as number of moves
+    /// after which the spread of the Markov Chain positions is used to set the step-size in each dimension
+    static const unsigned minNumAdaptiveMoves = 100;
+
+    void printStepSizes(const MarkovChain&, unsigned) const;
+
+    bool isConverged(MarkovChain&, unsigned, unsigned);
+
+    void sampleSphericallyRandom(MarkovChain&);
+
+    void updateX(MarkovChain&, const vdouble&);
+
+    template <typename Integrand>
+    double evalProb(Integrand&, MarkovChain&, unsigned, const vdouble&);
+
+    template <typename Integrand>
+    void evalProbBatch(Integrand&, MarkovChain&, unsigned, const vdouble&, unsigned, vdouble&);
+
+    /// evaluate logarithm of integrand
+    template <typename Integrand>
+    double evalLogProb(Integrand&, MarkovChain&, unsigned, const vdouble&);
+
+    /// evaluate integrand and gradient of "potential energy" E = -log(integrand)
+    template <typename Integrand>
+    double evalProbAndGradE(Integrand&, MarkovChain&, unsigned, const vdouble&, vdouble&);
 
     gPtr_C integrand_;
+    void* integrandParam_;
 
     /// parameters defining integration region
     ///  numDimensions: dimensionality of integration region (Hypercube)
@@ -79,7 +455,6 @@ namespace classic_svFit
     ///  xMax:          upper boundaries of integration region
     ///  initMode:      flag indicating how initial position of Markov Chain is chosen (uniform/Gaus distribution)
     unsigned numDimensions_;
-    double* x_;
     std::vector<double> xMin_; // index = dimension
     std::vector<double> xMax_; // index = dimension
     int initMode_;
@@ -97,6 +472,9 @@ namespace classic_svFit
     // (i.e. an initial point of non-zero probability)
     unsigned maxCallsStartingPos_;
 
+    /// candidates for initial position of Markov Chain
+    std::vector<vdouble> startPositionCandidates_;
+
     /// parameters defining "simulated annealing" stage at beginning of integration
     ///  simAnnealingAlpha: number of "stochastic moves" performed at high temperature during "burnin" stage
     ///  T0:                initial annealing temperature
@@ -109,6 +487,12 @@ namespace classic_svFit
     double alpha_;
     double alpha2_;
 
+    /// parameters of automatic "simulated annealing" schedule
+    bool isAutoAnnealing_;
+    double annealingMinProbRatio_;
+    double annealingEnergyTolerance_;
+    unsigned numIterEnergyWindow_;
+
     /// number of Markov Chains run in parallel
     unsigned numChains_;
 
@@ -120,31 +504,53 @@ namespace classic_svFit
     /// parameters defining step-sizes of Metropolis moves:
     ///  epsilon0: average step-size
     ///  nu:       variation of step-size for individual moves
-    typedef std::vector<double> vdouble;
     double epsilon0_;
     vdouble epsilon0s_;
-    vdouble epsilon_;
     double nu_;
 
-    /// random number generator
-    TRandom3 rnd_;
+    /// number of proposals drawn per move (multiple-try Metropolis)
+    unsigned numTries_;
+
+    /// number of leapfrog steps per trajectory and step-size (Hamiltonian Monte Carlo)
+    unsigned numLeapfrogSteps_;
+    double leapfrogStepSize_;
+
+    /// flag to enable/disable evaluation of Metropolis moves in log domain
+    bool useLogDomain_;
+
+    /// parameters defining adaptation of step-sizes during "burnin" stage
+    bool useAdaptiveStepSize_;
+    double targetAcceptanceRate_;
+    double minFractionAdaptation_;
 
-    /// internal variables storing current state of Markov Chain
-    vdouble p_;
-    vdouble q_;
-    vdouble gradE_;
-    double prob_;
+    /// parameters defining stopping rule for "sampling" stage
+    bool useEarlyStopping_;
+    double earlyStoppingPrecision_;
+    unsigned minIterSampling_;
+    ConvergenceMonitor convergenceMonitor_;
 
-    /// temporary variables used for computations
-    vdouble u_;
-    vdouble pProposal_;
-    vdouble qProposal_;
+    /// state of Markov Chains (index = chain)
+    std::vector<MarkovChain> chains_;
+
+    /// random number generators used by Markov Chains (index = chain)
+    std::string randomGeneratorType_;
+    std::vector<RandomGenerator*> randomGenerators_;
+
+    /// integrand context and "call-back" functions set for individual Markov Chains (index = chain)
+    std::vector<bool> hasChainContext_;
+    std::vector<void*> chainIntegrandParams_;
+    std::vector<std::vector<const ROOT::Math::Functor*> > chainCallBackFunctions_;
+
+    /// thread pool used to run Markov Chains in parallel
+    unsigned numThreads_;
+    ThreadPool* threadPool_;
 
     vdouble probSum_; // index = chain*numBatches + batch
     vdouble integral_;
 
     long numMoves_accepted_;
     long numMoves_rejected_;
+    long numCalls_;
 
     unsigned numChainsRun_;
 
@@ -157,15 +563,285 @@ namespace classic_svFit
     int errorFlag_;
 
     std::vector<const ROOT::Math::Functor*> callBackFunctions_;
+    std::vector<const WeightedCallBackFunction*> weightedCallBackFunctions_;
+    std::vector<const WeightedCallBackFunction*> noWeightedCallBackFunctions_;
 
+    /// storage of samples of the "sampling" stage (enabled in case treeFileName is given)
     std::string treeFileName_;
-    TFile* treeFile_;
-    TTree* tree_;
-    int treeMove_;
-    float treeIntegrand_;
+    unsigned traceThinning_;
+    ChainTraceWriter* traceWriter_;
+    std::vector<std::string> traceColumnNames_;
+    TraceColumnFunction traceColumnFunction_;
 
     int verbosity_; // flag to enable/disable debug output
   };
+
+  //-------------------------------------------------------------------------------
+  // implementation of template member functions
+
+  template <typename Integrand, typename Observer>
+  void SVfitIntegratorMarkovChain::integrate(Integrand& integrand, Observer& observer, const double* xl, const double* xu, unsigned d, double& integral, double& integralErr)
+  {
+    setIntegrand(0, xl, xu, d, 0);
+    beginIntegration();
+    runChains(integrand, observer, true);
+    endIntegration(integral, integralErr);
+  }
+
+  template <typename Integrand, typename Observer>
+  void SVfitIntegratorMarkovChain::runChains(Integrand& integrand, Observer& observer, bool runParallel)
+  {
+    if ( threadPool_ && numChains_ > 1 && runParallel ) {
+      auto task = [this, &integrand, &observer](unsigned iChain) { runChain(integrand, observer, iChain); };
+      // CV: pass task by reference, as std::function would otherwise allocate memory to store a copy of the lambda
+      threadPool_->parallel_for(numChains_, std::cref(task));
+    } else {
+      for ( unsigned iChain = 0; iChain < numChains_; ++iChain ) {
+        runChain(integrand, observer, iChain);
+      }
+    }
+  }
+
+  template <typename Integrand, typename Observer>
+  void SVfitIntegratorMarkovChain::runChain(Integrand& integrand, Observer& observer, unsigned iChain)
+  {
+    MarkovChain& chain = chains_[iChain];
+    beginChain(chain);
+
+    bool isValidStartPos = false;
+    if ( initMode_ == kNone ) {
+      evalStartPosition(integrand, chain, iChain);
+      isValidStartPos = isValidStartPosition(chain);
+    }
+    if ( !isValidStartPos && !startPositionCandidates_.empty() ) {
+      isValidStartPos = initializeStartPosition_fromCandidates(integrand, chain, iChain);
+    }
+    unsigned iTry = 0;
+    while ( !isValidStartPos && iTry < maxCallsStartingPos_ ) {
+      initializeStartPosition_and_Momentum(chain);
+      evalStartPosition(integrand, chain, iChain);
+      if ( hasNonZeroProb(chain) ) {
+        isValidStartPos = true;
+      } else {
+        if ( iTry > 0 && (iTry % 100000) == 0 ) {
+          if ( iTry == 100000 ) std::cout << "<SVfitIntegratorMarkovChain::integrate>:" << std::endl;
+          std::cout << "try #" << iTry << ": did not find valid start-position yet." << std::endl;
+        }
+      }
+      ++iTry;
+    }
+    chain.numStartPositionTries_ = iTry;
+    endPhase(chain, IntegratorStatistics::kStartPosition);
+    if ( !isValidStartPos ) return;
+
+    beginAnnealing(chain);
+    unsigned iMoveFirst = 0;
+    if ( isAutoAnnealing_ ) iMoveFirst = runAnnealingPilot(integrand, chain, iChain);
+
+    for ( unsigned iMove = iMoveFirst; iMove < numIterBurnin_; ++iMove ) {
+      //--- propose Markov Chain transition to new, randomly chosen, point
+      bool isAccepted = false;
+      bool isValid = true;
+      if ( numLeapfrogSteps_ > 0 && iMove >= chain.numIterSimAnnealingPhase1plus2_ ) {
+        makeHamiltonianMove(integrand, chain, iChain, isAccepted);
+      } else if ( numTries_ > 1 ) {
+        makeMultipleTryMove(integrand, chain, iChain, iMove, isAccepted);
+      } else {
+        do {
+          makeStochasticMove(integrand, chain, iChain, iMove, isAccepted, isValid);
+        } while ( !isValid );
+      }
+      if ( isAccepted ) ++chain.numMovesBurnin_accepted_;
+      else ++chain.numMovesBurnin_rejected_;
+      if ( isAutoAnnealing_ && iMove < chain.numIterSimAnnealingPhase1plus2_ ) updateAnnealing(chain, iMove);
+      if ( useAdaptiveStepSize_ && iMove >= chain.numIterSimAnnealingPhase1plus2_ ) adaptStepSize(chain, isAccepted);
+    }
+    if ( useAdaptiveStepSize_ && verbosity_ >= 1 ) printStepSizes(chain, iChain);
+    endPhase(chain, IntegratorStatistics::kAdaptation);
+
+    for ( unsigned iMove = 0; iMove < numIterSampling_; ++iMove ) {
+      //--- propose Markov Chain transition to new, randomly chosen, point;
+      //    evaluate observer at this point
+      bool isAccepted = false;
+      bool isValid = true;
+      if ( numLeapfrogSteps_ > 0 ) {
+        makeHamiltonianMove(integrand, chain, iChain, isAccepted);
+        //--- CV: evaluate integrand at current position in case the move is rejected,
+        //        as "call-back" functions use the kinematics computed in the last integrand evaluation
+        if ( !isAccepted ) evalProb(integrand, chain, iChain, chain.q_);
+      } else if ( numTries_ > 1 ) {
+        makeMultipleTryMove(integrand, chain, iChain, numIterBurnin_ + iMove, isAccepted);
+        //--- CV: evaluate integrand at current position,
+        //        as "call-back" functions use the kinematics computed in the last integrand evaluation
+        evalProb(integrand, chain, iChain, chain.q_);
+      } else {
+        do {
+          makeStochasticMove(integrand, chain, iChain, numIterBurnin_ + iMove, isAccepted, isValid);
+        } while ( !isValid );
+      }
+
+      updateX(chain, chain.q_);
+      observer(iChain, chain.x_.data());
+
+      if ( endSamplingMove(chain, iChain, iMove, isAccepted) ) break;
+    }
+    endPhase(chain, IntegratorStatistics::kSampling);
+
+    chain.isValid_ = true;
+  }
+
+  template <typename Integrand>
+  unsigned SVfitIntegratorMarkovChain::runAnnealingPilot(Integrand& integrand, MarkovChain& chain, unsigned iChain)
+  {
+    //--- explore neighbourhood of start-position by Metropolis moves at temperature 1,
+    //    keeping track of the highest integrand value found
+    unsigned numIterPilot = std::min(numIterEnergyWindow_, numIterBurnin_);
+    double logProbStart = getLogProb(chain);
+    double logProbMax = logProbStart;
+    for ( unsigned iMove = 0; iMove < numIterPilot; ++iMove ) {
+      bool isAccepted = false;
+      bool isValid = true;
+      do {
+        // CV: move index beyond "simulated annealing" phases selects moves at temperature 1
+        makeStochasticMove(integrand, chain, iChain, numIterBurnin_, isAccepted, isValid);
+      } while ( !isValid );
+      if ( isAccepted ) {
+        ++chain.numMovesBurnin_accepted_;
+        double logProb = getLogProb(chain);
+        if ( logProb > logProbMax ) logProbMax = logProb;
+      } else {
+        ++chain.numMovesBurnin_rejected_;
+      }
+    }
+    selectAnnealing(chain, logProbStart, logProbMax);
+    return numIterPilot;
+  }
+
+  template <typename Integrand>
+  bool SVfitIntegratorMarkovChain::initializeStartPosition_fromCandidates(Integrand& integrand, MarkovChain& chain, unsigned iChain)
+  {
+    //--- evaluate integrand for all candidates
+    std::vector<std::pair<double, unsigned> >& candidateProbs = chain.candidateProbs_;
+    candidateProbs.clear();
+    for ( unsigned iCandidate = 0; iCandidate < startPositionCandidates_.size(); ++iCandidate ) {
+      convertStartPositionCandidate(iCandidate, chain.qProposal_);
+      if ( isLogDomain() ) {
+        double logProb = evalLogProb(integrand, chain, iChain, chain.qProposal_);
+        if ( logProb > -std::numeric_limits<double>::infinity() ) candidateProbs.push_back(std::pair<double, unsigned>(logProb, iCandidate));
+      } else {
+        double prob = evalProb(integrand, chain, iChain, chain.qProposal_);
+        if ( prob > 0. ) candidateProbs.push_back(std::pair<double, unsigned>(prob, iCandidate));
+      }
+    }
+    return selectStartPosition_fromCandidates(chain, iChain, candidateProbs);
+  }
+
+  template <typename Integrand>
+  void SVfitIntegratorMarkovChain::evalStartPosition(Integrand& integrand, MarkovChain& chain, unsigned iChain)
+  {
+    if ( isLogDomain() ) {
+      chain.logProb_ = evalLogProb(integrand, chain, iChain, chain.q_);
+      // CV: integrand value is needed for computation of the integral
+      chain.prob_ = TMath::Exp(chain.logProb_);
+    } else {
+      chain.prob_ = evalProb(integrand, chain, iChain, chain.q_);
+    }
+  }
+
+  template <typename Integrand>
+  void SVfitIntegratorMarkovChain::makeStochasticMove(Integrand& integrand, MarkovChain& chain, unsigned iChain, unsigned idxMove, bool& isAccepted, bool& isValid)
+  {
+    proposeMove(chain, idxMove, chain.q_);
+    if ( isLogDomain() ) {
+      double logProbProposal = evalLogProb(integrand, chain, iChain, chain.qProposal_);
+      isAccepted = acceptMove_log(chain, logProbProposal);
+    } else {
+      double probProposal = evalProb(integrand, chain, iChain, chain.qProposal_);
+      isAccepted = acceptMove(chain, probProposal);
+    }
+  }
+
+  template <typename Integrand>
+  void SVfitIntegratorMarkovChain::makeMultipleTryMove(Integrand& integrand, MarkovChain& chain, unsigned iChain, unsigned idxMove, bool& isAccepted)
+  {
+    //--- draw numTries proposals around current position and evaluate them in one batch
+    chain.pPrevious_ = chain.p_;
+    proposeMultipleTries(chain, idxMove, chain.q_, numTries_, true);
+    evalProbBatch(integrand, chain, iChain, chain.qTries_, numTries_, chain.probTries_);
+    double sumProbTries = 0.;
+    int idxSelected = selectTry(chain, sumProbTries);
+    if ( idxSelected < 0 ) {
+      chain.p_ = chain.pPrevious_;
+      isAccepted = false;
+      return;
+    }
+    double probSelected = chain.probTries_[idxSelected];
+
+    //--- draw reference set of numTries - 1 points around selected proposal;
+    //    the current position completes the reference set
+    proposeMultipleTries(chain, idxMove, chain.qSelected_, numTries_ - 1, false);
+    evalProbBatch(integrand, chain, iChain, chain.qTries_, numTries_ - 1, chain.probTries_);
+    double sumProbReferences = chain.prob_;
+    for ( unsigned iTry = 0; iTry < (numTries_ - 1); ++iTry ) {
+      sumProbReferences += chain.probTries_[iTry];
+    }
+    isAccepted = acceptMultipleTry(chain, idxSelected, probSelected, sumProbTries, sumProbReferences);
+  }
+
+  template <typename Integrand>
+  void SVfitIntegratorMarkovChain::makeHamiltonianMove(Integrand& integrand, MarkovChain& chain, unsigned iChain, bool& isAccepted)
+  {
+    //--- compute gradient at current position, unless known from previous trajectory
+    if ( !chain.isGradEValid_ ) {
+      evalProbAndGradE(integrand, chain, iChain, chain.q_, chain.gradE_);
+      chain.isGradEValid_ = true;
+    }
+
+    //--- follow trajectory, using the gradient computed in each leapfrog step for the next one
+    double totalEnergy = beginTrajectory(chain);
+    double probProposal = chain.prob_;
+    for ( unsigned iStep = 0; iStep < numLeapfrogSteps_; ++iStep ) {
+      moveLeapfrog_position(chain);
+      probProposal = evalProbAndGradE(integrand, chain, iChain, chain.qProposal_, chain.gradEProposal_);
+      if ( !(probProposal > 0.) ) break; // CV: trajectory has left region of non-zero integrand, move is rejected
+      moveLeapfrog_momentum(chain);
+    }
+    isAccepted = acceptTrajectory(chain, totalEnergy, probProposal);
+  }
+
+  template <typename Integrand>
+  double SVfitIntegratorMarkovChain::evalProb(Integrand& integrand, MarkovChain& chain, unsigned iChain, const vdouble& q)
+  {
+    ++chain.numCalls_;
+    double prob = integrand(iChain, q.data());
+    return prob;
+  }
+
+  template <typename Integrand>
+  void SVfitIntegratorMarkovChain::evalProbBatch(Integrand& integrand, MarkovChain& chain, unsigned iChain, const vdouble& q, unsigned numPoints, vdouble& prob)
+  {
+    chain.numCalls_ += numPoints;
+    integrand(iChain, q.data(), numPoints, prob.data());
+  }
+
+  template <typename Integrand>
+  double SVfitIntegratorMarkovChain::evalLogProb(Integrand& integrand, MarkovChain& chain, unsigned iChain, const vdouble& q)
+  {
+    ++chain.numCalls_;
+    double logProb = integrand(iChain, q.data(), LogDomain());
+    return logProb;
+  }
+
+  template <typename Integrand>
+  double SVfitIntegratorMarkovChain::evalProbAndGradE(Integrand& integrand, MarkovChain& chain, unsigned iChain, const vdouble& q, vdouble& gradE)
+  {
+    ++chain.numCalls_;
+    double prob = integrand(iChain, q.data(), gradE.data());
+    for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+      gradE[iDimension] = -gradE[iDimension];
+    }
+    return prob;
+  }
 }
 
 #endif
@@ -0,0 +1,106 @@
+#ifndef TauAnalysis_ClassicSVfit_SVfitIntegratorQuasiMonteCarlo_h
+#define TauAnalysis_ClassicSVfit_SVfitIntegratorQuasiMonteCarlo_h
+
+/** \class SVfitIntegratorQuasiMonteCarlo
+ *
+ * Randomized quasi-Monte Carlo integration in N-dimensional space,
+ * based on scrambled Sobol sequences.
+ *
+ * The Sobol points are generated in Gray-code order, using the direction numbers given in:
+ *  [1] "Constructing Sobol sequences with better two-dimensional projections",
+ *      S. Joe and F. Y. Kuo, SIAM J. Sci. Comput. 30 (2008) 2635
+ * and randomized by a random linear matrix scrambling followed by a random digital shift, as described in:
+ *  [2] "On the L2-discrepancy for anchored boxes",
+ *      J. Matousek, J. Complexity 14 (1998) 527
+ *
+ * The integral is computed for numScramblings independent randomizations of the Sobol sequence;
+ * the mean of these estimates is returned as integral and their spread is used to compute the uncertainty.
+ * As the points are distributed uniformly, the "call-back" functions are evaluated with weight proportional to the integrand value.
+ * The balance properties of the Sobol sequence hold for the first 2^m points only,
+ * so the number of points per scrambling should be a power of 2 (a warning is printed otherwise).
+ *
+ */
+
+#include "TauAnalysis/ClassicSVfit/interface/SVfitIntegratorBase.h"
+#include "TauAnalysis/ClassicSVfit/interface/svFitRandomGenerator.h"
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <stdint.h>
+
+namespace classic_svFit
+{
+  class SVfitIntegratorQuasiMonteCarlo : public SVfitIntegratorBase
+  {
+   public:
+    SVfitIntegratorQuasiMonteCarlo(unsigned numPointsPerScrambling, unsigned numScramblings, int verbosity = 0);
+    ~SVfitIntegratorQuasiMonteCarlo();
+
+    /// register "call-back" functions;
+    /// the points are evaluated with weights, so only weighted "call-back" functions are evaluated
+    void registerCallBackFunction(const ROOT::Math::Functor&);
+    void registerWeightedCallBackFunction(const WeightedCallBackFunction&);
+
+    /// set type of random number generator used for scrambling ("TRandom3" or "Philox"; default is "TRandom3")
+    void setRandomGenerator(const std::string& type);
+
+    /// compute integral of function g
+    void integrate(gPtr_C g, const double* xl, const double* xu, unsigned d, double& integral, double& integralErr, void* param = nullptr);
+
+    double getProbMax() const { return probMax_; }
+
+    long getNumCalls() const { return numCalls_; }
+
+    void print(std::ostream&) const;
+
+    /// maximum number of dimensions for which direction numbers are available
+    static const unsigned maxNumDimensions = 10;
+
+   protected:
+    typedef std::vector<double> vdouble;
+
+    /// compute direction numbers of the Sobol sequence (index = dimension*32 + bit)
+    void initializeDirectionNumbers();
+
+    /// randomize direction numbers and starting point of the Sobol sequence
+    void scramble();
+
+    /// draw random 32-bit integer
+    uint32_t randomBits();
+
+    gPtr_C integrand_;
+    void* integrandParam_;
+
+    unsigned numDimensions_;
+    vdouble xMin_; // index = dimension
+    vdouble xMax_; // index = dimension
+
+    unsigned numPointsPerScrambling_;
+    unsigned numScramblings_;
+
+    /// direction numbers of unscrambled and scrambled Sobol sequence, with first binary digit stored in the highest bit
+    std::vector<uint32_t> directionNumbers_;
+    std::vector<uint32_t> directionNumbersScrambled_;
+    /// current point of the Sobol sequence (index = dimension)
+    std::vector<uint32_t> point_;
+
+    /// temporary variables used for computations
+    vdouble q_;
+    vdouble x_;
+
+    std::string randomGeneratorType_;
+    RandomGenerator* rnd_;
+
+    std::vector<const WeightedCallBackFunction*> callBackFunctions_;
+
+    vdouble integral_; // index = scrambling
+
+    double probMax_;
+    long numCalls_;
+
+    int verbosity_; // flag to enable/disable debug output
+  };
+}
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef TauAnalysis_ClassicSVfit_SVfitIntegratorVEGAS_h
+#define TauAnalysis_ClassicSVfit_SVfitIntegratorVEGAS_h
+
+/** \class SVfitIntegratorVEGAS
+ *
+ * Adaptive importance sampling integration in N-dimensional space.
+ *
+ * The code is implemented following the description in:
+ *  [1] "A New Algorithm for Adaptive Multidimensional Integration",
+ *      G. P. Lepage, J. Comput. Phys. 27 (1978) 192
+ *
+ * The sampling density is a product of one-dimensional piecewise constant densities,
+ * defined by a grid of bins of varying width in each dimension.
+ * After each iteration, the bin boundaries are moved such that
+ * each bin contributes equally to the (smoothed and damped) sum of squared integrand values.
+ *
+ * The integration proceeds in two stages:
+ *  - "training":  the grid is adapted to the integrand; the integral estimates are discarded
+ *  - "sampling":  the grid continues to be adapted; the integral estimates of the iterations are combined,
+ *                 weighted by their inverse variance, and the "call-back" functions are evaluated
+ *                 for each sampled point, with weight equal to the ratio of integrand value to sampling density
+ *
+ */
+
+#include "TauAnalysis/ClassicSVfit/interface/SVfitIntegratorBase.h"
+#include "TauAnalysis/ClassicSVfit/interface/svFitRandomGenerator.h"
+
+#include <vector>
+#include <string>
+#include <iostream>
+
+namespace classic_svFit
+{
+  class SVfitIntegratorVEGAS : public SVfitIntegratorBase
+  {
+   public:
+    SVfitIntegratorVEGAS(unsigned numCallsPerIteration, unsigned numIterTraining, unsigned numIterSampling,
+                         unsigned numBins = 50, double alpha = 1.5, int verbosity = 0);
+    ~SVfitIntegratorVEGAS();
+
+    /// register "call-back" functions;
+    /// as points are sampled with non-uniform density, only weighted "call-back" functions are evaluated
+    void registerCallBackFunction(const ROOT::Math::Functor&);
+    void registerWeightedCallBackFunction(const WeightedCallBackFunction&);
+
+    /// set type of random number generator ("TRandom3" or "Philox"; default is "TRandom3")
+    void setRandomGenerator(const std::string& type);
+
+    /// compute integral of function g
+    void integrate(gPtr_C g, const double* xl, const double* xu, unsigned d, double& integral, double& integralErr, void* param = nullptr);
+
+    double getProbMax() const { return probMax_; }
+
+    long getNumCalls() const { return numCalls_; }
+
+    void print(std::ostream&) const;
+
+   protected:
+    typedef std::vector<double> vdouble;
+
+    /// sample numCallsPerIteration points according to current grid,
+    /// returns estimate of integral and of its variance
+    void runIteration(bool isSampling, double& integral, double& integralVar);
+
+    /// move bin boundaries according to accumulated squared integrand values (section 3 of [1])
+    void refineGrid();
+
+    gPtr_C integrand_;
+    void* integrandParam_;
+
+    unsigned numDimensions_;
+    vdouble xMin_; // index = dimension
+    vdouble xMax_; // index = dimension
+
+    /// parameters defining number of integrand evaluations
+    unsigned numCallsPerIteration_;
+    unsigned numIterTraining_;
+    unsigned numIterSampling_;
+
+    /// parameters defining the grid:
+    ///  numBins: number of bins per dimension
+    ///  alpha:   damping parameter for grid refinement (eq. (11) in [1])
+    unsigned numBins_;
+    double alpha_;
+
+    /// bin boundaries in coordinates rescaled to the interval [0..1] (index = dimension*(numBins + 1) + bin)
+    vdouble gridEdges_;
+    vdouble gridEdgesNew_;
+    /// sum of squared weights per bin, accumulated during the current iteration (index = dimension*numBins + bin)
+    vdouble gridSumW2_;
+    vdouble gridSmoothed_;
+    vdouble gridRefine_;
+
+    /// temporary variables used for computations
+    vdouble u_;
+    vdouble q_;
+    vdouble x_;
+    std::vector<unsigned> bins_;
+
+    std::string randomGeneratorType_;
+    RandomGenerator* rnd_;
+
+    std::vector<const WeightedCallBackFunction*> callBackFunctions_;
+
+    vdouble integral_; // index = sampling iteration
+    vdouble integralErr_;
+
+    double probMax_;
+    long numCalls_;
+
+    int verbosity_; // flag to enable/disable debug output
+  };
+}
+
+#endif
@@ -108,6 +108,10 @@ namespace classic_svFit
 
   double roundToNdigits(double, int = 3);
 
+  /// return CPU time used by calling thread and elapsed real time, in seconds (measured from an arbitrary reference point)
+  double getThreadCpuTime();
+  double getRealTime();
+
   struct GraphPoint
   {
     double x_;
@@ -127,6 +131,10 @@ namespace classic_svFit
   double compCosThetaNuNu(double, double, double, double, double, double);
   double compPSfactor_tauToLepDecay(double, double, double, double, double, double, double);
   double compPSfactor_tauToHadDecay(double, double, double, double, double, double);
+  /// versions with per-event constants computed beforehand: the squared mass of the visible tau decay products (visMass2),
+  /// the minimum visible energy fraction visMass2/tauLeptonMass2 (xMin) and, for hadronic tau decays, the normalization 1/(tauLeptonMass2 - visMass2) (psNorm)
+  double compPSfactor_tauToLepDecay(double x, double visEn, double visP, double visMass, double visMass2, double xMin, double nunuEn, double nunuP, double nunuMass);
+  double compPSfactor_tauToHadDecay(double x, double visEn, double visP, double visMass2, double xMin, double psNorm, double nuEn, double nuP);
 
   struct integrationParameters
   {
@@ -0,0 +1,140 @@
+#ifndef TauAnalysis_ClassicSVfit_svFitChainTrace_h
+#define TauAnalysis_ClassicSVfit_svFitChainTrace_h
+
+/** \class ChainTraceWriter, ChainTraceReader
+ *
+ * Storage of the points visited by the Markov Chains in the "sampling" stage of the integration,
+ * e.g. for debugging or to re-histogram the samples with a different binning without re-running the integration.
+ *
+ * The samples are stored in two files:
+ *  - the data file (fileName) contains blocks of up to blockSize samples of one Markov Chain,
+ *    stored column by column as 32-bit floating point numbers in native byte order
+ *  - the index file (fileName + ".idx") contains one line of text per event:
+ *      event <event> columns <numColumns> <name_1> ... <name_numColumns> blocks <numBlocks> <offset_1> <chain_1> <numSamples_1> ...
+ *    where offset is the position of the block in the data file (in bytes)
+ * Both files are opened in append mode, so that the samples of subsequent events (or jobs) are added to the existing files.
+ *
+ * Only every thinning-th sample is stored.
+ * Completed blocks are written to disk by a background thread, so the Markov Chains are not slowed down by file I/O.
+ *
+ */
+
+#include <TH1.h>
+
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace classic_svFit
+{
+  class ChainTraceWriter
+  {
+   public:
+    ChainTraceWriter(const std::string& fileName, unsigned thinning = 1, unsigned blockSize = 4096);
+    ~ChainTraceWriter();
+
+    /// start new event; columnNames specifies the quantities stored for each sample
+    void beginEvent(const std::vector<std::string>& columnNames, unsigned numChains);
+
+    /// return true in case sample iSample is stored, according to thinning
+    bool isSelected(unsigned iSample) const { return (iSample % thinning_) == 0; }
+
+    /// store sample of Markov Chain iChain (values given in order of columnNames).
+    /// Different chains may be filled concurrently from different threads
+    void fill(unsigned iChain, const float* values);
+
+    /// write remaining samples and append entry for the event to index file
+    void endEvent();
+
+    unsigned getNumColumns() const { return columnNames_.size(); }
+
+   private:
+    struct Block
+    {
+      unsigned iChain_;
+      unsigned numSamples_;
+      std::vector<float> values_; // index = column*blockSize + sample
+    };
+
+    /// pass block to background thread and return empty block
+    Block* submitBlock(Block*);
+
+    void runWriter();
+
+    std::string fileName_;
+    unsigned thinning_;
+    unsigned blockSize_;
+
+    std::ofstream dataFile_;
+    std::ofstream indexFile_;
+    unsigned long numEvents_;
+
+    std::vector<std::string> columnNames_;
+
+    /// block currently filled by each Markov Chain (index = chain)
+    std::vector<Block*> currentBlocks_;
+
+    /// blocks waiting to be written and empty blocks available for reuse, protected by mutex_
+    std::deque<Block*> queuedBlocks_;
+    std::vector<Block*> freeBlocks_;
+    unsigned numBlocksInProgress_;
+
+    /// offset, chain and number of samples of blocks written for current event, protected by mutex_
+    struct BlockIndex
+    {
+      unsigned long offset_;
+      unsigned iChain_;
+      unsigned numSamples_;
+    };
+    std::vector<BlockIndex> blockIndices_;
+
+    std::mutex mutex_;
+    std::condition_variable queueCondition_;
+    std::condition_variable doneCondition_;
+    bool stop_;
+    std::thread writer_;
+  };
+
+  class ChainTraceReader
+  {
+   public:
+    ChainTraceReader(const std::string& fileName);
+    ~ChainTraceReader();
+
+    unsigned getNumEvents() const { return events_.size(); }
+
+    const std::vector<std::string>& getColumnNames(unsigned iEvent) const;
+
+    /// read values of given column for all samples of event iEvent (all chains)
+    void readColumn(unsigned iEvent, const std::string& columnName, std::vector<float>& values) const;
+
+    /// fill samples of event iEvent into given histogram.
+    /// Besides the names of stored columns, the following quantities computed from the tau lepton four-vectors
+    /// (columns "tau1Px" .. "tau2E") can be given:
+    ///   "ditauPt", "ditauEta", "ditauPhi", "ditauMass", "ditauTransverseMass",
+    ///   "tau1Pt", "tau1Eta", "tau1Phi", "tau2Pt", "tau2Eta", "tau2Phi".
+    /// Samples of all events are filled in case iEvent is -1
+    void fillHistogram(TH1* histogram, const std::string& quantity, int iEvent = -1) const;
+
+   private:
+    struct Event
+    {
+      std::vector<std::string> columnNames_;
+      std::vector<unsigned long> offsets_;      // index = block
+      std::vector<unsigned> numSamples_;        // index = block
+    };
+
+    void readQuantity(unsigned iEvent, const std::string& quantity, std::vector<float>& values) const;
+
+    std::string fileName_;
+    mutable std::ifstream dataFile_;
+
+    std::vector<Event> events_;
+  };
+}
+
+#endif
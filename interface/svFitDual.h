@@ -0,0 +1,174 @@
+#ifndef TauAnalysis_ClassicSVfit_svFitDual_h
+#define TauAnalysis_ClassicSVfit_svFitDual_h
+
+/** \class Dual
+ *
+ * Dual number for forward-mode automatic differentiation:
+ * each Dual stores a value together with its partial derivatives with respect to up to maxNumDerivatives input variables,
+ * which are propagated through all arithmetic operations and mathematical functions by the chain rule.
+ *
+ * Used to compute the gradient of the integrand for Hamiltonian Monte Carlo moves
+ * in a single evaluation, without the rounding errors of finite differences.
+ *
+ */
+
+#include <TMath.h>
+
+namespace classic_svFit
+{
+  class Dual
+  {
+   public:
+    /// maximum number of input variables (= maximum number of integration dimensions)
+    static const unsigned maxNumDerivatives = 6;
+
+    /// constant, all derivatives are zero
+    explicit Dual(double value = 0.)
+      : value_(value)
+    {
+      for ( unsigned idx = 0; idx < maxNumDerivatives; ++idx ) {
+        derivatives_[idx] = 0.;
+      }
+    }
+
+    /// input variable idx, with derivative with respect to itself given by derivative
+    Dual(double value, unsigned idx, double derivative = 1.)
+      : Dual(value)
+    {
+      derivatives_[idx] = derivative;
+    }
+
+    double value() const { return value_; }
+    double derivative(unsigned idx) const { return derivatives_[idx]; }
+
+    Dual& operator+=(const Dual& other)
+    {
+      value_ += other.value_;
+      for ( unsigned idx = 0; idx < maxNumDerivatives; ++idx ) {
+        derivatives_[idx] += other.derivatives_[idx];
+      }
+      return *this;
+    }
+    Dual& operator-=(const Dual& other)
+    {
+      value_ -= other.value_;
+      for ( unsigned idx = 0; idx < maxNumDerivatives; ++idx ) {
+        derivatives_[idx] -= other.derivatives_[idx];
+      }
+      return *this;
+    }
+    Dual& operator*=(const Dual& other)
+    {
+      for ( unsigned idx = 0; idx < maxNumDerivatives; ++idx ) {
+        derivatives_[idx] = derivatives_[idx]*other.value_ + value_*other.derivatives_[idx];
+      }
+      value_ *= other.value_;
+      return *this;
+    }
+    Dual& operator/=(const Dual& other)
+    {
+      double inverse = 1./other.value_;
+      value_ *= inverse;
+      for ( unsigned idx = 0; idx < maxNumDerivatives; ++idx ) {
+        derivatives_[idx] = (derivatives_[idx] - value_*other.derivatives_[idx])*inverse;
+      }
+      return *this;
+    }
+    Dual& operator+=(double other)
+    {
+      value_ += other;
+      return *this;
+    }
+    Dual& operator-=(double other)
+    {
+      value_ -= other;
+      return *this;
+    }
+    Dual& operator*=(double other)
+    {
+      value_ *= other;
+      for ( unsigned idx = 0; idx < maxNumDerivatives; ++idx ) {
+        derivatives_[idx] *= other;
+      }
+      return *this;
+    }
+    Dual& operator/=(double other)
+    {
+      return (*this) *= (1./other);
+    }
+
+    Dual operator-() const
+    {
+      Dual result(*this);
+      result *= -1.;
+      return result;
+    }
+
+    /// apply function with given value f(x) and derivative df/dx at x to this Dual
+    Dual chainRule(double value, double derivative) const
+    {
+      Dual result(value);
+      for ( unsigned idx = 0; idx < maxNumDerivatives; ++idx ) {
+        result.derivatives_[idx] = derivative*derivatives_[idx];
+      }
+      return result;
+    }
+
+   private:
+    double value_;
+    double derivatives_[maxNumDerivatives];
+  };
+
+  inline Dual operator+(Dual x, const Dual& y) { return x += y; }
+  inline Dual operator-(Dual x, const Dual& y) { return x -= y; }
+  inline Dual operator*(Dual x, const Dual& y) { return x *= y; }
+  inline Dual operator/(Dual x, const Dual& y) { return x /= y; }
+  inline Dual operator+(Dual x, double y) { return x += y; }
+  inline Dual operator-(Dual x, double y) { return x -= y; }
+  inline Dual operator*(Dual x, double y) { return x *= y; }
+  inline Dual operator/(Dual x, double y) { return x /= y; }
+  inline Dual operator+(double x, Dual y) { return y += x; }
+  inline Dual operator-(double x, const Dual& y) { return Dual(x) -= y; }
+  inline Dual operator*(double x, Dual y) { return y *= x; }
+  inline Dual operator/(double x, const Dual& y) { return Dual(x) /= y; }
+
+  inline Dual square(const Dual& x)
+  {
+    return x*x;
+  }
+
+  inline Dual sqrt(const Dual& x)
+  {
+    double value = TMath::Sqrt(x.value());
+    return x.chainRule(value, 0.5/value);
+  }
+
+  inline Dual exp(const Dual& x)
+  {
+    double value = TMath::Exp(x.value());
+    return x.chainRule(value, value);
+  }
+
+  inline Dual log(const Dual& x)
+  {
+    return x.chainRule(TMath::Log(x.value()), 1./x.value());
+  }
+
+  inline Dual sin(const Dual& x)
+  {
+    return x.chainRule(TMath::Sin(x.value()), TMath::Cos(x.value()));
+  }
+
+  inline Dual cos(const Dual& x)
+  {
+    return x.chainRule(TMath::Cos(x.value()), -TMath::Sin(x.value()));
+  }
+
+  inline Dual pow(const Dual& x, double exponent)
+  {
+    double value = TMath::Power(x.value(), exponent);
+    return x.chainRule(value, exponent*value/x.value());
+  }
+}
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef TauAnalysis_ClassicSVfit_svFitFormula_h
+#define TauAnalysis_ClassicSVfit_svFitFormula_h
+
+/** \class CompiledFormula
+ *
+ * Arithmetic expression in one variable x, compiled once into a sequence of instructions for a small stack machine,
+ * so that it can be evaluated many times without the overhead of TFormula::Eval.
+ *
+ * The supported syntax is the subset of the TFormula syntax used for the dynamic log(M) term:
+ * numbers, the variable x, the operators + - * / and ^ (or **), parentheses, the constant pi
+ * and the functions sqrt, exp, log, log10, abs, pow, min, max, sin, cos, tan,
+ * as well as their TMath equivalents (TMath::Sqrt, TMath::Exp, TMath::Log, TMath::Log10, TMath::Abs,
+ * TMath::Power, TMath::Min, TMath::Max, TMath::Sin, TMath::Cos, TMath::Tan, TMath::Pi()).
+ * All numbers are treated as floating-point numbers.
+ * Sub-expressions that do not depend on x are evaluated when the expression is compiled.
+ *
+ * The eval method does not allocate memory and is safe to call concurrently.
+ *
+ * Expressions given in terms of another variable name (e.g. m or mass for the dynamic log(M) term)
+ * are converted with replaceVariableName, which replaces whole identifiers only,
+ * so that function names containing the variable name (e.g. min, max or TMath::Exp) are left unchanged.
+ *
+ */
+
+#include <string>
+#include <vector>
+
+namespace classic_svFit
+{
+  class CompiledFormula
+  {
+   public:
+    CompiledFormula();
+    ~CompiledFormula() {}
+
+    /// compile expression; returns false, and leaves the formula empty,
+    /// in case the expression is not supported
+    bool compile(const std::string& expression);
+
+    /// check if an expression has been compiled successfully
+    bool isValid() const { return !instructions_.empty(); }
+
+    /// evaluate compiled expression for given value of x
+    double eval(double x) const;
+
+   private:
+    enum OpCode { kConstant, kVariable,
+                  kAdd, kSubtract, kMultiply, kDivide, kPower, kMin, kMax,                     // binary operations
+                  kNegate, kSqrt, kExp, kLog, kLog10, kAbs, kSin, kCos, kTan };                // unary operations
+    struct Instruction
+    {
+      OpCode opCode_;
+      double value_; // only used by kConstant
+    };
+
+    static bool isBinary(OpCode opCode) { return opCode >= kAdd && opCode <= kMax; }
+    static double applyBinary(OpCode opCode, double x, double y);
+    static double applyUnary(OpCode opCode, double x);
+
+    /// recursive-descent parser: expression = term { (+|-) term }, term = unary { (*|/) unary },
+    /// unary = (+|-) unary | power, power = primary [ (^|**) unary ], primary = number | x | pi | function | ( expression )
+    bool parseExpression();
+    bool parseTerm();
+    bool parseUnary();
+    bool parsePower();
+    bool parsePrimary();
+    void skipWhitespace();
+    bool accept(const char* token);
+
+    /// append instruction, evaluating operations on constant operands directly
+    void emit(OpCode opCode, double value = 0.);
+
+    std::vector<Instruction> instructions_;
+
+    /// maximum depth of the stack, determined when compiling the expression
+    static const unsigned maxStackSize = 32;
+    unsigned stackSize_;
+
+    /// parser state: current position in expression and current depth of the stack
+    const char* pos_;
+    unsigned depth_;
+  };
+
+  /// replace all occurrences of the identifier name in given expression by the variable x;
+  /// identifiers that merely contain name (e.g. "min" or "mass" for name = "m") are left unchanged
+  std::string replaceVariableName(const std::string& expression, const std::string& name);
+}
+
+#endif
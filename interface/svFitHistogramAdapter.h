@@ -2,10 +2,14 @@
 #define TauAnalysis_ClassicSVfit_svFitHistogramAdapter_h
 
 #include "TauAnalysis/ClassicSVfit/interface/MeasuredTauLepton.h"
+#include "TauAnalysis/ClassicSVfit/interface/SVfitIntegratorBase.h"
 
 #include <Math/Functor.h>
 #include <TH1.h>
 
+#include <atomic>
+#include <vector>
+
 namespace classic_svFit
 {
   class HistogramTools
@@ -21,11 +25,19 @@ namespace classic_svFit
         double& xQuantile050,
         double& xQuantile084
     );
+    static void extractQuantiles(
+        TH1 const* histogram,
+        double& xQuantile016,
+        double& xQuantile050,
+        double& xQuantile084
+    );
     static double extractValue(TH1 const* histogram);
     static double extractUncertainty(TH1 const* histogram);
     static double extractLmax(TH1 const* histogram);
     static TH1* makeHistogram_linBinWidth(const std::string& histogramName, int numBins, double xMin, double xMax);
     static TH1* makeHistogram_logBinWidth(const std::string& histogramName, double xMin, double xMax, double logBinWidth);
+    /// compute bin edges of histogram with bins of equal width in log(x), as used by makeHistogram_logBinWidth
+    static void compBinning_logBinWidth(double xMin, double xMax, double logBinWidth, std::vector<double>& binning);
   };
 
   class SVfitQuantity
@@ -38,25 +50,42 @@ namespace classic_svFit
     void writeHistogram() const;
 
     void fillHistogram(double value);
+    void fillHistogram(double value, double weight);
+
+    /// add content of histogram filled by other instance (e.g. by Markov Chain run in different thread)
+    void addHistogram(const SVfitQuantity& quantity);
 
     double extractValue() const;
     double extractUncertainty() const;
     double extractLmax() const;
+    void extractQuantiles(double& xQuantile016, double& xQuantile050, double& xQuantile084) const;
 
     bool isValidSolution() const;
 
    protected:
+    /// book histogram with bins of equal width or of equal width in log(x);
+    /// in case the histogram exists already, its binning is updated and its content is reset,
+    /// so that no memory gets allocated when the histograms are booked for each event
+    /// (the histogram name, "ClassicSVfitIntegrand_" + label_ + "_" + name, is set when the histogram is created)
+    void bookHistogram_linBinWidth(const char* name, int numBins, double xMin, double xMax);
+    void bookHistogram_logBinWidth(const char* name, double xMin, double xMax, double logBinWidth);
+
     std::string label_;
 
     mutable TH1* histogram_ = nullptr;
 
+    /// bin edges of histogram with bins of equal width in log(x)
+    std::vector<double> binning_;
+
    private:
-    static int nInstances;
+    /// instance counter, used to give histograms unique names
+    /// (atomic, as SVfitQuantity objects may be created concurrently by ClassicSVfit instances running in different threads)
+    static std::atomic<int> nInstances;
    protected:
     std::string uniqueName_;
   };
 
-  class HistogramAdapter : public ROOT::Math::Functor
+  class HistogramAdapter : public ROOT::Math::Functor, public WeightedCallBackFunction
   {
    public:
     HistogramAdapter(const std::string& label);
@@ -64,6 +93,9 @@ namespace classic_svFit
 
     void writeHistograms(const std::string& likelihoodFileName) const;
 
+    /// add content of histograms filled by other adapter of same type
+    virtual void addHistograms(const HistogramAdapter& adapter);
+
     double extractValue(const SVfitQuantity* quantity) const;
     double extractUncertainty(const SVfitQuantity* quantity) const;
     double extractLmax(const SVfitQuantity* quantity) const;
@@ -83,30 +115,28 @@ namespace classic_svFit
    public:
     SVfitQuantityTau(const std::string& label);
 
-    virtual TH1* createHistogram(const LorentzVector& visP4) const = 0;
-
-    void bookHistogram(const LorentzVector& visP4);
+    virtual void bookHistogram(const LorentzVector& visP4) = 0;
   };
 
   class SVfitQuantityTauPt : public SVfitQuantityTau
   {
    public:
     SVfitQuantityTauPt(const std::string& label);
-    virtual TH1* createHistogram(const LorentzVector& visP4) const;
+    virtual void bookHistogram(const LorentzVector& visP4);
   };
 
   class SVfitQuantityTauEta : public SVfitQuantityTau
   {
    public:
     SVfitQuantityTauEta(const std::string& label);
-    virtual TH1* createHistogram(const LorentzVector& visP4) const;
+    virtual void bookHistogram(const LorentzVector& visP4);
   };
 
   class SVfitQuantityTauPhi : public SVfitQuantityTau
   {
    public:
     SVfitQuantityTauPhi(const std::string& label);
-    virtual TH1* createHistogram(const LorentzVector& visP4) const;
+    virtual void bookHistogram(const LorentzVector& visP4);
   };
   
   class HistogramAdapterTau : public HistogramAdapter
@@ -119,7 +149,10 @@ namespace classic_svFit
     void setMeasurement(const LorentzVector& visP4);
     void setTauP4(const LorentzVector& tauP4);
 
-    void fillHistograms(const LorentzVector& tauP4, const LorentzVector& visP4) const;
+    void fillHistograms(const LorentzVector& tauP4, const LorentzVector& visP4, double weight = 1.) const;
+
+    /// fill histograms with given weight (used by integration algorithms based on importance sampling)
+    void evalWeighted(const double* x, double weight) const;
 
     /// get pT, eta, phi, mass of tau lepton
     double getPt() const;
@@ -155,44 +188,42 @@ namespace classic_svFit
    public:
     SVfitQuantityDiTau(const std::string& label);
 
-    virtual TH1* createHistogram(const LorentzVector& vis1P4, const LorentzVector& vis2P4, const Vector& met) const = 0;
-
-    void bookHistogram(const LorentzVector& vis1P4, const LorentzVector& vis2P4, const Vector& met);
+    virtual void bookHistogram(const LorentzVector& vis1P4, const LorentzVector& vis2P4, const Vector& met) = 0;
   };
 
   class SVfitQuantityDiTauPt : public SVfitQuantityDiTau
   {
    public:
     SVfitQuantityDiTauPt(const std::string& label);
-    virtual TH1* createHistogram(const LorentzVector& vis1P4, const LorentzVector& vis2P4, const Vector& met) const;
+    virtual void bookHistogram(const LorentzVector& vis1P4, const LorentzVector& vis2P4, const Vector& met);
   };
 
   class SVfitQuantityDiTauEta : public SVfitQuantityDiTau
   {
    public:
     SVfitQuantityDiTauEta(const std::string& label);
-    virtual TH1* createHistogram(const LorentzVector& vis1P4, const LorentzVector& vis2P4, const Vector& met) const;
+    virtual void bookHistogram(const LorentzVector& vis1P4, const LorentzVector& vis2P4, const Vector& met);
   };
 
   class SVfitQuantityDiTauPhi : public SVfitQuantityDiTau
   {
    public:
     SVfitQuantityDiTauPhi(const std::string& label);
-    virtual TH1* createHistogram(const LorentzVector& vis1P4, const LorentzVector& vis2P4, const Vector& met) const;
+    virtual void bookHistogram(const LorentzVector& vis1P4, const LorentzVector& vis2P4, const Vector& met);
   };
 
   class SVfitQuantityDiTauMass : public SVfitQuantityDiTau
   {
    public:
     SVfitQuantityDiTauMass(const std::string& label);
-    virtual TH1* createHistogram(const LorentzVector& vis1P4, const LorentzVector& vis2P4, const Vector& met) const;
+    virtual void bookHistogram(const LorentzVector& vis1P4, const LorentzVector& vis2P4, const Vector& met);
   };
 
   class SVfitQuantityDiTauTransverseMass : public SVfitQuantityDiTau
   {
    public:
     SVfitQuantityDiTauTransverseMass(const std::string& label);
-    virtual TH1* createHistogram(const LorentzVector& vis1P4, const LorentzVector& vis2P4, const Vector& met) const;
+    virtual void bookHistogram(const LorentzVector& vis1P4, const LorentzVector& vis2P4, const Vector& met);
   };
 
   class HistogramAdapterDiTau : public HistogramAdapter
@@ -201,13 +232,33 @@ namespace classic_svFit
     HistogramAdapterDiTau(const std::string& label = "ditau");
     ~HistogramAdapterDiTau();
 
+    /// create new adapter of the same type and label (histograms are not copied),
+    /// used to fill histograms in parallel threads
+    virtual HistogramAdapterDiTau* clone() const;
+
+    void addHistograms(const HistogramAdapter& adapter);
+
     void bookHistograms(const LorentzVector& vis1P4, const LorentzVector& vis2P4, const Vector& met);
 
     void setMeasurement(const LorentzVector& vis1P4, const LorentzVector& vis2P4, const Vector& met);
     void setTau1And2P4(const LorentzVector& tau1P4,  const LorentzVector& tau2P4);
 
+    /// get tau lepton momenta set by the integrand in its last evaluation
+    const LorentzVector& getTau1P4() const { return tau1P4_; }
+    const LorentzVector& getTau2P4() const { return tau2P4_; }
+
     void fillHistograms(const LorentzVector& tau1P4, const LorentzVector& tau2P4, const LorentzVector& ditauP4,
-			const LorentzVector& vis1P4, const LorentzVector& vis2P4, const Vector& met) const;
+			const LorentzVector& vis1P4, const LorentzVector& vis2P4, const Vector& met, double weight = 1.) const;
+
+    /// fill histograms for tau lepton momenta set by the integrand in its last evaluation
+    /// (same as evaluating the adapter as "call-back" function, but without virtual function call)
+    void fillHistograms(double weight = 1.) const
+    {
+      fillHistograms(tau1P4_, tau2P4_, ditauP4_, vis1P4_, vis2P4_, met_, weight);
+    }
+
+    /// fill histograms with given weight (used by integration algorithms based on importance sampling)
+    void evalWeighted(const double* x, double weight) const;
 
     HistogramAdapterTau* tau1() const;
     HistogramAdapterTau* tau2() const;
@@ -229,6 +280,10 @@ namespace classic_svFit
     double getTransverseMassErr() const;
     double getTransverseMassLmax() const;
 
+    /// get -1 sigma, median and +1 sigma quantiles of di-tau mass distribution
+    /// (used to monitor convergence of Markov Chain integration)
+    void getMassQuantiles(double& quantile016, double& quantile050, double& quantile084) const;
+
     /// convenient access to four-vector of di-tau system 
     LorentzVector getP4() const;
 
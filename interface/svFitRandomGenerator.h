@@ -0,0 +1,103 @@
+#ifndef TauAnalysis_ClassicSVfit_svFitRandomGenerator_h
+#define TauAnalysis_ClassicSVfit_svFitRandomGenerator_h
+
+/** \class RandomGenerator
+ *
+ * Interface to random number generators used by the Markov Chain integration.
+ *
+ * Random numbers are requested in blocks, so that implementations
+ * can generate and transform many numbers in one go.
+ *
+ * Two implementations are provided:
+ *  - TRandom3RandomGenerator: wraps ROOT's TRandom3 (Mersenne Twister),
+ *    producing the same sequence of random numbers as calling TRandom3::Gaus, Uniform and BreitWigner directly
+ *  - PhiloxRandomGenerator: counter-based Philox4x32-10 generator described in
+ *    [1] "Parallel Random Numbers: As Easy as 1, 2, 3",
+ *        J. Salmon, M. Moraes, R. Dror, D. Shaw, Proceedings of SC11 (2011),
+ *    in which the seed is used as key, so that generators with different seeds produce independent streams
+ *
+ */
+
+#include <TRandom3.h>
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace classic_svFit
+{
+  class RandomGenerator
+  {
+   public:
+    RandomGenerator() {}
+    virtual ~RandomGenerator() {}
+
+    /// (re)initialize generator with given seed
+    virtual void setSeed(unsigned long seed) = 0;
+
+    /// fill x[0..n-1] with random numbers distributed uniformly in ]0..1[
+    virtual void fillUniform(double* x, unsigned n) = 0;
+
+    /// fill x[0..n-1] with random numbers distributed according to a Gaussian of mean 0 and width 1
+    virtual void fillGaus(double* x, unsigned n) = 0;
+
+    /// fill x[0..n-1] with random numbers distributed according to a Breit-Wigner (Cauchy) distribution
+    /// of mean 0 and full width at half maximum 1 (same convention as TRandom::BreitWigner)
+    virtual void fillBreitWigner(double* x, unsigned n) = 0;
+
+    /// convenience functions for single random numbers
+    double Uniform(double xMin, double xMax);
+    double Gaus(double mean, double sigma);
+    double BreitWigner(double mean, double gamma);
+  };
+
+  class TRandom3RandomGenerator : public RandomGenerator
+  {
+   public:
+    TRandom3RandomGenerator();
+    ~TRandom3RandomGenerator() {}
+
+    void setSeed(unsigned long seed);
+
+    void fillUniform(double* x, unsigned n);
+    void fillGaus(double* x, unsigned n);
+    void fillBreitWigner(double* x, unsigned n);
+
+   private:
+    TRandom3 rnd_;
+  };
+
+  class PhiloxRandomGenerator : public RandomGenerator
+  {
+   public:
+    PhiloxRandomGenerator();
+    ~PhiloxRandomGenerator() {}
+
+    void setSeed(unsigned long seed);
+
+    void fillUniform(double* x, unsigned n);
+    void fillGaus(double* x, unsigned n);
+    void fillBreitWigner(double* x, unsigned n);
+
+   private:
+    /// compute next block of 4 random 32-bit integers and increment counter
+    void generateBlock(uint32_t* output);
+
+    uint32_t key_[2];
+    uint32_t counter_[4];
+
+    /// buffer used by fillGaus, to process pairs of uniform random numbers in Box-Muller transform
+    std::vector<double> buffer_;
+  };
+
+  /// create random number generator of given type ("TRandom3" or "Philox")
+  RandomGenerator* makeRandomGenerator(const std::string& type);
+
+  /// combine seed with value (SplitMix64 finalizer [2]), used to derive seeds from the inputs of an event
+  /// and to split the random number stream of an event into independent streams, one per Markov Chain.
+  /// [2] "Fast Splittable Pseudorandom Number Generators", G. Steele, D. Lea, C. Flood, OOPSLA 2014
+  uint64_t hashSeed(uint64_t seed, uint64_t value);
+  uint64_t hashSeed(uint64_t seed, double value);
+}
+
+#endif
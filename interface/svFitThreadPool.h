@@ -0,0 +1,80 @@
+#ifndef TauAnalysis_ClassicSVfit_svFitThreadPool_h
+#define TauAnalysis_ClassicSVfit_svFitThreadPool_h
+
+/** \class ThreadPool
+ *
+ * Fixed-size pool of worker threads,
+ * used to run independent tasks (e.g. Markov Chains or events) in parallel.
+ *
+ * The thread calling parallel_for takes part in the processing of the tasks,
+ * so a pool of N threads keeps N - 1 worker threads waiting for work.
+ *
+ * Tasks are distributed in contiguous blocks over one queue per thread.
+ * Each thread processes the tasks in its own queue front to back;
+ * once its queue is empty, it steals tasks from the back of the queues of the other threads.
+ * Work stealing keeps all threads busy when the processing time varies a lot between tasks.
+ *
+ */
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace classic_svFit
+{
+  class ThreadPool
+  {
+   public:
+    ThreadPool(unsigned numThreads);
+    ~ThreadPool();
+
+    unsigned getNumThreads() const { return numThreads_; }
+
+    /// execute task(iTask) for iTask = 0..numTasks-1,
+    /// returns once all tasks have been processed
+    void parallel_for(unsigned numTasks, const std::function<void(unsigned)>& task);
+
+    /// execute task(iTask, iThread) for iTask = 0..numTasks-1,
+    /// where iThread = 0..numThreads-1 identifies the thread processing the task
+    /// (iThread = 0 is the thread calling parallel_for);
+    /// no two tasks with the same iThread run concurrently,
+    /// so iThread can be used to index per-thread resources
+    void parallel_for(unsigned numTasks, const std::function<void(unsigned, unsigned)>& task);
+
+   private:
+    void runWorker(unsigned iThread);
+
+    void processTasks(unsigned iThread);
+
+    /// take next task from own queue or steal one from the queue of another thread;
+    /// returns false if all queues are empty
+    bool getTask(unsigned iThread, unsigned& iTask);
+
+    unsigned numThreads_;
+    std::vector<std::thread> workers_;
+
+    struct TaskQueue
+    {
+      std::mutex mutex_;
+      std::deque<unsigned> tasks_;
+    };
+    std::vector<TaskQueue> queues_;
+
+    std::mutex mutex_;
+    std::condition_variable startCondition_;
+    std::condition_variable doneCondition_;
+
+    /// task currently being processed, protected by mutex_
+    const std::function<void(unsigned, unsigned)>* task_;
+    unsigned numTasks_;
+    unsigned numTasksDone_;
+    unsigned numActiveThreads_;
+    unsigned long generation_;
+    bool stop_;
+  };
+}
+
+#endif
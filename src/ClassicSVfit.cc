@@ -11,6 +11,7 @@
 #include <TVectorD.h>
 
 #include <algorithm>
+#include <limits>
 
 using namespace classic_svFit;
 
@@ -18,36 +19,439 @@ namespace
 {
   double g_C(const double* x, size_t dim, void* param)
   {
-    return ClassicSVfitIntegrand::gSVfitIntegrand->Eval(x);
+    return static_cast<const ClassicSVfitIntegrand*>(param)->Eval(x);
   }
+
+  /// maximum number of integration dimensions (at most 3 per leg, cf. xl_ and xh_)
+  const unsigned maxNumDimensions = 6;
+
+  /// integrand and observer passed to the Markov Chain integration,
+  /// calling ClassicSVfitIntegrand::Eval and HistogramAdapterDiTau::fillHistograms of the integrand and adapter used by each chain
+  /// without indirection through function pointer and virtual function calls
+  /// (chain 0 uses the integrand and histogram adapter of the ClassicSVfit instance, chain iChain > 0 uses the copies with index iChain - 1)
+  struct ChainIntegrand
+  {
+    ChainIntegrand(const ClassicSVfitIntegrandBase* integrand, const std::vector<ClassicSVfitIntegrandBase*>& chainIntegrands, unsigned numDimensions)
+      : integrand_(integrand)
+      , chainIntegrands_(chainIntegrands)
+      , numDimensions_(numDimensions)
+    {}
+    const ClassicSVfitIntegrand* getIntegrand(unsigned iChain) const
+    {
+      return static_cast<const ClassicSVfitIntegrand*>(( iChain == 0 ) ? integrand_ : chainIntegrands_[iChain - 1]);
+    }
+    double operator()(unsigned iChain, const double* q) const
+    {
+      return getIntegrand(iChain)->ClassicSVfitIntegrand::Eval(q);
+    }
+    void operator()(unsigned iChain, const double* q, unsigned numPoints, double* prob) const
+    {
+      getIntegrand(iChain)->EvalBatch(q, numPoints, prob);
+    }
+    double operator()(unsigned iChain, const double* q, double* gradLogProb) const
+    {
+      return getIntegrand(iChain)->EvalWithGradient(q, gradLogProb);
+    }
+    double operator()(unsigned iChain, const double* q, SVfitIntegratorMarkovChain::LogDomain) const
+    {
+      return getIntegrand(iChain)->ClassicSVfitIntegrand::EvalLog(q);
+    }
+    const ClassicSVfitIntegrandBase* integrand_;
+    const std::vector<ClassicSVfitIntegrandBase*>& chainIntegrands_;
+    unsigned numDimensions_;
+  };
+  struct ChainObserver
+  {
+    ChainObserver(const HistogramAdapterDiTau* histogramAdapter, const std::vector<HistogramAdapterDiTau*>& chainHistogramAdapters,
+                  const ChainIntegrand& chainIntegrand, const double* xl, const double* xh, unsigned numDimensions,
+                  ClassicSVfit::VariationHistograms& metVariationHistograms,
+                  ClassicSVfit::VariationHistograms& visMomentumVariationHistograms, const std::vector<ClassicSVfitIntegrandBase*>& visMomentumVariationIntegrands)
+      : histogramAdapter_(histogramAdapter)
+      , chainHistogramAdapters_(chainHistogramAdapters)
+      , chainIntegrand_(chainIntegrand)
+      , xl_(xl)
+      , xh_(xh)
+      , numDimensions_(numDimensions)
+      , metVariationHistograms_(metVariationHistograms)
+      , visMomentumVariationHistograms_(visMomentumVariationHistograms)
+      , visMomentumVariationIntegrands_(visMomentumVariationIntegrands)
+      , numVisMomentumVariations_(visMomentumVariationIntegrands.size()/(chainHistogramAdapters.size() + 1))
+    {}
+    void operator()(unsigned iChain, const double* x) const
+    {
+      const HistogramAdapterDiTau* histogramAdapter = ( iChain == 0 ) ? histogramAdapter_ : chainHistogramAdapters_[iChain - 1];
+      histogramAdapter->fillHistograms();
+
+      const ClassicSVfitIntegrand* integrand = chainIntegrand_.getIntegrand(iChain);
+      const std::vector<double>& metVariationWeights = integrand->getMETVariationWeights();
+      unsigned numMETVariations = metVariationWeights.size();
+      if ( numMETVariations == 0 && numVisMomentumVariations_ == 0 ) return;
+
+//--- evaluate the integrand for the current point x of the Markov Chain,
+//    without changing the kinematics held by the histogram adapter
+      // CV: the integrand expects the integration variables in the standardised range [0,1]
+      double q[maxNumDimensions];
+      for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+        q[iDimension] = (x[iDimension] - xl_[iDimension])/(xh_[iDimension] - xl_[iDimension]);
+      }
+      double logProb = integrand->EvalLogForReweighting(q);
+      if ( logProb == -std::numeric_limits<double>::infinity() ) return;
+
+//--- fill histograms for MET variations,
+//    weighting the sample by the ratio of the MET transfer functions of the varied and of the nominal MET estimate
+      if ( numMETVariations > 0 ) {
+        for ( unsigned iVariation = 0; iVariation < numMETVariations; ++iVariation ) {
+          metVariationHistograms_.fill(iChain, iVariation, integrand->getFittedTau1P4(), integrand->getFittedTau2P4(), metVariationWeights[iVariation]);
+        }
+        ++metVariationHistograms_.numSamples_[iChain];
+      }
+
+//--- fill histograms for variations of the momenta of the visible tau decay products,
+//    weighting the sample by the ratio of the integrands for the scaled and for the nominal momenta
+      if ( numVisMomentumVariations_ > 0 ) {
+        for ( unsigned iVariation = 0; iVariation < numVisMomentumVariations_; ++iVariation ) {
+          const ClassicSVfitIntegrand* visMomentumVariationIntegrand = static_cast<const ClassicSVfitIntegrand*>(
+            visMomentumVariationIntegrands_[iChain*numVisMomentumVariations_ + iVariation]);
+          double logProb_variation = visMomentumVariationIntegrand->EvalLogForReweighting(q);
+          double weight = ( logProb_variation > -std::numeric_limits<double>::infinity() ) ? TMath::Exp(logProb_variation - logProb) : 0.;
+          visMomentumVariationHistograms_.fill(iChain, iVariation, visMomentumVariationIntegrand->getFittedTau1P4(), visMomentumVariationIntegrand->getFittedTau2P4(), weight);
+        }
+        ++visMomentumVariationHistograms_.numSamples_[iChain];
+      }
+    }
+    const HistogramAdapterDiTau* histogramAdapter_;
+    const std::vector<HistogramAdapterDiTau*>& chainHistogramAdapters_;
+    const ChainIntegrand& chainIntegrand_;
+    const double* xl_;
+    const double* xh_;
+    unsigned numDimensions_;
+    ClassicSVfit::VariationHistograms& metVariationHistograms_;
+    ClassicSVfit::VariationHistograms& visMomentumVariationHistograms_;
+    const std::vector<ClassicSVfitIntegrandBase*>& visMomentumVariationIntegrands_;
+    unsigned numVisMomentumVariations_;
+  };
 }
 
 ClassicSVfit::ClassicSVfit(int verbosity)
   : ClassicSVfitBase(verbosity)
   , diTauMassConstraint_(-1.)
   , histogramAdapter_(new HistogramAdapterDiTau("ditau"))
+  , minEffectiveSampleFraction_(0.1)
+  , batchThreadPool_(0)
 {
   integrand_ = new ClassicSVfitIntegrand(verbosity_);
   legIntegrationParams_.resize(2);
-  xl_ = new double[6];
-  xh_ = new double[6];
+  xl_ = new double[maxNumDimensions];
+  xh_ = new double[maxNumDimensions];
 }
 
 ClassicSVfit::~ClassicSVfit()
 {
   delete histogramAdapter_;
+  deleteChainHistogramAdapters();
+  deleteVisMomentumVariationIntegrands();
+  delete batchThreadPool_;
+}
+
+void ClassicSVfit::deleteChainHistogramAdapters()
+{
+  for ( std::vector<HistogramAdapterDiTau*>::iterator chainHistogramAdapter = chainHistogramAdapters_.begin();
+        chainHistogramAdapter != chainHistogramAdapters_.end(); ++chainHistogramAdapter ) {
+    delete (*chainHistogramAdapter);
+  }
+  chainHistogramAdapters_.clear();
+}
+
+void ClassicSVfit::deleteVisMomentumVariationIntegrands()
+{
+  for ( std::vector<ClassicSVfitIntegrandBase*>::iterator visMomentumVariationIntegrand = visMomentumVariationIntegrands_.begin();
+        visMomentumVariationIntegrand != visMomentumVariationIntegrands_.end(); ++visMomentumVariationIntegrand ) {
+    delete (*visMomentumVariationIntegrand);
+  }
+  visMomentumVariationIntegrands_.clear();
+}
+
+ClassicSVfit::VariationHistograms::~VariationHistograms()
+{
+  clear();
+}
+
+void ClassicSVfit::VariationHistograms::initialize(const HistogramAdapterDiTau* histogramAdapter, unsigned numChains, unsigned numVariations)
+{
+  // CV: histograms are kept for subsequent events, unless the number of Markov Chains or of variations changes
+  if ( histogramAdapters_.size() != numChains*numVariations ) {
+    clear();
+    for ( unsigned idx = 0; idx < numChains*numVariations; ++idx ) {
+      histogramAdapters_.push_back(histogramAdapter->clone());
+    }
+  }
+  sumWeights_.assign(numChains*numVariations, 0.);
+  sumWeights2_.assign(numChains*numVariations, 0.);
+  numSamples_.assign(numChains, 0);
+}
+
+void ClassicSVfit::VariationHistograms::clear()
+{
+  for ( std::vector<HistogramAdapterDiTau*>::iterator histogramAdapter = histogramAdapters_.begin();
+        histogramAdapter != histogramAdapters_.end(); ++histogramAdapter ) {
+    delete (*histogramAdapter);
+  }
+  histogramAdapters_.clear();
+}
+
+void ClassicSVfit::VariationHistograms::fill(unsigned iChain, unsigned iVariation, const LorentzVector& tau1P4, const LorentzVector& tau2P4, double weight)
+{
+  unsigned idx = iChain*(sumWeights_.size()/numSamples_.size()) + iVariation;
+  if ( weight > 0. ) {
+    HistogramAdapterDiTau* histogramAdapter = histogramAdapters_[idx];
+    histogramAdapter->setTau1And2P4(tau1P4, tau2P4);
+    histogramAdapter->fillHistograms(weight);
+  }
+  sumWeights_[idx] += weight;
+  sumWeights2_[idx] += weight*weight;
+}
+
+void ClassicSVfit::setMinEffectiveSampleFraction(double minEffectiveSampleFraction)
+{
+  minEffectiveSampleFraction_ = minEffectiveSampleFraction;
+}
+
+void ClassicSVfit::addMETVariation(double measuredMETx, double measuredMETy, const TMatrixD& covMET)
+{
+  METVariation metVariation;
+  metVariation.measuredMETx_ = measuredMETx;
+  metVariation.measuredMETy_ = measuredMETy;
+  metVariation.covMET_.ResizeTo(covMET);
+  metVariation.covMET_ = covMET;
+  metVariations_.push_back(metVariation);
+}
+
+void ClassicSVfit::clearMETVariations()
+{
+  metVariations_.clear();
+  metVariationResults_.clear();
+}
+
+unsigned ClassicSVfit::getNumMETVariations() const
+{
+  return metVariations_.size();
+}
+
+const ClassicSVfit::VariationResult& ClassicSVfit::getMETVariationResult(unsigned iVariation) const
+{
+  assert(iVariation < metVariationResults_.size());
+  return metVariationResults_[iVariation];
+}
+
+HistogramAdapterDiTau* ClassicSVfit::getMETVariationHistogramAdapter(unsigned iVariation) const
+{
+  assert(iVariation < metVariations_.size() && iVariation < metVariationHistograms_.histogramAdapters_.size());
+  return metVariationHistograms_.histogramAdapters_[iVariation];
+}
+
+void ClassicSVfit::addVisMomentumVariation(double visPtShift1, double visPtShift2)
+{
+  VisMomentumVariation visMomentumVariation;
+  visMomentumVariation.visPtShift_[0] = visPtShift1;
+  visMomentumVariation.visPtShift_[1] = visPtShift2;
+  visMomentumVariations_.push_back(visMomentumVariation);
+}
+
+void ClassicSVfit::clearVisMomentumVariations()
+{
+  visMomentumVariations_.clear();
+  visMomentumVariationResults_.clear();
+  deleteVisMomentumVariationIntegrands();
+}
+
+unsigned ClassicSVfit::getNumVisMomentumVariations() const
+{
+  return visMomentumVariations_.size();
+}
+
+const ClassicSVfit::VariationResult& ClassicSVfit::getVisMomentumVariationResult(unsigned iVariation) const
+{
+  assert(iVariation < visMomentumVariationResults_.size());
+  return visMomentumVariationResults_[iVariation];
+}
+
+HistogramAdapterDiTau* ClassicSVfit::getVisMomentumVariationHistogramAdapter(unsigned iVariation) const
+{
+  assert(iVariation < visMomentumVariations_.size() && iVariation < visMomentumVariationHistograms_.histogramAdapters_.size());
+  return visMomentumVariationHistograms_.histogramAdapters_[iVariation];
+}
+
+void ClassicSVfit::prepareVisMomentumVariations(const std::vector<MeasuredTauLepton>& measuredTauLeptons, double measuredMETx, double measuredMETy)
+{
+  assert(measuredTauLeptons.size() == 2);
+  unsigned numChains = chainIntegrands_.size() + 1;
+  unsigned numVariations = visMomentumVariations_.size();
+
+//--- scale the momenta of the visible tau decay products and keep them in the same order as measuredTauLeptons_,
+//    so that the integration variables refer to the same leg for the nominal and for the scaled momenta
+  MeasuredTauLepton measuredTauLeptons_rounded[2] = { measuredTauLeptons[0], measuredTauLeptons[1] };
+  measuredTauLeptons_rounded[0].roundToNdigits();
+  measuredTauLeptons_rounded[1].roundToNdigits();
+  bool isSwapped = sortMeasuredTauLeptons()(measuredTauLeptons_rounded[1], measuredTauLeptons_rounded[0]);
+  visMomentumVariationTauLeptons_.resize(numVariations);
+  for ( unsigned iVariation = 0; iVariation < numVariations; ++iVariation ) {
+    std::vector<MeasuredTauLepton>& visMomentumVariationTauLeptons = visMomentumVariationTauLeptons_[iVariation];
+    visMomentumVariationTauLeptons.clear();
+    for ( unsigned iLeg = 0; iLeg < 2; ++iLeg ) {
+      unsigned idx = ( isSwapped ) ? 1 - iLeg : iLeg;
+      const MeasuredTauLepton& measuredTauLepton = measuredTauLeptons[idx];
+      MeasuredTauLepton visMomentumVariationTauLepton(
+        measuredTauLepton.type(), visMomentumVariations_[iVariation].visPtShift_[idx]*measuredTauLepton.pt(),
+        measuredTauLepton.eta(), measuredTauLepton.phi(), measuredTauLepton.mass(), measuredTauLepton.decayMode());
+      visMomentumVariationTauLepton.roundToNdigits();
+      visMomentumVariationTauLeptons.push_back(visMomentumVariationTauLepton);
+    }
+  }
+
+//--- create one copy of the integrand per Markov Chain and variation;
+//    CV: the copies are kept for subsequent events, the momenta of the visible tau decay products are set in prepareIntegrand
+  if ( visMomentumVariationIntegrands_.size() != numChains*numVariations ) {
+    deleteVisMomentumVariationIntegrands();
+    for ( unsigned idx = 0; idx < numChains*numVariations; ++idx ) {
+      visMomentumVariationIntegrands_.push_back(integrand_->clone());
+    }
+  }
+
+//--- the integrands for variations of the visible momenta only need the nominal MET estimate
+  double metX = roundToNdigits(measuredMETx);
+  double metY = roundToNdigits(measuredMETy);
+  for ( std::vector<ClassicSVfitIntegrandBase*>::iterator visMomentumVariationIntegrand = visMomentumVariationIntegrands_.begin();
+        visMomentumVariationIntegrand != visMomentumVariationIntegrands_.end(); ++visMomentumVariationIntegrand ) {
+    (*visMomentumVariationIntegrand)->clearMET();
+    (*visMomentumVariationIntegrand)->addMETEstimate(metX, metY, covMET_rounded_);
+  }
+}
+
+void ClassicSVfit::bookVariationHistograms()
+{
+  unsigned numChains = chainHistogramAdapters_.size() + 1;
+  unsigned numMETVariations = metVariations_.size();
+  metVariationHistograms_.initialize(histogramAdapter_, numChains, numMETVariations);
+  for ( unsigned iChain = 0; iChain < numChains; ++iChain ) {
+    for ( unsigned iVariation = 0; iVariation < numMETVariations; ++iVariation ) {
+      const METVariation& metVariation = metVariations_[iVariation];
+      Vector met(metVariation.measuredMETx_, metVariation.measuredMETy_, 0.);
+      HistogramAdapterDiTau* histogramAdapter = metVariationHistograms_.histogramAdapters_[iChain*numMETVariations + iVariation];
+      histogramAdapter->setMeasurement(measuredTauLeptons_[0].p4(), measuredTauLeptons_[1].p4(), met);
+      histogramAdapter->bookHistograms(measuredTauLeptons_[0].p4(), measuredTauLeptons_[1].p4(), met);
+    }
+  }
+  unsigned numVisMomentumVariations = visMomentumVariations_.size();
+  visMomentumVariationHistograms_.initialize(histogramAdapter_, numChains, numVisMomentumVariations);
+  for ( unsigned iChain = 0; iChain < numChains; ++iChain ) {
+    for ( unsigned iVariation = 0; iVariation < numVisMomentumVariations; ++iVariation ) {
+      const std::vector<MeasuredTauLepton>& visMomentumVariationTauLeptons = visMomentumVariationTauLeptons_[iVariation];
+      HistogramAdapterDiTau* histogramAdapter = visMomentumVariationHistograms_.histogramAdapters_[iChain*numVisMomentumVariations + iVariation];
+      histogramAdapter->setMeasurement(visMomentumVariationTauLeptons[0].p4(), visMomentumVariationTauLeptons[1].p4(), met_);
+      histogramAdapter->bookHistograms(visMomentumVariationTauLeptons[0].p4(), visMomentumVariationTauLeptons[1].p4(), met_);
+    }
+  }
+}
+
+void ClassicSVfit::compVariationResults(const VariationHistograms& variationHistograms, std::vector<VariationResult>& variationResults, const char* label) const
+{
+  unsigned numChains = variationHistograms.numSamples_.size();
+  unsigned numVariations = ( numChains > 0 ) ? variationHistograms.sumWeights_.size()/numChains : 0;
+  long numSamples = 0;
+  for ( unsigned iChain = 0; iChain < numChains; ++iChain ) {
+    numSamples += variationHistograms.numSamples_[iChain];
+  }
+  variationResults.resize(numVariations);
+  for ( unsigned iVariation = 0; iVariation < numVariations; ++iVariation ) {
+    // CV: histograms of chain 0 are returned by get..VariationHistogramAdapter
+    HistogramAdapterDiTau* histogramAdapter = variationHistograms.histogramAdapters_[iVariation];
+    double sumWeights = 0.;
+    double sumWeights2 = 0.;
+    for ( unsigned iChain = 0; iChain < numChains; ++iChain ) {
+      unsigned idx = iChain*numVariations + iVariation;
+      if ( iChain > 0 ) histogramAdapter->addHistograms(*variationHistograms.histogramAdapters_[idx]);
+      sumWeights += variationHistograms.sumWeights_[idx];
+      sumWeights2 += variationHistograms.sumWeights2_[idx];
+    }
+    VariationResult& result = variationResults[iVariation];
+    result.isValidSolution_ = histogramAdapter->isValidSolution();
+    result.pt_ = histogramAdapter->getPt();
+    result.ptErr_ = histogramAdapter->getPtErr();
+    result.mass_ = histogramAdapter->getMass();
+    result.massErr_ = histogramAdapter->getMassErr();
+    result.transverseMass_ = histogramAdapter->getTransverseMass();
+    result.transverseMassErr_ = histogramAdapter->getTransverseMassErr();
+    result.effectiveSampleSize_ = ( sumWeights2 > 0. ) ? square(sumWeights)/sumWeights2 : 0.;
+    result.effectiveSampleFraction_ = ( numSamples > 0 ) ? result.effectiveSampleSize_/numSamples : 0.;
+    result.isReweightingPoor_ = ( result.effectiveSampleFraction_ < minEffectiveSampleFraction_ );
+    if ( verbosity_ >= 1 ) {
+      std::cout << label << " variation #" << iVariation << ": mass = " << result.mass_ << " +/- " << result.massErr_ << ","
+                << " effective sample size = " << result.effectiveSampleSize_ << " (fraction = " << result.effectiveSampleFraction_ << ")" << std::endl;
+      if ( result.isReweightingPoor_ ) {
+        std::cout << "Warning: effective sample fraction is below " << minEffectiveSampleFraction_ << ","
+                  << " the variation should be integrated separately !!" << std::endl;
+      }
+    }
+  }
 }
 
 void ClassicSVfit::setDiTauMassConstraint(double diTauMass)
 {
   diTauMassConstraint_ = diTauMass;
   (static_cast<ClassicSVfitIntegrand*>(integrand_))->setDiTauMassConstraint(diTauMassConstraint_);
+  for ( unsigned iChain = 0; iChain < chainIntegrands_.size(); ++iChain ) {
+    (static_cast<ClassicSVfitIntegrand*>(chainIntegrands_[iChain]))->setDiTauMassConstraint(diTauMassConstraint_);
+  }
+  deleteVisMomentumVariationIntegrands();
+}
+
+void ClassicSVfit::integrandConfigurationChanged()
+{
+  deleteVisMomentumVariationIntegrands();
 }
 
 void ClassicSVfit::initializeMCIntegrator()
 {
   ClassicSVfitBase::initializeMCIntegrator();
-  intAlgo_->registerCallBackFunction(*histogramAdapter_);
+  deleteChainHistogramAdapters();
+  deleteVisMomentumVariationIntegrands();
+
+  SVfitIntegratorMarkovChain* intAlgoMarkovChain = dynamic_cast<SVfitIntegratorMarkovChain*>(intAlgo_);
+  if ( !intAlgoMarkovChain ) {
+    // CV: integration algorithms based on importance sampling fill the histograms with weights
+    intAlgo_->registerWeightedCallBackFunction(*histogramAdapter_);
+    return;
+  }
+
+  // CV: each further Markov Chain evaluates its own copy of the integrand
+  //     and fills its own copy of the histograms, so that chains can run in parallel threads
+  for ( unsigned iChain = 0; iChain < chainIntegrands_.size(); ++iChain ) {
+    chainHistogramAdapters_.push_back(histogramAdapter_->clone());
+  }
+
+  // CV: monitor convergence of Markov Chains by the quantiles of the di-tau mass distribution
+  intAlgoMarkovChain->setConvergenceMonitor([this](unsigned iChain, std::vector<double>& observables) {
+    const HistogramAdapterDiTau* histogramAdapter = ( iChain == 0 ) ? histogramAdapter_ : chainHistogramAdapters_[iChain - 1];
+    observables.resize(3);
+    histogramAdapter->getMassQuantiles(observables[0], observables[1], observables[2]);
+  });
+
+  // CV: store tau lepton four-vectors in the chain-trace file,
+  //     so that any quantity filled by the histogram adapter can be computed from the stored samples
+  const char* traceColumnNames[] = { "tau1Px", "tau1Py", "tau1Pz", "tau1E", "tau2Px", "tau2Py", "tau2Pz", "tau2E" };
+  intAlgoMarkovChain->setTraceColumns(std::vector<std::string>(traceColumnNames, traceColumnNames + 8), [this](unsigned iChain, float* values) {
+    const HistogramAdapterDiTau* histogramAdapter = ( iChain == 0 ) ? histogramAdapter_ : chainHistogramAdapters_[iChain - 1];
+    const LorentzVector& tau1P4 = histogramAdapter->getTau1P4();
+    const LorentzVector& tau2P4 = histogramAdapter->getTau2P4();
+    values[0] = tau1P4.px();
+    values[1] = tau1P4.py();
+    values[2] = tau1P4.pz();
+    values[3] = tau1P4.energy();
+    values[4] = tau2P4.px();
+    values[5] = tau2P4.py();
+    values[6] = tau2P4.pz();
+    values[7] = tau2P4.energy();
+  });
 }
 
 void ClassicSVfit::setIntegrationParams(bool useDiTauMassConstraint)
@@ -62,18 +466,111 @@ void ClassicSVfit::setIntegrationParams(bool useDiTauMassConstraint)
 
 void ClassicSVfit::prepareIntegrand()
 {
-  integrand_->setLeptonInputs(measuredTauLeptons_);
-  (static_cast<ClassicSVfitIntegrand*>(integrand_))->setHistogramAdapter(histogramAdapter_);
+  prepareIntegrand(integrand_, histogramAdapter_, measuredTauLeptons_);
+  for ( unsigned iChain = 0; iChain < chainIntegrands_.size(); ++iChain ) {
+    prepareIntegrand(chainIntegrands_[iChain], chainHistogramAdapters_[iChain], measuredTauLeptons_);
+  }
+  // CV: the integrands for variations of the visible momenta do not fill histograms themselves
+  unsigned numVisMomentumVariations = visMomentumVariations_.size();
+  for ( unsigned idx = 0; idx < visMomentumVariationIntegrands_.size(); ++idx ) {
+    prepareIntegrand(visMomentumVariationIntegrands_[idx], 0, visMomentumVariationTauLeptons_[idx % numVisMomentumVariations]);
+  }
+}
+
+void ClassicSVfit::prepareIntegrand(ClassicSVfitIntegrandBase* integrand, HistogramAdapterDiTau* histogramAdapter,
+                                    const std::vector<MeasuredTauLepton>& measuredTauLeptons)
+{
+  integrand->setLeptonInputs(measuredTauLeptons);
+  (static_cast<ClassicSVfitIntegrand*>(integrand))->setHistogramAdapter(histogramAdapter);
 #ifdef USE_SVFITTF
-  if ( useHadTauTF_ ) integrand_->enableHadTauTF();
-  else integrand_->disableHadTauTF();
+  if ( useHadTauTF_ ) integrand->enableHadTauTF();
+  else integrand->disableHadTauTF();
 #endif
   for ( unsigned iLeg = 0; iLeg < legIntegrationParams_.size(); ++iLeg ) {
-    integrand_->setLegIntegrationParams(iLeg, legIntegrationParams_[iLeg]);
+    integrand->setLegIntegrationParams(iLeg, legIntegrationParams_[iLeg]);
+  }
+  integrand->setNumDimensions(numDimensions_);
+  integrand->setIntegrationRanges(xl_, xh_);
+  (static_cast<ClassicSVfitIntegrand*>(integrand))->selectEvalPSKernel();
+}
+
+void ClassicSVfit::computeStartPositionCandidates(std::vector<std::vector<double> >& candidates) const
+{
+  assert(measuredTauLeptons_.size() == 2);
+
+//--- compute visible energy fractions x1, x2 in collinear approximation,
+//    i.e. assuming the neutrinos to be emitted in direction of the visible tau decay products:
+//      METx = a1*vis1Px + a2*vis2Px, METy = a1*vis1Py + a2*vis2Py, x = 1/(1 + a)
+  const MeasuredTauLepton& measuredTauLepton1 = measuredTauLeptons_[0];
+  const MeasuredTauLepton& measuredTauLepton2 = measuredTauLeptons_[1];
+  bool isPrompt1 = ( measuredTauLepton1.type() == MeasuredTauLepton::kPrompt );
+  bool isPrompt2 = ( measuredTauLepton2.type() == MeasuredTauLepton::kPrompt );
+  double a1 = 0.;
+  double a2 = 0.;
+  if ( isPrompt1 && !isPrompt2 ) {
+    a2 = (met_.x()*measuredTauLepton2.px() + met_.y()*measuredTauLepton2.py())/square(measuredTauLepton2.pt());
+  } else if ( !isPrompt1 && isPrompt2 ) {
+    a1 = (met_.x()*measuredTauLepton1.px() + met_.y()*measuredTauLepton1.py())/square(measuredTauLepton1.pt());
+  } else if ( !isPrompt1 && !isPrompt2 ) {
+    double det = measuredTauLepton1.px()*measuredTauLepton2.py() - measuredTauLepton1.py()*measuredTauLepton2.px();
+    if ( TMath::Abs(det) > 1.e-3*measuredTauLepton1.pt()*measuredTauLepton2.pt() ) {
+      a1 = (met_.x()*measuredTauLepton2.py() - met_.y()*measuredTauLepton2.px())/det;
+      a2 = (measuredTauLepton1.px()*met_.y() - measuredTauLepton1.py()*met_.x())/det;
+    } else {
+      // CV: visible tau decay products back-to-back in transverse plane, collinear approximation not defined
+      a1 = 1.;
+      a2 = 1.;
+    }
+  }
+  const double xMin = 0.01;
+  const double xMax = 0.99;
+  double xColl[2];
+  xColl[0] = ( a1 > 0. ) ? TMath::Min(TMath::Max(1./(1. + a1), xMin), xMax) : xMax;
+  xColl[1] = ( a2 > 0. ) ? TMath::Min(TMath::Max(1./(1. + a2), xMin), xMax) : xMax;
+
+//--- compute azimuthal angle of neutrinos in the local coordinate system of each visible tau decay product
+//    (same definition of axes as in FittedTauLepton::setMeasuredTauLepton), such that the neutrinos point in direction of the MET
+  double phiNu[2];
+  for ( unsigned iLeg = 0; iLeg < 2; ++iLeg ) {
+    Vector beamAxis(0., 0., 1.);
+    Vector eZ = normalize(measuredTauLeptons_[iLeg].p3());
+    Vector eY = normalize(compCrossProduct(eZ, beamAxis));
+    Vector eX = normalize(compCrossProduct(eY, eZ));
+    phiNu[iLeg] = TMath::ATan2(compScalarProduct(met_, eY), compScalarProduct(met_, eX));
+  }
+
+//--- vary energy fractions and angles around collinear approximation
+  const double xFactors[] = { 1., 0.9, 1.1, 0.75, 1.25 };
+  const double phiOffsets[] = { 0., -0.25, +0.25, -0.5, +0.5 };
+  const unsigned numXFactors = sizeof(xFactors)/sizeof(double);
+  const unsigned numPhiOffsets = sizeof(phiOffsets)/sizeof(double);
+  // CV: candidates are overwritten in place, so that the memory allocated for the previous event gets reused
+  candidates.resize(numXFactors*numPhiOffsets);
+  for ( unsigned iXFactor = 0; iXFactor < numXFactors; ++iXFactor ) {
+    for ( unsigned iPhiOffset = 0; iPhiOffset < numPhiOffsets; ++iPhiOffset ) {
+      std::vector<double>& candidate = candidates[iXFactor*numPhiOffsets + iPhiOffset];
+      candidate.assign(numDimensions_, 0.);
+      for ( unsigned iLeg = 0; iLeg < 2; ++iLeg ) {
+        const integrationParameters& legIntegrationParams = legIntegrationParams_[iLeg];
+        double x = TMath::Min(TMath::Max(xFactors[iXFactor]*xColl[iLeg], xMin), xMax);
+        if ( legIntegrationParams.idx_X_ != -1 ) {
+          candidate[legIntegrationParams.idx_X_] = x;
+        }
+        if ( legIntegrationParams.idx_phi_ != -1 ) {
+          double phi = phiNu[iLeg] + phiOffsets[iPhiOffset];
+          if ( phi > +TMath::Pi() ) phi -= 2.*TMath::Pi();
+          if ( phi < -TMath::Pi() ) phi += 2.*TMath::Pi();
+          candidate[legIntegrationParams.idx_phi_] = phi;
+        }
+        if ( legIntegrationParams.idx_VisPtShift_ != -1 ) {
+          candidate[legIntegrationParams.idx_VisPtShift_] = 1.;
+        }
+        if ( legIntegrationParams.idx_mNuNu_ != -1 ) {
+          candidate[legIntegrationParams.idx_mNuNu_] = 0.5*(1. - x)*tauLeptonMass2;
+        }
+      }
+    }
   }
-  integrand_->setNumDimensions(numDimensions_);
-  integrand_->setIntegrationRanges(xl_, xh_);
-  ClassicSVfitIntegrand::gSVfitIntegrand = static_cast<ClassicSVfitIntegrand*>(integrand_);
 }
 
 void ClassicSVfit::prepareLeptonInput(const std::vector<MeasuredTauLepton>& measuredTauLeptons)
@@ -102,13 +599,28 @@ void ClassicSVfit::integrate(const std::vector<MeasuredTauLepton>& measuredTauLe
   clock_->Reset();
   clock_->Start("<ClassicSVfit::integrate>");
 
+  // CV: initialize integrator first, as it creates the copies of the integrand used by the Markov Chains
+  if ( !intAlgo_ ) initializeMCIntegrator();
   prepareLeptonInput(measuredTauLeptons);
-  integrand_->clearMET();
+  if ( seedingPolicy_ == kEventSeed ) intAlgo_->setSeed(compEventSeed(measuredMETx, measuredMETy, covMET));
+  else intAlgo_->resetSeed();
+  clearMET();
   addMETEstimate(measuredMETx, measuredMETy, covMET);
+  if ( dynamic_cast<SVfitIntegratorMarkovChain*>(intAlgo_) ) {
+    if ( !visMomentumVariations_.empty() ) prepareVisMomentumVariations(measuredTauLeptons, measuredMETx, measuredMETy);
+    // CV: MET variations are added as further MET estimates,
+    //     for which the integrand computes the ratio of MET transfer functions to the nominal MET estimate
+    for ( std::vector<METVariation>::const_iterator metVariation = metVariations_.begin();
+          metVariation != metVariations_.end(); ++metVariation ) {
+      addMETEstimate(metVariation->measuredMETx_, metVariation->measuredMETy_, metVariation->covMET_);
+    }
+  } else if ( (!metVariations_.empty() || !visMomentumVariations_.empty()) && verbosity_ >= 1 ) {
+    std::cerr << "<ClassicSVfit::integrate>:"
+              << "Warning: systematic variations are supported by the Markov Chain integration only !!\n";
+  }
   bool useDiTauMassConstraint = (diTauMassConstraint_ > 0);
   setIntegrationParams(useDiTauMassConstraint);
   prepareIntegrand();
-  if ( !intAlgo_ ) initializeMCIntegrator();
 
   // CV: book histograms for evaluation of pT, eta, phi, mass and transverse mass of di-tau system
   if ( measuredTauLeptons_.size() == 2 ) {
@@ -116,11 +628,38 @@ void ClassicSVfit::integrate(const std::vector<MeasuredTauLepton>& measuredTauLe
     met_.SetY(measuredMETy);
     histogramAdapter_->setMeasurement(measuredTauLeptons_[0].p4(), measuredTauLeptons_[1].p4(), met_);
     histogramAdapter_->bookHistograms(measuredTauLeptons_[0].p4(), measuredTauLeptons_[1].p4(), met_);
+    for ( std::vector<HistogramAdapterDiTau*>::iterator chainHistogramAdapter = chainHistogramAdapters_.begin();
+          chainHistogramAdapter != chainHistogramAdapters_.end(); ++chainHistogramAdapter ) {
+      (*chainHistogramAdapter)->setMeasurement(measuredTauLeptons_[0].p4(), measuredTauLeptons_[1].p4(), met_);
+      (*chainHistogramAdapter)->bookHistograms(measuredTauLeptons_[0].p4(), measuredTauLeptons_[1].p4(), met_);
+    }
+    if ( !metVariations_.empty() || !visMomentumVariations_.empty() ) bookVariationHistograms();
   } else assert(0);
   
   double theIntegral, theIntegralErr;
-  intAlgo_->integrate(&g_C, xl_, xh_, numDimensions_, theIntegral, theIntegralErr);
+  SVfitIntegratorMarkovChain* intAlgoMarkovChain = dynamic_cast<SVfitIntegratorMarkovChain*>(intAlgo_);
+  if ( intAlgoMarkovChain ) {
+    if ( useStartPositionSeeding_ ) computeStartPositionCandidates(startPositionCandidates_);
+    else startPositionCandidates_.clear();
+    intAlgoMarkovChain->setStartPositionCandidates(startPositionCandidates_);
+
+    ChainIntegrand chainIntegrand(integrand_, chainIntegrands_, numDimensions_);
+    ChainObserver chainObserver(histogramAdapter_, chainHistogramAdapters_,
+                                chainIntegrand, xl_, xh_, numDimensions_,
+                                metVariationHistograms_, visMomentumVariationHistograms_, visMomentumVariationIntegrands_);
+    intAlgoMarkovChain->integrate(chainIntegrand, chainObserver, xl_, xh_, numDimensions_, theIntegral, theIntegralErr);
+  } else {
+    intAlgo_->integrate(&g_C, xl_, xh_, numDimensions_, theIntegral, theIntegralErr, static_cast<ClassicSVfitIntegrand*>(integrand_));
+  }
+  numObjFunctionCalls_ = intAlgo_->getNumCalls();
+  integratorStatistics_ = intAlgo_->getStatistics();
+  for ( std::vector<HistogramAdapterDiTau*>::iterator chainHistogramAdapter = chainHistogramAdapters_.begin();
+        chainHistogramAdapter != chainHistogramAdapters_.end(); ++chainHistogramAdapter ) {
+    histogramAdapter_->addHistograms(**chainHistogramAdapter);
+  }
   isValidSolution_ = histogramAdapter_->isValidSolution();
+  if ( !metVariations_.empty() ) compVariationResults(metVariationHistograms_, metVariationResults_, "MET");
+  if ( !visMomentumVariations_.empty() ) compVariationResults(visMomentumVariationHistograms_, visMomentumVariationResults_, "visible momentum");
   
   if ( likelihoodFileName_ != "" ) {
     histogramAdapter_->writeHistograms(likelihoodFileName_);
@@ -135,10 +674,69 @@ void ClassicSVfit::integrate(const std::vector<MeasuredTauLepton>& measuredTauLe
   }
 }
 
+ClassicSVfit* ClassicSVfit::createBatchWorker() const
+{
+  ClassicSVfit* worker = new ClassicSVfit(verbosity_);
+  worker->copyConfiguration(*this);
+  worker->diTauMassConstraint_ = diTauMassConstraint_;
+  worker->setHistogramAdapter(histogramAdapter_->clone());
+  return worker;
+}
+
+std::vector<ClassicSVfit::Result> ClassicSVfit::integrate(const std::vector<Event>& events)
+{
+  if ( !batchThreadPool_ || batchThreadPool_->getNumThreads() != numThreads_ ) {
+    delete batchThreadPool_;
+    batchThreadPool_ = new ThreadPool(numThreads_);
+  }
+
+  std::vector<ClassicSVfit*> workers;
+  for ( unsigned iThread = 0; iThread < batchThreadPool_->getNumThreads(); ++iThread ) {
+    workers.push_back(createBatchWorker());
+  }
+
+  std::vector<Result> results(events.size());
+  batchThreadPool_->parallel_for(events.size(), [&](unsigned iEvent, unsigned iThread) {
+    ClassicSVfit* worker = workers[iThread];
+    const Event& event = events[iEvent];
+    worker->integrate(event.measuredTauLeptons_, event.measuredMETx_, event.measuredMETy_, event.covMET_);
+    const HistogramAdapterDiTau* histogramAdapter = worker->getHistogramAdapter();
+    Result& result = results[iEvent];
+    result.isValidSolution_ = worker->isValidSolution();
+    result.pt_ = histogramAdapter->getPt();
+    result.ptErr_ = histogramAdapter->getPtErr();
+    result.eta_ = histogramAdapter->getEta();
+    result.etaErr_ = histogramAdapter->getEtaErr();
+    result.phi_ = histogramAdapter->getPhi();
+    result.phiErr_ = histogramAdapter->getPhiErr();
+    result.mass_ = histogramAdapter->getMass();
+    result.massErr_ = histogramAdapter->getMassErr();
+    result.transverseMass_ = histogramAdapter->getTransverseMass();
+    result.transverseMassErr_ = histogramAdapter->getTransverseMassErr();
+    result.probMax_ = worker->getProbMax();
+    result.numObjFunctionCalls_ = worker->getNumObjFunctionCalls();
+    result.numSeconds_cpu_ = worker->getComputingTime_cpu();
+    result.numSeconds_real_ = worker->getComputingTime_real();
+    result.integratorStatistics_ = worker->getIntegratorStatistics();
+  });
+
+  for ( std::vector<ClassicSVfit*>::iterator worker = workers.begin();
+        worker != workers.end(); ++worker ) {
+    delete (*worker);
+  }
+
+  return results;
+}
+
 void ClassicSVfit::setHistogramAdapter(classic_svFit::HistogramAdapterDiTau* histogramAdapter)
 {
   if ( histogramAdapter_ ) delete histogramAdapter_;
   histogramAdapter_ = histogramAdapter;
+  // CV: histograms for systematic variations are created as copies of the histogram adapter, re-create them
+  metVariationHistograms_.clear();
+  visMomentumVariationHistograms_.clear();
+  // CV: integrator holds reference to histogram adapter, re-initialize it
+  resetMCIntegrator();
 }
 
 classic_svFit::HistogramAdapterDiTau* ClassicSVfit::getHistogramAdapter() const
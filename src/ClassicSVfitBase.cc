@@ -1,6 +1,8 @@
 #include "TauAnalysis/ClassicSVfit/interface/ClassicSVfitBase.h"
 
 #include "TauAnalysis/ClassicSVfit/interface/SVfitIntegratorMarkovChain.h"
+#include "TauAnalysis/ClassicSVfit/interface/SVfitIntegratorVEGAS.h"
+#include "TauAnalysis/ClassicSVfit/interface/SVfitIntegratorQuasiMonteCarlo.h"
 
 #include <TGraphErrors.h>
 #include <TH1.h>
@@ -15,9 +17,31 @@ using namespace classic_svFit;
 
 ClassicSVfitBase::ClassicSVfitBase(int verbosity)
   : integrand_(0)
+  , covMET_rounded_(2, 2)
   , intAlgo_(0)
+  , integratorType_("MarkovChain")
   , maxObjFunctionCalls_(100000)
+  , numChains_(1)
+  , numThreads_(1)
+  , randomGeneratorType_("TRandom3")
+  , seedingPolicy_(kFixedSeed)
+  , seedSalt_(0)
+  , useStartPositionSeeding_(false)
+  , useAdaptiveStepSize_(false)
+  , targetAcceptanceRate_(0.3)
+  , minFractionAdaptation_(0.2)
+  , annealingSchedule_()
+  , numTries_(1)
+  , numLeapfrogSteps_(0)
+  , leapfrogStepSize_(2.e-2)
+  , useLogDomain_(false)
+  , useEarlyStopping_(false)
+  , earlyStoppingPrecision_(1.e-2)
+  , minObjFunctionCalls_(20000)
+  , numObjFunctionCalls_(0)
+  , integratorStatistics_()
   , treeFileName_("")
+  , treeThinning_(1)
   , likelihoodFileName_("")
   , numDimensions_(0)
   , xl_(nullptr)
@@ -35,6 +59,10 @@ ClassicSVfitBase::ClassicSVfitBase(int verbosity)
 ClassicSVfitBase::~ClassicSVfitBase()
 {
   delete integrand_;
+  for ( std::vector<ClassicSVfitIntegrandBase*>::iterator chainIntegrand = chainIntegrands_.begin();
+        chainIntegrand != chainIntegrands_.end(); ++chainIntegrand ) {
+    delete (*chainIntegrand);
+  }
 
   if ( intAlgo_ ) {
     delete intAlgo_;
@@ -50,39 +78,67 @@ void ClassicSVfitBase::setVerbosity(int aVerbosity)
 {
   verbosity_ = aVerbosity;
   integrand_->setVerbosity(verbosity_);
+  for ( unsigned iChain = 0; iChain < chainIntegrands_.size(); ++iChain ) {
+    chainIntegrands_[iChain]->setVerbosity(verbosity_);
+  }
+  integrandConfigurationChanged();
 }
 
 void ClassicSVfitBase::addLogM_fixed(bool value, double power)
 {
   integrand_->addLogM_fixed(value, power);
+  for ( unsigned iChain = 0; iChain < chainIntegrands_.size(); ++iChain ) {
+    chainIntegrands_[iChain]->addLogM_fixed(value, power);
+  }
+  integrandConfigurationChanged();
 }
 
 void ClassicSVfitBase::addLogM_dynamic(bool value, const std::string& power)
 {
   integrand_->addLogM_dynamic(value, power);
+  for ( unsigned iChain = 0; iChain < chainIntegrands_.size(); ++iChain ) {
+    chainIntegrands_[iChain]->addLogM_dynamic(value, power);
+  }
+  integrandConfigurationChanged();
 }
 
 #ifdef USE_SVFITTF
 void ClassicSVfitBase::setHadTauTF(const HadTauTFBase* hadTauTF)
 {
   integrand_->setHadTauTF(hadTauTF);
+  for ( unsigned iChain = 0; iChain < chainIntegrands_.size(); ++iChain ) {
+    chainIntegrands_[iChain]->setHadTauTF(hadTauTF);
+  }
+  integrandConfigurationChanged();
 }
 
 void ClassicSVfitBase::enableHadTauTF()
 {
   integrand_->enableHadTauTF();
+  for ( unsigned iChain = 0; iChain < chainIntegrands_.size(); ++iChain ) {
+    chainIntegrands_[iChain]->enableHadTauTF();
+  }
   useHadTauTF_ = true;
+  integrandConfigurationChanged();
 }
 
 void ClassicSVfitBase::disableHadTauTF()
 {
   integrand_->disableHadTauTF();
+  for ( unsigned iChain = 0; iChain < chainIntegrands_.size(); ++iChain ) {
+    chainIntegrands_[iChain]->disableHadTauTF();
+  }
   useHadTauTF_ = false;
+  integrandConfigurationChanged();
 }
 
 void ClassicSVfitBase::setRhoHadTau(double rhoHadTau)
 {
   integrand_->setRhoHadTau(rhoHadTau);
+  for ( unsigned iChain = 0; iChain < chainIntegrands_.size(); ++iChain ) {
+    chainIntegrands_[iChain]->setRhoHadTau(rhoHadTau);
+  }
+  integrandConfigurationChanged();
 }
 #endif
 
@@ -90,6 +146,151 @@ void ClassicSVfitBase::setRhoHadTau(double rhoHadTau)
 void ClassicSVfitBase::setMaxObjFunctionCalls(unsigned maxObjFunctionCalls)
 {
   maxObjFunctionCalls_ = maxObjFunctionCalls;
+  resetMCIntegrator();
+}
+
+void ClassicSVfitBase::setIntegrator(const std::string& integratorType)
+{
+  if ( !(integratorType == "MarkovChain" || integratorType == "VEGAS" || integratorType == "QuasiMonteCarlo") ) {
+    std::cerr << "<ClassicSVfitBase::setIntegrator>:"
+              << "Invalid Configuration Parameter 'integratorType' = " << integratorType << ","
+              << " expected to be either \"MarkovChain\", \"VEGAS\" or \"QuasiMonteCarlo\" --> ABORTING !!\n";
+    assert(0);
+  }
+  integratorType_ = integratorType;
+  resetMCIntegrator();
+}
+
+void ClassicSVfitBase::setNumChains(unsigned numChains)
+{
+  assert(numChains >= 1);
+  numChains_ = numChains;
+  resetMCIntegrator();
+}
+
+void ClassicSVfitBase::setNumThreads(unsigned numThreads)
+{
+  assert(numThreads >= 1);
+  numThreads_ = numThreads;
+  resetMCIntegrator();
+}
+
+void ClassicSVfitBase::setRandomGenerator(const std::string& randomGeneratorType)
+{
+  randomGeneratorType_ = randomGeneratorType;
+  resetMCIntegrator();
+}
+
+void ClassicSVfitBase::setSeedingPolicy(SeedingPolicy seedingPolicy, unsigned long salt)
+{
+  seedingPolicy_ = seedingPolicy;
+  seedSalt_ = salt;
+}
+
+unsigned long ClassicSVfitBase::compEventSeed(double measuredMETx, double measuredMETy, const TMatrixD& covMET) const
+{
+  uint64_t seed = seedSalt_;
+  for ( std::vector<MeasuredTauLepton>::const_iterator measuredTauLepton = measuredTauLeptons_.begin();
+        measuredTauLepton != measuredTauLeptons_.end(); ++measuredTauLepton ) {
+    seed = hashSeed(seed, static_cast<uint64_t>(measuredTauLepton->type()));
+    seed = hashSeed(seed, static_cast<uint64_t>(measuredTauLepton->decayMode()));
+    seed = hashSeed(seed, measuredTauLepton->pt());
+    seed = hashSeed(seed, measuredTauLepton->eta());
+    seed = hashSeed(seed, measuredTauLepton->phi());
+    seed = hashSeed(seed, measuredTauLepton->mass());
+  }
+  // CV: round MET and its covariance matrix in the same way as addMETEstimate
+  seed = hashSeed(seed, roundToNdigits(measuredMETx));
+  seed = hashSeed(seed, roundToNdigits(measuredMETy));
+  seed = hashSeed(seed, roundToNdigits(covMET[0][0]));
+  seed = hashSeed(seed, roundToNdigits(covMET[1][0]));
+  seed = hashSeed(seed, roundToNdigits(covMET[0][1]));
+  seed = hashSeed(seed, roundToNdigits(covMET[1][1]));
+  return seed;
+}
+
+void ClassicSVfitBase::enableStartPositionSeeding()
+{
+  useStartPositionSeeding_ = true;
+}
+
+void ClassicSVfitBase::disableStartPositionSeeding()
+{
+  useStartPositionSeeding_ = false;
+}
+
+void ClassicSVfitBase::enableAdaptiveStepSize(double targetAcceptanceRate, double minFractionAdaptation)
+{
+  useAdaptiveStepSize_ = true;
+  targetAcceptanceRate_ = targetAcceptanceRate;
+  minFractionAdaptation_ = minFractionAdaptation;
+  resetMCIntegrator();
+}
+
+void ClassicSVfitBase::disableAdaptiveStepSize()
+{
+  useAdaptiveStepSize_ = false;
+  resetMCIntegrator();
+}
+
+void ClassicSVfitBase::setAnnealingSchedule(const AnnealingSchedule& schedule)
+{
+  assert(schedule.fractionPhase1_ >= 0. && schedule.fractionPhase2_ >= 0. && (schedule.fractionPhase1_ + schedule.fractionPhase2_) <= 1.);
+  annealingSchedule_ = schedule;
+  resetMCIntegrator();
+}
+
+void ClassicSVfitBase::enableMultipleTryMetropolis(unsigned numTries)
+{
+  assert(numTries >= 1);
+  numTries_ = numTries;
+  resetMCIntegrator();
+}
+
+void ClassicSVfitBase::disableMultipleTryMetropolis()
+{
+  numTries_ = 1;
+  resetMCIntegrator();
+}
+
+void ClassicSVfitBase::enableHamiltonianMonteCarlo(unsigned numLeapfrogSteps, double stepSize)
+{
+  assert(numLeapfrogSteps >= 1);
+  numLeapfrogSteps_ = numLeapfrogSteps;
+  leapfrogStepSize_ = stepSize;
+  resetMCIntegrator();
+}
+
+void ClassicSVfitBase::disableHamiltonianMonteCarlo()
+{
+  numLeapfrogSteps_ = 0;
+  resetMCIntegrator();
+}
+
+void ClassicSVfitBase::enableLogDomain()
+{
+  useLogDomain_ = true;
+  resetMCIntegrator();
+}
+
+void ClassicSVfitBase::disableLogDomain()
+{
+  useLogDomain_ = false;
+  resetMCIntegrator();
+}
+
+void ClassicSVfitBase::enableEarlyStopping(double precision, unsigned minObjFunctionCalls)
+{
+  useEarlyStopping_ = true;
+  earlyStoppingPrecision_ = precision;
+  minObjFunctionCalls_ = minObjFunctionCalls;
+  resetMCIntegrator();
+}
+
+void ClassicSVfitBase::disableEarlyStopping()
+{
+  useEarlyStopping_ = false;
+  resetMCIntegrator();
 }
 
 void ClassicSVfitBase::setLikelihoodFileName(const std::string& likelihoodFileName)
@@ -100,6 +301,13 @@ void ClassicSVfitBase::setLikelihoodFileName(const std::string& likelihoodFileNa
 void ClassicSVfitBase::setTreeFileName(const std::string& treeFileName)
 {
   treeFileName_ = treeFileName;
+  resetMCIntegrator();
+}
+
+void ClassicSVfitBase::setTreeThinning(unsigned thinning)
+{
+  treeThinning_ = thinning;
+  resetMCIntegrator();
 }
 
 bool ClassicSVfitBase::isValidSolution() const 
@@ -107,6 +315,11 @@ bool ClassicSVfitBase::isValidSolution() const
   return isValidSolution_;
 }
 
+long ClassicSVfitBase::getNumObjFunctionCalls() const
+{
+  return numObjFunctionCalls_;
+}
+
 double ClassicSVfitBase::getComputingTime_cpu() const 
 {
   return numSeconds_cpu_;
@@ -119,23 +332,119 @@ double ClassicSVfitBase::getComputingTime_real() const
 
 void ClassicSVfitBase::initializeMCIntegrator()
 {
-  //unsigned numChains = TMath::Nint(maxObjFunctionCalls_/100000.);
-  unsigned numChains = 1;
-  unsigned numIterBurnin = TMath::Nint(0.10*maxObjFunctionCalls_/numChains);
-  unsigned numIterSampling = TMath::Nint(0.90*maxObjFunctionCalls_/numChains);
-  unsigned numIterSimAnnealingPhase1 = TMath::Nint(0.20*numIterBurnin);
-  unsigned numIterSimAnnealingPhase2 = TMath::Nint(0.60*numIterBurnin);
+  for ( std::vector<ClassicSVfitIntegrandBase*>::iterator chainIntegrand = chainIntegrands_.begin();
+        chainIntegrand != chainIntegrands_.end(); ++chainIntegrand ) {
+    delete (*chainIntegrand);
+  }
+  chainIntegrands_.clear();
+
+  if ( integratorType_ == "VEGAS" ) {
+    // CV: split function calls evenly among "training" and "sampling" iterations
+    unsigned numIterTraining = 5;
+    unsigned numIterSampling = 5;
+    unsigned numCallsPerIteration = TMath::Max(2, TMath::Nint(static_cast<double>(maxObjFunctionCalls_)/(numIterTraining + numIterSampling)));
+    SVfitIntegratorVEGAS* intAlgoVEGAS = new SVfitIntegratorVEGAS(
+      numCallsPerIteration, numIterTraining, numIterSampling,
+      50, 1.5,
+      0);
+    intAlgoVEGAS->setRandomGenerator(randomGeneratorType_);
+    intAlgo_ = intAlgoVEGAS;
+    return;
+  } else if ( integratorType_ == "QuasiMonteCarlo" ) {
+    // CV: split function calls evenly among independent scramblings of the Sobol sequence;
+    //     the number of points per scrambling is rounded down to a power of 2, for which the Sobol sequence is balanced
+    unsigned numScramblings = 8;
+    unsigned numPointsPerScrambling = 1;
+    while ( 2*numPointsPerScrambling*numScramblings <= maxObjFunctionCalls_ ) {
+      numPointsPerScrambling *= 2;
+    }
+    SVfitIntegratorQuasiMonteCarlo* intAlgoQuasiMonteCarlo = new SVfitIntegratorQuasiMonteCarlo(
+      numPointsPerScrambling, numScramblings,
+      0);
+    intAlgoQuasiMonteCarlo->setRandomGenerator(randomGeneratorType_);
+    intAlgo_ = intAlgoQuasiMonteCarlo;
+    return;
+  }
+
+  // CV: split function calls among chains;
+  //     number of sampling iterations per chain needs to be a multiple of the number of batches
+  //    (SVfitIntegratorMarkovChain aborts otherwise, so rounding changes the number of iterations
+  //     only for values of maxObjFunctionCalls that could not be used before);
+  //     multiple-try Metropolis moves take 2*numTries integrand evaluations
+  //    (2*numTries - 1 for the move and one to evaluate the "call-back" functions at the current position),
+  //     Hamiltonian Monte Carlo moves take up to numLeapfrogSteps + 1 evaluations of integrand (and gradient)
+  unsigned numChains = numChains_;
+  unsigned numCallsPerMove = 1;
+  if      ( numLeapfrogSteps_ > 0 ) numCallsPerMove = numLeapfrogSteps_ + 1;
+  else if ( numTries_ > 1         ) numCallsPerMove = 2*numTries_;
+  unsigned numBatches = 100;
+  unsigned numIterBurnin = TMath::Nint(0.10*maxObjFunctionCalls_/(numChains*numCallsPerMove));
+  unsigned numIterSampling = numBatches*TMath::Max(1, TMath::Nint(0.90*maxObjFunctionCalls_/(numChains*numCallsPerMove*numBatches)));
+  unsigned numIterSimAnnealingPhase1 = TMath::Nint(annealingSchedule_.fractionPhase1_*numIterBurnin);
+  unsigned numIterSimAnnealingPhase2 = TMath::Min(TMath::Nint(annealingSchedule_.fractionPhase2_*numIterBurnin), static_cast<int>(numIterBurnin - numIterSimAnnealingPhase1));
+  double alpha = ( annealingSchedule_.alpha_ > 0. ) ? annealingSchedule_.alpha_ : 1. - 1./(0.1*numIterBurnin);
   if ( treeFileName_ == "" && verbosity_ >= 2 ) {
-    treeFileName_ = "SVfitIntegratorMarkovChain_ClassicSVfit.root";
+    treeFileName_ = "SVfitIntegratorMarkovChain_ClassicSVfit.trace";
   }
-  intAlgo_ = new SVfitIntegratorMarkovChain(
+  SVfitIntegratorMarkovChain* intAlgoMarkovChain = new SVfitIntegratorMarkovChain(
     "uniform",
     numIterBurnin, numIterSampling, numIterSimAnnealingPhase1, numIterSimAnnealingPhase2,
-    15., 1. - 1./(0.1*numIterBurnin),
-    numChains, 100,
+    annealingSchedule_.T0_, alpha,
+    numChains, numBatches,
     1.e-2, 0.71,
     treeFileName_.data(),
     0);
+  intAlgoMarkovChain->setNumThreads(numThreads_);
+  intAlgoMarkovChain->setRandomGenerator(randomGeneratorType_);
+  intAlgoMarkovChain->setAdaptiveStepSize(useAdaptiveStepSize_, targetAcceptanceRate_, minFractionAdaptation_);
+  unsigned numIterEnergyWindow = TMath::Max(1, TMath::Nint(annealingSchedule_.fractionEnergyWindow_*numIterBurnin));
+  intAlgoMarkovChain->setAutoAnnealing(annealingSchedule_.isAuto_, annealingSchedule_.minProbRatio_, annealingSchedule_.energyTolerance_, numIterEnergyWindow);
+  intAlgoMarkovChain->setMultipleTry(numTries_);
+  intAlgoMarkovChain->setHamiltonianMonteCarlo(numLeapfrogSteps_, leapfrogStepSize_);
+  intAlgoMarkovChain->setLogDomain(useLogDomain_);
+  intAlgoMarkovChain->setTraceThinning(treeThinning_);
+  // CV: minimum number of function calls includes the "burnin" stage
+  int minIterSampling = TMath::Nint(static_cast<double>(minObjFunctionCalls_)/(numChains*numCallsPerMove)) - static_cast<int>(numIterBurnin);
+  intAlgoMarkovChain->setEarlyStopping(useEarlyStopping_, earlyStoppingPrecision_, TMath::Max(0, minIterSampling));
+  intAlgo_ = intAlgoMarkovChain;
+
+  // CV: create copies of integrand for Markov Chains run in parallel threads
+  for ( unsigned iChain = 1; iChain < numChains; ++iChain ) {
+    chainIntegrands_.push_back(integrand_->clone());
+  }
+}
+
+void ClassicSVfitBase::resetMCIntegrator()
+{
+  delete intAlgo_;
+  intAlgo_ = 0;
+}
+
+void ClassicSVfitBase::copyConfiguration(const ClassicSVfitBase& other)
+{
+  delete integrand_;
+  integrand_ = other.integrand_->clone();
+  verbosity_ = other.verbosity_;
+  integratorType_ = other.integratorType_;
+  maxObjFunctionCalls_ = other.maxObjFunctionCalls_;
+  numChains_ = other.numChains_;
+  randomGeneratorType_ = other.randomGeneratorType_;
+  seedingPolicy_ = other.seedingPolicy_;
+  seedSalt_ = other.seedSalt_;
+  useStartPositionSeeding_ = other.useStartPositionSeeding_;
+  useAdaptiveStepSize_ = other.useAdaptiveStepSize_;
+  targetAcceptanceRate_ = other.targetAcceptanceRate_;
+  minFractionAdaptation_ = other.minFractionAdaptation_;
+  annealingSchedule_ = other.annealingSchedule_;
+  numTries_ = other.numTries_;
+  numLeapfrogSteps_ = other.numLeapfrogSteps_;
+  leapfrogStepSize_ = other.leapfrogStepSize_;
+  useLogDomain_ = other.useLogDomain_;
+  useEarlyStopping_ = other.useEarlyStopping_;
+  earlyStoppingPrecision_ = other.earlyStoppingPrecision_;
+  minObjFunctionCalls_ = other.minObjFunctionCalls_;
+  useHadTauTF_ = other.useHadTauTF_;
+  resetMCIntegrator();
 }
 
 void ClassicSVfitBase::printMET(double measuredMETx, double measuredMETy, const TMatrixD& covMET) const
@@ -243,6 +552,9 @@ void ClassicSVfitBase::setIntegrationRanges(unsigned iLeg)
 void ClassicSVfitBase::clearMET()
 { 
   integrand_->clearMET();
+  for ( unsigned iChain = 0; iChain < chainIntegrands_.size(); ++iChain ) {
+    chainIntegrands_[iChain]->clearMET();
+  }
 }
 
 void ClassicSVfitBase::addMETEstimate(double measuredMETx, double measuredMETy, const TMatrixD& covMET)
@@ -250,12 +562,14 @@ void ClassicSVfitBase::addMETEstimate(double measuredMETx, double measuredMETy,
   double metX = roundToNdigits(measuredMETx);
   double metY = roundToNdigits(measuredMETy);
 
-  TMatrixD aCovMET(2,2);
-  aCovMET[0][0] = roundToNdigits(covMET[0][0]);
-  aCovMET[1][0] = roundToNdigits(covMET[1][0]);
-  aCovMET[0][1] = roundToNdigits(covMET[0][1]);
-  aCovMET[1][1] = roundToNdigits(covMET[1][1]);
+  covMET_rounded_[0][0] = roundToNdigits(covMET[0][0]);
+  covMET_rounded_[1][0] = roundToNdigits(covMET[1][0]);
+  covMET_rounded_[0][1] = roundToNdigits(covMET[0][1]);
+  covMET_rounded_[1][1] = roundToNdigits(covMET[1][1]);
   
-  if ( verbosity_ >= 1 ) printMET(metX, metY, aCovMET);
-  integrand_->addMETEstimate(metX, metY, aCovMET);
+  if ( verbosity_ >= 1 ) printMET(metX, metY, covMET_rounded_);
+  integrand_->addMETEstimate(metX, metY, covMET_rounded_);
+  for ( unsigned iChain = 0; iChain < chainIntegrands_.size(); ++iChain ) {
+    chainIntegrands_[iChain]->addMETEstimate(metX, metY, covMET_rounded_);
+  }
 }
@@ -1,23 +1,46 @@
 #include "TauAnalysis/ClassicSVfit/interface/ClassicSVfitIntegrand.h"
 
 #include "TauAnalysis/ClassicSVfit/interface/SVfitIntegratorMarkovChain.h"
+#include "TauAnalysis/ClassicSVfit/interface/svFitDual.h"
 
 #include <TMath.h>
 #include <TString.h> // Form
 #include <Math/VectorUtil.h>
 
 #include <math.h>
+#include <algorithm> // std::min
+#include <limits>    // std::numeric_limits
 
 using namespace classic_svFit;
 
-/// global function pointer, needed for Markov Chain integration
-const ClassicSVfitIntegrand* ClassicSVfitIntegrand::gSVfitIntegrand = 0;
+namespace
+{
+  /// value returned by EvalPS (isLog = false) and EvalLogPS (isLog = true) in case the integrand is zero
+  template <bool isLog>
+  inline double zeroProb()
+  {
+    return ( isLog ) ? -std::numeric_limits<double>::infinity() : 0.;
+  }
+
+  const double logConstFactor = TMath::Log(classic_svFit::constFactor) + TMath::Log(classic_svFit::matrixElementNorm);
+}
 
 ClassicSVfitIntegrand::ClassicSVfitIntegrand(int verbosity)
   : ClassicSVfitIntegrandBase(verbosity)
+  , evalPSKernel_(&ClassicSVfitIntegrand::EvalPS_generic<false>)
+  , evalLogPSKernel_(&ClassicSVfitIntegrand::EvalPS_generic<true>)
   , fittedTauLepton1_(0, verbosity)
+  , leg1isLeptonicTauDecay_(false)
+  , leg1isHadronicTauDecay_(false)
+  , leg1isPrompt_(false)
   , fittedTauLepton2_(1, verbosity)
+  , leg2isLeptonicTauDecay_(false)
+  , leg2isHadronicTauDecay_(false)
+  , leg2isPrompt_(false)
+  , mVis_measured_(0.)
+  , mVis2_measured_(0.)
   , diTauMassConstraint_(-1.)
+  , diTauMassConstraint2_(-1.)
   , histogramAdapter_(nullptr)
 {
   if ( verbosity_ ) {
@@ -40,9 +63,35 @@ ClassicSVfitIntegrand::ClassicSVfitIntegrand(int verbosity)
   fittedTauLeptons_.resize(numTaus_);
   fittedTauLeptons_[0] = &fittedTauLepton1_;
   fittedTauLeptons_[1] = &fittedTauLepton2_;
+}
 
-  // set global function pointer to this
-  gSVfitIntegrand = this;
+ClassicSVfitIntegrand::ClassicSVfitIntegrand(const ClassicSVfitIntegrand& integrand)
+  : ClassicSVfitIntegrandBase(integrand)
+  , evalPSKernel_(integrand.evalPSKernel_)
+  , evalLogPSKernel_(integrand.evalLogPSKernel_)
+  , measuredTauLepton1_(integrand.measuredTauLepton1_)
+  , fittedTauLepton1_(integrand.fittedTauLepton1_)
+  , leg1isLeptonicTauDecay_(integrand.leg1isLeptonicTauDecay_)
+  , leg1isHadronicTauDecay_(integrand.leg1isHadronicTauDecay_)
+  , leg1isPrompt_(integrand.leg1isPrompt_)
+  , measuredTauLepton2_(integrand.measuredTauLepton2_)
+  , fittedTauLepton2_(integrand.fittedTauLepton2_)
+  , leg2isLeptonicTauDecay_(integrand.leg2isLeptonicTauDecay_)
+  , leg2isHadronicTauDecay_(integrand.leg2isHadronicTauDecay_)
+  , leg2isPrompt_(integrand.leg2isPrompt_)
+  , mVis_measured_(integrand.mVis_measured_)
+  , mVis2_measured_(integrand.mVis2_measured_)
+  , diTauMassConstraint_(integrand.diTauMassConstraint_)
+  , diTauMassConstraint2_(integrand.diTauMassConstraint2_)
+  , histogramAdapter_(integrand.histogramAdapter_)
+{
+  for ( unsigned iLeg = 0; iLeg < 2; ++iLeg ) {
+    legConstants_[iLeg] = integrand.legConstants_[iLeg];
+  }
+
+  fittedTauLeptons_.resize(numTaus_);
+  fittedTauLeptons_[0] = &fittedTauLepton1_;
+  fittedTauLeptons_[1] = &fittedTauLepton2_;
 }
 
 ClassicSVfitIntegrand::~ClassicSVfitIntegrand()
@@ -52,6 +101,11 @@ ClassicSVfitIntegrand::~ClassicSVfitIntegrand()
   }
 }
 
+ClassicSVfitIntegrand* ClassicSVfitIntegrand::clone() const
+{
+  return new ClassicSVfitIntegrand(*this);
+}
+
 void ClassicSVfitIntegrand::setDiTauMassConstraint(double diTauMass)
 {
   diTauMassConstraint_ = diTauMass;
@@ -91,6 +145,68 @@ void ClassicSVfitIntegrand::setLeptonInputs(const std::vector<MeasuredTauLepton>
 }
 
 double ClassicSVfitIntegrand::EvalPS(const double* q) const
+{
+  return (this->*evalPSKernel_)(q);
+}
+
+double ClassicSVfitIntegrand::EvalLogPS(const double* q) const
+{
+  return (this->*evalLogPSKernel_)(q);
+}
+
+template <bool isLog>
+double ClassicSVfitIntegrand::compProbPS(double prob_tauDecay, double prob_TF, double mTauTau, double jacobiFactor) const
+{
+  if ( isLog ) {
+    double logProb = logConstFactor + TMath::Log(prob_tauDecay) + TMath::Log(prob_TF) + TMath::Log(jacobiFactor);
+    if ( mTauTau > 1. ) {
+      if ( addLogM_dynamic_ ) {
+        logProb -= TMath::Max(0., evalLogM_dynamic_power(mTauTau))*TMath::Log(mTauTau);
+      } else if ( addLogM_fixed_ ) {
+        logProb -= addLogM_fixed_power_*TMath::Log(mTauTau);
+      }
+    }
+    if ( verbosity_ >= 2 ) {
+      std::cout << "mTauTau = " << mTauTau << std::endl;
+      std::cout << "log(prob): decay = " << TMath::Log(prob_tauDecay) << ","
+                << " TF = " << TMath::Log(prob_TF) << ", Jacobi = " << TMath::Log(jacobiFactor)
+                << " --> returning " << logProb << std::endl;
+    }
+    if ( TMath::IsNaN(logProb) ) {
+      logProb = zeroProb<isLog>();
+    }
+    return logProb;
+  }
+
+  double prob_PS_and_tauDecay = classic_svFit::constFactor;
+  prob_PS_and_tauDecay *= prob_tauDecay;
+  prob_PS_and_tauDecay *= classic_svFit::matrixElementNorm;
+
+  double prob_logM = 1.;
+  if ( addLogM_fixed_ ) {
+    prob_logM = 1./TMath::Power(TMath::Max(1., mTauTau), addLogM_fixed_power_);
+  }
+  if ( addLogM_dynamic_ ) {
+    double addLogM_power = evalLogM_dynamic_power(mTauTau);
+    prob_logM = 1./TMath::Power(TMath::Max(1., mTauTau), TMath::Max(0., addLogM_power));
+  }
+
+  double prob = prob_PS_and_tauDecay*prob_TF*prob_logM*jacobiFactor;
+  if ( verbosity_ >= 2 ) {
+    std::cout << "mTauTau = " << mTauTau << std::endl;
+    std::cout << "prob: PS+decay = " << prob_PS_and_tauDecay << ","
+              << " TF = " << prob_TF << ", log(M) = " << prob_logM << ", Jacobi = " << jacobiFactor 
+	      << " --> returning " << prob << std::endl;
+  }
+  if ( TMath::IsNaN(prob) ) {
+    prob = 0.;
+  }
+
+  return prob;
+}
+
+template <bool isLog>
+double ClassicSVfitIntegrand::EvalPS_generic(const double* q) const
 {
   rescaleX(q);
 
@@ -108,7 +224,7 @@ double ClassicSVfitIntegrand::EvalPS(const double* q) const
   if ( errorCode_ & MatrixInversion ||
        errorCode_ & LeptonNumber    ||
        errorCode_ & TestMass        ) {
-    return 0.; 
+    return zeroProb<isLog>();
   }
 
   double visPtShift1 = 1.;
@@ -119,7 +235,7 @@ double ClassicSVfitIntegrand::EvalPS(const double* q) const
   if( useHadTauTF_ && idx_visPtShift1 != -1 && !leg1isLeptonicTauDecay_ ) visPtShift1 = (1./x_[idx_visPtShift1]);
   if( useHadTauTF_ && idx_visPtShift2 != -1 && !leg2isLeptonicTauDecay_ ) visPtShift2 = (1./x_[idx_visPtShift2]);
 #endif
-  if ( visPtShift1 < 1.e-2 || visPtShift2 < 1.e-2 ) return 0.;
+  if ( visPtShift1 < 1.e-2 || visPtShift2 < 1.e-2 ) return zeroProb<isLog>();
 
   // scale momenta of visible tau decays products
   fittedTauLepton1_.updateVisMomentum(visPtShift1);
@@ -133,7 +249,7 @@ double ClassicSVfitIntegrand::EvalPS(const double* q) const
     x1_dash = x_[idx_x1];
   }
   double x1 = x1_dash/visPtShift1;
-  if ( !(x1 >= 1.e-5 && x1 <= 1.) ) return 0.;
+  if ( !(x1 >= 1.e-5 && x1 <= 1.) ) return zeroProb<isLog>();
 
   double x2_dash = 1.;
   if ( !leg2isPrompt_ ) {
@@ -145,7 +261,7 @@ double ClassicSVfitIntegrand::EvalPS(const double* q) const
     }
   }
   double x2 = x2_dash/visPtShift2;
-  if ( !(x2 >= 1.e-5 && x2 <= 1.) ) return 0.;
+  if ( !(x2 >= 1.e-5 && x2 <= 1.) ) return zeroProb<isLog>();
 
   // compute neutrino and tau lepton momenta 
   if ( !leg1isPrompt_ ) {
@@ -158,7 +274,7 @@ double ClassicSVfitIntegrand::EvalPS(const double* q) const
     //std::cout << "fittedTauLepton1: errorCode = " << fittedTauLepton1_.errorCode() << std::endl;
     if ( fittedTauLepton1_.errorCode() != FittedTauLepton::None ) {
       errorCode_ |= TauDecayParameters;
-      return 0.;
+      return zeroProb<isLog>();
     }
   }
 
@@ -172,7 +288,7 @@ double ClassicSVfitIntegrand::EvalPS(const double* q) const
     //std::cout << "fittedTauLepton2: errorCode = " << fittedTauLepton2_.errorCode() << std::endl;
     if ( fittedTauLepton2_.errorCode() != FittedTauLepton::None ) {
       errorCode_ |= TauDecayParameters;
-      return 0.;
+      return zeroProb<isLog>();
     }
   }
 
@@ -194,7 +310,6 @@ double ClassicSVfitIntegrand::EvalPS(const double* q) const
     }
   }
 
-  double prob_PS_and_tauDecay = classic_svFit::constFactor;
   double prob_tauDecay = 1.;
   double prob_TF = 1.;
   for ( unsigned iTau = 0; iTau < numTaus_; ++iTau ) {
@@ -223,18 +338,7 @@ double ClassicSVfitIntegrand::EvalPS(const double* q) const
     }
 #endif
   }
-  prob_PS_and_tauDecay *= prob_tauDecay;
-  prob_PS_and_tauDecay *= classic_svFit::matrixElementNorm;
-
   double mTauTau = (fittedTauLepton1_.tauP4() + fittedTauLepton2_.tauP4()).mass();
-  double prob_logM = 1.;
-  if ( addLogM_fixed_ ) {
-    prob_logM = 1./TMath::Power(TMath::Max(1., mTauTau), addLogM_fixed_power_);
-  }
-  if ( addLogM_dynamic_ ) {    
-    double addLogM_power = addLogM_dynamic_formula_->Eval(mTauTau);
-    prob_logM = 1./TMath::Power(TMath::Max(1., mTauTau), TMath::Max(0., addLogM_power));
-  }
 
   double jacobiFactor = 1./(visPtShift1*visPtShift2); // product of derrivatives dx1/dx1' and dx2/dx2' for parametrization of x1, x2 by x1', x2'
   if ( diTauMassConstraint_ > 0. ) {
@@ -246,18 +350,148 @@ double ClassicSVfitIntegrand::EvalPS(const double* q) const
   //std::cout << "call #" << numCalls << ":" << std::endl;
   //if ( numCalls > 100 ) assert(0);
 
-  double prob = prob_PS_and_tauDecay*prob_TF*prob_logM*jacobiFactor;
-  if ( verbosity_ >= 2 ) {
-    std::cout << "mTauTau = " << mTauTau << std::endl;
-    std::cout << "prob: PS+decay = " << prob_PS_and_tauDecay << ","
-              << " TF = " << prob_TF << ", log(M) = " << prob_logM << ", Jacobi = " << jacobiFactor 
-	      << " --> returning " << prob << std::endl;
+  return compProbPS<isLog>(prob_tauDecay, prob_TF, mTauTau, jacobiFactor);
+}
+
+template <int legType>
+bool ClassicSVfitIntegrand::updateTauMomentum_kernel(FittedTauLepton& fittedTauLepton, unsigned iLeg, double x) const
+{
+  const LegConstants& legConstants = legConstants_[iLeg];
+  double phiNu = x_[legConstants.idx_phi_];
+  double nuMass = ( legType == kLeptonicLeg ) ? TMath::Sqrt(x_[legConstants.idx_mNuNu_]) : 0.;
+  fittedTauLepton.updateTauMomentum(x, phiNu, nuMass);
+  if ( fittedTauLepton.errorCode() != FittedTauLepton::None ) {
+    errorCode_ |= TauDecayParameters;
+    return false;
   }
-  if ( TMath::IsNaN(prob) ) {
-    prob = 0.;
+  return true;
+}
+
+template <int legType>
+double ClassicSVfitIntegrand::compPSfactor_kernel(const FittedTauLepton& fittedTauLepton, unsigned iLeg) const
+{
+  const LegConstants& legConstants = legConstants_[iLeg];
+  const LorentzVector& nuP4 = fittedTauLepton.nuP4();
+  if ( legType == kLeptonicLeg ) {
+    return compPSfactor_tauToLepDecay(fittedTauLepton.x(), legConstants.visEn_, legConstants.visP_, legConstants.visMass_, legConstants.visMass2_, legConstants.minX_,
+                                      nuP4.E(), nuP4.P(), fittedTauLepton.nuMass());
+  } else if ( legType == kHadronicLeg ) {
+    return compPSfactor_tauToHadDecay(fittedTauLepton.x(), legConstants.visEn_, legConstants.visP_, legConstants.visMass2_, legConstants.minX_, legConstants.psNorm_,
+                                      nuP4.E(), nuP4.P());
   }
+  return 1.;
+}
 
-  return prob;
+template <int leg1Type, int leg2Type, bool hasMassConstraint, bool isLog>
+double ClassicSVfitIntegrand::EvalPS_kernel(const double* q) const
+{
+  rescaleX(q);
+
+  // in case of initialization errors don't start to do anything
+  if ( errorCode_ & MatrixInversion ||
+       errorCode_ & LeptonNumber    ||
+       errorCode_ & TestMass        ) {
+    return zeroProb<isLog>();
+  }
+
+  // CV: momenta of visible tau decay products do not depend on the integration variables
+  //     and have been computed by selectEvalPSKernel
+
+  // compute visible energy fractions for both taus
+  double x1 = ( leg1Type != kPromptLeg ) ? x_[legConstants_[0].idx_X_] : 1.;
+  if ( !(x1 >= 1.e-5 && x1 <= 1.) ) return zeroProb<isLog>();
+
+  double x2 = 1.;
+  if ( leg2Type != kPromptLeg ) {
+    x2 = ( hasMassConstraint ) ? (mVis2_measured_/diTauMassConstraint2_)/x1 : x_[legConstants_[1].idx_X_];
+  }
+  if ( !(x2 >= 1.e-5 && x2 <= 1.) ) return zeroProb<isLog>();
+
+  // compute neutrino and tau lepton momenta
+  if ( leg1Type != kPromptLeg && !updateTauMomentum_kernel<leg1Type>(fittedTauLepton1_, 0, x1) ) return zeroProb<isLog>();
+  if ( leg2Type != kPromptLeg && !updateTauMomentum_kernel<leg2Type>(fittedTauLepton2_, 1, x2) ) return zeroProb<isLog>();
+
+  // evaluate tau decay matrix elements
+  double prob_tauDecay = 1.;
+  prob_tauDecay *= compPSfactor_kernel<leg1Type>(fittedTauLepton1_, 0);
+  prob_tauDecay *= compPSfactor_kernel<leg2Type>(fittedTauLepton2_, 1);
+  double mTauTau = (fittedTauLepton1_.tauP4() + fittedTauLepton2_.tauP4()).mass();
+
+  double jacobiFactor = 1.;
+  if ( hasMassConstraint ) {
+    jacobiFactor *= (2.*x2/diTauMassConstraint_);
+  }
+
+  return compProbPS<isLog>(prob_tauDecay, 1., mTauTau, jacobiFactor);
+}
+
+template <int leg1Type, bool isLog>
+ClassicSVfitIntegrand::EvalPSKernel ClassicSVfitIntegrand::getEvalPSKernel(int leg2Type, bool hasMassConstraint)
+{
+  if ( leg2Type == kLeptonicLeg ) {
+    if ( hasMassConstraint ) return &ClassicSVfitIntegrand::EvalPS_kernel<leg1Type, kLeptonicLeg, true, isLog>;
+    else                     return &ClassicSVfitIntegrand::EvalPS_kernel<leg1Type, kLeptonicLeg, false, isLog>;
+  } else if ( leg2Type == kHadronicLeg ) {
+    if ( hasMassConstraint ) return &ClassicSVfitIntegrand::EvalPS_kernel<leg1Type, kHadronicLeg, true, isLog>;
+    else                     return &ClassicSVfitIntegrand::EvalPS_kernel<leg1Type, kHadronicLeg, false, isLog>;
+  } else {
+    if ( hasMassConstraint ) return &ClassicSVfitIntegrand::EvalPS_kernel<leg1Type, kPromptLeg, true, isLog>;
+    else                     return &ClassicSVfitIntegrand::EvalPS_kernel<leg1Type, kPromptLeg, false, isLog>;
+  }
+}
+
+void ClassicSVfitIntegrand::selectEvalPSKernel()
+{
+  evalPSKernel_ = &ClassicSVfitIntegrand::EvalPS_generic<false>;
+  evalLogPSKernel_ = &ClassicSVfitIntegrand::EvalPS_generic<true>;
+
+  // compute momenta of visible tau decay products
+  // (the generic implementation recomputes them for every evaluation, as they depend on the integration variables in case transfer functions are used)
+  fittedTauLepton1_.updateVisMomentum(1.);
+  fittedTauLepton2_.updateVisMomentum(1.);
+
+  // CV: use generic implementation in case debug output is requested
+  if ( verbosity_ >= 2 ) return;
+
+  int legTypes[2];
+  for ( unsigned iLeg = 0; iLeg < numTaus_; ++iLeg ) {
+    const FittedTauLepton* fittedTauLepton = fittedTauLeptons_[iLeg];
+    const MeasuredTauLepton& measuredTauLepton = fittedTauLepton->getMeasuredTauLepton();
+    const integrationParameters& params = legIntegrationParams_[iLeg];
+    // CV: use generic implementation in case the pT of the visible tau decay products is varied by transfer functions
+    //     or the integration variables do not match the decay type
+    if ( params.idx_VisPtShift_ != -1 ) return;
+    if      ( measuredTauLepton.isLeptonicTauDecay() && params.idx_phi_ != -1 && params.idx_mNuNu_ != -1 ) legTypes[iLeg] = kLeptonicLeg;
+    else if ( measuredTauLepton.isHadronicTauDecay() && params.idx_phi_ != -1 && params.idx_mNuNu_ == -1 ) legTypes[iLeg] = kHadronicLeg;
+    else if ( measuredTauLepton.isPrompt()                                                                 ) legTypes[iLeg] = kPromptLeg;
+    else return;
+
+    LegConstants& legConstants = legConstants_[iLeg];
+    legConstants.visMass_ = measuredTauLepton.mass();
+    legConstants.visMass2_ = square(legConstants.visMass_);
+    legConstants.minX_ = legConstants.visMass2_/tauLeptonMass2;
+    legConstants.psNorm_ = 1.0/(tauLeptonMass2 - legConstants.visMass2_);
+    legConstants.visEn_ = fittedTauLepton->visP4().E();
+    legConstants.visP_ = fittedTauLepton->visP();
+    legConstants.idx_X_ = params.idx_X_;
+    legConstants.idx_phi_ = params.idx_phi_;
+    legConstants.idx_mNuNu_ = params.idx_mNuNu_;
+  }
+
+  bool hasMassConstraint = ( diTauMassConstraint_ > 0. );
+  if ( legTypes[0] != kPromptLeg && legConstants_[0].idx_X_ == -1 ) return;
+  if ( legTypes[1] != kPromptLeg && (legConstants_[1].idx_X_ == -1) != hasMassConstraint ) return;
+
+  if ( legTypes[0] == kLeptonicLeg ) {
+    evalPSKernel_ = getEvalPSKernel<kLeptonicLeg, false>(legTypes[1], hasMassConstraint);
+    evalLogPSKernel_ = getEvalPSKernel<kLeptonicLeg, true>(legTypes[1], hasMassConstraint);
+  } else if ( legTypes[0] == kHadronicLeg ) {
+    evalPSKernel_ = getEvalPSKernel<kHadronicLeg, false>(legTypes[1], hasMassConstraint);
+    evalLogPSKernel_ = getEvalPSKernel<kHadronicLeg, true>(legTypes[1], hasMassConstraint);
+  } else {
+    evalPSKernel_ = getEvalPSKernel<kPromptLeg, false>(legTypes[1], hasMassConstraint);
+    evalLogPSKernel_ = getEvalPSKernel<kPromptLeg, true>(legTypes[1], hasMassConstraint);
+  }
 }
 
 double ClassicSVfitIntegrand::Eval(const double* x, unsigned int iComponent) const
@@ -278,3 +512,547 @@ double ClassicSVfitIntegrand::Eval(const double* x, unsigned int iComponent) con
   }
   return prob;
 }
+
+double ClassicSVfitIntegrand::EvalLog(const double* x, unsigned int iComponent) const
+{
+  const double minusInfinity = -std::numeric_limits<double>::infinity();
+  if ( iComponent == 0 ) {
+    logPhaseSpaceComponentCache_ = EvalLogPS(x);
+  }
+  if ( logPhaseSpaceComponentCache_ == minusInfinity ) return minusInfinity;
+  double logProb_metTF = EvalMET_TF_log(iComponent);
+  double logProb = logPhaseSpaceComponentCache_ + logProb_metTF;
+  if ( verbosity_ >= 2 ) {
+    std::cout << " log(metTF): " << logProb_metTF << ","
+	      << " logPhaseSpaceComponentCache: " << logPhaseSpaceComponentCache_
+	      << " --> returning " << logProb << std::endl;
+  }
+  if ( TMath::IsNaN(logProb) ) return minusInfinity;
+  if ( histogramAdapter_ && logProb > minusInfinity ) {
+    histogramAdapter_->setTau1And2P4(fittedTauLepton1_.tauP4(), fittedTauLepton2_.tauP4());
+  }
+  return logProb;
+}
+
+double ClassicSVfitIntegrand::EvalLogForReweighting(const double* q) const
+{
+  // CV: use the logarithm of the integrand, so that points accepted by the Markov Chain in log domain are not dropped
+  const double minusInfinity = -std::numeric_limits<double>::infinity();
+  double logProb = EvalLogPS(q);
+  if ( logProb == minusInfinity ) return minusInfinity;
+  logProb += EvalMET_TF_log(0);
+  if ( TMath::IsNaN(logProb) ) return minusInfinity;
+  if ( !metVariationWeights_.empty() ) compMETVariationWeights();
+  return logProb;
+}
+
+const unsigned ClassicSVfitIntegrand::maxNumPointsPerBlock;
+
+namespace
+{
+  /// maximum number of integration dimensions (three per tau lepton)
+  const unsigned maxNumDimensions = 6;
+
+  /// multiply prob by the matrix element of leptonic tau decays (see compPSfactor_tauToLepDecay) for numPoints <= maxNumPointsPerBlock points.
+  /// The conditions for a physical solution are applied as masks in a second loop instead of early returns,
+  /// so that neither loop contains branches and both can be vectorised
+  void mulPSfactors_tauToLepDecay(unsigned numPoints, const double* x, const double* nunuEn, const double* nunuP, const double* nunuMass,
+                                  double visEn, double visP, double visMass, double visMass2, double xMin, double* prob)
+  {
+    double tauEn_rf[ClassicSVfitIntegrand::maxNumPointsPerBlock];
+    double visEn_rf[ClassicSVfitIntegrand::maxNumPointsPerBlock];
+    double cosThetaNuNu[ClassicSVfitIntegrand::maxNumPointsPerBlock];
+    double PSfactor[ClassicSVfitIntegrand::maxNumPointsPerBlock];
+    for ( unsigned iPoint = 0; iPoint < numPoints; ++iPoint ) {
+      double nunuMass2 = square(nunuMass[iPoint]);
+      tauEn_rf[iPoint] = (tauLeptonMass2 + nunuMass2 - visMass2)/(2.*nunuMass[iPoint]);
+      visEn_rf[iPoint] = tauEn_rf[iPoint] - nunuMass[iPoint];
+      double I = nunuMass2*(2.*tauEn_rf[iPoint]*visEn_rf[iPoint] - (2./3.)*TMath::Sqrt((square(tauEn_rf[iPoint]) - tauLeptonMass2)*(square(visEn_rf[iPoint]) - visMass2)));
+      #ifdef XSECTION_NORMALIZATION
+      I *= GFfactor;
+      #endif
+      // CV: same as compCosThetaNuNu, written out as functions defined in other translation units are not inlined
+      cosThetaNuNu[iPoint] = (visEn*nunuEn[iPoint] - 0.5*(tauLeptonMass2 - (visMass2 + nunuMass2)))/(visP*nunuP[iPoint]);
+      PSfactor[iPoint] = (visEn + nunuEn[iPoint])*I/(8.*visP*square(x[iPoint])*TMath::Sqrt(square(visP) + square(nunuP[iPoint]) + 2.*visP*nunuP[iPoint]*cosThetaNuNu[iPoint] + tauLeptonMass2));
+      #ifdef XSECTION_NORMALIZATION
+      PSfactor[iPoint] *= 2.;
+      #endif
+    }
+    // CV: conditions are combined by bitwise and, which (unlike logical and) does not introduce branches
+    for ( unsigned iPoint = 0; iPoint < numPoints; ++iPoint ) {
+      bool isPhysical = ( (x[iPoint] >= xMin) & (x[iPoint] <= 1.) & (square(nunuMass[iPoint]) < ((1. - x[iPoint])*tauLeptonMass2)) &
+                          (tauEn_rf[iPoint] >= tauLeptonMass) & (visEn_rf[iPoint] >= visMass) &
+                          (cosThetaNuNu[iPoint] >= (-1. + epsilon)) & (cosThetaNuNu[iPoint] <= +1.) );
+      prob[iPoint] *= ( isPhysical ) ? PSfactor[iPoint] : 0.;
+    }
+  }
+
+  /// multiply prob by the matrix element of hadronic tau decays (see compPSfactor_tauToHadDecay) for numPoints <= maxNumPointsPerBlock points,
+  /// with the conditions for a physical solution applied as masks in a second loop
+  void mulPSfactors_tauToHadDecay(unsigned numPoints, const double* x, const double* nuEn, const double* nuP,
+                                  double visEn, double visP, double visMass2, double xMin, double psNorm, double* prob)
+  {
+    double cosThetaNu[ClassicSVfitIntegrand::maxNumPointsPerBlock];
+    double PSfactor[ClassicSVfitIntegrand::maxNumPointsPerBlock];
+    for ( unsigned iPoint = 0; iPoint < numPoints; ++iPoint ) {
+      cosThetaNu[iPoint] = (visEn*nuEn[iPoint] - 0.5*(tauLeptonMass2 - visMass2))/(visP*nuP[iPoint]);
+      PSfactor[iPoint] = (visEn + nuEn[iPoint])/(8.*visP*square(x[iPoint])*TMath::Sqrt(square(visP) + square(nuP[iPoint]) + 2.*visP*nuP[iPoint]*cosThetaNu[iPoint] + tauLeptonMass2));
+      PSfactor[iPoint] *= psNorm;
+      #ifdef XSECTION_NORMALIZATION
+      PSfactor[iPoint] *= M2;
+      #endif
+    }
+    for ( unsigned iPoint = 0; iPoint < numPoints; ++iPoint ) {
+      bool isPhysical = ( (x[iPoint] >= xMin) & (x[iPoint] <= 1.) & (cosThetaNu[iPoint] >= (-1. + epsilon)) & (cosThetaNu[iPoint] <= +1.) );
+      prob[iPoint] *= ( isPhysical ) ? PSfactor[iPoint] : 0.;
+    }
+  }
+}
+
+void ClassicSVfitIntegrand::EvalBatch(const double* q, unsigned numPoints, double* prob) const
+{
+  // CV: evaluate the points one by one in case debug output is requested, in case of initialization errors,
+  //     or in case the pT of the visible tau decay products is varied by transfer functions
+  bool useScalarEval = ( verbosity_ >= 2 || numDimensions_ > maxNumDimensions );
+  if ( errorCode_ & MatrixInversion ||
+       errorCode_ & LeptonNumber    ||
+       errorCode_ & TestMass        ) {
+    useScalarEval = true;
+  }
+  for ( unsigned iTau = 0; iTau < numTaus_; ++iTau ) {
+    if ( legIntegrationParams_[iTau].idx_VisPtShift_ != -1 ) useScalarEval = true;
+  }
+
+  // transfer matrix for MET (same for all points)
+  const METEstimate& metEstimate = metEstimates_[0];
+  if ( !metEstimate.isInvertible_ ) useScalarEval = true;
+
+  if ( useScalarEval ) {
+    double qPoint[maxNumDimensions];
+    for ( unsigned iPoint = 0; iPoint < numPoints; ++iPoint ) {
+      for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+        qPoint[iDimension] = q[iDimension*numPoints + iPoint];
+      }
+      prob[iPoint] = Eval(qPoint);
+    }
+    return;
+  }
+
+  double invCovMETxx = metEstimate.adjCovMETxx_;
+  double invCovMETxy = metEstimate.adjCovMETxy_;
+  double invCovMETyx = metEstimate.adjCovMETyx_;
+  double invCovMETyy = metEstimate.adjCovMETyy_;
+  double covDet = metEstimate.covDet_;
+  double const_MET = metEstimate.const_MET_;
+  double measuredMETx = metEstimate.measuredMETx_;
+  double measuredMETy = metEstimate.measuredMETy_;
+
+  // compute momenta of visible tau decay products and local coordinate systems (same for all points)
+  fittedTauLepton1_.updateVisMomentum(1.);
+  fittedTauLepton2_.updateVisMomentum(1.);
+  const bool isPrompt[2] = { leg1isPrompt_, leg2isPrompt_ };
+  const bool isLeptonicTauDecay[2] = { leg1isLeptonicTauDecay_, leg2isLeptonicTauDecay_ };
+  const bool isHadronicTauDecay[2] = { leg1isHadronicTauDecay_, leg2isHadronicTauDecay_ };
+  double visMass[2], visMass2[2], minX[2], psNorm[2], visEn[2], visP[2];
+  for ( unsigned iTau = 0; iTau < numTaus_; ++iTau ) {
+    const FittedTauLepton* fittedTauLepton = fittedTauLeptons_[iTau];
+    visMass[iTau] = fittedTauLepton->getMeasuredTauLepton().mass();
+    visMass2[iTau] = square(visMass[iTau]);
+    minX[iTau] = visMass2[iTau]/tauLeptonMass2;
+    psNorm[iTau] = 1.0/(tauLeptonMass2 - visMass2[iTau]);
+    visEn[iTau] = fittedTauLepton->visP4().E();
+    visP[iTau] = fittedTauLepton->visP4().P();
+  }
+  const bool hasMassConstraint = ( diTauMassConstraint_ > 0. );
+  const bool addLogM = ( addLogM_fixed_ || addLogM_dynamic_ );
+
+  // CV: keep track of the last point with non-zero integrand, in order to update the histogram adapter
+  //     and the phase-space cache in the same way as calling Eval for each point in turn
+  int idxLastPoint = -1;
+  LorentzVector tauP4_lastPoint[2];
+
+  double x[2][maxNumPointsPerBlock];
+  double phiNu[2][maxNumPointsPerBlock];
+  double nuMass[2][maxNumPointsPerBlock];
+  double nuEn[2][maxNumPointsPerBlock];
+  double nuP[2][maxNumPointsPerBlock];
+  double nuPx[2][maxNumPointsPerBlock];
+  double nuPy[2][maxNumPointsPerBlock];
+  double nuPz[2][maxNumPointsPerBlock];
+  double tauEn[2][maxNumPointsPerBlock];
+  double tauPx[2][maxNumPointsPerBlock];
+  double tauPy[2][maxNumPointsPerBlock];
+  double tauPz[2][maxNumPointsPerBlock];
+  bool isValidTau[2][maxNumPointsPerBlock];
+  bool isValid[maxNumPointsPerBlock];
+  double prob_tauDecay[maxNumPointsPerBlock];
+  double prob_logM[maxNumPointsPerBlock];
+  double jacobiFactor[maxNumPointsPerBlock];
+  double prob_PS[maxNumPointsPerBlock];
+  double pull2[maxNumPointsPerBlock];
+  double prob_metTF[maxNumPointsPerBlock];
+  FittedTauLepton::MomentaBatch momenta[2];
+  for ( unsigned iTau = 0; iTau < 2; ++iTau ) {
+    FittedTauLepton::MomentaBatch& momenta_i = momenta[iTau];
+    momenta_i.nuEn_ = nuEn[iTau];
+    momenta_i.nuP_ = nuP[iTau];
+    momenta_i.nuPx_ = nuPx[iTau];
+    momenta_i.nuPy_ = nuPy[iTau];
+    momenta_i.nuPz_ = nuPz[iTau];
+    momenta_i.tauEn_ = tauEn[iTau];
+    momenta_i.tauPx_ = tauPx[iTau];
+    momenta_i.tauPy_ = tauPy[iTau];
+    momenta_i.tauPz_ = tauPz[iTau];
+    momenta_i.isValid_ = isValidTau[iTau];
+  }
+
+  for ( unsigned iPointFirst = 0; iPointFirst < numPoints; iPointFirst += maxNumPointsPerBlock ) {
+    unsigned numPointsBlock = std::min(numPoints - iPointFirst, maxNumPointsPerBlock);
+    const double* qBlock = q + iPointFirst;
+
+    // compute visible energy fractions for both taus
+    int idx_x1 = legIntegrationParams_[0].idx_X_;
+    int idx_x2 = legIntegrationParams_[1].idx_X_;
+    for ( unsigned iPoint = 0; iPoint < numPointsBlock; ++iPoint ) {
+      double x1 = 1.;
+      if ( !leg1isPrompt_ ) {
+        double q_i = qBlock[idx_x1*numPoints + iPoint];
+        x1 = (1. - q_i)*xMin_[idx_x1] + q_i*xMax_[idx_x1];
+      }
+      double x2 = 1.;
+      if ( !leg2isPrompt_ ) {
+        if ( idx_x2 != -1 ) {
+          double q_i = qBlock[idx_x2*numPoints + iPoint];
+          x2 = (1. - q_i)*xMin_[idx_x2] + q_i*xMax_[idx_x2];
+        } else {
+          x2 = (mVis2_measured_/diTauMassConstraint2_)/x1;
+        }
+      }
+      x[0][iPoint] = x1;
+      x[1][iPoint] = x2;
+      isValid[iPoint] = ( x1 >= 1.e-5 && x1 <= 1. && x2 >= 1.e-5 && x2 <= 1. );
+    }
+
+    // compute neutrino and tau lepton momenta
+    for ( unsigned iTau = 0; iTau < numTaus_; ++iTau ) {
+      if ( !isPrompt[iTau] ) {
+        const integrationParameters& params = legIntegrationParams_[iTau];
+        int idx_phiNu = params.idx_phi_;
+        assert(idx_phiNu != -1);
+        int idx_nuMass = params.idx_mNuNu_;
+        for ( unsigned iPoint = 0; iPoint < numPointsBlock; ++iPoint ) {
+          double q_phiNu = qBlock[idx_phiNu*numPoints + iPoint];
+          phiNu[iTau][iPoint] = (1. - q_phiNu)*xMin_[idx_phiNu] + q_phiNu*xMax_[idx_phiNu];
+          nuMass[iTau][iPoint] = 0.;
+          if ( idx_nuMass != -1 ) {
+            double q_nuMass = qBlock[idx_nuMass*numPoints + iPoint];
+            nuMass[iTau][iPoint] = TMath::Sqrt((1. - q_nuMass)*xMin_[idx_nuMass] + q_nuMass*xMax_[idx_nuMass]);
+          }
+        }
+      }
+      fittedTauLeptons_[iTau]->updateTauMomenta(numPointsBlock, x[iTau], phiNu[iTau], nuMass[iTau], momenta[iTau]);
+      for ( unsigned iPoint = 0; iPoint < numPointsBlock; ++iPoint ) {
+        if ( isValid[iPoint] && !isValidTau[iTau][iPoint] ) {
+          errorCode_ |= TauDecayParameters;
+          isValid[iPoint] = false;
+        }
+      }
+    }
+
+    // evaluate tau decay matrix elements, following EvalPS
+    // CV: the decay type is the same for all points, so that it is checked outside of the loops over the points.
+    //     Points with unphysical tau decay parameters are set to zero here; in case the factors multiplied in below
+    //     are not finite for these points, the product is NaN and is set to zero when the factors are combined
+    for ( unsigned iPoint = 0; iPoint < numPointsBlock; ++iPoint ) {
+      prob_tauDecay[iPoint] = ( isValid[iPoint] ) ? 1. : 0.;
+    }
+    for ( unsigned iTau = 0; iTau < numTaus_; ++iTau ) {
+      if ( isLeptonicTauDecay[iTau] ) {
+        mulPSfactors_tauToLepDecay(numPointsBlock, x[iTau], nuEn[iTau], nuP[iTau], nuMass[iTau],
+                                   visEn[iTau], visP[iTau], visMass[iTau], visMass2[iTau], minX[iTau], prob_tauDecay);
+      } else if ( isHadronicTauDecay[iTau] ) {
+        mulPSfactors_tauToHadDecay(numPointsBlock, x[iTau], nuEn[iTau], nuP[iTau],
+                                   visEn[iTau], visP[iTau], visMass2[iTau], minX[iTau], psNorm[iTau], prob_tauDecay);
+      }
+    }
+
+    // evaluate log(M) term
+    // CV: this loop calls TMath::Power and evalLogM_dynamic_power for each point and is not vectorised,
+    //     it is kept separate from the other loops so that these can be
+    for ( unsigned iPoint = 0; iPoint < numPointsBlock; ++iPoint ) {
+      prob_logM[iPoint] = 1.;
+    }
+    if ( addLogM ) {
+      for ( unsigned iPoint = 0; iPoint < numPointsBlock; ++iPoint ) {
+        if ( !isValid[iPoint] ) continue;
+        double mTauTau2 = square(tauEn[0][iPoint] + tauEn[1][iPoint]) - square(tauPx[0][iPoint] + tauPx[1][iPoint])
+                        - square(tauPy[0][iPoint] + tauPy[1][iPoint]) - square(tauPz[0][iPoint] + tauPz[1][iPoint]);
+        double mTauTau = ( mTauTau2 > 0. ) ? TMath::Sqrt(mTauTau2) : 0.;
+        if ( addLogM_fixed_ ) {
+          prob_logM[iPoint] = 1./TMath::Power(TMath::Max(1., mTauTau), addLogM_fixed_power_);
+        }
+        if ( addLogM_dynamic_ ) {
+          double addLogM_power = evalLogM_dynamic_power(mTauTau);
+          prob_logM[iPoint] = 1./TMath::Power(TMath::Max(1., mTauTau), TMath::Max(0., addLogM_power));
+        }
+      }
+    }
+
+    // evaluate Jacobi factor
+    for ( unsigned iPoint = 0; iPoint < numPointsBlock; ++iPoint ) {
+      jacobiFactor[iPoint] = 1.;
+    }
+    if ( hasMassConstraint ) {
+      for ( unsigned iPoint = 0; iPoint < numPointsBlock; ++iPoint ) {
+        jacobiFactor[iPoint] = 2.*x[1][iPoint]/diTauMassConstraint_;
+      }
+    }
+
+    // combine tau decay matrix elements, log(M) term and Jacobi factor, following EvalPS
+    for ( unsigned iPoint = 0; iPoint < numPointsBlock; ++iPoint ) {
+      double prob = classic_svFit::constFactor*prob_tauDecay[iPoint]*classic_svFit::matrixElementNorm*prob_logM[iPoint]*jacobiFactor[iPoint];
+      prob_PS[iPoint] = ( !TMath::IsNaN(prob) ) ? prob : 0.;
+    }
+
+    // evaluate transfer function for MET/hadronic recoil, following EvalMET_TF
+    // CV: the neutrino momenta of prompt leptons are set to zero by FittedTauLepton::updateTauMomenta,
+    //     so that the momenta of both legs can be summed without checking the decay type
+    for ( unsigned iPoint = 0; iPoint < numPointsBlock; ++iPoint ) {
+      double residualX = measuredMETx - (nuPx[0][iPoint] + nuPx[1][iPoint]);
+      double residualY = measuredMETy - (nuPy[0][iPoint] + nuPy[1][iPoint]);
+      pull2[iPoint] = residualX*(invCovMETxx*residualX + invCovMETxy*residualY) +
+                      residualY*(invCovMETyx*residualX + invCovMETyy*residualY);
+      pull2[iPoint] /= covDet;
+    }
+    // CV: the exponential is vectorised only in case the compiler is given a vector math library
+    for ( unsigned iPoint = 0; iPoint < numPointsBlock; ++iPoint ) {
+      prob_metTF[iPoint] = const_MET*TMath::Exp(-0.5*pull2[iPoint]);
+    }
+
+    for ( unsigned iPoint = 0; iPoint < numPointsBlock; ++iPoint ) {
+      double prob_i = ( prob_PS[iPoint] < 1.e-300 ) ? 0. : prob_PS[iPoint]*prob_metTF[iPoint];
+      prob[iPointFirst + iPoint] = prob_i;
+      if ( histogramAdapter_ && prob_i > 1.e-300 ) {
+        idxLastPoint = iPointFirst + iPoint;
+        for ( unsigned iTau = 0; iTau < numTaus_; ++iTau ) {
+          tauP4_lastPoint[iTau].SetPxPyPzE(tauPx[iTau][iPoint], tauPy[iTau][iPoint], tauPz[iTau][iPoint], tauEn[iTau][iPoint]);
+        }
+      }
+    }
+    if ( iPointFirst + numPointsBlock == numPoints ) {
+      phaseSpaceComponentCache_ = prob_PS[numPointsBlock - 1];
+    }
+  }
+
+  if ( numPoints > 0 ) {
+    double qPoint[maxNumDimensions];
+    for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+      qPoint[iDimension] = q[iDimension*numPoints + numPoints - 1];
+    }
+    rescaleX(qPoint);
+  }
+  if ( idxLastPoint != -1 ) {
+    histogramAdapter_->setTau1And2P4(tauP4_lastPoint[0], tauP4_lastPoint[1]);
+  }
+}
+
+namespace
+{
+  /// versions of compCosThetaNuNu, compPSfactor_tauToLepDecay and compPSfactor_tauToHadDecay for dual numbers;
+  /// the PS factors are returned as logarithm and the checks for the physical region are omitted,
+  /// as the gradient is computed only for points with non-zero integrand
+  Dual compCosThetaNuNu_dual(const Dual& visEn, const Dual& visP, double visMass2, const Dual& nunuEn, const Dual& nunuP, const Dual& nunuMass2)
+  {
+    return (visEn*nunuEn - 0.5*(tauLeptonMass2 - (visMass2 + nunuMass2)))/(visP*nunuP);
+  }
+
+  Dual compLogPSfactor_tauToLepDecay(const Dual& x, const Dual& visEn, const Dual& visP, double visMass, const Dual& nunuEn, const Dual& nunuP, const Dual& nunuMass2)
+  {
+    double visMass2 = square(visMass);
+    Dual nunuMass = sqrt(nunuMass2);
+    Dual tauEn_rf = (tauLeptonMass2 + nunuMass2 - visMass2)/(2.*nunuMass);
+    Dual visEn_rf = tauEn_rf - nunuMass;
+    Dual I = nunuMass2*(2.*tauEn_rf*visEn_rf - (2./3.)*sqrt((square(tauEn_rf) - tauLeptonMass2)*(square(visEn_rf) - visMass2)));
+    #ifdef XSECTION_NORMALIZATION
+    I *= GFfactor;
+    #endif
+    Dual cosThetaNuNu = compCosThetaNuNu_dual(visEn, visP, visMass2, nunuEn, nunuP, nunuMass2);
+    Dual logPSfactor = log(visEn + nunuEn) + log(I) - TMath::Log(8.) - log(visP) - 2.*log(x)
+      - 0.5*log(square(visP) + square(nunuP) + 2.*visP*nunuP*cosThetaNuNu + tauLeptonMass2);
+    #ifdef XSECTION_NORMALIZATION
+    logPSfactor += TMath::Log(2.);
+    #endif
+    return logPSfactor;
+  }
+
+  Dual compLogPSfactor_tauToHadDecay(const Dual& x, const Dual& visEn, const Dual& visP, double visMass, const Dual& nuEn, const Dual& nuP)
+  {
+    double visMass2 = square(visMass);
+    Dual cosThetaNu = compCosThetaNuNu_dual(visEn, visP, visMass2, nuEn, nuP, Dual(0.));
+    Dual logPSfactor = log(visEn + nuEn) - TMath::Log(8.) - log(visP) - 2.*log(x)
+      - 0.5*log(square(visP) + square(nuP) + 2.*visP*nuP*cosThetaNu + tauLeptonMass2);
+    logPSfactor -= TMath::Log(tauLeptonMass2 - visMass2);
+    #ifdef XSECTION_NORMALIZATION
+    logPSfactor += TMath::Log(M2);
+    #endif
+    return logPSfactor;
+  }
+}
+
+Dual ClassicSVfitIntegrand::EvalLogProb(const Dual* x) const
+{
+  const MeasuredTauLepton* measuredTauLeptons[2] = { &measuredTauLepton1_, &measuredTauLepton2_ };
+  const bool isPrompt[2] = { leg1isPrompt_, leg2isPrompt_ };
+
+  Dual visPtShift[2] = { Dual(1.), Dual(1.) };
+#ifdef USE_SVFITTF
+  for ( unsigned iTau = 0; iTau < numTaus_; ++iTau ) {
+    int idx_visPtShift = legIntegrationParams_[iTau].idx_VisPtShift_;
+    if ( useHadTauTF_ && idx_visPtShift != -1 && !measuredTauLeptons[iTau]->isLeptonicTauDecay() ) visPtShift[iTau] = 1./x[idx_visPtShift];
+  }
+#endif
+
+  // compute visible energy fractions for both taus
+  Dual x1_dash(1.);
+  if ( !leg1isPrompt_ ) {
+    x1_dash = x[legIntegrationParams_[0].idx_X_];
+  }
+  Dual x2_dash(1.);
+  if ( !leg2isPrompt_ ) {
+    int idx_x2 = legIntegrationParams_[1].idx_X_;
+    if ( idx_x2 != -1 ) {
+      x2_dash = x[idx_x2];
+    } else {
+      x2_dash = (mVis2_measured_/diTauMassConstraint2_)/x1_dash;
+    }
+  }
+  Dual visEnFractions[2] = { x1_dash/visPtShift[0], x2_dash/visPtShift[1] };
+
+  // compute neutrino and tau lepton momenta and evaluate tau decay matrix elements,
+  // following FittedTauLepton::updateVisMomentum, FittedTauLepton::updateTauMomentum and EvalPS
+  Dual logProb(TMath::Log(classic_svFit::constFactor*classic_svFit::matrixElementNorm));
+  Dual ditauPx(0.), ditauPy(0.), ditauPz(0.), ditauEn(0.);
+  Dual sumNuPx(0.), sumNuPy(0.);
+  for ( unsigned iTau = 0; iTau < numTaus_; ++iTau ) {
+    const MeasuredTauLepton& measuredTauLepton = *measuredTauLeptons[iTau];
+    const integrationParameters& params = legIntegrationParams_[iTau];
+
+    Dual visPx = visPtShift[iTau]*measuredTauLepton.px();
+    Dual visPy = visPtShift[iTau]*measuredTauLepton.py();
+    Dual visPz = visPtShift[iTau]*measuredTauLepton.pz();
+    Dual visP = sqrt(square(visPx) + square(visPy) + square(visPz));
+    double visMass2 = square(measuredTauLepton.mass());
+    Dual visEn = sqrt(square(visP) + visMass2);
+    ditauPx += visPx;
+    ditauPy += visPy;
+    ditauPz += visPz;
+    ditauEn += visEn;
+    if ( isPrompt[iTau] ) continue;
+
+    const Dual& visEnFraction = visEnFractions[iTau];
+    Dual nuEn = visEn*(1. - visEnFraction)/visEnFraction;
+    Dual nuMass2(0.);
+    if ( params.idx_mNuNu_ != -1 ) nuMass2 = x[params.idx_mNuNu_];
+    Dual nuP = sqrt(square(nuEn) - nuMass2);
+    Dual cosThetaNu = compCosThetaNuNu_dual(visEn, visP, visMass2, nuEn, nuP, nuMass2);
+    Dual sinThetaNu = sqrt(1. - square(cosThetaNu));
+    const Dual& phiNu = x[params.idx_phi_];
+
+    Dual nuPx_local = nuP*cos(phiNu)*sinThetaNu;
+    Dual nuPy_local = nuP*sin(phiNu)*sinThetaNu;
+    Dual nuPz_local = nuP*cosThetaNu;
+    Vector eX, eY, eZ;
+    fittedTauLeptons_[iTau]->getLocalCoordinateSystem(eX, eY, eZ);
+    Dual nuPx = nuPx_local*eX.x() + nuPy_local*eY.x() + nuPz_local*eZ.x();
+    Dual nuPy = nuPx_local*eX.y() + nuPy_local*eY.y() + nuPz_local*eZ.y();
+    Dual nuPz = nuPx_local*eX.z() + nuPy_local*eY.z() + nuPz_local*eZ.z();
+    ditauPx += nuPx;
+    ditauPy += nuPy;
+    ditauPz += nuPz;
+    ditauEn += nuEn;
+    sumNuPx += nuPx;
+    sumNuPy += nuPy;
+
+    if      ( measuredTauLepton.isLeptonicTauDecay() ) logProb += compLogPSfactor_tauToLepDecay(visEnFraction, visEn, visP, measuredTauLepton.mass(), nuEn, nuP, nuMass2);
+    else if ( measuredTauLepton.isHadronicTauDecay() ) logProb += compLogPSfactor_tauToHadDecay(visEnFraction, visEn, visP, measuredTauLepton.mass(), nuEn, nuP);
+
+#ifdef USE_SVFITTF
+    // CV: the transfer function is not available for dual numbers,
+    //     so its derivative with respect to the generated pT is computed numerically
+    if ( useHadTauTF_ && params.idx_VisPtShift_ != -1 && measuredTauLepton.isHadronicTauDecay() ) {
+      Dual visPt = sqrt(square(visPx) + square(visPy));
+      double visEta = measuredTauLepton.eta(); // eta is not changed by scaling the momentum of the visible tau decay products
+      const HadTauTFBase& hadTauTF = *hadTauTFs_[iTau];
+      double prob = hadTauTF(measuredTauLepton.pt(), visPt.value(), visEta);
+      double h = 1.e-3*visPt.value();
+      double dProb = hadTauTF(measuredTauLepton.pt(), visPt.value() + h, visEta) - hadTauTF(measuredTauLepton.pt(), visPt.value() - h, visEta);
+      logProb += visPt.chainRule(TMath::Log(prob), dProb/(2.*h*prob));
+    }
+#endif
+  }
+
+  // evaluate log(M) term
+  Dual mTauTau = sqrt(square(ditauEn) - (square(ditauPx) + square(ditauPy) + square(ditauPz)));
+  if ( mTauTau.value() > 1. ) {
+    if ( addLogM_dynamic_ ) {
+      double power = evalLogM_dynamic_power(mTauTau.value());
+      if ( power > 0. ) {
+        double h = 1.e-3*mTauTau.value();
+        double dPower = evalLogM_dynamic_power(mTauTau.value() + h) - evalLogM_dynamic_power(mTauTau.value() - h);
+        logProb -= mTauTau.chainRule(power, dPower/(2.*h))*log(mTauTau);
+      }
+    } else if ( addLogM_fixed_ ) {
+      logProb -= addLogM_fixed_power_*log(mTauTau);
+    }
+  }
+
+  // Jacobi factor for parametrization of x1, x2 by x1', x2'
+  logProb -= log(visPtShift[0]*visPtShift[1]);
+  if ( diTauMassConstraint_ > 0. ) {
+    logProb += log(visEnFractions[1]) + TMath::Log(2./diTauMassConstraint_);
+  }
+
+  // evaluate transfer function for MET/hadronic recoil, following EvalMET_TF
+  const METEstimate& metEstimate = metEstimates_[0];
+  Dual residualX = metEstimate.measuredMETx_ - sumNuPx;
+  Dual residualY = metEstimate.measuredMETy_ - sumNuPy;
+#ifdef USE_SVFITTF
+  if ( rhoHadTau_ != 0. ) {
+    for ( unsigned iTau = 0; iTau < numTaus_; ++iTau ) {
+      const MeasuredTauLepton& measuredTauLepton = *measuredTauLeptons[iTau];
+      if ( measuredTauLepton.isHadronicTauDecay() && legIntegrationParams_[iTau].idx_VisPtShift_ != -1 ) {
+	residualX += (rhoHadTau_*(visPtShift[iTau] - 1.)*measuredTauLepton.px());
+	residualY += (rhoHadTau_*(visPtShift[iTau] - 1.)*measuredTauLepton.py());
+      }
+    }
+  }
+#endif
+  Dual pull2 = residualX*(metEstimate.adjCovMETxx_*residualX + metEstimate.adjCovMETxy_*residualY) +
+               residualY*(metEstimate.adjCovMETyx_*residualX + metEstimate.adjCovMETyy_*residualY);
+  logProb += metEstimate.logConst_MET_ - 0.5*pull2/metEstimate.covDet_;
+
+  return logProb;
+}
+
+double ClassicSVfitIntegrand::EvalWithGradient(const double* q, double* gradLogProb) const
+{
+  assert(numDimensions_ <= Dual::maxNumDerivatives);
+  double prob = Eval(q);
+  for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+    gradLogProb[iDimension] = 0.;
+  }
+  if ( !(prob > 0.) ) return prob;
+
+  // CV: x_ has been set by EvalPS;
+  //     the derivatives of the integration variables x with respect to q are given by the size of the integration region
+  Dual x[Dual::maxNumDerivatives];
+  for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+    x[iDimension] = Dual(x_[iDimension], iDimension, xMax_[iDimension] - xMin_[iDimension]);
+  }
+  Dual logProb = EvalLogProb(x);
+  for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+    double gradLogProb_i = logProb.derivative(iDimension);
+    if ( TMath::Finite(gradLogProb_i) ) gradLogProb[iDimension] = gradLogProb_i;
+  }
+  return prob;
+}
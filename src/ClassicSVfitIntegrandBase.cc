@@ -5,6 +5,7 @@
 #include <Math/VectorUtil.h>
 
 #include <math.h>
+#include <limits> // std::numeric_limits
 
 using namespace classic_svFit;
 
@@ -27,6 +28,55 @@ ClassicSVfitIntegrandBase::ClassicSVfitIntegrandBase(int verbosity)
   , verbosity_(verbosity)
 {}
 
+ClassicSVfitIntegrandBase::ClassicSVfitIntegrandBase(const ClassicSVfitIntegrandBase& integrand)
+  : numTaus_(integrand.numTaus_)
+  , metEstimates_(integrand.metEstimates_)
+  , metVariationWeights_(integrand.metVariationWeights_)
+#ifdef USE_SVFITTF
+  , useHadTauTF_(integrand.useHadTauTF_)
+  , rhoHadTau_(integrand.rhoHadTau_)
+#endif
+  , legIntegrationParams_(integrand.legIntegrationParams_)
+  , numDimensions_(integrand.numDimensions_)
+  , maxNumberOfDimensions_(integrand.maxNumberOfDimensions_)
+  , xMin_(nullptr)
+  , xMax_(nullptr)
+  , x_(nullptr)
+  , addLogM_fixed_(integrand.addLogM_fixed_)
+  , addLogM_fixed_power_(integrand.addLogM_fixed_power_)
+  , addLogM_dynamic_(integrand.addLogM_dynamic_)
+  , addLogM_dynamic_expression_(integrand.addLogM_dynamic_expression_)
+  , addLogM_dynamic_compiledFormula_(integrand.addLogM_dynamic_compiledFormula_)
+  , addLogM_dynamic_formula_(0)
+  , errorCode_(integrand.errorCode_)
+  , phaseSpaceComponentCache_(integrand.phaseSpaceComponentCache_)
+  , logPhaseSpaceComponentCache_(integrand.logPhaseSpaceComponentCache_)
+  , verbosity_(integrand.verbosity_)
+{
+  // CV: fittedTauLeptons_ point to data-members of derived class and need to be set by derived class
+#ifdef USE_SVFITTF
+  for ( std::vector<const HadTauTFBase*>::const_iterator hadTauTF = integrand.hadTauTFs_.begin();
+	hadTauTF != integrand.hadTauTFs_.end(); ++hadTauTF ) {
+    hadTauTFs_.push_back((*hadTauTF)->Clone(Form("leg%i", (int)hadTauTFs_.size())));
+  }
+#endif
+
+  if ( maxNumberOfDimensions_ > 0 ) {
+    xMin_ = new double[maxNumberOfDimensions_];
+    xMax_ = new double[maxNumberOfDimensions_];
+    x_ = new double[maxNumberOfDimensions_];
+    for ( unsigned iDimension = 0; iDimension < maxNumberOfDimensions_; ++iDimension ) {
+      xMin_[iDimension] = integrand.xMin_[iDimension];
+      xMax_[iDimension] = integrand.xMax_[iDimension];
+      x_[iDimension] = integrand.x_[iDimension];
+    }
+  }
+
+  if ( integrand.addLogM_dynamic_formula_ ) {
+    addLogM_dynamic_formula_ = new TFormula(integrand.addLogM_dynamic_formula_->GetName(), addLogM_dynamic_expression_.data(), false);
+  }
+}
+
 ClassicSVfitIntegrandBase::~ClassicSVfitIntegrandBase()
 {
 #ifdef USE_SVFITTF
@@ -36,9 +86,9 @@ ClassicSVfitIntegrandBase::~ClassicSVfitIntegrandBase()
   }
 #endif
 
-  delete xMin_;
-  delete xMax_;
-  delete x_;
+  delete [] xMin_;
+  delete [] xMax_;
+  delete [] x_;
 
   delete addLogM_dynamic_formula_;
 }
@@ -64,12 +114,17 @@ void ClassicSVfitIntegrandBase::addLogM_dynamic(bool value, const std::string& p
   addLogM_dynamic_ = value;
   if ( addLogM_dynamic_ ) {
     if ( power != "" ) {
-      TString power_tstring = power.data();
-      power_tstring = power_tstring.ReplaceAll("m", "x");
-      power_tstring = power_tstring.ReplaceAll("mass", "x");
+      // CV: replace whole identifiers only, so that function names like min, max or TMath::Exp remain intact
+      addLogM_dynamic_expression_ = replaceVariableName(replaceVariableName(power, "m"), "mass");
       std::string formulaName = "ClassicSVfitIntegrand_addLogM_dynamic_formula";
       delete addLogM_dynamic_formula_;
-      addLogM_dynamic_formula_ = new TFormula(formulaName.data(), power_tstring.Data());
+      addLogM_dynamic_formula_ = 0;
+      // CV: compile expression into a sequence of instructions that can be evaluated fast and without locks;
+      //     fall back to TFormula for expressions that are not supported by CompiledFormula
+      if ( !addLogM_dynamic_compiledFormula_.compile(addLogM_dynamic_expression_) ) {
+        // CV: do not add formula to global list of functions, as several instances (possibly in different threads) use the same name
+        addLogM_dynamic_formula_ = new TFormula(formulaName.data(), addLogM_dynamic_expression_.data(), false);
+      }
     } else {
       std::cerr << "Warning: expression = '" << power << "' is invalid --> disabling dynamic logM term !!" << std::endl;
       addLogM_dynamic_ = false;
@@ -147,6 +202,7 @@ void ClassicSVfitIntegrandBase::setLeptonInputs(const std::vector<MeasuredTauLep
   }
 
   phaseSpaceComponentCache_ = 0;
+  logPhaseSpaceComponentCache_ = -std::numeric_limits<double>::infinity();
 
 #ifdef USE_SVFITTF
   if ( useHadTauTF_ ) {
@@ -163,21 +219,25 @@ void ClassicSVfitIntegrandBase::setLeptonInputs(const std::vector<MeasuredTauLep
 
 void ClassicSVfitIntegrandBase::addMETEstimate(double measuredMETx, double measuredMETy, const TMatrixD& covMET)
 {
-  measuredMETx_.push_back(measuredMETx);
-  measuredMETy_.push_back(measuredMETy);
-  covMET_.push_back(covMET);
+  unsigned iComponent = metEstimates_.size();
+  METEstimate metEstimate;
+  initMETEstimate(metEstimate, measuredMETx, measuredMETy, covMET);
+  if ( !metEstimate.isInvertible_ ) {
+    std::cerr << "Error: Cannot invert MET covariance Matrix (det=0) !!" << std::endl;
+  }
+  metEstimates_.push_back(metEstimate);
+  if ( iComponent > 0 ) metVariationWeights_.resize(iComponent, 1.);
 }
 
 int ClassicSVfitIntegrandBase::getMETComponentsSize() const 
 {
-  return measuredMETx_.size();
+  return metEstimates_.size();
 }
 
 void ClassicSVfitIntegrandBase::clearMET()
 {
-  measuredMETx_.clear();
-  measuredMETy_.clear();
-  covMET_.clear();
+  metEstimates_.clear();
+  metVariationWeights_.clear();
 }
 
 void ClassicSVfitIntegrandBase::rescaleX(const double* q) const
@@ -188,27 +248,30 @@ void ClassicSVfitIntegrandBase::rescaleX(const double* q) const
   }
 }
 
-double ClassicSVfitIntegrandBase::EvalMET_TF(unsigned int iComponent) const
+void ClassicSVfitIntegrandBase::initMETEstimate(METEstimate& metEstimate, double aMETx, double aMETy, const TMatrixD& covMET)
 {
-  return EvalMET_TF(measuredMETx_[iComponent], measuredMETy_[iComponent], covMET_[iComponent]);
-}
+  metEstimate.measuredMETx_ = aMETx;
+  metEstimate.measuredMETy_ = aMETy;
 
-double ClassicSVfitIntegrandBase::EvalMET_TF(double aMETx, double aMETy, const TMatrixD& covMET) const
-{
   // determine transfer matrix for MET
-  double invCovMETxx =  covMET(1,1);
-  double invCovMETxy = -covMET(0,1);
-  double invCovMETyx = -covMET(1,0);
-  double invCovMETyy =  covMET(0,0);
-  double covDet = invCovMETxx*invCovMETyy - invCovMETxy*invCovMETyx;
-
-  if( std::abs(covDet) < 1.e-10 ){
-    std::cerr << "Error: Cannot invert MET covariance Matrix (det=0) !!" << std::endl;
-    errorCode_ |= MatrixInversion;
-    return 0;
+  metEstimate.adjCovMETxx_ =  covMET(1,1);
+  metEstimate.adjCovMETxy_ = -covMET(0,1);
+  metEstimate.adjCovMETyx_ = -covMET(1,0);
+  metEstimate.adjCovMETyy_ =  covMET(0,0);
+  metEstimate.covDet_ = metEstimate.adjCovMETxx_*metEstimate.adjCovMETyy_ - metEstimate.adjCovMETxy_*metEstimate.adjCovMETyx_;
+
+  metEstimate.isInvertible_ = !( std::abs(metEstimate.covDet_) < 1.e-10 );
+  if ( metEstimate.isInvertible_ ) {
+    metEstimate.const_MET_ = 1./(2.*TMath::Pi()*TMath::Sqrt(metEstimate.covDet_));
+    metEstimate.logConst_MET_ = TMath::Log(metEstimate.const_MET_);
+  } else {
+    metEstimate.const_MET_ = 0.;
+    metEstimate.logConst_MET_ = -std::numeric_limits<double>::infinity();
   }
-  double const_MET = 1./(2.*TMath::Pi()*TMath::Sqrt(covDet));
+}
 
+double ClassicSVfitIntegrandBase::compMET_pull2(const METEstimate& metEstimate) const
+{
   // compute sum of momenta of all neutrinos produced in tau decays
   double sumNuPx = 0.;
   double sumNuPy = 0.;
@@ -219,8 +282,8 @@ double ClassicSVfitIntegrandBase::EvalMET_TF(double aMETx, double aMETy, const T
   }
 
   // evaluate transfer function for MET/hadronic recoil
-  double residualX = aMETx - sumNuPx;
-  double residualY = aMETy - sumNuPy;
+  double residualX = metEstimate.measuredMETx_ - sumNuPx;
+  double residualY = metEstimate.measuredMETy_ - sumNuPy;
 #ifdef USE_SVFITTF
   if ( rhoHadTau_ != 0. ) {
     for ( unsigned iTau = 0; iTau < numTaus_; ++iTau ) {
@@ -238,17 +301,54 @@ double ClassicSVfitIntegrandBase::EvalMET_TF(double aMETx, double aMETy, const T
     }
   }
 #endif
-  double pull2 = residualX*(invCovMETxx*residualX + invCovMETxy*residualY) +
-                 residualY*(invCovMETyx*residualX + invCovMETyy*residualY);
-  pull2 /= covDet;
-  double prob = const_MET*TMath::Exp(-0.5*pull2);
-
-  if ( verbosity_ >= 2 ) {    
-    std::cout << "TF(met): recPx = " << aMETx << ", recPy = " << aMETy << ","
+  double pull2 = residualX*(metEstimate.adjCovMETxx_*residualX + metEstimate.adjCovMETxy_*residualY) +
+                 residualY*(metEstimate.adjCovMETyx_*residualX + metEstimate.adjCovMETyy_*residualY);
+  pull2 /= metEstimate.covDet_;
+  if ( verbosity_ >= 2 ) {
+    std::cout << "TF(met): recPx = " << metEstimate.measuredMETx_ << ", recPy = " << metEstimate.measuredMETy_ << ","
 	      << " genPx = " << sumNuPx << ", genPy = " << sumNuPy << ","
-	      << " pull2 = " << pull2 << ", prob = " << prob << std::endl;
+	      << " pull2 = " << pull2 << std::endl;
+  }
+  return pull2;
+}
+
+double ClassicSVfitIntegrandBase::EvalMET_TF(unsigned int iComponent) const
+{
+  const METEstimate& metEstimate = metEstimates_[iComponent];
+  // CV: an error message has been printed when the MET estimate was added
+  if ( !metEstimate.isInvertible_ ) {
+    errorCode_ |= MatrixInversion;
+    return 0.;
+  }
+  double prob = metEstimate.const_MET_*TMath::Exp(-0.5*compMET_pull2(metEstimate));
+  if ( verbosity_ >= 2 ) {
+    std::cout << " --> prob = " << prob << std::endl;
   }
   return prob;
 }
 
+void ClassicSVfitIntegrandBase::compMETVariationWeights() const
+{
+  // CV: compute weights from the difference of logarithms, so that the weights do not underflow
+  //     in case the MET estimates differ by many standard deviations
+  double logProb_nominal = EvalMET_TF_log(0);
+  for ( unsigned iComponent = 1; iComponent < metEstimates_.size(); ++iComponent ) {
+    metVariationWeights_[iComponent - 1] = TMath::Exp(EvalMET_TF_log(iComponent) - logProb_nominal);
+  }
+}
+
+double ClassicSVfitIntegrandBase::EvalMET_TF_log(unsigned int iComponent) const
+{
+  const METEstimate& metEstimate = metEstimates_[iComponent];
+  if ( !metEstimate.isInvertible_ ) {
+    errorCode_ |= MatrixInversion;
+    return -std::numeric_limits<double>::infinity();
+  }
+  double logProb = metEstimate.logConst_MET_ - 0.5*compMET_pull2(metEstimate);
+  if ( verbosity_ >= 2 ) {
+    std::cout << " --> log(prob) = " << logProb << std::endl;
+  }
+  return logProb;
+}
+
 
@@ -12,6 +12,7 @@ FittedTauLepton::FittedTauLepton(int iTau, int verbosity)
   , phiNu_(-1.)
   , nuMass_(-1.)
   , errorCode_(None)
+  , visP_(0.)
   , verbosity_(verbosity)
 {}
 
@@ -69,6 +70,7 @@ void FittedTauLepton::updateVisMomentum(double visPtShift)
   double visEn = TMath::Sqrt(square(visPx) + square(visPy) + square(visPz) + measuredTauLepton_mass2_);
   //std::cout << "vis: En = " << visEn << ", Pt = " << TMath::Sqrt(square(visPx) + square(visPy)) << std::endl;
   visP4_.SetPxPyPzE(visPx, visPy, visPz, visEn);
+  visP_ = visP4_.P();
 
   // set tau lepton four-vector to four-vector of visible decay products and neutrino four-vector to zero,
   // in case of electrons or muons directly originating from LFV Higgs boson decay
@@ -86,11 +88,15 @@ void FittedTauLepton::updateTauMomentum(double x, double phiNu, double nuMass)
 
   errorCode_ = None;
 
+  // keep tau lepton four-vector equal to four-vector of visible decay products (set by updateVisMomentum),
+  // in case of electrons or muons directly originating from LFV Higgs boson decay
+  if ( measuredTauLepton_.type() == MeasuredTauLepton::kPrompt ) return;
+
   // compute neutrino and tau lepton four-vector 
   double nuEn = visP4_.E()*(1. - x_)/x_;
   double nuMass2 = square(nuMass_);
   double nuP = TMath::Sqrt(TMath::Max(0., square(nuEn) - nuMass2));
-  double cosThetaNu = compCosThetaNuNu(visP4_.E(), visP4_.P(), measuredTauLepton_mass2_, nuEn, nuP, nuMass2);
+  double cosThetaNu = compCosThetaNuNu(visP4_.E(), visP_, measuredTauLepton_mass2_, nuEn, nuP, nuMass2);
   if ( !(cosThetaNu >= -1. && cosThetaNu <= +1.) ) {
     errorCode_ |= TauDecayParameters;
     return;
@@ -118,11 +124,78 @@ void FittedTauLepton::updateTauMomentum(double x, double phiNu, double nuMass)
   tauP4_.SetPxPyPzE(tauPx, tauPy, tauPz, tauEn);
 }
 
+void FittedTauLepton::updateTauMomenta(unsigned numPoints, const double* x, const double* phiNu, const double* nuMass, MomentaBatch& momenta) const
+{
+  double visEn = visP4_.E();
+  double visPx = visP4_.px();
+  double visPy = visP4_.py();
+  double visPz = visP4_.pz();
+
+  // set tau lepton four-vector to four-vector of visible decay products and neutrino four-vector to zero,
+  // in case of electrons or muons directly originating from LFV Higgs boson decay
+  if ( measuredTauLepton_.type() == MeasuredTauLepton::kPrompt ) {
+    for ( unsigned iPoint = 0; iPoint < numPoints; ++iPoint ) {
+      momenta.nuEn_[iPoint] = 0.;
+      momenta.nuP_[iPoint] = 0.;
+      momenta.nuPx_[iPoint] = 0.;
+      momenta.nuPy_[iPoint] = 0.;
+      momenta.nuPz_[iPoint] = 0.;
+      momenta.tauEn_[iPoint] = visEn;
+      momenta.tauPx_[iPoint] = visPx;
+      momenta.tauPy_[iPoint] = visPy;
+      momenta.tauPz_[iPoint] = visPz;
+      momenta.isValid_[iPoint] = true;
+    }
+    return;
+  }
+
+  // compute neutrino energy and momentum, polar angle of neutrinos relative to the visible tau decay products,
+  // and rotate neutrino momenta from the local coordinate system of the visible tau decay products to the labframe
+  for ( unsigned iPoint = 0; iPoint < numPoints; ++iPoint ) {
+    double x_i = x[iPoint];
+    double nuEn = visEn*(1. - x_i)/x_i;
+    double nuMass2 = square(nuMass[iPoint]);
+    double nuP = TMath::Sqrt(TMath::Max(0., square(nuEn) - nuMass2));
+    double cosThetaNu = compCosThetaNuNu(visEn, visP_, measuredTauLepton_mass2_, nuEn, nuP, nuMass2);
+    // CV: unphysical points get zero neutrino momentum by selecting values rather than branching (as in mulPSfactors_tauToLepDecay);
+    //     conditions are combined by bitwise and, which (unlike logical and) does not introduce branches
+    bool isValid = ( (cosThetaNu >= -1.) & (cosThetaNu <= +1.) );
+    nuEn = ( isValid ) ? nuEn : 0.;
+    nuP = ( isValid ) ? nuP : 0.;
+    cosThetaNu = ( isValid ) ? cosThetaNu : 0.;
+    // CV: sin(thetaNu) >= 0 for thetaNu in [0,pi]
+    double sinThetaNu = TMath::Sqrt(1. - square(cosThetaNu));
+    double cosPhiNu, sinPhiNu;
+    sincos(phiNu[iPoint], &sinPhiNu, &cosPhiNu);
+    double nuPx_local = nuP*cosPhiNu*sinThetaNu;
+    double nuPy_local = nuP*sinPhiNu*sinThetaNu;
+    double nuPz_local = nuP*cosThetaNu;
+    double nuPx = nuPx_local*eX_x_ + nuPy_local*eY_x_ + nuPz_local*eZ_x_;
+    double nuPy = nuPx_local*eX_y_ + nuPy_local*eY_y_ + nuPz_local*eZ_y_;
+    double nuPz = nuPx_local*eX_z_ + nuPy_local*eY_z_ + nuPz_local*eZ_z_;
+    momenta.nuEn_[iPoint] = nuEn;
+    momenta.nuP_[iPoint] = nuP;
+    momenta.nuPx_[iPoint] = nuPx;
+    momenta.nuPy_[iPoint] = nuPy;
+    momenta.nuPz_[iPoint] = nuPz;
+    momenta.tauEn_[iPoint] = visEn + nuEn;
+    momenta.tauPx_[iPoint] = visPx + nuPx;
+    momenta.tauPy_[iPoint] = visPy + nuPy;
+    momenta.tauPz_[iPoint] = visPz + nuPz;
+    momenta.isValid_[iPoint] = isValid;
+  }
+}
+
 const LorentzVector& FittedTauLepton::visP4() const
 {
   return visP4_;
 }
 
+double FittedTauLepton::visP() const
+{
+  return visP_;
+}
+
 const LorentzVector& FittedTauLepton::nuP4() const
 {
   return nuP4_;
@@ -152,3 +225,10 @@ int FittedTauLepton::errorCode() const
 {
   return errorCode_;
 }
+
+void FittedTauLepton::getLocalCoordinateSystem(Vector& eX, Vector& eY, Vector& eZ) const
+{
+  eX = Vector(eX_x_, eX_y_, eX_z_);
+  eY = Vector(eY_x_, eY_y_, eY_z_);
+  eZ = Vector(eZ_x_, eZ_y_, eZ_z_);
+}
@@ -1,17 +1,19 @@
 #include "TauAnalysis/ClassicSVfit/interface/SVfitIntegratorMarkovChain.h"
 
 #include "TauAnalysis/ClassicSVfit/interface/svFitAuxFunctions.h"
+#include "TauAnalysis/ClassicSVfit/interface/svFitThreadPool.h"
 
 #include <TMath.h>
+#include <TString.h>
 
 #include <iostream>
 #include <iomanip>
 #include <sstream>
 #include <limits>
+#include <algorithm>
+#include <functional>
 #include <assert.h>
 
-enum { kUniform, kGaus, kNone };
-
 namespace
 {
   template <typename T>
@@ -40,6 +42,9 @@ namespace
 
 using namespace classic_svFit;
 
+const unsigned SVfitIntegratorMarkovChain::numStepSizeFactorsPerBlock;
+const unsigned SVfitIntegratorMarkovChain::minNumAdaptiveMoves;
+
 SVfitIntegratorMarkovChain::SVfitIntegratorMarkovChain(const std::string& initMode,
                    unsigned numIterBurnin, unsigned numIterSampling, unsigned numIterSimAnnealingPhase1, unsigned numIterSimAnnealingPhase2,
                    double T0, double alpha,
@@ -47,15 +52,19 @@ SVfitIntegratorMarkovChain::SVfitIntegratorMarkovChain(const std::string& initMo
                    double epsilon0, double nu,
                    const std::string& treeFileName, int verbosity)
   : integrand_(0),
-    x_(0),
+    integrandParam_(0),
+    randomGeneratorType_("TRandom3"),
+    numThreads_(1),
+    threadPool_(0),
+    numCalls_(0),
     numIntegrationCalls_(0),    
     numMovesTotal_accepted_(0),
     numMovesTotal_rejected_(0),
     probMax_(-1.),
     errorFlag_(0),
     treeFileName_(treeFileName),
-    treeFile_(0),
-    tree_(0)
+    traceThinning_(1),
+    traceWriter_(0)
 {
   if      ( initMode == "uniform" ) initMode_ = kUniform;
   else if ( initMode == "Gaus"    ) initMode_ = kGaus;
@@ -96,6 +105,11 @@ SVfitIntegratorMarkovChain::SVfitIntegratorMarkovChain(const std::string& initMo
   }
   alpha2_ = square(alpha_);
 
+  isAutoAnnealing_ = false;
+  annealingMinProbRatio_ = 1.e-2;
+  annealingEnergyTolerance_ = 0.5;
+  numIterEnergyWindow_ = 100;
+
 //--- get parameter specifying how many Markov Chains are run in parallel
   numChains_ = numChains;
   if ( numChains_ == 0 ) {
@@ -104,6 +118,9 @@ SVfitIntegratorMarkovChain::SVfitIntegratorMarkovChain(const std::string& initMo
         << " value greater 0 expected --> ABORTING !!\n";
     assert(0);
   }
+  hasChainContext_.resize(numChains_, false);
+  chainIntegrandParams_.resize(numChains_, 0);
+  chainCallBackFunctions_.resize(numChains_);
 
   numBatches_ = numBatches;
   if ( numBatches_ == 0 ) {
@@ -122,6 +139,21 @@ SVfitIntegratorMarkovChain::SVfitIntegratorMarkovChain(const std::string& initMo
   epsilon0_ = epsilon0;
   nu_ = nu;
 
+  numTries_ = 1;
+
+  numLeapfrogSteps_ = 0;
+  leapfrogStepSize_ = 2.e-2;
+
+  useLogDomain_ = false;
+
+  useAdaptiveStepSize_ = false;
+  targetAcceptanceRate_ = 0.3;
+  minFractionAdaptation_ = 0.2;
+
+  useEarlyStopping_ = false;
+  earlyStoppingPrecision_ = 1.e-2;
+  minIterSampling_ = 0;
+
   verbosity_ = verbosity;
 }
 
@@ -134,16 +166,20 @@ SVfitIntegratorMarkovChain::~SVfitIntegratorMarkovChain()
               << " (fraction = " << (double)numMovesTotal_accepted_/(numMovesTotal_accepted_ + numMovesTotal_rejected_)*100. << "%)" << std::endl;
   }
 
-  delete [] x_;
+  delete threadPool_;
+
+  delete traceWriter_;
+
+  for ( std::vector<RandomGenerator*>::iterator randomGenerator = randomGenerators_.begin();
+        randomGenerator != randomGenerators_.end(); ++randomGenerator ) {
+    delete (*randomGenerator);
+  }
 }
 
-void SVfitIntegratorMarkovChain::setIntegrand(gPtr_C g, const double* xl, const double* xu, unsigned d)
+void SVfitIntegratorMarkovChain::setIntegrand(gPtr_C g, const double* xl, const double* xu, unsigned d, void* param)
 {
   numDimensions_ = d;
 
-  delete [] x_;
-  x_ = new double[numDimensions_];
-
   xMin_.resize(numDimensions_);
   xMax_.resize(numDimensions_);
   for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
@@ -152,18 +188,54 @@ void SVfitIntegratorMarkovChain::setIntegrand(gPtr_C g, const double* xl, const
   }
 
   epsilon0s_.resize(numDimensions_);
-  epsilon_.resize(numDimensions_);
   for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
     epsilon0s_[iDimension] = epsilon0_;
   }
 
-  p_.resize(2*numDimensions_);   // first N entries = "significant" components, last N entries = "dummy" components
-  q_.resize(numDimensions_);     // "potential energy" E(q) depends in the first N "significant" components only
-  prob_ = 0.;
-
-  u_.resize(2*numDimensions_);   // first N entries = "significant" components, last N entries = "dummy" components
-  pProposal_.resize(numDimensions_);
-  qProposal_.resize(numDimensions_);
+  chains_.resize(numChains_);
+  if ( randomGenerators_.empty() ) {
+    for ( unsigned iChain = 0; iChain < numChains_; ++iChain ) {
+      randomGenerators_.push_back(makeRandomGenerator(randomGeneratorType_));
+    }
+  }
+  for ( unsigned iChain = 0; iChain < numChains_; ++iChain ) {
+    MarkovChain& chain = chains_[iChain];
+    chain.rnd_ = randomGenerators_[iChain];
+    chain.p_.resize(2*numDimensions_);   // first N entries = "significant" components, last N entries = "dummy" components
+    chain.q_.resize(numDimensions_);     // "potential energy" E(q) depends in the first N "significant" components only
+    chain.prob_ = 0.;
+    chain.logProb_ = -std::numeric_limits<double>::infinity();
+    chain.gradE_.resize(numDimensions_);
+    chain.gradEProposal_.resize(numDimensions_);
+
+    chain.x_.resize(numDimensions_);
+    chain.u_.resize(2*numDimensions_);   // first N entries = "significant" components, last N entries = "dummy" components
+    chain.gaus_.resize(2*numDimensions_);
+    chain.epsilon_.resize(numDimensions_);
+    chain.pProposal_.resize(numDimensions_);
+    chain.qProposal_.resize(numDimensions_);
+    chain.epsilon0s_.resize(numDimensions_);
+    chain.qMean_.resize(numDimensions_);
+    chain.qM2_.resize(numDimensions_);
+    chain.pPrevious_.resize(2*numDimensions_);
+    chain.pTries_.resize(2*numDimensions_*numTries_);
+    chain.qTries_.resize(numDimensions_*numTries_);
+    chain.probTries_.resize(numTries_);
+    chain.qSelected_.resize(numDimensions_);
+    chain.qPoint_.resize(numDimensions_);
+    chain.stepSizeFactors_.resize(numStepSizeFactorsPerBlock);
+    chain.idxStepSizeFactor_ = numStepSizeFactorsPerBlock;
+
+    if ( hasChainContext_[iChain] ) {
+      chain.integrandParam_ = chainIntegrandParams_[iChain];
+      chain.callBackFunctions_ = &chainCallBackFunctions_[iChain];
+      chain.weightedCallBackFunctions_ = &noWeightedCallBackFunctions_;
+    } else {
+      chain.integrandParam_ = param;
+      chain.callBackFunctions_ = &callBackFunctions_;
+      chain.weightedCallBackFunctions_ = &weightedCallBackFunctions_;
+    }
+  }
 
   probSum_.resize(numChains_*numBatches_);
   for ( vdouble::iterator probSum_i = probSum_.begin();
@@ -173,6 +245,7 @@ void SVfitIntegratorMarkovChain::setIntegrand(gPtr_C g, const double* xl, const
   integral_.resize(numChains_*numBatches_);
 
   integrand_ = g;
+  integrandParam_ = param;
 }
 
 void SVfitIntegratorMarkovChain::registerCallBackFunction(const ROOT::Math::Functor& function)
@@ -180,9 +253,154 @@ void SVfitIntegratorMarkovChain::registerCallBackFunction(const ROOT::Math::Func
   callBackFunctions_.push_back(&function);
 }
 
-void SVfitIntegratorMarkovChain::integrate(gPtr_C g, const double* xl, const double* xu, unsigned d, double& integral, double& integralErr)
+void SVfitIntegratorMarkovChain::registerWeightedCallBackFunction(const WeightedCallBackFunction& function)
+{
+  weightedCallBackFunctions_.push_back(&function);
+}
+
+void SVfitIntegratorMarkovChain::setNumThreads(unsigned numThreads)
+{
+  if ( numThreads == 0 ) numThreads = 1;
+  if ( numThreads == numThreads_ ) return;
+  numThreads_ = numThreads;
+  delete threadPool_;
+  threadPool_ = ( numThreads_ > 1 ) ? new ThreadPool(numThreads_) : 0;
+}
+
+void SVfitIntegratorMarkovChain::setTraceThinning(unsigned thinning)
+{
+  if ( thinning == 0 ) thinning = 1;
+  if ( thinning == traceThinning_ ) return;
+  traceThinning_ = thinning;
+  delete traceWriter_;
+  traceWriter_ = 0;
+}
+
+void SVfitIntegratorMarkovChain::setTraceColumns(const std::vector<std::string>& columnNames, const TraceColumnFunction& function)
+{
+  traceColumnNames_ = columnNames;
+  traceColumnFunction_ = function;
+}
+
+void SVfitIntegratorMarkovChain::setAutoAnnealing(bool value, double minProbRatio, double energyTolerance, unsigned numIterEnergyWindow)
+{
+  if ( !(energyTolerance > 0.) || numIterEnergyWindow == 0 ) {
+    std::cerr << "<SVfitIntegratorMarkovChain>:"
+              << "Invalid Configuration Parameters 'energyTolerance' = " << energyTolerance << ","
+              << " 'numIterEnergyWindow' = " << numIterEnergyWindow << ","
+              << " positive values expected --> ABORTING !!\n";
+    assert(0);
+  }
+  isAutoAnnealing_ = value;
+  annealingMinProbRatio_ = minProbRatio;
+  annealingEnergyTolerance_ = energyTolerance;
+  numIterEnergyWindow_ = numIterEnergyWindow;
+}
+
+void SVfitIntegratorMarkovChain::setStartPositionCandidates(const std::vector<std::vector<double> >& candidates)
+{
+  startPositionCandidates_ = candidates;
+}
+
+void SVfitIntegratorMarkovChain::setRandomGenerator(const std::string& type)
+{
+  delete makeRandomGenerator(type); // CV: check that type is valid
+  randomGeneratorType_ = type;
+  for ( std::vector<RandomGenerator*>::iterator randomGenerator = randomGenerators_.begin();
+        randomGenerator != randomGenerators_.end(); ++randomGenerator ) {
+    delete (*randomGenerator);
+  }
+  randomGenerators_.clear();
+}
+
+void SVfitIntegratorMarkovChain::setAdaptiveStepSize(bool value, double targetAcceptanceRate, double minFractionAdaptation)
+{
+  if ( !(targetAcceptanceRate > 0. && targetAcceptanceRate < 1.) ) {
+    std::cerr << "<SVfitIntegratorMarkovChain>:"
+              << "Invalid Configuration Parameter 'targetAcceptanceRate' = " << targetAcceptanceRate << ","
+              << " value within interval ]0..1[ expected --> ABORTING !!\n";
+    assert(0);
+  }
+  if ( !(minFractionAdaptation >= 0. && minFractionAdaptation <= 1.) ) {
+    std::cerr << "<SVfitIntegratorMarkovChain>:"
+              << "Invalid Configuration Parameter 'minFractionAdaptation' = " << minFractionAdaptation << ","
+              << " value within interval [0..1] expected --> ABORTING !!\n";
+    assert(0);
+  }
+  useAdaptiveStepSize_ = value;
+  targetAcceptanceRate_ = targetAcceptanceRate;
+  minFractionAdaptation_ = minFractionAdaptation;
+}
+
+void SVfitIntegratorMarkovChain::setMultipleTry(unsigned numTries)
+{
+  if ( numTries == 0 ) {
+    std::cerr << "<SVfitIntegratorMarkovChain>:"
+              << "Invalid Configuration Parameter 'numTries' = " << numTries << ","
+              << " value greater 0 expected --> ABORTING !!\n";
+    assert(0);
+  }
+  numTries_ = numTries;
+  checkLogDomain();
+}
+
+void SVfitIntegratorMarkovChain::setHamiltonianMonteCarlo(unsigned numLeapfrogSteps, double stepSize)
+{
+  if ( !(stepSize > 0.) ) {
+    std::cerr << "<SVfitIntegratorMarkovChain>:"
+              << "Invalid Configuration Parameter 'stepSize' = " << stepSize << ","
+              << " positive value expected --> ABORTING !!\n";
+    assert(0);
+  }
+  numLeapfrogSteps_ = numLeapfrogSteps;
+  leapfrogStepSize_ = stepSize;
+  checkLogDomain();
+}
+
+void SVfitIntegratorMarkovChain::setLogDomain(bool value)
+{
+  useLogDomain_ = value;
+  checkLogDomain();
+}
+
+void SVfitIntegratorMarkovChain::checkLogDomain() const
+{
+  if ( useLogDomain_ && !isLogDomain() ) {
+    std::cerr << "<SVfitIntegratorMarkovChain>:"
+              << "Warning: evaluation in log domain is not supported for multiple-try Metropolis and Hamiltonian Monte Carlo moves,"
+              << " moves are not evaluated in log domain !!\n";
+  }
+}
+
+void SVfitIntegratorMarkovChain::setEarlyStopping(bool value, double precision, unsigned minIterSampling)
 {
-  setIntegrand(g, xl, xu, d);
+  if ( !(precision > 0.) ) {
+    std::cerr << "<SVfitIntegratorMarkovChain>:"
+              << "Invalid Configuration Parameter 'precision' = " << precision << ","
+              << " positive value expected --> ABORTING !!\n";
+    assert(0);
+  }
+  useEarlyStopping_ = value;
+  earlyStoppingPrecision_ = precision;
+  minIterSampling_ = minIterSampling;
+}
+
+void SVfitIntegratorMarkovChain::setConvergenceMonitor(const ConvergenceMonitor& monitor)
+{
+  convergenceMonitor_ = monitor;
+}
+
+void SVfitIntegratorMarkovChain::setChainContext(unsigned iChain, void* param, const std::vector<const ROOT::Math::Functor*>& callBackFunctions)
+{
+  assert(iChain < numChains_);
+  hasChainContext_[iChain] = true;
+  chainIntegrandParams_[iChain] = param;
+  chainCallBackFunctions_[iChain] = callBackFunctions;
+}
+
+void SVfitIntegratorMarkovChain::integrate(gPtr_C g, const double* xl, const double* xu, unsigned d, double& integral, double& integralErr, void* param)
+{
+  setIntegrand(g, xl, xu, d, param);
 
   if ( !integrand_ ) {
     std::cerr << "<SVfitIntegratorMarkovChain>:"
@@ -190,123 +408,146 @@ void SVfitIntegratorMarkovChain::integrate(gPtr_C g, const double* xl, const dou
     assert(0);
   }
 
+//--- evaluate integrand via function pointer, passing the integrand context of each chain,
+//    and "call-back" functions registered via registerCallBackFunction or setChainContext
+  struct PointerIntegrand
+  {
+    PointerIntegrand(SVfitIntegratorMarkovChain& integrator)
+      : integrator_(integrator)
+    {}
+    double operator()(unsigned iChain, const double* q) const
+    {
+      return (*integrator_.integrand_)(q, integrator_.numDimensions_, integrator_.chains_[iChain].integrandParam_);
+    }
+    void operator()(unsigned iChain, const double* q, unsigned numPoints, double* prob) const
+    {
+      MarkovChain& chain = integrator_.chains_[iChain];
+      unsigned numDimensions = integrator_.numDimensions_;
+      for ( unsigned iPoint = 0; iPoint < numPoints; ++iPoint ) {
+        for ( unsigned iDimension = 0; iDimension < numDimensions; ++iDimension ) {
+          chain.qPoint_[iDimension] = q[iDimension*numPoints + iPoint];
+        }
+        prob[iPoint] = (*integrator_.integrand_)(chain.qPoint_.data(), numDimensions, chain.integrandParam_);
+      }
+    }
+    double operator()(unsigned iChain, const double* q, double* gradLogProb) const
+    {
+//--- compute gradient by central finite differences,
+//    evaluating the integrand at q last, so that "call-back" functions use the kinematics computed at q
+      MarkovChain& chain = integrator_.chains_[iChain];
+      unsigned numDimensions = integrator_.numDimensions_;
+      const double h = 1.e-6;
+      for ( unsigned iDimension = 0; iDimension < numDimensions; ++iDimension ) {
+        chain.qPoint_[iDimension] = q[iDimension];
+      }
+      for ( unsigned iDimension = 0; iDimension < numDimensions; ++iDimension ) {
+        chain.qPoint_[iDimension] = q[iDimension] + h;
+        double probUp = (*integrator_.integrand_)(chain.qPoint_.data(), numDimensions, chain.integrandParam_);
+        chain.qPoint_[iDimension] = q[iDimension] - h;
+        double probDown = (*integrator_.integrand_)(chain.qPoint_.data(), numDimensions, chain.integrandParam_);
+        chain.qPoint_[iDimension] = q[iDimension];
+        gradLogProb[iDimension] = ( probUp > 0. && probDown > 0. ) ? (TMath::Log(probUp) - TMath::Log(probDown))/(2.*h) : 0.;
+      }
+      return (*integrator_.integrand_)(q, numDimensions, chain.integrandParam_);
+    }
+    double operator()(unsigned iChain, const double* q, LogDomain) const
+    {
+      double prob = (*this)(iChain, q);
+      return ( prob > 0. ) ? TMath::Log(prob) : -std::numeric_limits<double>::infinity();
+    }
+    SVfitIntegratorMarkovChain& integrator_;
+  };
+  struct CallBackObserver
+  {
+    CallBackObserver(const SVfitIntegratorMarkovChain& integrator)
+      : integrator_(integrator)
+    {}
+    void operator()(unsigned iChain, const double* x) const
+    {
+      const MarkovChain& chain = integrator_.chains_[iChain];
+      for ( std::vector<const ROOT::Math::Functor*>::const_iterator callBackFunction = chain.callBackFunctions_->begin();
+            callBackFunction != chain.callBackFunctions_->end(); ++callBackFunction ) {
+        (**callBackFunction)(x);
+      }
+      for ( std::vector<const WeightedCallBackFunction*>::const_iterator callBackFunction = chain.weightedCallBackFunctions_->begin();
+            callBackFunction != chain.weightedCallBackFunctions_->end(); ++callBackFunction ) {
+        (*callBackFunction)->evalWeighted(x, 1.);
+      }
+    }
+    const SVfitIntegratorMarkovChain& integrator_;
+  };
+  PointerIntegrand pointerIntegrand(*this);
+  CallBackObserver callBackObserver(*this);
+
+//--- run Markov Chains in parallel threads,
+//    provided each chain (except for one) has its own integrand context and "call-back" functions
+  unsigned numChainsWithoutContext = 0;
+  for ( unsigned iChain = 0; iChain < numChains_; ++iChain ) {
+    if ( !hasChainContext_[iChain] ) ++numChainsWithoutContext;
+  }
+  bool runParallel = ( numChainsWithoutContext <= 1 );
+  if ( !runParallel && threadPool_ && numChains_ > 1 && verbosity_ >= 1 ) {
+    std::cerr << "<SVfitIntegratorMarkovChain>:"
+              << "Warning: no integrand context set for " << numChainsWithoutContext << " Markov Chains --> running chains sequentially !!\n";
+  }
+
+  beginIntegration();
+  runChains(pointerIntegrand, callBackObserver, runParallel);
+  endIntegration(integral, integralErr);
+}
+
+void SVfitIntegratorMarkovChain::beginIntegration()
+{
   for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
-    xMin_[iDimension] = xl[iDimension];
-    xMax_[iDimension] = xu[iDimension];
     if ( verbosity_ >= 1 ) {
       std::cout << "dimension #" << iDimension << ": min = " << xMin_[iDimension] << ", max = " << xMax_[iDimension] << std::endl;
     }
   }
 
-//--- CV: set random number generator used to initialize starting-position
-//        for each integration, in order to make integration results independent of processing history
-  rnd_.SetSeed(12345);
+//--- CV: set random number generators used to initialize starting-position
+//        for each integration, in order to make integration results independent of processing history;
+//        each chain uses a different seed, so that results do not depend on the number of threads
+  for ( unsigned iChain = 0; iChain < numChains_; ++iChain ) {
+    chains_[iChain].rnd_->setSeed(getSeed(iChain));
+  }
 
   numMoves_accepted_ = 0;
   numMoves_rejected_ = 0;
 
   probMax_ = -1.;
 
-  unsigned k = numChains_*numBatches_;
-  unsigned m = numIterSampling_/numBatches_;
-
   numChainsRun_ = 0;
+  numCalls_ = 0;
 
   if ( treeFileName_ != "" ) {
-    treeFile_ = new TFile(treeFileName_.data(), "RECREATE");
-    tree_ = new TTree("tree", "Markov Chain transitions");
+    if ( !traceWriter_ ) traceWriter_ = new ChainTraceWriter(treeFileName_, traceThinning_);
+    std::vector<std::string> columnNames;
     for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
-      std::string branchName = Form("x%u", iDimension);
-      tree_->Branch(branchName.data(), &x_[iDimension]);
+      columnNames.push_back(Form("x%u", iDimension));
     }
-    tree_->Branch("move", &treeMove_);
-    tree_->Branch("integrand", &treeIntegrand_);
-  }
-
-  for ( unsigned iChain = 0; iChain < numChains_; ++iChain ) {
-    bool isValidStartPos = false;
-    if ( initMode_ == kNone ) {
-      prob_ = evalProb(q_);
-      if ( prob_ > 0. ) {
-      bool isWithinBounds = true;
-      for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
-        double q_i = q_[iDimension];
-        if ( !(q_i > 0. && q_i < 1.) ) isWithinBounds = false;
-      }
-      if ( isWithinBounds ) {
-        isValidStartPos = true;
-      } else {
-        if ( verbosity_ >= 1 ) {
-          std::cerr << "<SVfitIntegratorMarkovChain>:"
-                    << "Warning: Requested start-position = " << format_vdouble(q_) << " not within interval ]0..1[ --> searching for valid alternative !!\n";
-        }
-      }
-      } else {
-        if ( verbosity_ >= 1 ) {
-          std::cerr << "<SVfitIntegratorMarkovChain>:"
-                    << "Warning: Requested start-position = " << format_vdouble(q_) << " returned probability zero --> searching for valid alternative !!";
-        }
-      }
+    columnNames.push_back("move");
+    columnNames.push_back("integrand");
+    columnNames.insert(columnNames.end(), traceColumnNames_.begin(), traceColumnNames_.end());
+    for ( unsigned iChain = 0; iChain < numChains_; ++iChain ) {
+      chains_[iChain].traceValues_.resize(columnNames.size());
     }
-    unsigned iTry = 0;
-    while ( !isValidStartPos && iTry < maxCallsStartingPos_ ) {
-      initializeStartPosition_and_Momentum();
-      prob_ = evalProb(q_);
-      if ( prob_ > 0. ) {
-        isValidStartPos = true;
-      } else {
-        if ( iTry > 0 && (iTry % 100000) == 0 ) {
-          if ( iTry == 100000 ) std::cout << "<SVfitIntegratorMarkovChain::integrate>:" << std::endl;
-          std::cout << "try #" << iTry << ": did not find valid start-position yet." << std::endl;
-        }
-      }
-      ++iTry;
-    }
-    if ( !isValidStartPos ) continue;
-
-    for ( unsigned iMove = 0; iMove < numIterBurnin_; ++iMove ) {
-//--- propose Markov Chain transition to new, randomly chosen, point
-      bool isAccepted = false;
-      bool isValid = true;
-      do {
-	makeStochasticMove(iMove, isAccepted, isValid);
-      } while ( !isValid );
-    }
-
-    unsigned idxBatch = iChain*numBatches_;
-
-    for ( unsigned iMove = 0; iMove < numIterSampling_; ++iMove ) {
-//--- propose Markov Chain transition to new, randomly chosen, point;
-//    evaluate "call-back" functions at this point
-      bool isAccepted = false;
-      bool isValid = true;
-      do {
-        makeStochasticMove(numIterBurnin_ + iMove, isAccepted, isValid);
-      } while ( !isValid );
-      if ( isAccepted ) {
-	if ( prob_ > probMax_ ) probMax_ = prob_;
-        ++numMoves_accepted_;
-      } else {
-        ++numMoves_rejected_;
-      }
-
-      updateX(q_);
-      for ( std::vector<const ROOT::Math::Functor*>::const_iterator callBackFunction = callBackFunctions_.begin();
-            callBackFunction != callBackFunctions_.end(); ++callBackFunction ) {
-        (**callBackFunction)(x_);
-      }
-
-      if ( tree_ ) {
-        treeMove_ = iMove;
-        treeIntegrand_ = prob_;
-        tree_->Fill();
-      }
+    traceWriter_->beginEvent(columnNames, numChains_);
+  }
+}
 
-      if ( iMove > 0 && (iMove % m) == 0 ) ++idxBatch;
-      assert(idxBatch < (numChains_*numBatches_));
-      probSum_[idxBatch] += prob_;
-    }
+void SVfitIntegratorMarkovChain::endIntegration(double& integral, double& integralErr)
+{
+  unsigned m = numIterSampling_/numBatches_;
 
+  unsigned k = 0;
+  for ( unsigned iChain = 0; iChain < numChains_; ++iChain ) {
+    const MarkovChain& chain = chains_[iChain];
+    k += chain.numBatchesRun_;
+    numCalls_ += chain.numCalls_;
+    if ( !chain.isValid_ ) continue;
+    numMoves_accepted_ += chain.numMoves_accepted_;
+    numMoves_rejected_ += chain.numMoves_rejected_;
+    if ( chain.probMax_ > probMax_ ) probMax_ = chain.probMax_;
     ++numChainsRun_;
   }
 
@@ -317,15 +558,20 @@ void SVfitIntegratorMarkovChain::integrate(gPtr_C g, const double* xl, const dou
 
 //--- compute integral value and uncertainty
 //   (eqs. (6.39) and (6.40) in [1])
+//    (only batches filled before the stopping rule ended the sampling stage are used)
   integral = 0.;
-  for ( unsigned i = 0; i < k; ++i ) {
-    integral += integral_[i];
+  for ( unsigned iChain = 0; iChain < numChains_; ++iChain ) {
+    for ( unsigned iBatch = 0; iBatch < chains_[iChain].numBatchesRun_; ++iBatch ) {
+      integral += integral_[iChain*numBatches_ + iBatch];
+    }
   }
   integral /= k;
 
   integralErr = 0.;
-  for ( unsigned i = 0; i < k; ++i ) {
-    integralErr += square(integral_[i] - integral);
+  for ( unsigned iChain = 0; iChain < numChains_; ++iChain ) {
+    for ( unsigned iBatch = 0; iBatch < chains_[iChain].numBatchesRun_; ++iBatch ) {
+      integralErr += square(integral_[iChain*numBatches_ + iBatch] - integral);
+    }
   }
   if ( k >= 2 ) integralErr /= (k*(k - 1));
   integralErr = TMath::Sqrt(integralErr);
@@ -334,75 +580,326 @@ void SVfitIntegratorMarkovChain::integrate(gPtr_C g, const double* xl, const dou
 
   errorFlag_ = ( numChainsRun_ >= 0.5*numChains_ ) ? 0 : 1;
 
+  fillStatistics(integral, integralErr);
+
   ++numIntegrationCalls_;
   numMovesTotal_accepted_ += numMoves_accepted_;
   numMovesTotal_rejected_ += numMoves_rejected_;
 
-  if ( tree_ ) {
-    tree_->Write();
-  }
-  delete treeFile_;
-  treeFile_ = 0;
-  //delete tree_;
-  tree_ = 0;
+  if ( traceWriter_ ) traceWriter_->endEvent();
 
   if ( verbosity_ >= 1 ) print(std::cout);
 }
 
-void SVfitIntegratorMarkovChain::print(std::ostream& stream) const
+void SVfitIntegratorMarkovChain::beginChain(MarkovChain& chain)
 {
-  stream << "<SVfitIntegratorMarkovChain::print>:" << std::endl;
-  for ( unsigned iChain = 0; iChain < numChains_; ++iChain ) {
-    double integral = 0.;
-    for ( unsigned iBatch = 0; iBatch < numBatches_; ++iBatch ) {
-      double integral_i = integral_[iChain*numBatches_ + iBatch];
-      //std::cout << "batch #" << iBatch << ": integral = " << integral_i << std::endl;
-      integral += integral_i;
+  chain.numMoves_accepted_ = 0;
+  chain.numMoves_rejected_ = 0;
+  chain.numMovesBurnin_accepted_ = 0;
+  chain.numMovesBurnin_rejected_ = 0;
+  chain.numStartPositionTries_ = 0;
+  for ( unsigned idxPhase = 0; idxPhase < IntegratorStatistics::kNumPhases; ++idxPhase ) {
+    chain.numCallsPhase_[idxPhase] = 0;
+    chain.cpuTimePhase_[idxPhase] = 0.;
+    chain.realTimePhase_[idxPhase] = 0.;
+  }
+  chain.probMax_ = -1.;
+  chain.isValid_ = false;
+  chain.numCalls_ = 0;
+  chain.numBatchesRun_ = numBatches_;
+  if ( useEarlyStopping_ ) chain.observables_.resize(numBatches_);
+
+  chain.epsilon0s_ = epsilon0s_;
+  for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+    chain.qMean_[iDimension] = 0.;
+    chain.qM2_[iDimension] = 0.;
+  }
+  chain.numAdaptiveMoves_ = 0;
+  chain.logStepScale_ = 0.;
+  chain.isGradEValid_ = false;
+  // CV: discard step-size factors left over from previous integration,
+  //     so that the integration result does not depend on the processing history
+  chain.idxStepSizeFactor_ = numStepSizeFactorsPerBlock;
+  chain.logProbMaxCandidates_ = -std::numeric_limits<double>::infinity();
+  beginPhase(chain);
+}
+
+void SVfitIntegratorMarkovChain::beginPhase(MarkovChain& chain)
+{
+  chain.phaseBeginNumCalls_ = chain.numCalls_;
+  chain.phaseBeginCpuTime_ = getThreadCpuTime();
+  chain.phaseBeginRealTime_ = getRealTime();
+}
+
+void SVfitIntegratorMarkovChain::endPhase(MarkovChain& chain, unsigned idxPhase)
+{
+  chain.numCallsPhase_[idxPhase] = chain.numCalls_ - chain.phaseBeginNumCalls_;
+  chain.cpuTimePhase_[idxPhase] = getThreadCpuTime() - chain.phaseBeginCpuTime_;
+  chain.realTimePhase_[idxPhase] = getRealTime() - chain.phaseBeginRealTime_;
+  beginPhase(chain);
+}
+
+void SVfitIntegratorMarkovChain::beginAnnealing(MarkovChain& chain)
+{
+  chain.numIterSimAnnealingPhase1_ = numIterSimAnnealingPhase1_;
+  chain.numIterSimAnnealingPhase1plus2_ = numIterSimAnnealingPhase1plus2_;
+
+//--- end "simulated annealing" early enough to leave the adaptation window for tuning the step-sizes
+  if ( useAdaptiveStepSize_ ) {
+    unsigned numIterAdaptation = std::max(static_cast<unsigned>(TMath::Nint(minFractionAdaptation_*numIterBurnin_)), minNumAdaptiveMoves);
+    unsigned maxIterSimAnnealing = ( numIterAdaptation < numIterBurnin_ ) ? numIterBurnin_ - numIterAdaptation : 0;
+    if ( chain.numIterSimAnnealingPhase1plus2_ > maxIterSimAnnealing ) {
+      chain.numIterSimAnnealingPhase1plus2_ = maxIterSimAnnealing;
+      chain.numIterSimAnnealingPhase1_ = std::min(chain.numIterSimAnnealingPhase1_, maxIterSimAnnealing);
     }
-    integral /= numBatches_;
-    //std::cout << "<integral> = " << integral << std::endl;
+  }
+  chain.energySum_ = 0.;
+  chain.numEnergyEntries_ = 0;
+  chain.numEnergyWindows_ = 0;
+  chain.energyMeanPrevious_ = 0.;
+}
+
+void SVfitIntegratorMarkovChain::selectAnnealing(MarkovChain& chain, double logProbStart, double logProbMaxPilot)
+{
+//--- skip "simulated annealing" in case chain starts close to the maximum of the integrand,
+//    as far as known from the pilot moves and from the evaluation of the start-position candidates
+//   (the candidates are evaluated before the start-position is chosen; for the first chain, the start-position is the best candidate)
+  double logProbMax = TMath::Max(logProbMaxPilot, chain.logProbMaxCandidates_);
+  if ( logProbStart >= TMath::Log(annealingMinProbRatio_) + logProbMax ) {
+    chain.numIterSimAnnealingPhase1_ = 0;
+    chain.numIterSimAnnealingPhase1plus2_ = 0;
+  }
+  if ( verbosity_ >= 2 ) {
+    std::cout << "<SVfitIntegratorMarkovChain::selectAnnealing>:" << std::endl;
+    std::cout << " log(prob) = " << logProbStart << " (max. of pilot = " << logProbMaxPilot << ", max. of candidates = " << chain.logProbMaxCandidates_ << "):"
+              << " sim. annealing iterations = " << chain.numIterSimAnnealingPhase1plus2_ << std::endl;
+  }
+}
+
+double SVfitIntegratorMarkovChain::getLogProb(const MarkovChain& chain) const
+{
+  return ( isLogDomain() ) ? chain.logProb_ : TMath::Log(chain.prob_);
+}
 
-    double integralErr = 0.;
-    for ( unsigned iBatch = 0; iBatch < numBatches_; ++iBatch ) {
-      double integral_i = integral_[iChain*numBatches_ + iBatch];
-      integralErr += square(integral_i - integral);
+bool SVfitIntegratorMarkovChain::hasNonZeroProb(const MarkovChain& chain) const
+{
+  return ( isLogDomain() ) ? chain.logProb_ > -std::numeric_limits<double>::infinity() : chain.prob_ > 0.;
+}
+
+void SVfitIntegratorMarkovChain::updateAnnealing(MarkovChain& chain, unsigned iMove)
+{
+  if ( iMove < chain.numIterSimAnnealingPhase1_ ) return;
+
+//--- compare mean "potential energy" in subsequent windows of moves during phase 2
+  chain.energySum_ += -getLogProb(chain);
+  ++chain.numEnergyEntries_;
+  if ( chain.numEnergyEntries_ < numIterEnergyWindow_ ) return;
+  double energyMean = chain.energySum_/chain.numEnergyEntries_;
+  if ( chain.numEnergyWindows_ > 0 && TMath::Abs(energyMean - chain.energyMeanPrevious_) < annealingEnergyTolerance_ ) {
+    chain.numIterSimAnnealingPhase1plus2_ = iMove + 1;
+    if ( verbosity_ >= 2 ) {
+      std::cout << "<SVfitIntegratorMarkovChain::updateAnnealing>:" << std::endl;
+      std::cout << " E = " << energyMean << " (previous = " << chain.energyMeanPrevious_ << "):"
+                << " ending sim. annealing after " << chain.numIterSimAnnealingPhase1plus2_ << " iterations" << std::endl;
+    }
+  }
+  chain.energyMeanPrevious_ = energyMean;
+  ++chain.numEnergyWindows_;
+  chain.energySum_ = 0.;
+  chain.numEnergyEntries_ = 0;
+}
+
+bool SVfitIntegratorMarkovChain::isValidStartPosition(const MarkovChain& chain) const
+{
+  if ( hasNonZeroProb(chain) ) {
+    bool isWithinBounds = true;
+    for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+      double q_i = chain.q_[iDimension];
+      if ( !(q_i > 0. && q_i < 1.) ) isWithinBounds = false;
+    }
+    if ( isWithinBounds ) {
+      return true;
+    } else {
+      if ( verbosity_ >= 1 ) {
+        std::cerr << "<SVfitIntegratorMarkovChain>:"
+                  << "Warning: Requested start-position = " << format_vdouble(chain.q_) << " not within interval ]0..1[ --> searching for valid alternative !!\n";
+      }
+    }
+  } else {
+    if ( verbosity_ >= 1 ) {
+      std::cerr << "<SVfitIntegratorMarkovChain>:"
+                << "Warning: Requested start-position = " << format_vdouble(chain.q_) << " returned probability zero --> searching for valid alternative !!";
+    }
+  }
+  return false;
+}
+
+bool SVfitIntegratorMarkovChain::endSamplingMove(MarkovChain& chain, unsigned iChain, unsigned iMove, bool isAccepted)
+{
+  if ( isAccepted ) {
+    if ( chain.prob_ > chain.probMax_ ) chain.probMax_ = chain.prob_;
+    ++chain.numMoves_accepted_;
+  } else {
+    ++chain.numMoves_rejected_;
+  }
+
+  if ( traceWriter_ && traceWriter_->isSelected(iMove) ) {
+    float* traceValues = chain.traceValues_.data();
+    for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+      traceValues[iDimension] = chain.x_[iDimension];
     }
-    if ( numBatches_ >= 2 ) integralErr /= (numBatches_*(numBatches_ - 1));
-    integralErr = TMath::Sqrt(integralErr);
+    traceValues[numDimensions_] = iMove;
+    traceValues[numDimensions_ + 1] = chain.prob_;
+    if ( traceColumnFunction_ ) traceColumnFunction_(iChain, traceValues + numDimensions_ + 2);
+    traceWriter_->fill(iChain, traceValues);
+  }
 
-    std::cout << " chain #" << iChain << ": integral = " << integral << " +/- " << integralErr << std::endl;
+  unsigned m = numIterSampling_/numBatches_;
+  unsigned idxBatch = iChain*numBatches_ + iMove/m;
+  assert(idxBatch < ((iChain + 1)*numBatches_));
+  probSum_[idxBatch] += chain.prob_;
+
+//--- check stopping rule at end of each batch
+  if ( useEarlyStopping_ && ((iMove + 1) % m) == 0 && (iMove + 1) < numIterSampling_ ) {
+    unsigned numBatchesDone = (iMove + 1)/m;
+    if ( isConverged(chain, iChain, numBatchesDone) && (iMove + 1) >= minIterSampling_ ) {
+      chain.numBatchesRun_ = numBatchesDone;
+      return true;
+    }
+  }
+  return false;
+}
+
+void SVfitIntegratorMarkovChain::fillStatistics(double integral, double integralErr)
+{
+  statistics_.reset();
+  for ( unsigned iChain = 0; iChain < numChains_; ++iChain ) {
+    const MarkovChain& chain = chains_[iChain];
+    for ( unsigned idxPhase = 0; idxPhase < IntegratorStatistics::kNumPhases; ++idxPhase ) {
+      statistics_.numCalls_[idxPhase] += chain.numCallsPhase_[idxPhase];
+      statistics_.cpuTime_[idxPhase] += chain.cpuTimePhase_[idxPhase];
+      statistics_.realTime_[idxPhase] += chain.realTimePhase_[idxPhase];
+    }
+    statistics_.numMoves_accepted_[IntegratorStatistics::kAdaptation] += chain.numMovesBurnin_accepted_;
+    statistics_.numMoves_rejected_[IntegratorStatistics::kAdaptation] += chain.numMovesBurnin_rejected_;
+    statistics_.numMoves_accepted_[IntegratorStatistics::kSampling] += chain.numMoves_accepted_;
+    statistics_.numMoves_rejected_[IntegratorStatistics::kSampling] += chain.numMoves_rejected_;
+    statistics_.numStartPositionTries_ += chain.numStartPositionTries_;
+
+//--- compute integral value and uncertainty for each chain separately
+    IntegratorStatistics::Chain chainStatistics;
+    chainStatistics.isValid_ = chain.isValid_;
+    unsigned numBatchesRun = chain.numBatchesRun_;
+    double chainIntegral = 0.;
+    for ( unsigned iBatch = 0; iBatch < numBatchesRun; ++iBatch ) {
+      chainIntegral += integral_[iChain*numBatches_ + iBatch];
+    }
+    if ( numBatchesRun >= 1 ) chainIntegral /= numBatchesRun;
+    double chainIntegralErr = 0.;
+    for ( unsigned iBatch = 0; iBatch < numBatchesRun; ++iBatch ) {
+      chainIntegralErr += square(integral_[iChain*numBatches_ + iBatch] - chainIntegral);
+    }
+    if ( numBatchesRun >= 2 ) chainIntegralErr /= (numBatchesRun*(numBatchesRun - 1));
+    chainStatistics.integral_ = chainIntegral;
+    chainStatistics.integralErr_ = TMath::Sqrt(chainIntegralErr);
+    chainStatistics.probMax_ = chain.probMax_;
+    chainStatistics.numCalls_ = chain.numCalls_;
+    chainStatistics.numMoves_accepted_ = chain.numMovesBurnin_accepted_ + chain.numMoves_accepted_;
+    chainStatistics.numMoves_rejected_ = chain.numMovesBurnin_rejected_ + chain.numMoves_rejected_;
+    statistics_.chains_.push_back(chainStatistics);
+  }
+  statistics_.integral_ = integral;
+  statistics_.integralErr_ = integralErr;
+  statistics_.probMax_ = probMax_;
+}
+
+void SVfitIntegratorMarkovChain::print(std::ostream& stream) const
+{
+  stream << "<SVfitIntegratorMarkovChain::print>:" << std::endl;
+  for ( unsigned iChain = 0; iChain < statistics_.chains_.size(); ++iChain ) {
+    const IntegratorStatistics::Chain& chainStatistics = statistics_.chains_[iChain];
+    stream << " chain #" << iChain << ": integral = " << chainStatistics.integral_ << " +/- " << chainStatistics.integralErr_ << std::endl;
+  }
+  stream << "moves: accepted = " << numMoves_accepted_ << ", rejected = " << numMoves_rejected_
+         << " (fraction = " << (double)numMoves_accepted_/(numMoves_accepted_ + numMoves_rejected_)*100.
+         << "%)" << std::endl;
+  stream << "integrand evaluations = " << numCalls_ << std::endl;
+  const char* phaseNames[IntegratorStatistics::kNumPhases] = { "start-position", "burnin", "sampling" };
+  for ( unsigned idxPhase = 0; idxPhase < IntegratorStatistics::kNumPhases; ++idxPhase ) {
+    stream << " " << phaseNames[idxPhase] << ": evaluations = " << statistics_.numCalls_[idxPhase] << ","
+           << " CPU time = " << statistics_.cpuTime_[idxPhase] << " s, real time = " << statistics_.realTime_[idxPhase] << " s" << std::endl;
   }
-  std::cout << "moves: accepted = " << numMoves_accepted_ << ", rejected = " << numMoves_rejected_
-            << " (fraction = " << (double)numMoves_accepted_/(numMoves_accepted_ + numMoves_rejected_)*100.
-            << "%)" << std::endl;
 }
 
 //
 //-------------------------------------------------------------------------------
 //
 
-void SVfitIntegratorMarkovChain::initializeStartPosition_and_Momentum()
+void SVfitIntegratorMarkovChain::initializeStartPosition_and_Momentum(MarkovChain& chain)
 {
 //--- randomly choose start position of Markov Chain in N-dimensional space
   for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
     bool isInitialized = false;
     while ( !isInitialized ) {
       double q0 = 0.;
-      if ( initMode_ == kGaus ) q0 = rnd_.Gaus(0.5, 0.5);
-      else q0 = rnd_.Uniform(0., 1.);
+      if ( initMode_ == kGaus ) q0 = chain.rnd_->Gaus(0.5, 0.5);
+      else q0 = chain.rnd_->Uniform(0., 1.);
       if ( q0 > 0. && q0 < 1. ) {
-  q_[iDimension] = q0;
+  chain.q_[iDimension] = q0;
   isInitialized = true;
       }
     }
   }
   if ( verbosity_ >= 2 ) {
     std::cout << "<SVfitIntegratorMarkovChain::initializeStartPosition_and_Momentum>:" << std::endl;
-    std::cout << " q = " << format_vdouble(q_) << std::endl;
+    std::cout << " q = " << format_vdouble(chain.q_) << std::endl;
   }
 }
 
-void SVfitIntegratorMarkovChain::sampleSphericallyRandom()
+void SVfitIntegratorMarkovChain::convertStartPositionCandidate(unsigned iCandidate, vdouble& q) const
+{
+//--- convert candidate to coordinates rescaled to the interval ]0..1[
+  const double qMin = 1.e-6;
+  const double qMax = 1. - 1.e-6;
+  const vdouble& candidate = startPositionCandidates_[iCandidate];
+  assert(candidate.size() == numDimensions_);
+  for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+    double q_i = (candidate[iDimension] - xMin_[iDimension])/(xMax_[iDimension] - xMin_[iDimension]);
+    q[iDimension] = TMath::Min(TMath::Max(q_i, qMin), qMax);
+  }
+}
+
+bool SVfitIntegratorMarkovChain::selectStartPosition_fromCandidates(MarkovChain& chain, unsigned iChain, std::vector<std::pair<double, unsigned> >& candidateProbs) const
+{
+  if ( candidateProbs.empty() ) {
+    if ( verbosity_ >= 1 ) {
+      std::cerr << "<SVfitIntegratorMarkovChain>:"
+                << "Warning: integrand is zero for all " << startPositionCandidates_.size() << " start-position candidates --> searching for valid alternative !!\n";
+    }
+    return false;
+  }
+
+//--- choose candidate with highest integrand value,
+//    using candidates with lower values for further chains so that chains start from different points
+  std::sort(candidateProbs.begin(), candidateProbs.end(), std::greater<std::pair<double, unsigned> >());
+  const std::pair<double, unsigned>& bestCandidate = candidateProbs[iChain % candidateProbs.size()];
+  convertStartPositionCandidate(bestCandidate.second, chain.q_);
+  if ( isLogDomain() ) {
+    chain.logProbMaxCandidates_ = candidateProbs.front().first;
+    chain.logProb_ = bestCandidate.first;
+    chain.prob_ = TMath::Exp(chain.logProb_);
+  } else {
+    chain.logProbMaxCandidates_ = TMath::Log(candidateProbs.front().first);
+    chain.prob_ = bestCandidate.first;
+  }
+  if ( verbosity_ >= 2 ) {
+    std::cout << "<SVfitIntegratorMarkovChain::initializeStartPosition_fromCandidates>:" << std::endl;
+    std::cout << " q = " << format_vdouble(chain.q_) << " (prob = " << chain.prob_ << ")" << std::endl;
+  }
+  return true;
+}
+
+void SVfitIntegratorMarkovChain::sampleSphericallyRandom(MarkovChain& chain)
 {
 //--- compute vector of unit length
 //    pointing in random direction in N-dimensional space
@@ -411,53 +908,49 @@ void SVfitIntegratorMarkovChain::sampleSphericallyRandom()
 //          uses the fact that a N-dimensional Gaussian is spherically symmetric
 //         (u is uniformly distributed over the surface of an N-dimensional hypersphere)
 //
+  chain.rnd_->fillGaus(chain.u_.data(), 2*numDimensions_);
   double uMag2 = 0.;
   for ( unsigned iDimension = 0; iDimension < 2*numDimensions_; ++iDimension ) {
-    double u_i = rnd_.Gaus(0., 1.);
-    u_[iDimension] = u_i;
+    double u_i = chain.u_[iDimension];
     uMag2 += (u_i*u_i);
   }
   double uMag = TMath::Sqrt(uMag2);
   for ( unsigned iDimension = 0; iDimension < 2*numDimensions_; ++iDimension ) {
-    u_[iDimension] /= uMag;
+    chain.u_[iDimension] /= uMag;
   }
 }
 
-void SVfitIntegratorMarkovChain::makeStochasticMove(unsigned idxMove, bool& isAccepted, bool& isValid)
+void SVfitIntegratorMarkovChain::proposeMove(MarkovChain& chain, unsigned idxMove, const vdouble& q)
 {
 //--- perform "stochastic" move
 //    (eq. 24 in [2])
 
 //--- perform random updates of momentum components
-  if ( idxMove < numIterSimAnnealingPhase1_ ) {
+  if ( idxMove < chain.numIterSimAnnealingPhase1_ ) {
+    chain.rnd_->fillGaus(chain.p_.data(), 2*numDimensions_);
     for ( unsigned iDimension = 0; iDimension < 2*numDimensions_; ++iDimension ) {
-      p_[iDimension] = sqrtT0_*rnd_.Gaus(0., 1.);
+      chain.p_[iDimension] *= sqrtT0_;
     }
-  } else if ( idxMove < numIterSimAnnealingPhase1plus2_ ) {
+  } else if ( idxMove < chain.numIterSimAnnealingPhase1plus2_ ) {
     double pMag2 = 0.;
     for ( unsigned iDimension = 0; iDimension < 2*numDimensions_; ++iDimension ) {
-      double p_i = p_[iDimension];
+      double p_i = chain.p_[iDimension];
       pMag2 += p_i*p_i;
     }
     double pMag = TMath::Sqrt(pMag2);
-    sampleSphericallyRandom();
+    sampleSphericallyRandom(chain);
+    chain.rnd_->fillGaus(chain.gaus_.data(), 2*numDimensions_);
     for ( unsigned iDimension = 0; iDimension < 2*numDimensions_; ++iDimension ) {
-      p_[iDimension] = alpha_*pMag*u_[iDimension] + (1. - alpha2_)*rnd_.Gaus(0., 1.);
+      chain.p_[iDimension] = alpha_*pMag*chain.u_[iDimension] + (1. - alpha2_)*chain.gaus_[iDimension];
     }
   } else {
-    for ( unsigned iDimension = 0; iDimension < 2*numDimensions_; ++iDimension ) {
-      p_[iDimension] = rnd_.Gaus(0., 1.);
-    }
+    chain.rnd_->fillGaus(chain.p_.data(), 2*numDimensions_);
   }
 
 //--- choose random step size
-  double exp_nu_times_C = 0.;
-  do {
-    double C = rnd_.BreitWigner(0., 1.);
-    exp_nu_times_C = TMath::Exp(nu_*C);
-  } while ( TMath::IsNaN(exp_nu_times_C) || !TMath::Finite(exp_nu_times_C) || exp_nu_times_C > 1.e+6 );
+  double exp_nu_times_C = getStepSizeFactor(chain);
   for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
-    epsilon_[iDimension] = epsilon0s_[iDimension]*exp_nu_times_C;
+    chain.epsilon_[iDimension] = chain.epsilon0s_[iDimension]*exp_nu_times_C;
   }
 
   // Metropolis algorithm: move according to eq. (27) in [2]
@@ -465,55 +958,313 @@ void SVfitIntegratorMarkovChain::makeStochasticMove(unsigned idxMove, bool& isAc
 //--- update position components
 //    by single step of chosen size in direction of the momentum components
   for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
-    qProposal_[iDimension] = q_[iDimension] + epsilon_[iDimension]*p_[iDimension];
+    chain.qProposal_[iDimension] = q[iDimension] + chain.epsilon_[iDimension]*chain.p_[iDimension];
   }
 
 //--- ensure that proposed new point is within integration region
 //   (take integration region to be "cyclic")
   for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
-    double q_i = qProposal_[iDimension];
+    double q_i = chain.qProposal_[iDimension];
     q_i = q_i - TMath::Floor(q_i);
     assert(q_i >= 0. && q_i <= 1.);
-    qProposal_[iDimension] = q_i;
+    chain.qProposal_[iDimension] = q_i;
   }
+}
 
+double SVfitIntegratorMarkovChain::getStepSizeFactor(MarkovChain& chain)
+{
+//--- CV: factors that are not finite or exceed 1.e+6 are skipped,
+//        which is equivalent to drawing a new random number in case the factor is rejected
+  while ( true ) {
+    if ( chain.idxStepSizeFactor_ >= numStepSizeFactorsPerBlock ) fillStepSizeFactors(chain);
+    double exp_nu_times_C = chain.stepSizeFactors_[chain.idxStepSizeFactor_];
+    ++chain.idxStepSizeFactor_;
+    if ( exp_nu_times_C <= 1.e+6 ) return exp_nu_times_C; // CV: false for NaN
+  }
+}
+
+void SVfitIntegratorMarkovChain::fillStepSizeFactors(MarkovChain& chain)
+{
+  double* stepSizeFactors = chain.stepSizeFactors_.data();
+  chain.rnd_->fillBreitWigner(stepSizeFactors, numStepSizeFactorsPerBlock);
+  for ( unsigned idx = 0; idx < numStepSizeFactorsPerBlock; ++idx ) {
+    stepSizeFactors[idx] = TMath::Exp(nu_*stepSizeFactors[idx]);
+  }
+  chain.idxStepSizeFactor_ = 0;
+}
+
+bool SVfitIntegratorMarkovChain::acceptMove(MarkovChain& chain, double probProposal)
+{
 //--- check if proposed move of Markov Chain to new position is accepted or not:
 //    compute change in phase-space volume for "dummy" momentum components
 //   (eqs. 25 in [2])
-  double probProposal = evalProb(qProposal_);
-
   double deltaE = 0.;
-  if      ( probProposal > 0. && prob_ > 0. ) deltaE = -TMath::Log(probProposal/prob_);
-  else if ( probProposal > 0.               ) deltaE = -std::numeric_limits<double>::max();
-  else if (                      prob_ > 0. ) deltaE = +std::numeric_limits<double>::max();
+  if      ( probProposal > 0. && chain.prob_ > 0. ) deltaE = -TMath::Log(probProposal/chain.prob_);
+  else if ( probProposal > 0.                     ) deltaE = -std::numeric_limits<double>::max();
+  else if (                      chain.prob_ > 0. ) deltaE = +std::numeric_limits<double>::max();
   else assert(0);
 
   // Metropolis algorithm: move according to eq. (13) in [2]
   double pAccept = TMath::Exp(-deltaE);
 
-  double u = rnd_.Uniform(0., 1.);
+  double u = chain.rnd_->Uniform(0., 1.);
+
+  if ( u < pAccept ) {
+    for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+      chain.q_[iDimension] = chain.qProposal_[iDimension];
+    }
+    chain.prob_ = probProposal;
+    return true;
+  } else {
+    return false;
+  }
+}
+
+bool SVfitIntegratorMarkovChain::acceptMove_log(MarkovChain& chain, double logProbProposal)
+{
+//--- check if proposed move of Markov Chain to new position is accepted or not,
+//    computing the change in "potential energy" E = -log(integrand) directly from the logarithms of the integrand;
+//    proposals with integrand zero (logProbProposal = -infinity) or NaN are always rejected
+  double deltaE = chain.logProb_ - logProbProposal;
+
+  // Metropolis algorithm: move according to eq. (13) in [2];
+  // CV: moves that increase the integrand are always accepted, so the exponential needs to be computed for the other moves only
+  //    (the random number is drawn in any case, so that the sequence of random numbers does not depend on the outcome)
+  double pAccept = ( deltaE <= 0. ) ? 1. : TMath::Exp(-deltaE);
+
+  double u = chain.rnd_->Uniform(0., 1.);
 
   if ( u < pAccept ) {
     for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
-      q_[iDimension] = qProposal_[iDimension];
+      chain.q_[iDimension] = chain.qProposal_[iDimension];
+    }
+    chain.logProb_ = logProbProposal;
+    // CV: integrand value is needed for computation of the integral
+    chain.prob_ = TMath::Exp(logProbProposal);
+    return true;
+  } else {
+    return false;
+  }
+}
+
+void SVfitIntegratorMarkovChain::proposeMultipleTries(MarkovChain& chain, unsigned idxMove, const vdouble& q, unsigned numPoints, bool storeMomenta)
+{
+//--- each proposal is drawn independently, starting from the momentum of the previous move
+  for ( unsigned iPoint = 0; iPoint < numPoints; ++iPoint ) {
+    chain.p_ = chain.pPrevious_;
+    proposeMove(chain, idxMove, q);
+    for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+      chain.qTries_[iDimension*numTries_ + iPoint] = chain.qProposal_[iDimension];
     }
-    prob_ = probProposal;
-    isAccepted = true;
+    if ( storeMomenta ) {
+      std::copy(chain.p_.begin(), chain.p_.end(), chain.pTries_.begin() + iPoint*2*numDimensions_);
+    }
+  }
+}
+
+int SVfitIntegratorMarkovChain::selectTry(MarkovChain& chain, double& sumProbTries)
+{
+  sumProbTries = 0.;
+  for ( unsigned iTry = 0; iTry < numTries_; ++iTry ) {
+    sumProbTries += chain.probTries_[iTry];
+  }
+  if ( !(sumProbTries > 0.) ) return -1;
+
+  double u = chain.rnd_->Uniform(0., sumProbTries);
+  int idxSelected = numTries_ - 1;
+  double sumProb = 0.;
+  for ( unsigned iTry = 0; iTry < numTries_; ++iTry ) {
+    sumProb += chain.probTries_[iTry];
+    if ( u < sumProb && chain.probTries_[iTry] > 0. ) {
+      idxSelected = iTry;
+      break;
+    }
+  }
+  for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+    chain.qSelected_[iDimension] = chain.qTries_[iDimension*numTries_ + idxSelected];
+  }
+  return idxSelected;
+}
+
+bool SVfitIntegratorMarkovChain::acceptMultipleTry(MarkovChain& chain, unsigned idxSelected, double probSelected, double sumProbTries, double sumProbReferences)
+{
+//--- accept move with probability min(1, sum of integrand values of proposals/sum of integrand values of reference points)
+//   (the proposal distribution is symmetric, so that the weights of [3] reduce to the integrand values)
+  double pAccept = sumProbTries/sumProbReferences;
+
+  double u = chain.rnd_->Uniform(0., 1.);
+
+  if ( u < pAccept ) {
+    chain.q_ = chain.qSelected_;
+    chain.prob_ = probSelected;
+    std::copy(chain.pTries_.begin() + idxSelected*2*numDimensions_, chain.pTries_.begin() + (idxSelected + 1)*2*numDimensions_, chain.p_.begin());
+    return true;
   } else {
-    isAccepted = false;
+    chain.p_ = chain.pPrevious_;
+    return false;
   }
 }
 
-void SVfitIntegratorMarkovChain::updateX(const std::vector<double>& q)
+double SVfitIntegratorMarkovChain::beginTrajectory(MarkovChain& chain)
 {
+//--- draw new momentum components for each trajectory
+  chain.rnd_->fillGaus(chain.p_.data(), 2*numDimensions_);
+
+//--- choose random step size;
+//    the step size is varied between trajectories, to avoid trajectories that are periodic in some dimensions
+  double stepScale = leapfrogStepSize_*chain.rnd_->Uniform(0.8, 1.2)/epsilon0_;
   for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
-    const double & q_i = q[iDimension];
-    x_[iDimension] = (1. - q_i)*xMin_[iDimension] + q_i*xMax_[iDimension];
+    chain.epsilon_[iDimension] = chain.epsilon0s_[iDimension]*stepScale;
   }
+
+  chain.qProposal_ = chain.q_;
+  chain.gradEProposal_ = chain.gradE_;
+
+  return -TMath::Log(chain.prob_) + compKineticEnergy(chain);
 }
 
-double SVfitIntegratorMarkovChain::evalProb(const std::vector<double>& q)
+void SVfitIntegratorMarkovChain::moveLeapfrog_position(MarkovChain& chain)
 {
-  double prob = (*integrand_)(q.data(), numDimensions_, 0);
-  return prob;
+//--- ensure that new position is within integration region
+//   (take integration region to be "cyclic")
+  for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+    double epsilon_i = chain.epsilon_[iDimension];
+    chain.p_[iDimension] -= 0.5*epsilon_i*chain.gradEProposal_[iDimension];
+    double q_i = chain.qProposal_[iDimension] + epsilon_i*chain.p_[iDimension];
+    q_i = q_i - TMath::Floor(q_i);
+    assert(q_i >= 0. && q_i <= 1.);
+    chain.qProposal_[iDimension] = q_i;
+  }
+}
+
+void SVfitIntegratorMarkovChain::moveLeapfrog_momentum(MarkovChain& chain)
+{
+  for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+    chain.p_[iDimension] -= 0.5*chain.epsilon_[iDimension]*chain.gradEProposal_[iDimension];
+  }
+}
+
+bool SVfitIntegratorMarkovChain::acceptTrajectory(MarkovChain& chain, double totalEnergy, double probProposal)
+{
+//--- accept move to end-point of trajectory with probability min(1, exp(-change in total energy))
+  if ( !(probProposal > 0.) ) return false;
+  double deltaH = -TMath::Log(probProposal) + compKineticEnergy(chain) - totalEnergy;
+  double pAccept = TMath::Exp(-deltaH);
+
+  double u = chain.rnd_->Uniform(0., 1.);
+
+  if ( u < pAccept ) {
+    chain.q_ = chain.qProposal_;
+    chain.prob_ = probProposal;
+    chain.gradE_ = chain.gradEProposal_;
+    return true;
+  } else {
+    return false;
+  }
+}
+
+double SVfitIntegratorMarkovChain::compKineticEnergy(const MarkovChain& chain) const
+{
+//--- "kinetic energy" depends on the first N "significant" momentum components only
+  double kineticEnergy = 0.;
+  for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+    double p_i = chain.p_[iDimension];
+    kineticEnergy += 0.5*p_i*p_i;
+  }
+  return kineticEnergy;
+}
+
+void SVfitIntegratorMarkovChain::adaptStepSize(MarkovChain& chain, bool isAccepted)
+{
+//--- update running mean and variance of Markov Chain positions
+//   (Welford's algorithm)
+  ++chain.numAdaptiveMoves_;
+  double n = chain.numAdaptiveMoves_;
+  for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+    double q_i = chain.q_[iDimension];
+    double delta = q_i - chain.qMean_[iDimension];
+    chain.qMean_[iDimension] += delta/n;
+    chain.qM2_[iDimension] += delta*(q_i - chain.qMean_[iDimension]);
+  }
+
+//--- tune overall step-size scale towards target acceptance rate
+//   (Robbins-Monro stochastic approximation with decreasing gain)
+  double gain = 1./TMath::Power(n + 1., 0.6);
+  chain.logStepScale_ += gain*((isAccepted ? 1. : 0.) - targetAcceptanceRate_);
+  double stepScale = TMath::Exp(chain.logStepScale_);
+
+//--- take step-size in each dimension proportional to spread of positions in this dimension,
+//    normalized such that the geometric mean of the step-sizes equals epsilon0 times the overall scale;
+//    use equal step-sizes until the spread has been estimated from a sufficient number of moves
+  const double epsilonMin = 1.e-6;
+  const double epsilonMax = 0.5;
+  double logSigmaMean = 0.;
+  if ( chain.numAdaptiveMoves_ >= minNumAdaptiveMoves ) {
+    for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+      double sigma_i = TMath::Sqrt(chain.qM2_[iDimension]/(n - 1.));
+      logSigmaMean += TMath::Log(TMath::Max(sigma_i, epsilonMin));
+    }
+    logSigmaMean /= numDimensions_;
+  }
+  for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+    double epsilon0_i = epsilon0s_[iDimension]*stepScale;
+    if ( chain.numAdaptiveMoves_ >= minNumAdaptiveMoves ) {
+      double sigma_i = TMath::Sqrt(chain.qM2_[iDimension]/(n - 1.));
+      epsilon0_i *= TMath::Exp(TMath::Log(TMath::Max(sigma_i, epsilonMin)) - logSigmaMean);
+    }
+    chain.epsilon0s_[iDimension] = TMath::Min(TMath::Max(epsilon0_i, epsilonMin), epsilonMax);
+  }
+}
+
+void SVfitIntegratorMarkovChain::printStepSizes(const MarkovChain& chain, unsigned iChain) const
+{
+  std::cout << "chain #" << iChain << ": step-sizes = " << format_vdouble(chain.epsilon0s_) << std::endl;
+}
+
+bool SVfitIntegratorMarkovChain::isConverged(MarkovChain& chain, unsigned iChain, unsigned numBatchesDone)
+{
+//--- check relative change of observables between the middle and the end of the "sampling" stage done so far;
+//    observables are retrieved at the end of every batch
+  bool isConverged_observables = true;
+  if ( convergenceMonitor_ ) {
+    vdouble& observables = chain.observables_[numBatchesDone - 1];
+    convergenceMonitor_(iChain, observables);
+    const vdouble& observablesRef = chain.observables_[TMath::Max(1u, numBatchesDone/2) - 1];
+    if ( numBatchesDone < 2 || observablesRef.size() != observables.size() ) {
+      isConverged_observables = false;
+    } else {
+      for ( unsigned iObservable = 0; iObservable < observables.size(); ++iObservable ) {
+        double observable = observables[iObservable];
+        double observableRef = observablesRef[iObservable];
+        if ( !(TMath::Abs(observable - observableRef) <= earlyStoppingPrecision_*TMath::Abs(observable)) ) isConverged_observables = false;
+      }
+    }
+  }
+
+//--- check relative uncertainty on integral, estimated from the batch means
+//   (eqs. (6.39) and (6.40) in [1])
+  if ( numBatchesDone < 2 ) return false;
+  unsigned m = numIterSampling_/numBatches_;
+  double integral = 0.;
+  for ( unsigned iBatch = 0; iBatch < numBatchesDone; ++iBatch ) {
+    integral += probSum_[iChain*numBatches_ + iBatch]/m;
+  }
+  integral /= numBatchesDone;
+  double integralErr = 0.;
+  for ( unsigned iBatch = 0; iBatch < numBatchesDone; ++iBatch ) {
+    integralErr += square(probSum_[iChain*numBatches_ + iBatch]/m - integral);
+  }
+  integralErr /= (numBatchesDone*(numBatchesDone - 1));
+  integralErr = TMath::Sqrt(integralErr);
+  bool isConverged_integral = ( integral > 0. && integralErr < earlyStoppingPrecision_*integral );
+
+  return isConverged_integral && isConverged_observables;
+}
+
+void SVfitIntegratorMarkovChain::updateX(MarkovChain& chain, const std::vector<double>& q)
+{
+  for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+    const double & q_i = q[iDimension];
+    chain.x_[iDimension] = (1. - q_i)*xMin_[iDimension] + q_i*xMax_[iDimension];
+  }
 }
@@ -0,0 +1,285 @@
+#include "TauAnalysis/ClassicSVfit/interface/SVfitIntegratorQuasiMonteCarlo.h"
+
+#include "TauAnalysis/ClassicSVfit/interface/svFitAuxFunctions.h"
+
+#include <TMath.h>
+
+#include <iostream>
+#include <assert.h>
+
+using namespace classic_svFit;
+
+namespace
+{
+  // CV: parameters of the primitive polynomials and initial direction numbers m_1..m_s for dimensions 2..10,
+  //     taken from the file new-joe-kuo-6.21201 provided with [1];
+  //     the first dimension is the van der Corput sequence in base 2
+  struct SobolParameters
+  {
+    unsigned s_;     // degree of primitive polynomial
+    unsigned a_;     // coefficients of primitive polynomial
+    unsigned m_[5];  // initial direction numbers
+  };
+  const SobolParameters sobolParameters[SVfitIntegratorQuasiMonteCarlo::maxNumDimensions - 1] = {
+    { 1, 0, { 1 } },
+    { 2, 1, { 1, 3 } },
+    { 3, 1, { 1, 3, 1 } },
+    { 3, 2, { 1, 1, 1 } },
+    { 4, 1, { 1, 1, 3, 3 } },
+    { 4, 4, { 1, 3, 5, 13 } },
+    { 5, 2, { 1, 1, 5, 5, 17 } },
+    { 5, 4, { 1, 1, 5, 5, 5 } },
+    { 5, 7, { 1, 1, 7, 11, 19 } }
+  };
+
+  const unsigned numBits = 32;
+
+  inline unsigned parity(uint32_t x)
+  {
+    x ^= (x >> 16);
+    x ^= (x >> 8);
+    x ^= (x >> 4);
+    x ^= (x >> 2);
+    x ^= (x >> 1);
+    return (x & 1);
+  }
+
+  /// index of lowest bit set in n > 0
+  inline unsigned lowestSetBit(unsigned n)
+  {
+    unsigned idx = 0;
+    while ( !(n & 1) ) {
+      n >>= 1;
+      ++idx;
+    }
+    return idx;
+  }
+}
+
+const unsigned SVfitIntegratorQuasiMonteCarlo::maxNumDimensions;
+
+SVfitIntegratorQuasiMonteCarlo::SVfitIntegratorQuasiMonteCarlo(unsigned numPointsPerScrambling, unsigned numScramblings, int verbosity)
+  : integrand_(0),
+    integrandParam_(0),
+    numDimensions_(0),
+    numPointsPerScrambling_(numPointsPerScrambling),
+    numScramblings_(numScramblings),
+    randomGeneratorType_("TRandom3"),
+    rnd_(0),
+    probMax_(-1.),
+    numCalls_(0),
+    verbosity_(verbosity)
+{
+  if ( numPointsPerScrambling_ == 0 ) {
+    std::cerr << "<SVfitIntegratorQuasiMonteCarlo>:"
+              << "Invalid Configuration Parameter 'numPointsPerScrambling' = " << numPointsPerScrambling_ << ","
+              << " value greater 0 expected --> ABORTING !!\n";
+    assert(0);
+  }
+  if ( (numPointsPerScrambling_ & (numPointsPerScrambling_ - 1)) != 0 ) {
+    std::cerr << "<SVfitIntegratorQuasiMonteCarlo>:"
+              << "Warning: 'numPointsPerScrambling' = " << numPointsPerScrambling_ << " is not a power of 2,"
+              << " the points do not cover the integration region uniformly !!\n";
+  }
+  if ( numScramblings_ < 2 ) {
+    std::cerr << "<SVfitIntegratorQuasiMonteCarlo>:"
+              << "Invalid Configuration Parameter 'numScramblings' = " << numScramblings_ << ","
+              << " value greater 1 expected --> ABORTING !!\n";
+    assert(0);
+  }
+  rnd_ = makeRandomGenerator(randomGeneratorType_);
+  initializeDirectionNumbers();
+}
+
+SVfitIntegratorQuasiMonteCarlo::~SVfitIntegratorQuasiMonteCarlo()
+{
+  delete rnd_;
+}
+
+void SVfitIntegratorQuasiMonteCarlo::registerCallBackFunction(const ROOT::Math::Functor& function)
+{
+  std::cerr << "<SVfitIntegratorQuasiMonteCarlo>:"
+            << "Warning: unweighted call-back functions are not supported, use registerWeightedCallBackFunction instead !!\n";
+}
+
+void SVfitIntegratorQuasiMonteCarlo::registerWeightedCallBackFunction(const WeightedCallBackFunction& function)
+{
+  callBackFunctions_.push_back(&function);
+}
+
+void SVfitIntegratorQuasiMonteCarlo::setRandomGenerator(const std::string& type)
+{
+  RandomGenerator* rnd = makeRandomGenerator(type);
+  delete rnd_;
+  rnd_ = rnd;
+  randomGeneratorType_ = type;
+}
+
+void SVfitIntegratorQuasiMonteCarlo::initializeDirectionNumbers()
+{
+  directionNumbers_.resize(maxNumDimensions*numBits);
+  for ( unsigned iBit = 0; iBit < numBits; ++iBit ) {
+    directionNumbers_[iBit] = (1u << (numBits - 1 - iBit));
+  }
+  for ( unsigned iDimension = 1; iDimension < maxNumDimensions; ++iDimension ) {
+    const SobolParameters& params = sobolParameters[iDimension - 1];
+    unsigned s = params.s_;
+//--- compute m_k for k > s by the recurrence relation given by the primitive polynomial (eq. (2.2) in [1])
+    std::vector<uint32_t> m(numBits);
+    for ( unsigned k = 0; k < numBits; ++k ) {
+      if ( k < s ) {
+        m[k] = params.m_[k];
+      } else {
+        uint32_t m_k = m[k - s] ^ (m[k - s] << s);
+        for ( unsigned i = 1; i < s; ++i ) {
+          uint32_t a_i = (params.a_ >> (s - 1 - i)) & 1;
+          if ( a_i ) m_k ^= (m[k - i] << i);
+        }
+        m[k] = m_k;
+      }
+      directionNumbers_[iDimension*numBits + k] = (m[k] << (numBits - 1 - k));
+    }
+  }
+}
+
+uint32_t SVfitIntegratorQuasiMonteCarlo::randomBits()
+{
+  double u;
+  rnd_->fillUniform(&u, 1);
+  return static_cast<uint32_t>(u*4294967296.); // 2^32
+}
+
+void SVfitIntegratorQuasiMonteCarlo::scramble()
+{
+//--- multiply direction numbers by random lower-triangular binary matrix with unit diagonal,
+//    then start sequence at random digital shift
+  directionNumbersScrambled_.resize(numDimensions_*numBits);
+  point_.resize(numDimensions_);
+  uint32_t scramblingMatrix[numBits]; // index = row (digit of output)
+  for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+    for ( unsigned iRow = 0; iRow < numBits; ++iRow ) {
+      uint32_t diagonal = (1u << (numBits - 1 - iRow));
+      uint32_t belowDiagonal = ( iRow > 0 ) ? (randomBits() & ~((diagonal << 1) - 1)) : 0;
+      scramblingMatrix[iRow] = diagonal | belowDiagonal;
+    }
+    for ( unsigned iBit = 0; iBit < numBits; ++iBit ) {
+      uint32_t v = directionNumbers_[iDimension*numBits + iBit];
+      uint32_t vScrambled = 0;
+      for ( unsigned iRow = 0; iRow < numBits; ++iRow ) {
+        if ( parity(scramblingMatrix[iRow] & v) ) vScrambled |= (1u << (numBits - 1 - iRow));
+      }
+      directionNumbersScrambled_[iDimension*numBits + iBit] = vScrambled;
+    }
+    point_[iDimension] = randomBits();
+  }
+}
+
+void SVfitIntegratorQuasiMonteCarlo::integrate(gPtr_C g, const double* xl, const double* xu, unsigned d, double& integral, double& integralErr, void* param)
+{
+  if ( d > maxNumDimensions ) {
+    std::cerr << "<SVfitIntegratorQuasiMonteCarlo>:"
+              << "Number of dimensions = " << d << " exceeds maximum = " << maxNumDimensions << " --> ABORTING !!\n";
+    assert(0);
+  }
+
+  integrand_ = g;
+  integrandParam_ = param;
+  numDimensions_ = d;
+
+  xMin_.resize(numDimensions_);
+  xMax_.resize(numDimensions_);
+  for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+    xMin_[iDimension] = xl[iDimension];
+    xMax_[iDimension] = xu[iDimension];
+    if ( verbosity_ >= 1 ) {
+      std::cout << "dimension #" << iDimension << ": min = " << xMin_[iDimension] << ", max = " << xMax_[iDimension] << std::endl;
+    }
+  }
+  q_.resize(numDimensions_);
+  x_.resize(numDimensions_);
+
+//--- CV: reset random number generator for each integration,
+//        in order to make integration results independent of processing history
+  rnd_->setSeed(getSeed(0));
+
+  probMax_ = -1.;
+  numCalls_ = 0;
+  integral_.clear();
+
+  statistics_.reset();
+  double cpuTime = getThreadCpuTime();
+  double realTime = getRealTime();
+
+//--- weights are normalized such that their sum over all scramblings equals the integral
+  double weightNorm = 1./(static_cast<double>(numPointsPerScrambling_)*numScramblings_);
+
+  for ( unsigned iScrambling = 0; iScrambling < numScramblings_; ++iScrambling ) {
+    scramble();
+    double sumProb = 0.;
+    for ( unsigned iPoint = 0; iPoint < numPointsPerScrambling_; ++iPoint ) {
+//--- advance Sobol sequence in Gray-code order
+      if ( iPoint > 0 ) {
+        unsigned iBit = lowestSetBit(iPoint);
+        for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+          point_[iDimension] ^= directionNumbersScrambled_[iDimension*numBits + iBit];
+        }
+      }
+      for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+        q_[iDimension] = (point_[iDimension] + 0.5)*(1./4294967296.); // 2^32
+      }
+
+//--- CV: the integrand expects coordinates rescaled to the interval [0..1],
+//        the point x in the integration region is needed by the "call-back" functions only
+      double prob = (*integrand_)(q_.data(), numDimensions_, integrandParam_);
+      ++numCalls_;
+      if ( !(prob > 0.) ) continue;
+      if ( prob > probMax_ ) probMax_ = prob;
+      sumProb += prob;
+
+      for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+        x_[iDimension] = (1. - q_[iDimension])*xMin_[iDimension] + q_[iDimension]*xMax_[iDimension];
+      }
+      for ( std::vector<const WeightedCallBackFunction*>::const_iterator callBackFunction = callBackFunctions_.begin();
+            callBackFunction != callBackFunctions_.end(); ++callBackFunction ) {
+        (*callBackFunction)->evalWeighted(x_.data(), prob*weightNorm);
+      }
+    }
+    integral_.push_back(sumProb/numPointsPerScrambling_);
+    if ( verbosity_ >= 1 ) {
+      std::cout << "scrambling #" << iScrambling << ": integral = " << integral_.back() << std::endl;
+    }
+  }
+
+//--- compute mean and uncertainty on mean of the estimates obtained for independent scramblings
+  double sum = 0.;
+  for ( unsigned iScrambling = 0; iScrambling < numScramblings_; ++iScrambling ) {
+    sum += integral_[iScrambling];
+  }
+  integral = sum/numScramblings_;
+  double sum2 = 0.;
+  for ( unsigned iScrambling = 0; iScrambling < numScramblings_; ++iScrambling ) {
+    sum2 += square(integral_[iScrambling] - integral);
+  }
+  integralErr = TMath::Sqrt(sum2/(numScramblings_*(numScramblings_ - 1.)));
+
+  statistics_.numCalls_[IntegratorStatistics::kSampling] = numCalls_;
+  statistics_.cpuTime_[IntegratorStatistics::kSampling] = getThreadCpuTime() - cpuTime;
+  statistics_.realTime_[IntegratorStatistics::kSampling] = getRealTime() - realTime;
+  statistics_.integral_ = integral;
+  statistics_.integralErr_ = integralErr;
+  statistics_.probMax_ = probMax_;
+
+  if ( verbosity_ >= 1 ) {
+    std::cout << "--> returning integral = " << integral << " +/- " << integralErr << std::endl;
+    print(std::cout);
+  }
+}
+
+void SVfitIntegratorQuasiMonteCarlo::print(std::ostream& stream) const
+{
+  stream << "<SVfitIntegratorQuasiMonteCarlo::print>:" << std::endl;
+  for ( unsigned iScrambling = 0; iScrambling < integral_.size(); ++iScrambling ) {
+    stream << " scrambling #" << iScrambling << ": integral = " << integral_[iScrambling] << std::endl;
+  }
+  stream << "integrand evaluations = " << numCalls_ << std::endl;
+}
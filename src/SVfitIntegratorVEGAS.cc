@@ -0,0 +1,292 @@
+#include "TauAnalysis/ClassicSVfit/interface/SVfitIntegratorVEGAS.h"
+
+#include "TauAnalysis/ClassicSVfit/interface/svFitAuxFunctions.h"
+
+#include <TMath.h>
+
+#include <iostream>
+#include <assert.h>
+
+using namespace classic_svFit;
+
+SVfitIntegratorVEGAS::SVfitIntegratorVEGAS(unsigned numCallsPerIteration, unsigned numIterTraining, unsigned numIterSampling,
+                                           unsigned numBins, double alpha, int verbosity)
+  : integrand_(0),
+    integrandParam_(0),
+    numDimensions_(0),
+    numCallsPerIteration_(numCallsPerIteration),
+    numIterTraining_(numIterTraining),
+    numIterSampling_(numIterSampling),
+    numBins_(numBins),
+    alpha_(alpha),
+    randomGeneratorType_("TRandom3"),
+    rnd_(0),
+    probMax_(-1.),
+    numCalls_(0),
+    verbosity_(verbosity)
+{
+  if ( numCallsPerIteration_ < 2 ) {
+    std::cerr << "<SVfitIntegratorVEGAS>:"
+              << "Invalid Configuration Parameter 'numCallsPerIteration' = " << numCallsPerIteration_ << ","
+              << " value greater 1 expected --> ABORTING !!\n";
+    assert(0);
+  }
+  if ( numIterSampling_ == 0 ) {
+    std::cerr << "<SVfitIntegratorVEGAS>:"
+              << "Invalid Configuration Parameter 'numIterSampling' = " << numIterSampling_ << ","
+              << " value greater 0 expected --> ABORTING !!\n";
+    assert(0);
+  }
+  if ( numBins_ == 0 ) {
+    std::cerr << "<SVfitIntegratorVEGAS>:"
+              << "Invalid Configuration Parameter 'numBins' = " << numBins_ << ","
+              << " value greater 0 expected --> ABORTING !!\n";
+    assert(0);
+  }
+  rnd_ = makeRandomGenerator(randomGeneratorType_);
+}
+
+SVfitIntegratorVEGAS::~SVfitIntegratorVEGAS()
+{
+  delete rnd_;
+}
+
+void SVfitIntegratorVEGAS::registerCallBackFunction(const ROOT::Math::Functor& function)
+{
+  std::cerr << "<SVfitIntegratorVEGAS>:"
+            << "Warning: unweighted call-back functions are not supported, use registerWeightedCallBackFunction instead !!\n";
+}
+
+void SVfitIntegratorVEGAS::registerWeightedCallBackFunction(const WeightedCallBackFunction& function)
+{
+  callBackFunctions_.push_back(&function);
+}
+
+void SVfitIntegratorVEGAS::setRandomGenerator(const std::string& type)
+{
+  RandomGenerator* rnd = makeRandomGenerator(type);
+  delete rnd_;
+  rnd_ = rnd;
+  randomGeneratorType_ = type;
+}
+
+void SVfitIntegratorVEGAS::integrate(gPtr_C g, const double* xl, const double* xu, unsigned d, double& integral, double& integralErr, void* param)
+{
+  integrand_ = g;
+  integrandParam_ = param;
+  numDimensions_ = d;
+
+  xMin_.resize(numDimensions_);
+  xMax_.resize(numDimensions_);
+  for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+    xMin_[iDimension] = xl[iDimension];
+    xMax_[iDimension] = xu[iDimension];
+    if ( verbosity_ >= 1 ) {
+      std::cout << "dimension #" << iDimension << ": min = " << xMin_[iDimension] << ", max = " << xMax_[iDimension] << std::endl;
+    }
+  }
+
+//--- start each integration from uniform grid
+  gridEdges_.resize(numDimensions_*(numBins_ + 1));
+  gridEdgesNew_.resize(numBins_ + 1);
+  gridSumW2_.resize(numDimensions_*numBins_);
+  gridSmoothed_.resize(numBins_);
+  gridRefine_.resize(numBins_);
+  for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+    for ( unsigned iBin = 0; iBin <= numBins_; ++iBin ) {
+      gridEdges_[iDimension*(numBins_ + 1) + iBin] = static_cast<double>(iBin)/numBins_;
+    }
+  }
+  u_.resize(numDimensions_);
+  q_.resize(numDimensions_);
+  x_.resize(numDimensions_);
+  bins_.resize(numDimensions_);
+
+//--- CV: reset random number generator for each integration,
+//        in order to make integration results independent of processing history
+  rnd_->setSeed(getSeed(0));
+
+  probMax_ = -1.;
+  numCalls_ = 0;
+  integral_.clear();
+  integralErr_.clear();
+
+  statistics_.reset();
+
+  for ( unsigned iIter = 0; iIter < (numIterTraining_ + numIterSampling_); ++iIter ) {
+    bool isSampling = ( iIter >= numIterTraining_ );
+    double integral_i, integralVar_i;
+    long numCalls = numCalls_;
+    double cpuTime = getThreadCpuTime();
+    double realTime = getRealTime();
+    runIteration(isSampling, integral_i, integralVar_i);
+    unsigned idxPhase = ( isSampling ) ? IntegratorStatistics::kSampling : IntegratorStatistics::kAdaptation;
+    statistics_.numCalls_[idxPhase] += (numCalls_ - numCalls);
+    statistics_.cpuTime_[idxPhase] += (getThreadCpuTime() - cpuTime);
+    statistics_.realTime_[idxPhase] += (getRealTime() - realTime);
+    if ( verbosity_ >= 1 ) {
+      std::cout << "iteration #" << iIter << ( isSampling ? " (sampling)" : " (training)" ) << ":"
+                << " integral = " << integral_i << " +/- " << TMath::Sqrt(integralVar_i) << std::endl;
+    }
+    if ( isSampling ) {
+      integral_.push_back(integral_i);
+      integralErr_.push_back(TMath::Sqrt(integralVar_i));
+    }
+    refineGrid();
+  }
+
+//--- combine integral estimates of "sampling" iterations, weighted by inverse variance
+//   (eq. (5) in [1]); iterations with zero variance are included with equal weight if all variances are zero
+  double sumWeights = 0.;
+  double sumWeightedIntegrals = 0.;
+  for ( unsigned iIter = 0; iIter < integral_.size(); ++iIter ) {
+    if ( integralErr_[iIter] > 0. ) {
+      double weight = 1./square(integralErr_[iIter]);
+      sumWeights += weight;
+      sumWeightedIntegrals += weight*integral_[iIter];
+    }
+  }
+  if ( sumWeights > 0. ) {
+    integral = sumWeightedIntegrals/sumWeights;
+    integralErr = 1./TMath::Sqrt(sumWeights);
+  } else {
+    integral = 0.;
+    for ( unsigned iIter = 0; iIter < integral_.size(); ++iIter ) {
+      integral += integral_[iIter];
+    }
+    integral /= integral_.size();
+    integralErr = 0.;
+  }
+  statistics_.integral_ = integral;
+  statistics_.integralErr_ = integralErr;
+  statistics_.probMax_ = probMax_;
+
+  if ( verbosity_ >= 1 ) {
+    std::cout << "--> returning integral = " << integral << " +/- " << integralErr << std::endl;
+    print(std::cout);
+  }
+}
+
+void SVfitIntegratorVEGAS::runIteration(bool isSampling, double& integral, double& integralVar)
+{
+  for ( vdouble::iterator gridSumW2_i = gridSumW2_.begin();
+        gridSumW2_i != gridSumW2_.end(); ++gridSumW2_i ) {
+    (*gridSumW2_i) = 0.;
+  }
+
+  double sumW = 0.;
+  double sumW2 = 0.;
+  for ( unsigned iCall = 0; iCall < numCallsPerIteration_; ++iCall ) {
+//--- sample point according to current grid:
+//    choose bin with equal probability in each dimension, then position within bin uniformly
+    rnd_->fillUniform(u_.data(), numDimensions_);
+    double jacobiFactor = 1.;
+    for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+      double z = u_[iDimension]*numBins_;
+      unsigned iBin = TMath::Min(static_cast<unsigned>(z), numBins_ - 1);
+      const double* edges = &gridEdges_[iDimension*(numBins_ + 1)];
+      double binWidth = edges[iBin + 1] - edges[iBin];
+      double y = edges[iBin] + (z - iBin)*binWidth;
+      jacobiFactor *= numBins_*binWidth;
+      bins_[iDimension] = iBin;
+      q_[iDimension] = y;
+    }
+
+//--- CV: the integrand expects coordinates rescaled to the interval [0..1],
+//        the point x in the integration region is needed by the "call-back" functions only
+    double prob = (*integrand_)(q_.data(), numDimensions_, integrandParam_);
+    ++numCalls_;
+    if ( !(prob > 0.) ) continue;
+    if ( prob > probMax_ ) probMax_ = prob;
+
+    double w = prob*jacobiFactor;
+    sumW += w;
+    sumW2 += w*w;
+    for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+      gridSumW2_[iDimension*numBins_ + bins_[iDimension]] += w*w;
+    }
+
+    if ( isSampling ) {
+      for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+        x_[iDimension] = (1. - q_[iDimension])*xMin_[iDimension] + q_[iDimension]*xMax_[iDimension];
+      }
+      for ( std::vector<const WeightedCallBackFunction*>::const_iterator callBackFunction = callBackFunctions_.begin();
+            callBackFunction != callBackFunctions_.end(); ++callBackFunction ) {
+        (*callBackFunction)->evalWeighted(x_.data(), w);
+      }
+    }
+  }
+
+  double n = numCallsPerIteration_;
+  integral = sumW/n;
+  integralVar = TMath::Max(0., (sumW2/n - square(integral))/(n - 1.));
+}
+
+void SVfitIntegratorVEGAS::refineGrid()
+{
+  for ( unsigned iDimension = 0; iDimension < numDimensions_; ++iDimension ) {
+    const double* sumW2 = &gridSumW2_[iDimension*numBins_];
+    double* edges = &gridEdges_[iDimension*(numBins_ + 1)];
+
+//--- smooth sum of squared weights over neighbouring bins
+    double sumSmoothed = 0.;
+    for ( unsigned iBin = 0; iBin < numBins_; ++iBin ) {
+      double sum = sumW2[iBin];
+      unsigned n = 1;
+      if ( iBin > 0 ) {
+        sum += sumW2[iBin - 1];
+        ++n;
+      }
+      if ( (iBin + 1) < numBins_ ) {
+        sum += sumW2[iBin + 1];
+        ++n;
+      }
+      gridSmoothed_[iBin] = sum/n;
+      sumSmoothed += gridSmoothed_[iBin];
+    }
+    if ( !(sumSmoothed > 0.) ) continue;
+
+//--- compute damped importance of each bin (eq. (11) in [1])
+    double sumRefine = 0.;
+    for ( unsigned iBin = 0; iBin < numBins_; ++iBin ) {
+      double r = gridSmoothed_[iBin]/sumSmoothed;
+      if ( r > 0. && r < 1. ) {
+        gridRefine_[iBin] = TMath::Power((r - 1.)/TMath::Log(r), alpha_);
+      } else if ( r >= 1. ) {
+        gridRefine_[iBin] = 1.;
+      } else {
+        gridRefine_[iBin] = 0.;
+      }
+      sumRefine += gridRefine_[iBin];
+    }
+    if ( !(sumRefine > 0.) ) continue;
+
+//--- move bin boundaries such that each new bin contains the same share of importance
+    double delta = sumRefine/numBins_;
+    double accumulated = 0.;
+    unsigned iBinOld = 0;
+    gridEdgesNew_[0] = 0.;
+    for ( unsigned iBin = 1; iBin < numBins_; ++iBin ) {
+      double target = iBin*delta;
+      while ( accumulated + gridRefine_[iBinOld] < target && (iBinOld + 1) < numBins_ ) {
+        accumulated += gridRefine_[iBinOld];
+        ++iBinOld;
+      }
+      double fraction = ( gridRefine_[iBinOld] > 0. ) ? TMath::Min(1., (target - accumulated)/gridRefine_[iBinOld]) : 0.;
+      gridEdgesNew_[iBin] = edges[iBinOld] + fraction*(edges[iBinOld + 1] - edges[iBinOld]);
+    }
+    gridEdgesNew_[numBins_] = 1.;
+    for ( unsigned iBin = 0; iBin <= numBins_; ++iBin ) {
+      edges[iBin] = gridEdgesNew_[iBin];
+    }
+  }
+}
+
+void SVfitIntegratorVEGAS::print(std::ostream& stream) const
+{
+  stream << "<SVfitIntegratorVEGAS::print>:" << std::endl;
+  for ( unsigned iIter = 0; iIter < integral_.size(); ++iIter ) {
+    stream << " iteration #" << iIter << ": integral = " << integral_[iIter] << " +/- " << integralErr_[iIter] << std::endl;
+  }
+  stream << "integrand evaluations = " << numCalls_ << std::endl;
+}
@@ -4,6 +4,9 @@
 #include <TF1.h>
 #include <TFitResult.h>
 
+#include <chrono>
+#include <time.h>
+
 namespace classic_svFit
 {
 
@@ -18,6 +21,18 @@ double roundToNdigits(double x, int n)
   return x_rounded;
 }
 
+double getThreadCpuTime()
+{
+  timespec cpuTime;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuTime);
+  return cpuTime.tv_sec + 1.e-9*cpuTime.tv_nsec;
+}
+
+double getRealTime()
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 TGraphErrors* makeGraph(const std::string& graphName, const std::vector<GraphPoint>& graphPoints)
 {
   //std::cout << "<makeGraph>:" << std::endl;
@@ -156,6 +171,12 @@ double compCosThetaNuNu(double visEn, double visP, double visMass2, double nunuE
 }
 
 double compPSfactor_tauToLepDecay(double x, double visEn, double visP, double visMass, double nunuEn, double nunuP, double nunuMass)
+{
+  double visMass2 = square(visMass);
+  return compPSfactor_tauToLepDecay(x, visEn, visP, visMass, visMass2, visMass2/tauLeptonMass2, nunuEn, nunuP, nunuMass);
+}
+
+double compPSfactor_tauToLepDecay(double x, double visEn, double visP, double visMass, double visMass2, double xMin, double nunuEn, double nunuP, double nunuMass)
 {
   //std::cout << "<compPSfactor_tauToLepDecay>:" << std::endl;
   //std::cout << " x = " << x << std::endl;
@@ -165,9 +186,8 @@ double compPSfactor_tauToLepDecay(double x, double visEn, double visP, double vi
   //std::cout << " nunuEn = " << nunuEn << std::endl;
   //std::cout << " nunuP = " << nunuP << std::endl;
   //std::cout << " nunuMass = " << nunuMass << std::endl;
-  double visMass2 = square(visMass);
   double nunuMass2 = square(nunuMass);
-  if ( x >= (visMass2/tauLeptonMass2) && x <= 1. && nunuMass2 < ((1. - x)*tauLeptonMass2) ) { // physical solution
+  if ( x >= xMin && x <= 1. && nunuMass2 < ((1. - x)*tauLeptonMass2) ) { // physical solution
     double tauEn_rf = (tauLeptonMass2 + nunuMass2 - visMass2)/(2.*nunuMass);
     double visEn_rf = tauEn_rf - nunuMass;
     if ( !(tauEn_rf >= tauLeptonMass && visEn_rf >= visMass) ) return 0.;
@@ -191,21 +211,26 @@ double compPSfactor_tauToLepDecay(double x, double visEn, double visP, double vi
 }
 
 double compPSfactor_tauToHadDecay(double x, double visEn, double visP, double visMass, double nuEn, double nuP)
+{
+  double visMass2 = square(visMass);
+  return compPSfactor_tauToHadDecay(x, visEn, visP, visMass2, visMass2/tauLeptonMass2, 1.0/(tauLeptonMass2 - visMass2), nuEn, nuP);
+}
+
+double compPSfactor_tauToHadDecay(double x, double visEn, double visP, double visMass2, double xMin, double psNorm, double nuEn, double nuP)
 {
   //std::cout << "<compPSfactor_tauToHadDecay>:" << std::endl;
   //std::cout << " x = " << x << std::endl;
   //std::cout << " visEn = " << visEn << std::endl;
   //std::cout << " visP = " << visP << std::endl;
-  //std::cout << " visMass = " << visMass << std::endl;
+  //std::cout << " visMass2 = " << visMass2 << std::endl;
   //std::cout << " nuEn = " << nuEn << std::endl;
   //std::cout << " nuP = " << nuP << std::endl;
-  double visMass2 = square(visMass);
-  if ( x >= (visMass2/tauLeptonMass2) && x <= 1. ) { // physical solution
+  if ( x >= xMin && x <= 1. ) { // physical solution
     double cosThetaNu = classic_svFit::compCosThetaNuNu(visEn, visP, visMass2, nuEn, nuP, 0.);
     //std::cout << "cosThetaNu = " << cosThetaNu << std::endl;
     if ( !(cosThetaNu >= (-1. + epsilon) && cosThetaNu <= +1.) ) return 0.;
     double PSfactor = (visEn + nuEn)/(8.*visP*square(x)*TMath::Sqrt(square(visP) + square(nuP) + 2.*visP*nuP*cosThetaNu + tauLeptonMass2));
-    PSfactor *= 1.0/(tauLeptonMass2 - visMass2);
+    PSfactor *= psNorm;
     //-------------------------------------------------------------------------
     // CV: multiply by constant matrix element,
     //     chosen such that the branching fraction of the tau to decay into hadrons is reproduced
@@ -0,0 +1,332 @@
+#include "TauAnalysis/ClassicSVfit/interface/svFitChainTrace.h"
+
+#include "TauAnalysis/ClassicSVfit/interface/svFitAuxFunctions.h"
+
+#include <TMath.h>
+
+#include <iostream>
+#include <sstream>
+#include <assert.h>
+
+using namespace classic_svFit;
+
+ChainTraceWriter::ChainTraceWriter(const std::string& fileName, unsigned thinning, unsigned blockSize)
+  : fileName_(fileName)
+  , thinning_(( thinning > 0 ) ? thinning : 1)
+  , blockSize_(( blockSize > 0 ) ? blockSize : 1)
+  , numEvents_(0)
+  , numBlocksInProgress_(0)
+  , stop_(false)
+{
+//--- count events stored in existing index file, so that event numbers continue
+  std::string indexFileName = fileName_ + ".idx";
+  std::ifstream existingIndexFile(indexFileName.data());
+  std::string line;
+  while ( std::getline(existingIndexFile, line) ) {
+    if ( line != "" ) ++numEvents_;
+  }
+  existingIndexFile.close();
+
+  dataFile_.open(fileName_.data(), std::ios::out | std::ios::binary | std::ios::app);
+  indexFile_.open(indexFileName.data(), std::ios::out | std::ios::app);
+  if ( !dataFile_.is_open() || !indexFile_.is_open() ) {
+    std::cerr << "<ChainTraceWriter>:"
+              << "Failed to open file = " << fileName_ << " for writing --> ABORTING !!\n";
+    assert(0);
+  }
+
+  writer_ = std::thread(&ChainTraceWriter::runWriter, this);
+}
+
+ChainTraceWriter::~ChainTraceWriter()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  queueCondition_.notify_all();
+  writer_.join();
+
+  for ( std::vector<Block*>::iterator block = currentBlocks_.begin();
+        block != currentBlocks_.end(); ++block ) {
+    delete (*block);
+  }
+  for ( std::vector<Block*>::iterator block = freeBlocks_.begin();
+        block != freeBlocks_.end(); ++block ) {
+    delete (*block);
+  }
+}
+
+void ChainTraceWriter::beginEvent(const std::vector<std::string>& columnNames, unsigned numChains)
+{
+  columnNames_ = columnNames;
+  for ( std::vector<Block*>::iterator block = currentBlocks_.begin();
+        block != currentBlocks_.end(); ++block ) {
+    delete (*block);
+  }
+  currentBlocks_.clear();
+  for ( unsigned iChain = 0; iChain < numChains; ++iChain ) {
+    Block* block = 0;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if ( !freeBlocks_.empty() ) {
+        block = freeBlocks_.back();
+        freeBlocks_.pop_back();
+      }
+    }
+    if ( !block ) block = new Block();
+    block->iChain_ = iChain;
+    block->numSamples_ = 0;
+    block->values_.resize(columnNames_.size()*blockSize_);
+    currentBlocks_.push_back(block);
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  blockIndices_.clear();
+}
+
+void ChainTraceWriter::fill(unsigned iChain, const float* values)
+{
+  assert(iChain < currentBlocks_.size());
+  Block* block = currentBlocks_[iChain];
+  unsigned numColumns = columnNames_.size();
+  for ( unsigned iColumn = 0; iColumn < numColumns; ++iColumn ) {
+    block->values_[iColumn*blockSize_ + block->numSamples_] = values[iColumn];
+  }
+  ++block->numSamples_;
+  if ( block->numSamples_ == blockSize_ ) {
+    currentBlocks_[iChain] = submitBlock(block);
+  }
+}
+
+ChainTraceWriter::Block* ChainTraceWriter::submitBlock(Block* block)
+{
+  Block* emptyBlock = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queuedBlocks_.push_back(block);
+    ++numBlocksInProgress_;
+    if ( !freeBlocks_.empty() ) {
+      emptyBlock = freeBlocks_.back();
+      freeBlocks_.pop_back();
+    }
+  }
+  queueCondition_.notify_one();
+  if ( !emptyBlock ) emptyBlock = new Block();
+  emptyBlock->iChain_ = block->iChain_;
+  emptyBlock->numSamples_ = 0;
+  emptyBlock->values_.resize(columnNames_.size()*blockSize_);
+  return emptyBlock;
+}
+
+void ChainTraceWriter::runWriter()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  while ( true ) {
+    queueCondition_.wait(lock, [this] { return stop_ || !queuedBlocks_.empty(); });
+    if ( queuedBlocks_.empty() ) break; // CV: stop is requested and all blocks have been written
+    Block* block = queuedBlocks_.front();
+    queuedBlocks_.pop_front();
+    lock.unlock();
+
+//--- write block column by column, omitting unused entries of partially filled blocks
+    BlockIndex blockIndex;
+    blockIndex.offset_ = dataFile_.tellp();
+    blockIndex.iChain_ = block->iChain_;
+    blockIndex.numSamples_ = block->numSamples_;
+    unsigned numColumns = block->values_.size()/blockSize_;
+    for ( unsigned iColumn = 0; iColumn < numColumns; ++iColumn ) {
+      dataFile_.write(reinterpret_cast<const char*>(&block->values_[iColumn*blockSize_]), block->numSamples_*sizeof(float));
+    }
+
+    lock.lock();
+    blockIndices_.push_back(blockIndex);
+    freeBlocks_.push_back(block);
+    --numBlocksInProgress_;
+    if ( numBlocksInProgress_ == 0 ) doneCondition_.notify_all();
+  }
+}
+
+void ChainTraceWriter::endEvent()
+{
+  for ( std::vector<Block*>::iterator block = currentBlocks_.begin();
+        block != currentBlocks_.end(); ++block ) {
+    if ( (*block)->numSamples_ > 0 ) (*block) = submitBlock(*block);
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  doneCondition_.wait(lock, [this] { return numBlocksInProgress_ == 0; });
+  dataFile_.flush();
+
+  indexFile_ << "event " << numEvents_;
+  indexFile_ << " columns " << columnNames_.size();
+  for ( std::vector<std::string>::const_iterator columnName = columnNames_.begin();
+        columnName != columnNames_.end(); ++columnName ) {
+    indexFile_ << " " << (*columnName);
+  }
+  indexFile_ << " blocks " << blockIndices_.size();
+  for ( std::vector<BlockIndex>::const_iterator blockIndex = blockIndices_.begin();
+        blockIndex != blockIndices_.end(); ++blockIndex ) {
+    indexFile_ << " " << blockIndex->offset_ << " " << blockIndex->iChain_ << " " << blockIndex->numSamples_;
+  }
+  indexFile_ << std::endl;
+  blockIndices_.clear();
+  ++numEvents_;
+}
+
+//-------------------------------------------------------------------------------
+
+ChainTraceReader::ChainTraceReader(const std::string& fileName)
+  : fileName_(fileName)
+{
+  std::string indexFileName = fileName_ + ".idx";
+  std::ifstream indexFile(indexFileName.data());
+  dataFile_.open(fileName_.data(), std::ios::in | std::ios::binary);
+  if ( !indexFile.is_open() || !dataFile_.is_open() ) {
+    std::cerr << "<ChainTraceReader>:"
+              << "Failed to open file = " << fileName_ << " for reading --> ABORTING !!\n";
+    assert(0);
+  }
+
+  std::string line;
+  while ( std::getline(indexFile, line) ) {
+    if ( line == "" ) continue;
+    std::istringstream stream(line);
+    std::string keyword;
+    unsigned long iEvent;
+    unsigned numColumns;
+    stream >> keyword >> iEvent >> keyword >> numColumns;
+    Event event;
+    for ( unsigned iColumn = 0; iColumn < numColumns; ++iColumn ) {
+      std::string columnName;
+      stream >> columnName;
+      event.columnNames_.push_back(columnName);
+    }
+    unsigned numBlocks;
+    stream >> keyword >> numBlocks;
+    for ( unsigned iBlock = 0; iBlock < numBlocks; ++iBlock ) {
+      unsigned long offset;
+      unsigned iChain, numSamples;
+      stream >> offset >> iChain >> numSamples;
+      event.offsets_.push_back(offset);
+      event.numSamples_.push_back(numSamples);
+    }
+    if ( stream.fail() ) {
+      std::cerr << "<ChainTraceReader>:"
+                << "Failed to parse entry #" << events_.size() << " of index file = " << indexFileName << " --> ABORTING !!\n";
+      assert(0);
+    }
+    events_.push_back(event);
+  }
+}
+
+ChainTraceReader::~ChainTraceReader()
+{}
+
+const std::vector<std::string>& ChainTraceReader::getColumnNames(unsigned iEvent) const
+{
+  assert(iEvent < events_.size());
+  return events_[iEvent].columnNames_;
+}
+
+void ChainTraceReader::readColumn(unsigned iEvent, const std::string& columnName, std::vector<float>& values) const
+{
+  assert(iEvent < events_.size());
+  const Event& event = events_[iEvent];
+  unsigned numColumns = event.columnNames_.size();
+  unsigned iColumn = 0;
+  while ( iColumn < numColumns && event.columnNames_[iColumn] != columnName ) ++iColumn;
+  if ( iColumn == numColumns ) {
+    std::cerr << "<ChainTraceReader::readColumn>:"
+              << "No column = " << columnName << " stored for event #" << iEvent << " --> ABORTING !!\n";
+    assert(0);
+  }
+
+  values.clear();
+  for ( unsigned iBlock = 0; iBlock < event.offsets_.size(); ++iBlock ) {
+    unsigned numSamples = event.numSamples_[iBlock];
+    size_t numValues = values.size();
+    values.resize(numValues + numSamples);
+    dataFile_.clear();
+    dataFile_.seekg(event.offsets_[iBlock] + static_cast<unsigned long>(iColumn)*numSamples*sizeof(float));
+    dataFile_.read(reinterpret_cast<char*>(values.data() + numValues), numSamples*sizeof(float));
+    if ( !dataFile_ ) {
+      std::cerr << "<ChainTraceReader::readColumn>:"
+                << "Failed to read block #" << iBlock << " of event #" << iEvent << " from file = " << fileName_ << " --> ABORTING !!\n";
+      assert(0);
+    }
+  }
+}
+
+namespace
+{
+  LorentzVector getTauP4(const std::vector<float>& px, const std::vector<float>& py, const std::vector<float>& pz, const std::vector<float>& energy, unsigned iSample)
+  {
+    return LorentzVector(px[iSample], py[iSample], pz[iSample], energy[iSample]);
+  }
+}
+
+void ChainTraceReader::readQuantity(unsigned iEvent, const std::string& quantity, std::vector<float>& values) const
+{
+  const std::vector<std::string>& columnNames = getColumnNames(iEvent);
+  for ( std::vector<std::string>::const_iterator columnName = columnNames.begin();
+        columnName != columnNames.end(); ++columnName ) {
+    if ( (*columnName) == quantity ) {
+      readColumn(iEvent, quantity, values);
+      return;
+    }
+  }
+
+//--- compute quantity from tau lepton four-vectors,
+//    following the definitions used by HistogramAdapterDiTau and HistogramAdapterTau
+  std::vector<float> tau1Px, tau1Py, tau1Pz, tau1E, tau2Px, tau2Py, tau2Pz, tau2E;
+  readColumn(iEvent, "tau1Px", tau1Px);
+  readColumn(iEvent, "tau1Py", tau1Py);
+  readColumn(iEvent, "tau1Pz", tau1Pz);
+  readColumn(iEvent, "tau1E",  tau1E);
+  readColumn(iEvent, "tau2Px", tau2Px);
+  readColumn(iEvent, "tau2Py", tau2Py);
+  readColumn(iEvent, "tau2Pz", tau2Pz);
+  readColumn(iEvent, "tau2E",  tau2E);
+  unsigned numSamples = tau1Px.size();
+  values.resize(numSamples);
+  for ( unsigned iSample = 0; iSample < numSamples; ++iSample ) {
+    LorentzVector tau1P4 = getTauP4(tau1Px, tau1Py, tau1Pz, tau1E, iSample);
+    LorentzVector tau2P4 = getTauP4(tau2Px, tau2Py, tau2Pz, tau2E, iSample);
+    LorentzVector ditauP4 = tau1P4 + tau2P4;
+    double value = 0.;
+    if      ( quantity == "ditauPt"   ) value = ditauP4.pt();
+    else if ( quantity == "ditauEta"  ) value = ditauP4.eta();
+    else if ( quantity == "ditauPhi"  ) value = ditauP4.phi();
+    else if ( quantity == "ditauMass" ) value = ditauP4.mass();
+    else if ( quantity == "ditauTransverseMass" ) {
+      double transverseMass2 = square(tau1P4.Et() + tau2P4.Et()) - (square(ditauP4.px()) + square(ditauP4.py()));
+      value = TMath::Sqrt(TMath::Max(1., transverseMass2));
+    }
+    else if ( quantity == "tau1Pt"  ) value = tau1P4.pt();
+    else if ( quantity == "tau1Eta" ) value = tau1P4.eta();
+    else if ( quantity == "tau1Phi" ) value = tau1P4.phi();
+    else if ( quantity == "tau2Pt"  ) value = tau2P4.pt();
+    else if ( quantity == "tau2Eta" ) value = tau2P4.eta();
+    else if ( quantity == "tau2Phi" ) value = tau2P4.phi();
+    else {
+      std::cerr << "<ChainTraceReader::fillHistogram>:"
+                << "Invalid quantity = " << quantity << " --> ABORTING !!\n";
+      assert(0);
+    }
+    values[iSample] = value;
+  }
+}
+
+void ChainTraceReader::fillHistogram(TH1* histogram, const std::string& quantity, int iEvent) const
+{
+  unsigned firstEvent = ( iEvent >= 0 ) ? iEvent : 0;
+  unsigned lastEvent = ( iEvent >= 0 ) ? (iEvent + 1) : events_.size();
+  std::vector<float> values;
+  for ( unsigned jEvent = firstEvent; jEvent < lastEvent; ++jEvent ) {
+    readQuantity(jEvent, quantity, values);
+    for ( std::vector<float>::const_iterator value = values.begin();
+          value != values.end(); ++value ) {
+      histogram->Fill(*value);
+    }
+  }
+}
@@ -0,0 +1,272 @@
+#include "TauAnalysis/ClassicSVfit/interface/svFitFormula.h"
+
+#include <TMath.h>
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+using namespace classic_svFit;
+
+const unsigned CompiledFormula::maxStackSize;
+
+namespace
+{
+  struct FunctionDefinition
+  {
+    const char* name_;
+    int opCode_;
+    unsigned numArguments_;
+  };
+}
+
+CompiledFormula::CompiledFormula()
+  : stackSize_(0)
+  , pos_(nullptr)
+  , depth_(0)
+{}
+
+bool CompiledFormula::compile(const std::string& expression)
+{
+  instructions_.clear();
+  stackSize_ = 0;
+  pos_ = expression.data();
+  depth_ = 0;
+  bool isValid = parseExpression();
+  skipWhitespace();
+  if ( !isValid || *pos_ != '\0' || depth_ != 1 || stackSize_ > maxStackSize ) {
+    instructions_.clear();
+    isValid = false;
+  }
+  pos_ = nullptr;
+  return isValid;
+}
+
+double CompiledFormula::applyBinary(OpCode opCode, double x, double y)
+{
+  switch ( opCode ) {
+    case kAdd:      return x + y;
+    case kSubtract: return x - y;
+    case kMultiply: return x*y;
+    case kDivide:   return x/y;
+    case kPower:    return TMath::Power(x, y);
+    case kMin:      return TMath::Min(x, y);
+    case kMax:      return TMath::Max(x, y);
+    default:        return 0.;
+  }
+}
+
+double CompiledFormula::applyUnary(OpCode opCode, double x)
+{
+  switch ( opCode ) {
+    case kNegate: return -x;
+    case kSqrt:   return TMath::Sqrt(x);
+    case kExp:    return TMath::Exp(x);
+    case kLog:    return TMath::Log(x);
+    case kLog10:  return TMath::Log10(x);
+    case kAbs:    return TMath::Abs(x);
+    case kSin:    return TMath::Sin(x);
+    case kCos:    return TMath::Cos(x);
+    case kTan:    return TMath::Tan(x);
+    default:      return 0.;
+  }
+}
+
+double CompiledFormula::eval(double x) const
+{
+  double stack[maxStackSize];
+  unsigned depth = 0;
+  for ( std::vector<Instruction>::const_iterator instruction = instructions_.begin();
+        instruction != instructions_.end(); ++instruction ) {
+    OpCode opCode = instruction->opCode_;
+    if ( opCode == kConstant ) {
+      stack[depth++] = instruction->value_;
+    } else if ( opCode == kVariable ) {
+      stack[depth++] = x;
+    } else if ( isBinary(opCode) ) {
+      --depth;
+      stack[depth - 1] = applyBinary(opCode, stack[depth - 1], stack[depth]);
+    } else {
+      stack[depth - 1] = applyUnary(opCode, stack[depth - 1]);
+    }
+  }
+  return ( depth == 1 ) ? stack[0] : 0.;
+}
+
+void CompiledFormula::emit(OpCode opCode, double value)
+{
+//--- keep track of the depth of the stack
+  if ( opCode == kConstant || opCode == kVariable ) {
+    ++depth_;
+    if ( depth_ > stackSize_ ) stackSize_ = depth_;
+  } else if ( isBinary(opCode) ) {
+    --depth_;
+  }
+
+//--- evaluate operations on constant operands directly
+  unsigned numInstructions = instructions_.size();
+  if ( isBinary(opCode) && numInstructions >= 2 &&
+       instructions_[numInstructions - 2].opCode_ == kConstant && instructions_[numInstructions - 1].opCode_ == kConstant ) {
+    double result = applyBinary(opCode, instructions_[numInstructions - 2].value_, instructions_[numInstructions - 1].value_);
+    instructions_.pop_back();
+    instructions_.back().value_ = result;
+    return;
+  }
+  if ( opCode != kConstant && opCode != kVariable && !isBinary(opCode) && numInstructions >= 1 &&
+       instructions_[numInstructions - 1].opCode_ == kConstant ) {
+    instructions_.back().value_ = applyUnary(opCode, instructions_.back().value_);
+    return;
+  }
+
+  Instruction instruction;
+  instruction.opCode_ = opCode;
+  instruction.value_ = value;
+  instructions_.push_back(instruction);
+}
+
+void CompiledFormula::skipWhitespace()
+{
+  while ( std::isspace(static_cast<unsigned char>(*pos_)) ) ++pos_;
+}
+
+bool CompiledFormula::accept(const char* token)
+{
+  skipWhitespace();
+  size_t length = std::strlen(token);
+  if ( std::strncmp(pos_, token, length) == 0 ) {
+    pos_ += length;
+    return true;
+  }
+  return false;
+}
+
+bool CompiledFormula::parseExpression()
+{
+  if ( !parseTerm() ) return false;
+  while ( true ) {
+    if      ( accept("+") ) { if ( !parseTerm() ) return false; emit(kAdd);      }
+    else if ( accept("-") ) { if ( !parseTerm() ) return false; emit(kSubtract); }
+    else return true;
+  }
+}
+
+bool CompiledFormula::parseTerm()
+{
+  if ( !parseUnary() ) return false;
+  while ( true ) {
+    if      ( accept("*") ) { if ( !parseUnary() ) return false; emit(kMultiply); }
+    else if ( accept("/") ) { if ( !parseUnary() ) return false; emit(kDivide);   }
+    else return true;
+  }
+}
+
+bool CompiledFormula::parseUnary()
+{
+  if ( accept("-") ) {
+    if ( !parseUnary() ) return false;
+    emit(kNegate);
+    return true;
+  }
+  if ( accept("+") ) return parseUnary();
+  return parsePower();
+}
+
+bool CompiledFormula::parsePower()
+{
+  if ( !parsePrimary() ) return false;
+  if ( accept("^") || accept("**") ) {
+    // CV: power is right-associative and binds stronger than a unary minus on its left: -x^2 = -(x^2)
+    if ( !parseUnary() ) return false;
+    emit(kPower);
+  }
+  return true;
+}
+
+bool CompiledFormula::parsePrimary()
+{
+  skipWhitespace();
+
+  if ( accept("(") ) {
+    if ( !parseExpression() ) return false;
+    return accept(")");
+  }
+
+  if ( std::isdigit(static_cast<unsigned char>(*pos_)) || *pos_ == '.' ) {
+    char* end = nullptr;
+    double value = std::strtod(pos_, &end);
+    if ( end == pos_ ) return false;
+    pos_ = end;
+    emit(kConstant, value);
+    return true;
+  }
+
+  const char* begin = pos_;
+  while ( std::isalnum(static_cast<unsigned char>(*pos_)) || *pos_ == '_' || *pos_ == ':' ) ++pos_;
+  std::string name(begin, pos_ - begin);
+  if ( name.empty() ) return false;
+
+  if ( name == "x" ) {
+    emit(kVariable);
+    return true;
+  }
+  if ( name == "pi" ) {
+    emit(kConstant, TMath::Pi());
+    return true;
+  }
+  if ( name == "TMath::Pi" ) {
+    if ( !(accept("(") && accept(")")) ) return false;
+    emit(kConstant, TMath::Pi());
+    return true;
+  }
+
+  static const FunctionDefinition functions[] = {
+    { "sqrt",  kSqrt,  1 }, { "TMath::Sqrt",  kSqrt,  1 },
+    { "exp",   kExp,   1 }, { "TMath::Exp",   kExp,   1 },
+    { "log",   kLog,   1 }, { "TMath::Log",   kLog,   1 },
+    { "log10", kLog10, 1 }, { "TMath::Log10", kLog10, 1 },
+    { "abs",   kAbs,   1 }, { "TMath::Abs",   kAbs,   1 },
+    { "sin",   kSin,   1 }, { "TMath::Sin",   kSin,   1 },
+    { "cos",   kCos,   1 }, { "TMath::Cos",   kCos,   1 },
+    { "tan",   kTan,   1 }, { "TMath::Tan",   kTan,   1 },
+    { "pow",   kPower, 2 }, { "TMath::Power", kPower, 2 },
+    { "min",   kMin,   2 }, { "TMath::Min",   kMin,   2 },
+    { "max",   kMax,   2 }, { "TMath::Max",   kMax,   2 }
+  };
+  const unsigned numFunctions = sizeof(functions)/sizeof(FunctionDefinition);
+  for ( unsigned iFunction = 0; iFunction < numFunctions; ++iFunction ) {
+    const FunctionDefinition& function = functions[iFunction];
+    if ( name != function.name_ ) continue;
+    if ( !accept("(") ) return false;
+    for ( unsigned iArgument = 0; iArgument < function.numArguments_; ++iArgument ) {
+      if ( iArgument > 0 && !accept(",") ) return false;
+      if ( !parseExpression() ) return false;
+    }
+    if ( !accept(")") ) return false;
+    emit(static_cast<OpCode>(function.opCode_));
+    return true;
+  }
+
+  // CV: unknown identifier or function
+  return false;
+}
+
+std::string classic_svFit::replaceVariableName(const std::string& expression, const std::string& name)
+{
+  // CV: identifiers are delimited in the same way as by CompiledFormula::parsePrimary,
+  //     so that e.g. TMath::Max is treated as one identifier
+  std::string result;
+  const char* pos = expression.data();
+  while ( *pos != '\0' ) {
+    if ( std::isalnum(static_cast<unsigned char>(*pos)) || *pos == '_' || *pos == ':' ) {
+      const char* begin = pos;
+      while ( std::isalnum(static_cast<unsigned char>(*pos)) || *pos == '_' || *pos == ':' ) ++pos;
+      std::string identifier(begin, pos - begin);
+      if ( identifier == name ) result += "x";
+      else result += identifier;
+    } else {
+      result += *pos;
+      ++pos;
+    }
+  }
+  return result;
+}
@@ -2,6 +2,7 @@
 
 #include <TMath.h>
 #include <TFile.h>
+#include <TDirectory.h>
 #include <TObject.h>
 #include <TLorentzVector.h>
 
@@ -11,24 +12,31 @@
 
 using namespace classic_svFit;
 
+namespace
+{
+  double getBinDensity(TH1 const* histogram, int idxBin)
+  {
+    return histogram->GetBinContent(idxBin)/histogram->GetBinWidth(idxBin);
+  }
+}
+
+// CV: histograms are kept out of the current ROOT directory (gDirectory),
+//     so that ClassicSVfit instances running in different threads do not modify shared lists of objects
 TH1* HistogramTools::compHistogramDensity(TH1 const* histogram)
 {
+  TDirectory::TContext noDirectory(nullptr);
   TH1* histogram_density = static_cast<TH1*>(histogram->Clone((std::string(histogram->GetName()) + "_density").c_str()));
   histogram_density->Scale(1.0, "width");
   return histogram_density;
 }
 
-void HistogramTools::extractHistogramProperties(
+void HistogramTools::extractQuantiles(
     TH1 const* histogram,
-    double& xMaximum,
-    double& xMaximum_interpol,
-    double& xMean,
     double& xQuantile016,
     double& xQuantile050,
     double& xQuantile084
 )
 {
-  // compute median, -1 sigma and +1 sigma limits on reconstructed mass
   if ( histogram->Integral() > 0. ) {
     Double_t q[3];
     Double_t probSum[3];
@@ -44,22 +52,47 @@ void HistogramTools::extractHistogramProperties(
     xQuantile050 = 0.;
     xQuantile084 = 0.;
   }
+}
+
+void HistogramTools::extractHistogramProperties(
+    TH1 const* histogram,
+    double& xMaximum,
+    double& xMaximum_interpol,
+    double& xMean,
+    double& xQuantile016,
+    double& xQuantile050,
+    double& xQuantile084
+)
+{
+  // compute median, -1 sigma and +1 sigma limits on reconstructed mass
+  HistogramTools::extractQuantiles(histogram, xQuantile016, xQuantile050, xQuantile084);
 
   xMean = histogram->GetMean();
 
-  TH1* histogram_density = HistogramTools::compHistogramDensity(histogram);
-  if ( histogram_density->Integral() > 0. ) {
-    int binMaximum = histogram_density->GetMaximumBin();
-    xMaximum = histogram_density->GetBinCenter(binMaximum);
-    double yMaximum = histogram_density->GetBinContent(binMaximum);
-    if ( binMaximum > 1 && binMaximum < histogram_density->GetNbinsX() ) {
+  // CV: the density (bin content divided by bin width) is computed on the fly, in the same way as by compHistogramDensity,
+  //     as cloning the histogram would allocate memory for each event
+  int numBins = histogram->GetNbinsX();
+  double integral_density = 0.;
+  int binMaximum = 1;
+  double yMaximum = getBinDensity(histogram, 1);
+  for ( int idxBin = 1; idxBin <= numBins; ++idxBin ) {
+    double y = getBinDensity(histogram, idxBin);
+    integral_density += y;
+    if ( y > yMaximum ) {
+      binMaximum = idxBin;
+      yMaximum = y;
+    }
+  }
+  if ( integral_density > 0. ) {
+    xMaximum = histogram->GetBinCenter(binMaximum);
+    if ( binMaximum > 1 && binMaximum < numBins ) {
       int binLeft       = binMaximum - 1;
-      double xLeft      = histogram_density->GetBinCenter(binLeft);
-      double yLeft      = histogram_density->GetBinContent(binLeft);
+      double xLeft      = histogram->GetBinCenter(binLeft);
+      double yLeft      = getBinDensity(histogram, binLeft);
 
       int binRight      = binMaximum + 1;
-      double xRight     = histogram_density->GetBinCenter(binRight);
-      double yRight     = histogram_density->GetBinContent(binRight);
+      double xRight     = histogram->GetBinCenter(binRight);
+      double yRight     = getBinDensity(histogram, binRight);
 
       double xMinus     = xLeft - xMaximum;
       double yMinus     = yLeft - yMaximum;
@@ -74,7 +107,6 @@ void HistogramTools::extractHistogramProperties(
     xMaximum = 0.;
     xMaximum_interpol = 0.;
   }
-  delete histogram_density;
 }
 
 double HistogramTools::extractValue(TH1 const* histogram)
@@ -95,34 +127,46 @@ double HistogramTools::extractUncertainty(TH1 const* histogram)
 
 double HistogramTools::extractLmax(TH1 const* histogram)
 {
-  TH1* histogram_density = HistogramTools::compHistogramDensity(histogram);
-  double Lmax = histogram_density->GetMaximum();
-  delete histogram_density;
+  int numBins = histogram->GetNbinsX();
+  double Lmax = getBinDensity(histogram, 1);
+  for ( int idxBin = 2; idxBin <= numBins; ++idxBin ) {
+    double y = getBinDensity(histogram, idxBin);
+    if ( y > Lmax ) Lmax = y;
+  }
   return Lmax;
 }
 
 TH1* HistogramTools::makeHistogram_linBinWidth(const std::string& histogramName, int numBins, double xMin, double xMax)
 {
+  TDirectory::TContext noDirectory(nullptr);
   TH1* histogram = new TH1D(histogramName.data(), histogramName.data(), numBins, xMin, xMax);
   return histogram;
 }
 
 TH1* HistogramTools::makeHistogram_logBinWidth(const std::string& histogramName, double xMin, double xMax, double logBinWidth)
+{
+  std::vector<double> binning;
+  HistogramTools::compBinning_logBinWidth(xMin, xMax, logBinWidth, binning);
+  TDirectory::TContext noDirectory(nullptr);
+  TH1* histogram = new TH1D(histogramName.data(), histogramName.data(), binning.size() - 1, binning.data());
+  return histogram;
+}
+
+void HistogramTools::compBinning_logBinWidth(double xMin, double xMax, double logBinWidth, std::vector<double>& binning)
 {
   if ( xMin <= 0. ) xMin = 0.1;
   int numBins = 1 + TMath::Log(xMax/xMin)/TMath::Log(logBinWidth);
-  TArrayF binning(numBins + 1);
+  binning.resize(numBins + 1);
   binning[0] = 0.;
   double x = xMin;
   for ( int idxBin = 1; idxBin <= numBins; ++idxBin ) {
-    binning[idxBin] = x;
+    // CV: bin edges are rounded to single precision, for compatibility with histograms booked by previous versions
+    binning[idxBin] = static_cast<float>(x);
     x *= logBinWidth;
   }
-  TH1* histogram = new TH1D(histogramName.data(), histogramName.data(), numBins, binning.GetArray());
-  return histogram;
 }
 
-int SVfitQuantity::nInstances = 0;
+std::atomic<int> SVfitQuantity::nInstances(0);
 
 SVfitQuantity::SVfitQuantity(const std::string& label) 
   : label_(label)
@@ -153,6 +197,39 @@ void SVfitQuantity::fillHistogram(double value)
   histogram_->Fill(value);
 }
 
+void SVfitQuantity::fillHistogram(double value, double weight)
+{
+  histogram_->Fill(value, weight);
+}
+
+void SVfitQuantity::addHistogram(const SVfitQuantity& quantity)
+{
+  if ( histogram_ != nullptr && quantity.histogram_ != nullptr ) {
+    histogram_->Add(quantity.histogram_);
+  }
+}
+
+void SVfitQuantity::bookHistogram_linBinWidth(const char* name, int numBins, double xMin, double xMax)
+{
+  if ( histogram_ != nullptr ) {
+    histogram_->SetBins(numBins, xMin, xMax);
+    histogram_->Reset();
+  } else {
+    histogram_ = HistogramTools::makeHistogram_linBinWidth("ClassicSVfitIntegrand_" + label_ + "_" + name + uniqueName_, numBins, xMin, xMax);
+  }
+}
+
+void SVfitQuantity::bookHistogram_logBinWidth(const char* name, double xMin, double xMax, double logBinWidth)
+{
+  if ( histogram_ != nullptr ) {
+    HistogramTools::compBinning_logBinWidth(xMin, xMax, logBinWidth, binning_);
+    histogram_->SetBins(binning_.size() - 1, binning_.data());
+    histogram_->Reset();
+  } else {
+    histogram_ = HistogramTools::makeHistogram_logBinWidth("ClassicSVfitIntegrand_" + label_ + "_" + name + uniqueName_, xMin, xMax, logBinWidth);
+  }
+}
+
 double SVfitQuantity::extractValue() const
 {
   return HistogramTools::extractValue(histogram_);
@@ -168,6 +245,11 @@ double SVfitQuantity::extractLmax() const
   return HistogramTools::extractLmax(histogram_);
 }
 
+void SVfitQuantity::extractQuantiles(double& xQuantile016, double& xQuantile050, double& xQuantile084) const
+{
+  HistogramTools::extractQuantiles(histogram_, xQuantile016, xQuantile050, xQuantile084);
+}
+
 bool SVfitQuantity::isValidSolution() const
 {
   return (extractLmax() > 0.);
@@ -200,6 +282,14 @@ void HistogramAdapter::writeHistograms(const std::string& likelihoodFileName) co
   delete likelihoodFile;
 }
 
+void HistogramAdapter::addHistograms(const HistogramAdapter& adapter)
+{
+  assert(adapter.quantities_.size() == quantities_.size());
+  for ( size_t idxQuantity = 0; idxQuantity < quantities_.size(); ++idxQuantity ) {
+    quantities_[idxQuantity]->addHistogram(*adapter.quantities_[idxQuantity]);
+  }
+}
+
 double HistogramAdapter::extractValue(const SVfitQuantity* quantity) const
 {
   return quantity->extractValue();
@@ -227,38 +317,31 @@ SVfitQuantityTau::SVfitQuantityTau(const std::string& label)
   : SVfitQuantity(label)
 {}
 
-void SVfitQuantityTau::bookHistogram(const LorentzVector& visP4)
-{
-  if ( histogram_ != nullptr ) delete histogram_;
-  histogram_ = createHistogram(visP4);
-  histogram_->SetName(std::string(histogram_->GetName() + uniqueName_).c_str());
-}
-
 SVfitQuantityTauPt::SVfitQuantityTauPt(const std::string& label)
   : SVfitQuantityTau(label)
 {}
 
-TH1* SVfitQuantityTauPt::createHistogram(const LorentzVector& visP4) const
+void SVfitQuantityTauPt::bookHistogram(const LorentzVector& visP4)
 {
-  return HistogramTools::makeHistogram_logBinWidth("ClassicSVfitIntegrand_" + label_ + "_histogramPt", 1., 1.e+3, 1.025);
+  bookHistogram_logBinWidth("histogramPt", 1., 1.e+3, 1.025);
 }
 
 SVfitQuantityTauEta::SVfitQuantityTauEta(const std::string& label)
   : SVfitQuantityTau(label)
 {}
 
-TH1* SVfitQuantityTauEta::createHistogram(const LorentzVector& visP4) const
+void SVfitQuantityTauEta::bookHistogram(const LorentzVector& visP4)
 {
-  return HistogramTools::makeHistogram_linBinWidth("ClassicSVfitIntegrand_" + label_ + "_histogramEta", 198, -9.9, +9.9);
+  bookHistogram_linBinWidth("histogramEta", 198, -9.9, +9.9);
 }
 
 SVfitQuantityTauPhi::SVfitQuantityTauPhi(const std::string& label)
   : SVfitQuantityTau(label)
 {}
 
-TH1* SVfitQuantityTauPhi::createHistogram(const LorentzVector& visP4) const
+void SVfitQuantityTauPhi::bookHistogram(const LorentzVector& visP4)
 {
-  return HistogramTools::makeHistogram_linBinWidth("ClassicSVfitIntegrand_" + label_ + "_histogramEta", 180, -TMath::Pi(), +TMath::Pi());
+  bookHistogram_linBinWidth("histogramEta", 180, -TMath::Pi(), +TMath::Pi());
 }
 
 HistogramAdapterTau::HistogramAdapterTau(const std::string& label)
@@ -292,11 +375,11 @@ void HistogramAdapterTau::bookHistograms(const LorentzVector& visP4)
   quantity_phi_->bookHistogram(visP4);
 }
 
-void HistogramAdapterTau::fillHistograms(const LorentzVector& tauP4, const LorentzVector& visP4) const
+void HistogramAdapterTau::fillHistograms(const LorentzVector& tauP4, const LorentzVector& visP4, double weight) const
 {
-  quantity_pt_->fillHistogram(tauP4.pt());
-  quantity_eta_->fillHistogram(tauP4.eta());
-  quantity_phi_->fillHistogram(tauP4.phi());
+  quantity_pt_->fillHistogram(tauP4.pt(), weight);
+  quantity_eta_->fillHistogram(tauP4.eta(), weight);
+  quantity_phi_->fillHistogram(tauP4.phi(), weight);
 }
 
 double HistogramAdapterTau::getPt() const
@@ -356,6 +439,11 @@ double HistogramAdapterTau::DoEval(const double* x) const
   fillHistograms(tauP4_, visP4_);
   return 0.;
 }
+
+void HistogramAdapterTau::evalWeighted(const double* x, double weight) const
+{
+  fillHistograms(tauP4_, visP4_, weight);
+}
 //-------------------------------------------------------------------------------------------------
 
 //-------------------------------------------------------------------------------------------------
@@ -364,64 +452,57 @@ SVfitQuantityDiTau::SVfitQuantityDiTau(const std::string& label)
   : SVfitQuantity(label)
 {}
 
-void SVfitQuantityDiTau::bookHistogram(const LorentzVector& vis1P4, const LorentzVector& vis2P4, const Vector& met)
-{
-  if ( histogram_ != nullptr ) delete histogram_;
-  histogram_ = createHistogram(vis1P4, vis2P4, met);
-  histogram_->SetName(std::string(histogram_->GetName() + uniqueName_).c_str());
-}
-
 SVfitQuantityDiTauPt::SVfitQuantityDiTauPt(const std::string& label)
   : SVfitQuantityDiTau(label)
 {}
 
-TH1* SVfitQuantityDiTauPt::createHistogram(const LorentzVector& vis1P4, const LorentzVector& vis2P4, const Vector& met) const
+void SVfitQuantityDiTauPt::bookHistogram(const LorentzVector& vis1P4, const LorentzVector& vis2P4, const Vector& met)
 {
-  return HistogramTools::makeHistogram_logBinWidth("ClassicSVfitIntegrand_" + label_ + "_histogramPt", 1., 1.e+3, 1.025);
+  bookHistogram_logBinWidth("histogramPt", 1., 1.e+3, 1.025);
 }
 
 SVfitQuantityDiTauEta::SVfitQuantityDiTauEta(const std::string& label)
   : SVfitQuantityDiTau(label)
 {}
 
-TH1* SVfitQuantityDiTauEta::createHistogram(const LorentzVector& vis1P4, const LorentzVector& vis2P4, const Vector& met) const
+void SVfitQuantityDiTauEta::bookHistogram(const LorentzVector& vis1P4, const LorentzVector& vis2P4, const Vector& met)
 {
-  return HistogramTools::makeHistogram_linBinWidth("ClassicSVfitIntegrand_" + label_ + "_histogramEta", 198, -9.9, +9.9);
+  bookHistogram_linBinWidth("histogramEta", 198, -9.9, +9.9);
 }
 
 SVfitQuantityDiTauPhi::SVfitQuantityDiTauPhi(const std::string& label)
   : SVfitQuantityDiTau(label)
 {}
 
-TH1* SVfitQuantityDiTauPhi::createHistogram(const LorentzVector& vis1P4, const LorentzVector& vis2P4, const Vector& met) const
+void SVfitQuantityDiTauPhi::bookHistogram(const LorentzVector& vis1P4, const LorentzVector& vis2P4, const Vector& met)
 {
-  return HistogramTools::makeHistogram_linBinWidth("ClassicSVfitIntegrand_" + label_ + "_histogramPhi", 180, -TMath::Pi(), +TMath::Pi());
+  bookHistogram_linBinWidth("histogramPhi", 180, -TMath::Pi(), +TMath::Pi());
 }
 
 SVfitQuantityDiTauMass::SVfitQuantityDiTauMass(const std::string& label)
   : SVfitQuantityDiTau(label)
 {}
 
-TH1* SVfitQuantityDiTauMass::createHistogram(const LorentzVector& vis1P4, const LorentzVector& vis2P4, const Vector& met) const
+void SVfitQuantityDiTauMass::bookHistogram(const LorentzVector& vis1P4, const LorentzVector& vis2P4, const Vector& met)
 {
   double visMass = (vis1P4 + vis2P4).mass();
   double minMass = visMass/1.0125;
   double maxMass = TMath::Max(1.e+4, 1.e+1*minMass);
-  return HistogramTools::makeHistogram_logBinWidth("ClassicSVfitIntegrand_" + label_ + "_histogramMass", minMass, maxMass, 1.025);
+  bookHistogram_logBinWidth("histogramMass", minMass, maxMass, 1.025);
 }
 
 SVfitQuantityDiTauTransverseMass::SVfitQuantityDiTauTransverseMass(const std::string& label)
   : SVfitQuantityDiTau(label)
 {}
 
-TH1* SVfitQuantityDiTauTransverseMass::createHistogram(const LorentzVector& vis1P4, const LorentzVector& vis2P4, const Vector& met) const
+void SVfitQuantityDiTauTransverseMass::bookHistogram(const LorentzVector& vis1P4, const LorentzVector& vis2P4, const Vector& met)
 {
   classic_svFit::LorentzVector measuredDiTauSystem = vis1P4 + vis2P4;
   double visTransverseMass2 = square(vis1P4.Et() + vis2P4.Et()) - (square(measuredDiTauSystem.px()) + square(measuredDiTauSystem.py()));
   double visTransverseMass = TMath::Sqrt(TMath::Max(1., visTransverseMass2));
   double minTransverseMass = visTransverseMass/1.0125;
   double maxTransverseMass = TMath::Max(1.e+4, 1.e+1*minTransverseMass);
-  return HistogramTools::makeHistogram_logBinWidth("ClassicSVfitIntegrand_" + label_ + "_histogramTransverseMass", minTransverseMass, maxTransverseMass, 1.025);
+  bookHistogram_logBinWidth("histogramTransverseMass", minTransverseMass, maxTransverseMass, 1.025);
 }
     
 HistogramAdapterDiTau::HistogramAdapterDiTau(const std::string& label)
@@ -454,6 +535,19 @@ HistogramAdapterDiTau::~HistogramAdapterDiTau()
   delete adapter_tau2_;
 }
 
+HistogramAdapterDiTau* HistogramAdapterDiTau::clone() const
+{
+  return new HistogramAdapterDiTau(label_);
+}
+
+void HistogramAdapterDiTau::addHistograms(const HistogramAdapter& adapter)
+{
+  HistogramAdapter::addHistograms(adapter);
+  const HistogramAdapterDiTau& adapterDiTau = dynamic_cast<const HistogramAdapterDiTau&>(adapter);
+  adapter_tau1_->addHistograms(*adapterDiTau.adapter_tau1_);
+  adapter_tau2_->addHistograms(*adapterDiTau.adapter_tau2_);
+}
+
 void HistogramAdapterDiTau::setMeasurement(const LorentzVector& vis1P4, const LorentzVector& vis2P4, const Vector& met)
 {
   vis1P4_ = vis1P4;
@@ -484,16 +578,16 @@ void HistogramAdapterDiTau::bookHistograms(const LorentzVector& vis1P4, const Lo
 }
 
 void HistogramAdapterDiTau::fillHistograms(const LorentzVector& tau1P4, const LorentzVector& tau2P4, const LorentzVector& ditauP4,
-					   const LorentzVector& vis1P4, const LorentzVector& vis2P4, const Vector& met) const
+					   const LorentzVector& vis1P4, const LorentzVector& vis2P4, const Vector& met, double weight) const
 {
-  quantity_pt_->fillHistogram(ditauP4.pt());
-  quantity_eta_->fillHistogram(ditauP4.eta());
-  quantity_phi_->fillHistogram(ditauP4.phi());
-  quantity_mass_->fillHistogram(ditauP4.mass());
+  quantity_pt_->fillHistogram(ditauP4.pt(), weight);
+  quantity_eta_->fillHistogram(ditauP4.eta(), weight);
+  quantity_phi_->fillHistogram(ditauP4.phi(), weight);
+  quantity_mass_->fillHistogram(ditauP4.mass(), weight);
   double transverseMass2 = square(tau1P4.Et() + tau2P4.Et()) - (square(ditauP4.px()) + square(ditauP4.py()));
-  quantity_transverseMass_->fillHistogram(TMath::Sqrt(TMath::Max(1., transverseMass2)));
-  adapter_tau1_->fillHistograms(tau1P4, vis1P4);
-  adapter_tau2_->fillHistograms(tau2P4, vis2P4);
+  quantity_transverseMass_->fillHistogram(TMath::Sqrt(TMath::Max(1., transverseMass2)), weight);
+  adapter_tau1_->fillHistograms(tau1P4, vis1P4, weight);
+  adapter_tau2_->fillHistograms(tau2P4, vis2P4, weight);
 }
 
 HistogramAdapterTau* HistogramAdapterDiTau::tau1() const 
@@ -566,6 +660,11 @@ double HistogramAdapterDiTau::getMassLmax() const
   return extractLmax(quantity_mass_);
 }
 
+void HistogramAdapterDiTau::getMassQuantiles(double& quantile016, double& quantile050, double& quantile084) const
+{
+  quantity_mass_->extractQuantiles(quantile016, quantile050, quantile084);
+}
+
 double HistogramAdapterDiTau::getTransverseMass() const
 {
   return extractValue(quantity_transverseMass_);
@@ -590,7 +689,12 @@ classic_svFit::LorentzVector HistogramAdapterDiTau::getP4() const
 
 double HistogramAdapterDiTau::DoEval(const double* x) const
 {
-  fillHistograms(tau1P4_, tau2P4_, ditauP4_, vis1P4_, vis2P4_, met_);
+  fillHistograms();
   return 0.;
 }
+
+void HistogramAdapterDiTau::evalWeighted(const double* x, double weight) const
+{
+  fillHistograms(weight);
+}
 //-------------------------------------------------------------------------------------------------
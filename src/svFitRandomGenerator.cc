@@ -0,0 +1,221 @@
+#include "TauAnalysis/ClassicSVfit/interface/svFitRandomGenerator.h"
+
+#include <TMath.h>
+
+#include <cstring>
+#include <iostream>
+#include <assert.h>
+
+using namespace classic_svFit;
+
+double RandomGenerator::Uniform(double xMin, double xMax)
+{
+  double u;
+  fillUniform(&u, 1);
+  return xMin + (xMax - xMin)*u;
+}
+
+double RandomGenerator::Gaus(double mean, double sigma)
+{
+  double x;
+  fillGaus(&x, 1);
+  return mean + sigma*x;
+}
+
+double RandomGenerator::BreitWigner(double mean, double gamma)
+{
+  double x;
+  fillBreitWigner(&x, 1);
+  return mean + gamma*x;
+}
+
+//-------------------------------------------------------------------------------
+
+TRandom3RandomGenerator::TRandom3RandomGenerator()
+{}
+
+void TRandom3RandomGenerator::setSeed(unsigned long seed)
+{
+  rnd_.SetSeed(seed);
+}
+
+void TRandom3RandomGenerator::fillUniform(double* x, unsigned n)
+{
+  for ( unsigned i = 0; i < n; ++i ) {
+    x[i] = rnd_.Uniform(0., 1.);
+  }
+}
+
+void TRandom3RandomGenerator::fillGaus(double* x, unsigned n)
+{
+  for ( unsigned i = 0; i < n; ++i ) {
+    x[i] = rnd_.Gaus(0., 1.);
+  }
+}
+
+void TRandom3RandomGenerator::fillBreitWigner(double* x, unsigned n)
+{
+  for ( unsigned i = 0; i < n; ++i ) {
+    x[i] = rnd_.BreitWigner(0., 1.);
+  }
+}
+
+//-------------------------------------------------------------------------------
+
+namespace
+{
+  // CV: constants of Philox4x32-10 algorithm, taken from [1]
+  const uint32_t philoxM0 = 0xD2511F53;
+  const uint32_t philoxM1 = 0xCD9E8D57;
+  const uint32_t philoxW0 = 0x9E3779B9;
+  const uint32_t philoxW1 = 0xBB67AE85;
+  const unsigned philoxNumRounds = 10;
+
+  inline void mulhilo(uint32_t a, uint32_t b, uint32_t& hi, uint32_t& lo)
+  {
+    uint64_t product = static_cast<uint64_t>(a)*static_cast<uint64_t>(b);
+    hi = static_cast<uint32_t>(product >> 32);
+    lo = static_cast<uint32_t>(product);
+  }
+
+  /// convert two 32-bit integers into double with 53 random bits, distributed uniformly in ]0..1[
+  inline double toUniform(uint32_t a, uint32_t b)
+  {
+    uint64_t bits = ((static_cast<uint64_t>(a) << 32) | b) >> 11;
+    return (bits + 0.5)*(1./9007199254740992.); // 2^53
+  }
+}
+
+PhiloxRandomGenerator::PhiloxRandomGenerator()
+{
+  setSeed(0);
+}
+
+void PhiloxRandomGenerator::setSeed(unsigned long seed)
+{
+  uint64_t seed64 = seed;
+  key_[0] = static_cast<uint32_t>(seed64);
+  key_[1] = static_cast<uint32_t>(seed64 >> 32);
+  for ( unsigned i = 0; i < 4; ++i ) {
+    counter_[i] = 0;
+  }
+}
+
+void PhiloxRandomGenerator::generateBlock(uint32_t* output)
+{
+  uint32_t x0 = counter_[0];
+  uint32_t x1 = counter_[1];
+  uint32_t x2 = counter_[2];
+  uint32_t x3 = counter_[3];
+  uint32_t k0 = key_[0];
+  uint32_t k1 = key_[1];
+  for ( unsigned iRound = 0; iRound < philoxNumRounds; ++iRound ) {
+    if ( iRound > 0 ) {
+      k0 += philoxW0;
+      k1 += philoxW1;
+    }
+    uint32_t hi0, lo0, hi1, lo1;
+    mulhilo(philoxM0, x0, hi0, lo0);
+    mulhilo(philoxM1, x2, hi1, lo1);
+    x0 = hi1 ^ x1 ^ k0;
+    x1 = lo1;
+    x2 = hi0 ^ x3 ^ k1;
+    x3 = lo0;
+  }
+  output[0] = x0;
+  output[1] = x1;
+  output[2] = x2;
+  output[3] = x3;
+
+//--- increment 128-bit counter
+  for ( unsigned i = 0; i < 4; ++i ) {
+    if ( ++counter_[i] != 0 ) break;
+  }
+}
+
+void PhiloxRandomGenerator::fillUniform(double* x, unsigned n)
+{
+//--- each block of 4 random 32-bit integers yields 2 uniform random numbers;
+//    for odd n, the second number of the last block is discarded
+  uint32_t block[4];
+  unsigned i = 0;
+  for ( ; i + 1 < n; i += 2 ) {
+    generateBlock(block);
+    x[i]     = toUniform(block[0], block[1]);
+    x[i + 1] = toUniform(block[2], block[3]);
+  }
+  if ( i < n ) {
+    generateBlock(block);
+    x[i] = toUniform(block[0], block[1]);
+  }
+}
+
+void PhiloxRandomGenerator::fillGaus(double* x, unsigned n)
+{
+//--- Box-Muller transform:
+//    each pair of uniform random numbers (u1, u2) yields a pair of Gaussian random numbers
+//      r*cos(2*pi*u2), r*sin(2*pi*u2) with r = sqrt(-2*log(u1))
+  unsigned numPairs = (n + 1)/2;
+  if ( buffer_.size() < 2*numPairs ) buffer_.resize(2*numPairs);
+  fillUniform(buffer_.data(), 2*numPairs);
+  const double twoPi = 2.*TMath::Pi();
+  for ( unsigned iPair = 0; iPair < numPairs; ++iPair ) {
+    double r = TMath::Sqrt(-2.*TMath::Log(buffer_[2*iPair]));
+    double phi = twoPi*buffer_[2*iPair + 1];
+    buffer_[2*iPair]     = r*TMath::Cos(phi);
+    buffer_[2*iPair + 1] = r*TMath::Sin(phi);
+  }
+  for ( unsigned i = 0; i < n; ++i ) {
+    x[i] = buffer_[i];
+  }
+}
+
+void PhiloxRandomGenerator::fillBreitWigner(double* x, unsigned n)
+{
+//--- inverse of cumulative distribution function,
+//    x = 0.5*tan(pi*(u - 0.5)), for full width at half maximum 1
+  fillUniform(x, n);
+  for ( unsigned i = 0; i < n; ++i ) {
+    x[i] = 0.5*TMath::Tan(TMath::Pi()*(x[i] - 0.5));
+  }
+}
+
+//-------------------------------------------------------------------------------
+
+RandomGenerator* classic_svFit::makeRandomGenerator(const std::string& type)
+{
+  if      ( type == "TRandom3" ) return new TRandom3RandomGenerator();
+  else if ( type == "Philox"   ) return new PhiloxRandomGenerator();
+  else {
+    std::cerr << "<makeRandomGenerator>:"
+              << "Invalid Configuration Parameter 'type' = " << type << ","
+              << " expected to be either \"TRandom3\" or \"Philox\" --> ABORTING !!\n";
+    assert(0);
+  }
+  return 0;
+}
+
+namespace
+{
+  inline uint64_t splitMix64(uint64_t z)
+  {
+    z += 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27))*0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+}
+
+uint64_t classic_svFit::hashSeed(uint64_t seed, uint64_t value)
+{
+  return splitMix64(seed ^ splitMix64(value));
+}
+
+uint64_t classic_svFit::hashSeed(uint64_t seed, double value)
+{
+  // CV: adding 0. maps -0. to +0., so that both give the same hash
+  value += 0.;
+  uint64_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return hashSeed(seed, bits);
+}
@@ -0,0 +1,135 @@
+#include "TauAnalysis/ClassicSVfit/interface/svFitThreadPool.h"
+
+using namespace classic_svFit;
+
+ThreadPool::ThreadPool(unsigned numThreads)
+  : numThreads_(( numThreads > 0 ) ? numThreads : 1)
+  , queues_(numThreads_)
+  , task_(nullptr)
+  , numTasks_(0)
+  , numTasksDone_(0)
+  , numActiveThreads_(0)
+  , generation_(0)
+  , stop_(false)
+{
+  for ( unsigned iThread = 1; iThread < numThreads_; ++iThread ) {
+    workers_.push_back(std::thread(&ThreadPool::runWorker, this, iThread));
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  startCondition_.notify_all();
+  for ( std::vector<std::thread>::iterator worker = workers_.begin();
+        worker != workers_.end(); ++worker ) {
+    worker->join();
+  }
+}
+
+void ThreadPool::parallel_for(unsigned numTasks, const std::function<void(unsigned)>& task)
+{
+  parallel_for(numTasks, [&task](unsigned iTask, unsigned iThread) { task(iTask); });
+}
+
+void ThreadPool::parallel_for(unsigned numTasks, const std::function<void(unsigned, unsigned)>& task)
+{
+  if ( numTasks == 0 ) return;
+  if ( workers_.empty() || numTasks == 1 ) {
+    for ( unsigned iTask = 0; iTask < numTasks; ++iTask ) {
+      task(iTask, 0);
+    }
+    return;
+  }
+
+  // CV: assign contiguous blocks of tasks to the threads,
+  //     threads that finish their block early steal tasks from the others
+  for ( unsigned iThread = 0; iThread < numThreads_; ++iThread ) {
+    unsigned firstTask = (iThread*numTasks)/numThreads_;
+    unsigned lastTask = ((iThread + 1)*numTasks)/numThreads_;
+    std::lock_guard<std::mutex> lock(queues_[iThread].mutex_);
+    queues_[iThread].tasks_.clear();
+    for ( unsigned iTask = firstTask; iTask < lastTask; ++iTask ) {
+      queues_[iThread].tasks_.push_back(iTask);
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    task_ = &task;
+    numTasks_ = numTasks;
+    numTasksDone_ = 0;
+    ++generation_;
+  }
+  startCondition_.notify_all();
+
+  processTasks(0);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  // CV: wait also for all worker threads to leave processTasks,
+  //     so that none of them can pick up tasks of the next call to parallel_for with the current task function
+  doneCondition_.wait(lock, [this]() { return numTasksDone_ == numTasks_ && numActiveThreads_ == 0; });
+  task_ = nullptr;
+}
+
+void ThreadPool::runWorker(unsigned iThread)
+{
+  unsigned long lastGeneration = 0;
+  while ( true ) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      startCondition_.wait(lock, [this, lastGeneration]() { return stop_ || generation_ != lastGeneration; });
+      if ( stop_ ) return;
+      lastGeneration = generation_;
+    }
+    processTasks(iThread);
+  }
+}
+
+bool ThreadPool::getTask(unsigned iThread, unsigned& iTask)
+{
+  {
+    TaskQueue& queue = queues_[iThread];
+    std::lock_guard<std::mutex> lock(queue.mutex_);
+    if ( !queue.tasks_.empty() ) {
+      iTask = queue.tasks_.front();
+      queue.tasks_.pop_front();
+      return true;
+    }
+  }
+  for ( unsigned iOffset = 1; iOffset < numThreads_; ++iOffset ) {
+    TaskQueue& queue = queues_[(iThread + iOffset) % numThreads_];
+    std::lock_guard<std::mutex> lock(queue.mutex_);
+    if ( !queue.tasks_.empty() ) {
+      iTask = queue.tasks_.back();
+      queue.tasks_.pop_back();
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::processTasks(unsigned iThread)
+{
+  const std::function<void(unsigned, unsigned)>* task = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    task = task_;
+    if ( !task ) return;
+    ++numActiveThreads_;
+  }
+  unsigned iTask = 0;
+  while ( getTask(iThread, iTask) ) {
+    (*task)(iTask, iThread);
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++numTasksDone_;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    --numActiveThreads_;
+  }
+  doneCondition_.notify_all();
+}